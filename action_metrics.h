@@ -0,0 +1,85 @@
+#ifndef _ACTION_METRICS_H_
+#define _ACTION_METRICS_H_
+
+#include <array>
+#include <cstdint>
+#include <sys/wait.h>
+
+using std::array;
+using std::int64_t;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace Xidlechain {
+    // Counts durations in power-of-two buckets of microseconds: bucket 0
+    // holds durations under 1 us, bucket i those in [2^(i-1), 2^i) us, and
+    // the last bucket everything from 2^30 us (about 18 minutes) up.
+    // Adding a sample never allocates.
+    class Histogram {
+    public:
+        static constexpr int NUM_BUCKETS = 32;
+        array<uint32_t, NUM_BUCKETS> buckets{};
+
+        static int bucket_for(int64_t us) {
+            int bucket = 0;
+            while (us > 0 && bucket < NUM_BUCKETS - 1) {
+                us >>= 1;
+                bucket++;
+            }
+            return bucket;
+        }
+        void add(int64_t us) {
+            buckets[bucket_for(us)]++;
+        }
+    };
+
+    // How the runs of one exec or resume_exec action went. Shell commands
+    // are timed by the ProcessSpawner, builtins by the Command.
+    struct ActionMetrics {
+        // Runs which took at least this long are counted as timeouts. This
+        // is how long logind waits for the sleep inhibitor by default, so a
+        // sleep action this slow held up the suspend for as long as it could.
+        static constexpr int64_t TIMEOUT_US = 5 * 1000 * 1000;
+
+        uint64_t num_runs = 0;
+        // Runs which could not be started or exited with a non-zero status
+        uint64_t num_failures = 0;
+        uint64_t num_timeouts = 0;
+        // Async commands which have not exited yet
+        uint32_t num_running = 0;
+        // The exit status of the last run which finished, 128 + the signal
+        // number if it was killed, or -1 if it could not be started
+        int last_exit_status = 0;
+        // From just before the fork until the child was started, for sync
+        // and async commands alike. Builtins leave this empty.
+        Histogram spawn_latency_us;
+        // From just before the fork until the child exited. For builtins,
+        // how long the call took; one which works in the background (like
+        // dim) is only timed until it has started.
+        Histogram duration_us;
+
+        void record_spawn_failure() {
+            num_failures++;
+            last_exit_status = -1;
+        }
+        void record_exit(int64_t duration, int exit_status) {
+            duration_us.add(duration);
+            if (duration >= TIMEOUT_US) {
+                num_timeouts++;
+            }
+            if (exit_status != 0) {
+                num_failures++;
+            }
+            last_exit_status = exit_status;
+        }
+        // Converts a status from waitpid() the way a shell would
+        static int exit_status_from_wait_status(int wait_status) {
+            if (WIFSIGNALED(wait_status)) {
+                return 128 + WTERMSIG(wait_status);
+            }
+            return WEXITSTATUS(wait_status);
+        }
+    };
+}
+
+#endif
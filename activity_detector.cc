@@ -12,184 +12,227 @@
  * from sleep.
  */
 
-#include <gdk/gdkx.h>
-#include <glib.h>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <glib.h>
+#include <xcb/dpms.h>
 #include "activity_detector.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
 
+using std::free;
 using std::numeric_limits;
 using std::pair;
+using std::strncmp;
 
-static inline int64_t XSyncValueToInt64(XSyncValue value) {
-    return (static_cast<int64_t>(XSyncValueHigh32(value)) << 32 |
-            static_cast<int64_t>(XSyncValueLow32(value)));
-}
-
-static inline void XSyncInt64ToValue(XSyncValue* xvalue, int64_t value) {
-    XSyncIntsToValue(xvalue, value, value >> 32);
+static inline int64_t sync_int64_to_int64(xcb_sync_int64_t value) {
+    return static_cast<int64_t>(value.hi) << 32 | value.lo;
 }
 
 namespace Xidlechain {
-    XsyncActivityDetector::XsyncActivityDetector():
-        idle_counter_id(0),
+    XcbActivityDetector::XcbActivityDetector(XConnection *connection):
+        connection(connection),
+        conn(NULL),
+        idle_counter_id(XCB_NONE),
+        sync_event_base(0),
         min_timeout(numeric_limits<int64_t>::max()),
-        neg_trans_alarm(None),
-        event_receiver(NULL),
-        xdisplay(NULL)
+        neg_trans_alarm(XCB_NONE),
+        event_receiver(NULL)
     {}
 
-    XsyncActivityDetector::~XsyncActivityDetector() {
-        clear_timeouts();
+    XcbActivityDetector::~XcbActivityDetector() {
+        if (conn) {
+            clear_timeouts();
+            connection->remove_event_handler(this);
+        }
     }
 
-    bool XsyncActivityDetector::init(EventReceiver *receiver) {
+    bool XcbActivityDetector::init(EventReceiver *receiver) {
         g_return_val_if_fail(receiver != NULL, FALSE);
         event_receiver = receiver;
 
-        xdisplay = gdk_x11_get_default_xdisplay();
-        g_return_val_if_fail(xdisplay != NULL, FALSE);
+        conn = connection->get_connection();
+        g_return_val_if_fail(conn != NULL, FALSE);
 
-        int major_version, minor_version;
-        if (!(XSyncQueryExtension(xdisplay, &sync_event_base, &sync_error_base) &&
-              XSyncInitialize(xdisplay, &major_version, &minor_version)))
-        {
+        const xcb_query_extension_reply_t *ext = connection->get_extension(&xcb_sync_id);
+        if (!ext) {
             g_critical("Failed to initialize XSync extension");
             return false;
         }
-        int ncounters;
-        XSyncSystemCounter *counters = XSyncListSystemCounters(xdisplay, &ncounters);
+        sync_event_base = ext->first_event;
+        xcb_sync_initialize_cookie_t init_cookie = xcb_sync_initialize(
+            conn, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION);
+        xcb_sync_list_system_counters_cookie_t counters_cookie =
+            xcb_sync_list_system_counters(conn);
+        free(xcb_sync_initialize_reply(conn, init_cookie, NULL));
+        xcb_sync_list_system_counters_reply_t *counters =
+            xcb_sync_list_system_counters_reply(conn, counters_cookie, NULL);
         if (counters) {
-            for (int i = 0; i < ncounters; i++) {
-                if (counters[i].name && strcmp(counters[i].name, "IDLETIME") == 0) {
-                    idle_counter_id = counters[i].counter;
+            xcb_sync_systemcounter_iterator_t it =
+                xcb_sync_list_system_counters_counters_iterator(counters);
+            for (; it.rem > 0; xcb_sync_systemcounter_next(&it)) {
+                const char *name = xcb_sync_systemcounter_name(it.data);
+                int name_len = xcb_sync_systemcounter_name_length(it.data);
+                if (name_len == 8 && strncmp(name, "IDLETIME", name_len) == 0) {
+                    idle_counter_id = it.data->counter;
                     break;
                 }
             }
-            XSyncFreeSystemCounterList(counters);
-            if (idle_counter_id) {
-                gdk_window_add_filter(NULL, static_gdk_event_filter, this);
-            }
+            free(counters);
         }
-        if (idle_counter_id == 0) {
+        if (idle_counter_id == XCB_NONE) {
             g_critical("IDLETIME system sync counter not found");
             return false;
         }
+        connection->add_event_handler(this);
         return true;
     }
 
-    bool XsyncActivityDetector::add_idle_timeout(int64_t timeout_ms, gpointer data) {
-        g_assert(idle_counter_id != 0);
+    bool XcbActivityDetector::add_idle_timeout(int64_t timeout_ms, int timeout_id) {
+        g_assert(idle_counter_id != XCB_NONE);
         g_assert(timeout_ms > 1);
-        g_assert(pos_trans_alarms_by_data.find(data) == pos_trans_alarms_by_data.end());
+        g_assert(pos_trans_alarms_by_id.find(timeout_id) == pos_trans_alarms_by_id.end());
 
         if (timeout_ms < min_timeout) {
             min_timeout = timeout_ms;
             // Setup an alarm to fire when the user was idle, but is now active.
             // This occurs when IDLETIME > min_timeout - 1, and the user becomes
             // active.
-            XSyncAlarm alarm = create_idle_alarm(min_timeout-1, XSyncNegativeTransition);
-            g_return_val_if_fail(alarm != None, FALSE);
+            xcb_sync_alarm_t alarm = create_idle_alarm(min_timeout-1, XCB_SYNC_TESTTYPE_NEGATIVE_TRANSITION);
             if (neg_trans_alarm) {
-                XSyncDestroyAlarm(xdisplay, neg_trans_alarm);
+                xcb_sync_destroy_alarm(conn, neg_trans_alarm);
             }
             neg_trans_alarm = alarm;
         }
         // Send idle event when IDLETIME >= timeout_ms
-        XSyncAlarm alarm = create_idle_alarm(timeout_ms, XSyncPositiveTransition);
-        g_return_val_if_fail(alarm != None, FALSE);
-        pos_trans_alarms[alarm] = data;
-        pos_trans_alarms_by_data[data] = alarm;
+        xcb_sync_alarm_t alarm = create_idle_alarm(timeout_ms, XCB_SYNC_TESTTYPE_POSITIVE_TRANSITION);
+        pos_trans_alarms[alarm] = timeout_id;
+        pos_trans_alarms_by_id[timeout_id] = alarm;
         return true;
     }
 
-    bool XsyncActivityDetector::remove_idle_timeout(gpointer data) {
-        unordered_map<gpointer, XSyncAlarm>::iterator it = pos_trans_alarms_by_data.find(data);
-        if (it == pos_trans_alarms_by_data.end()) {
+    bool XcbActivityDetector::remove_idle_timeout(int timeout_id) {
+        unordered_map<int, xcb_sync_alarm_t>::iterator it = pos_trans_alarms_by_id.find(timeout_id);
+        if (it == pos_trans_alarms_by_id.end()) {
             return false;
         }
-        XSyncAlarm alarm = it->second;
-        XSyncDestroyAlarm(xdisplay, alarm);
+        xcb_sync_alarm_t alarm = it->second;
+        xcb_sync_destroy_alarm(conn, alarm);
         pos_trans_alarms.erase(alarm);
-        pos_trans_alarms_by_data.erase(it);
+        pos_trans_alarms_by_id.erase(it);
         return true;
     }
 
-    XSyncAlarm XsyncActivityDetector::create_idle_alarm(int64_t timeout_ms,
-                                                  XSyncTestType test_type)
+    // The request is only sent when the connection is flushed, i.e. at
+    // the latest before the main loop goes back to sleep.
+    xcb_sync_alarm_t XcbActivityDetector::create_idle_alarm(int64_t timeout_ms,
+                                                            xcb_sync_testtype_t test_type)
     {
-        uint64_t mask = XSyncCACounter |
-                        XSyncCAValue |
-                        XSyncCATestType |
-                        XSyncCADelta;
-        XSyncAlarmAttributes attr;
-        attr.trigger.counter = idle_counter_id;
-        attr.trigger.test_type = test_type;
-        XSyncInt64ToValue(&attr.trigger.wait_value, timeout_ms);
-        XSyncIntToValue(&attr.delta, 0);
-        return XSyncCreateAlarm(xdisplay, mask, &attr);
+        uint32_t mask = XCB_SYNC_CA_COUNTER |
+                        XCB_SYNC_CA_VALUE |
+                        XCB_SYNC_CA_TEST_TYPE |
+                        XCB_SYNC_CA_DELTA;
+        // In the order of the mask bits; 64-bit values are sent as
+        // the high half followed by the low half.
+        uint32_t values[] = {
+            idle_counter_id,
+            static_cast<uint32_t>(timeout_ms >> 32),
+            static_cast<uint32_t>(timeout_ms),
+            static_cast<uint32_t>(test_type),
+            0,
+            0,
+        };
+        xcb_sync_alarm_t alarm = xcb_generate_id(conn);
+        xcb_sync_create_alarm(conn, alarm, mask, values);
+        Metrics::x_alarms_armed++;
+        return alarm;
     }
 
-    bool XsyncActivityDetector::clear_timeouts() {
-        for (const pair<const XSyncAlarm, gpointer> &p : pos_trans_alarms) {
-            XSyncDestroyAlarm(xdisplay, p.first);
+    bool XcbActivityDetector::clear_timeouts() {
+        for (const pair<const xcb_sync_alarm_t, int> &p : pos_trans_alarms) {
+            xcb_sync_destroy_alarm(conn, p.first);
         }
         pos_trans_alarms.clear();
-        pos_trans_alarms_by_data.clear();
+        pos_trans_alarms_by_id.clear();
         if (neg_trans_alarm) {
-            XSyncDestroyAlarm(xdisplay, neg_trans_alarm);
-            neg_trans_alarm = None;
+            xcb_sync_destroy_alarm(conn, neg_trans_alarm);
+            neg_trans_alarm = XCB_NONE;
         }
         min_timeout = numeric_limits<int64_t>::max();
         return true;
     }
 
-    GdkFilterReturn XsyncActivityDetector::gdk_event_filter(
-        GdkXEvent *gxevent, GdkEvent *gevent)
-    {
-        XEvent* xevent = static_cast<XEvent*>(gxevent);
-        XSyncAlarmNotifyEvent* alarm_event =
-            static_cast<XSyncAlarmNotifyEvent*>(gxevent);
-        XSyncValue value;
-
-        if (xevent->type == sync_event_base + XSyncAlarmNotify &&
-            alarm_event->state != XSyncAlarmDestroyed &&
-            XSyncQueryCounter(xdisplay, idle_counter_id, &value))
-        {
-            bool is_idle = !XSyncValueLessThan(alarm_event->counter_value,
-                                               alarm_event->alarm_value);
-            bool is_idle2 = !XSyncValueLessThan(value,
-                                                alarm_event->alarm_value);
-            int64_t idle_time_ms = XSyncValueToInt64(alarm_event->counter_value);
-            if (is_idle != is_idle2) {
-                g_warning("Received stale event");
-            }
-            // We deliver the stale event anyways because the client might
-            // be expecting events to be delivered in a specific order.
-            EventType event_type;
-            gpointer user_data;
-            if (is_idle) {
-                g_info("Activity timeout at %ld ms", idle_time_ms);
-                event_type = EVENT_ACTIVITY_TIMEOUT;
-                unordered_map<XSyncAlarm, gpointer>::iterator it = pos_trans_alarms.find(alarm_event->alarm);
-                if (it == pos_trans_alarms.end()) {
-                    g_warning("Received event for deleted alarm");
-                    return GDK_FILTER_CONTINUE;
-                }
-                user_data = it->second;
-            } else {
-                g_info("Activity resume at %ld ms", idle_time_ms);
-                event_type = EVENT_ACTIVITY_RESUME;
-                user_data = NULL;
-            }
-            event_receiver->receive(event_type, user_data);
+    // We talk to the X server directly instead of spawning xset, which
+    // would need its own connection and block our startup until it exits.
+    bool XcbActivityDetector::disable_dpms_timeouts() {
+        g_return_val_if_fail(conn != NULL, FALSE);
+        if (!connection->get_extension(&xcb_dpms_id)) {
+            g_warning("DPMS extension is not available");
+            return false;
+        }
+        xcb_dpms_set_timeouts(conn, 0, 0, 0);
+        connection->flush();
+        return true;
+    }
+
+    bool XcbActivityDetector::disable_screensaver() {
+        g_return_val_if_fail(conn != NULL, FALSE);
+        xcb_get_screen_saver_reply_t *reply = xcb_get_screen_saver_reply(
+            conn, xcb_get_screen_saver(conn), NULL);
+        if (!reply) {
+            g_warning("Could not get screensaver settings");
+            return false;
         }
-        return GDK_FILTER_CONTINUE;
+        // Same as what xset does: only the timeout is changed
+        xcb_set_screen_saver(conn, 0, reply->interval,
+                             reply->prefer_blanking, reply->allow_exposures);
+        free(reply);
+        connection->flush();
+        return true;
     }
 
-    GdkFilterReturn XsyncActivityDetector::static_gdk_event_filter(
-        GdkXEvent *gxevent, GdkEvent *gevent, gpointer data)
-    {
-        XsyncActivityDetector* _this = static_cast<XsyncActivityDetector*>(data);
-        return _this->gdk_event_filter(gxevent, gevent);
+    void XcbActivityDetector::handle_x_event(const xcb_generic_event_t *event) {
+        if ((event->response_type & ~0x80) != sync_event_base + XCB_SYNC_ALARM_NOTIFY) {
+            return;
+        }
+        const xcb_sync_alarm_notify_event_t *alarm_event =
+            reinterpret_cast<const xcb_sync_alarm_notify_event_t*>(event);
+        if (alarm_event->state == XCB_SYNC_ALARMSTATE_DESTROYED) {
+            return;
+        }
+        xcb_sync_query_counter_reply_t *reply = xcb_sync_query_counter_reply(
+            conn, xcb_sync_query_counter(conn, idle_counter_id), NULL);
+        if (!reply) {
+            return;
+        }
+        int64_t counter_value = sync_int64_to_int64(reply->counter_value);
+        free(reply);
+        int64_t idle_time_ms = sync_int64_to_int64(alarm_event->counter_value);
+        int64_t alarm_value = sync_int64_to_int64(alarm_event->alarm_value);
+        bool is_idle = idle_time_ms >= alarm_value;
+        bool is_idle2 = counter_value >= alarm_value;
+        if (is_idle != is_idle2) {
+            g_warning("Received stale event");
+        }
+        // We deliver the stale event anyways because the client might
+        // be expecting events to be delivered in a specific order.
+        if (is_idle) {
+            g_info("Activity timeout at %" G_GINT64_FORMAT " ms", idle_time_ms);
+            unordered_map<xcb_sync_alarm_t, int>::iterator it = pos_trans_alarms.find(alarm_event->alarm);
+            if (it == pos_trans_alarms.end()) {
+                g_warning("Received event for deleted alarm");
+                return;
+            }
+            XIDLECHAIN_PROBE(x_alarm, it->second, idle_time_ms);
+            Trace::record(TRACE_DETECTED, EVENT_ACTIVITY_TIMEOUT, it->second);
+            event_receiver->receive(Event::activity_timeout(it->second));
+        } else {
+            g_info("Activity resume at %" G_GINT64_FORMAT " ms", idle_time_ms);
+            XIDLECHAIN_PROBE(x_alarm, -1, idle_time_ms);
+            Trace::record(TRACE_DETECTED, EVENT_ACTIVITY_RESUME, 0);
+            event_receiver->receive(Event(EVENT_ACTIVITY_RESUME));
+        }
     }
 }
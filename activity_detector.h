@@ -4,12 +4,15 @@
 #ifndef _ACTIVITY_DETECTOR_H_
 #define _ACTIVITY_DETECTOR_H_
 
+#include <cstdint>
 #include <unordered_map>
-#include <gdk/gdk.h>
-#include <X11/Xlib.h>
-#include <X11/extensions/sync.h>
+#include <glib.h>
+#include <xcb/xcb.h>
+#include <xcb/sync.h>
 #include "event_receiver.h"
+#include "x_connection.h"
 
+using std::int64_t;
 using std::unordered_map;
 
 namespace Xidlechain {
@@ -18,54 +21,60 @@ namespace Xidlechain {
         // Initializes the detector and specifies the event receiver.
         virtual bool init(EventReceiver *receiver) = 0;
         // After |timeout_ms| of inactivity, an ACTIVITY_TIMEOUT event will
-        // be emitted with |data| as the data parameter. If activity resumes,
-        // an ACTIVITY_RESUME event will be emitted with NULL for the data.
-        virtual bool add_idle_timeout(int64_t timeout_ms, gpointer data) = 0;
-        virtual bool remove_idle_timeout(gpointer data) = 0;
+        // be emitted carrying |timeout_id|. If activity resumes, an
+        // ACTIVITY_RESUME event will be emitted.
+        virtual bool add_idle_timeout(int64_t timeout_ms, int timeout_id) = 0;
+        virtual bool remove_idle_timeout(int timeout_id) = 0;
         // Deletes all timers.
         virtual bool clear_timeouts() = 0;
+        // Equivalent to `xset dpms 0 0 0`.
+        virtual bool disable_dpms_timeouts() = 0;
+        // Equivalent to `xset s off`.
+        virtual bool disable_screensaver() = 0;
     protected:
         virtual ~ActivityDetector() = default;
     };
 
-    class XsyncActivityDetector: public ActivityDetector {
-        XSyncCounter idle_counter_id;
-        int sync_event_base,
-            sync_error_base;
+    // Uses the IDLETIME system counter of the SYNC extension.
+    class XcbActivityDetector: public ActivityDetector, public XEventHandler {
+        XConnection *connection;
+        xcb_connection_t *conn;
+        xcb_sync_counter_t idle_counter_id;
+        uint8_t sync_event_base;
         // This is the smallest timeout out of all of our pos_trans_alarms.
         int64_t min_timeout;
         // These alarms trigger when a user becomes inactive for a certain
         // period of time.
-        unordered_map<XSyncAlarm, gpointer> pos_trans_alarms;
-        unordered_map<gpointer, XSyncAlarm> pos_trans_alarms_by_data;
+        unordered_map<xcb_sync_alarm_t, int> pos_trans_alarms;
+        unordered_map<int, xcb_sync_alarm_t> pos_trans_alarms_by_id;
         // This alarms triggers when a user used to be inactive for a certain
         // period of time, then became active again.
-        XSyncAlarm neg_trans_alarm;
+        xcb_sync_alarm_t neg_trans_alarm;
         EventReceiver *event_receiver;
-        Display *xdisplay;
 
-        XSyncAlarm create_idle_alarm(int64_t timeout_ms, XSyncTestType test_type);
-        GdkFilterReturn gdk_event_filter(
-            GdkXEvent *gxevent, GdkEvent *gevent);
-        static GdkFilterReturn static_gdk_event_filter(
-            GdkXEvent *gxevent, GdkEvent *gevent, gpointer data);
+        xcb_sync_alarm_t create_idle_alarm(int64_t timeout_ms, xcb_sync_testtype_t test_type);
     public:
-        XsyncActivityDetector();
-        ~XsyncActivityDetector();
-        XsyncActivityDetector(const XsyncActivityDetector&) = delete;
-        XsyncActivityDetector& operator=(const XsyncActivityDetector&) = delete;
+        XcbActivityDetector(XConnection *connection);
+        ~XcbActivityDetector();
+        XcbActivityDetector(const XcbActivityDetector&) = delete;
+        XcbActivityDetector& operator=(const XcbActivityDetector&) = delete;
 
         bool init(EventReceiver *receiver) override;
 
         // Adds a new timeout event which will be triggered after timeout_ms
-        // milliseconds. `data` will be sent to the event_receiver.
-        // WARNING: `data` must be unique for each timeout.
-        bool add_idle_timeout(int64_t timeout_ms, gpointer data) override;
-        // Removes the timeout associated with `data`. If no such timeout
-        // exists, false is returned.
-        bool remove_idle_timeout(gpointer data) override;
+        // milliseconds. `timeout_id` will be sent to the event_receiver.
+        // WARNING: `timeout_id` must be unique for each timeout.
+        bool add_idle_timeout(int64_t timeout_ms, int timeout_id) override;
+        // Removes the timeout associated with `timeout_id`. If no such
+        // timeout exists, false is returned.
+        bool remove_idle_timeout(int timeout_id) override;
 
         bool clear_timeouts() override;
+
+        bool disable_dpms_timeouts() override;
+        bool disable_screensaver() override;
+
+        void handle_x_event(const xcb_generic_event_t *event) override;
     };
 }
 
@@ -1,7 +1,13 @@
 #include "app.h"
 #include "audio_detector.h"
 #include "event_receiver.h"
+#include "metrics.h"
+#include "startup_timeline.h"
+#include "trace.h"
 
+#include <algorithm>
+
+using std::find;
 using std::pair;
 using std::unordered_set;
 
@@ -15,18 +21,17 @@ namespace Xidlechain {
     {}
 
     PulseAudioDetector::~PulseAudioDetector() {
-        if (ctx) {
-            pa_context_unref(ctx);
-        }
-        if (loop) {
-            pa_glib_mainloop_free(loop);
-        }
+        stop();
     }
 
     bool PulseAudioDetector::init(EventReceiver *receiver) {
         int status;
         g_return_val_if_fail(receiver != NULL, FALSE);
         event_receiver = receiver;
+        if (ctx) {
+            // already running
+            return true;
+        }
 
         loop = pa_glib_mainloop_new(NULL);
         g_return_val_if_fail(loop != NULL, FALSE);
@@ -42,10 +47,29 @@ namespace Xidlechain {
         return true;
     }
 
+    void PulseAudioDetector::stop() {
+        if (ctx) {
+            pa_context_set_state_callback(ctx, NULL, NULL);
+            pa_context_set_subscribe_callback(ctx, NULL, NULL);
+            pa_context_disconnect(ctx);
+            pa_context_unref(ctx);
+            ctx = NULL;
+        }
+        if (loop) {
+            pa_glib_mainloop_free(loop);
+            loop = NULL;
+            api = NULL;
+        }
+        running_sinks.clear();
+        sent_first_message = false;
+    }
+
     void PulseAudioDetector::add_sink(int idx) {
         bool inserted = running_sinks.insert(idx).second;
         if ((running_sinks.size() == 1 && inserted) || !sent_first_message) {
-            event_receiver->receive(EVENT_AUDIO_RUNNING, NULL);
+            Metrics::audio_transitions++;
+            Trace::record(TRACE_DETECTED, EVENT_AUDIO_RUNNING, 0);
+            event_receiver->receive(Event(EVENT_AUDIO_RUNNING));
             sent_first_message = true;
         }
     }
@@ -53,7 +77,9 @@ namespace Xidlechain {
     void PulseAudioDetector::remove_sink(int idx) {
         bool erased = running_sinks.erase(idx) > 0;
         if ((running_sinks.size() == 0 && erased) || !sent_first_message) {
-            event_receiver->receive(EVENT_AUDIO_STOPPED, NULL);
+            Metrics::audio_transitions++;
+            Trace::record(TRACE_DETECTED, EVENT_AUDIO_STOPPED, 0);
+            event_receiver->receive(Event(EVENT_AUDIO_STOPPED));
             sent_first_message = true;
         }
     }
@@ -61,6 +87,7 @@ namespace Xidlechain {
     void PulseAudioDetector::context_notify_cb(pa_context *ctx, void *userdata) {
         switch (pa_context_get_state(ctx)) {
             case PA_CONTEXT_READY: {
+                StartupTimeline::mark("connected to PulseAudio");
                 pa_context_get_sink_info_list(ctx, sink_info_cb, userdata);
 
                 pa_context_set_subscribe_callback(ctx, context_subscribe_cb, userdata);
@@ -134,4 +161,96 @@ namespace Xidlechain {
             }
         }
     }
+
+    SharedAudioDetector::SharedAudioDetector(AudioDetector *detector):
+        detector(detector),
+        detector_running(false),
+        have_state(false),
+        audio_running(false)
+    {}
+
+    bool SharedAudioDetector::add_client(Client *client) {
+        if (find(clients.begin(), clients.end(), client) != clients.end()) {
+            return true;
+        }
+        if (!detector_running) {
+            detector_running = detector->init(this);
+            if (!detector_running) {
+                return false;
+            }
+        }
+        clients.push_back(client);
+        if (have_state) {
+            // Like the detector itself, send the state asynchronously
+            client->initial_state_source_id = g_idle_add(
+                Client::static_send_initial_state, client);
+        }
+        return true;
+    }
+
+    void SharedAudioDetector::remove_client(Client *client) {
+        vector<Client*>::iterator it = find(clients.begin(), clients.end(), client);
+        if (it == clients.end()) {
+            return;
+        }
+        clients.erase(it);
+        if (client->initial_state_source_id) {
+            g_source_remove(client->initial_state_source_id);
+            client->initial_state_source_id = 0;
+        }
+        if (clients.empty() && detector_running) {
+            detector->stop();
+            detector_running = false;
+            have_state = false;
+        }
+    }
+
+    void SharedAudioDetector::receive(const Event &event) {
+        if (event.type != EVENT_AUDIO_RUNNING && event.type != EVENT_AUDIO_STOPPED) {
+            return;
+        }
+        have_state = true;
+        audio_running = event.type == EVENT_AUDIO_RUNNING;
+        // A receiver may stop its client while handling the event
+        vector<Client*> clients_copy = clients;
+        for (Client *client : clients_copy) {
+            if (find(clients.begin(), clients.end(), client) == clients.end()) {
+                continue;
+            }
+            if (client->initial_state_source_id) {
+                // This event supersedes the initial state
+                g_source_remove(client->initial_state_source_id);
+                client->initial_state_source_id = 0;
+            }
+            client->event_receiver->receive(event);
+        }
+    }
+
+    SharedAudioDetector::Client::Client(SharedAudioDetector *shared):
+        shared(shared),
+        event_receiver(NULL),
+        initial_state_source_id(0)
+    {}
+
+    SharedAudioDetector::Client::~Client() {
+        stop();
+    }
+
+    bool SharedAudioDetector::Client::init(EventReceiver *receiver) {
+        g_return_val_if_fail(receiver != NULL, FALSE);
+        event_receiver = receiver;
+        return shared->add_client(this);
+    }
+
+    void SharedAudioDetector::Client::stop() {
+        shared->remove_client(this);
+    }
+
+    gboolean SharedAudioDetector::Client::static_send_initial_state(gpointer user_data) {
+        Client *_this = static_cast<Client*>(user_data);
+        _this->initial_state_source_id = 0;
+        _this->event_receiver->receive(Event(
+            _this->shared->audio_running ? EVENT_AUDIO_RUNNING : EVENT_AUDIO_STOPPED));
+        return G_SOURCE_REMOVE;
+    }
 }
@@ -2,19 +2,24 @@
 #define _AUDIO_DETECTOR_H_
 
 #include <unordered_set>
+#include <vector>
+#include <glib.h>
 #include <pulse/pulseaudio.h>
 #include <pulse/glib-mainloop.h>
+#include "event_receiver.h"
 
 using std::unordered_set;
+using std::vector;
 
 namespace Xidlechain {
-    class EventReceiver;
-
     class AudioDetector {
     public:
         // Emits an AUDIO_RUNNING event when at least one sink is running,
         // and an AUDIO_STOPPED event when all sinks are idle.
         virtual bool init(EventReceiver *receiver) = 0;
+        // Disconnects from the sound server. No more events will be
+        // emitted until init() is called again.
+        virtual void stop() = 0;
     };
 
     class PulseAudioDetector: public AudioDetector {
@@ -43,7 +48,49 @@ namespace Xidlechain {
     public:
         PulseAudioDetector();
         ~PulseAudioDetector();
-        bool init(EventReceiver *receiver);
+        bool init(EventReceiver *receiver) override;
+        void stop() override;
+    };
+
+    // Lets several receivers (e.g. one per display) share a single
+    // detector, so that there is only one connection to the sound server.
+    // The detector runs while at least one of the clients is initialized.
+    class SharedAudioDetector: public EventReceiver {
+    public:
+        class Client: public AudioDetector {
+            SharedAudioDetector *shared;
+            EventReceiver *event_receiver;
+            // Used to deliver the current state to a client which was
+            // initialized after the detector had reported it.
+            guint initial_state_source_id;
+
+            static gboolean static_send_initial_state(gpointer user_data);
+            friend class SharedAudioDetector;
+        public:
+            Client(SharedAudioDetector *shared);
+            ~Client();
+            Client(const Client&) = delete;
+            Client& operator=(const Client&) = delete;
+
+            bool init(EventReceiver *receiver) override;
+            void stop() override;
+        };
+    private:
+        AudioDetector *detector;
+        vector<Client*> clients;
+        bool detector_running;
+        // Whether the detector has reported the initial state yet
+        bool have_state;
+        bool audio_running;
+
+        bool add_client(Client *client);
+        void remove_client(Client *client);
+    public:
+        SharedAudioDetector(AudioDetector *detector);
+        SharedAudioDetector(const SharedAudioDetector&) = delete;
+        SharedAudioDetector& operator=(const SharedAudioDetector&) = delete;
+
+        void receive(const Event &event) override;
     };
 }
 
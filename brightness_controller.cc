@@ -42,20 +42,47 @@ static int timespec_diff_in_millis(const timespec *a, const timespec *b) {
 }
 
 namespace Xidlechain {
+    struct DbusBrightnessController::DimmerContext {
+        // Held by the thread while it sets the brightness, and by the
+        // controller while it detaches
+        GMutex lock;
+        // Set when the controller is destroyed. The thread must not touch
+        // the LogindManager after that, and the completion callback must
+        // not touch the controller.
+        bool detached;
+        DbusBrightnessController *controller;
+        LogindManager *logind_manager;
+        gchar *device_name;
+        int original_brightness;
+    };
+
     DbusBrightnessController::DbusBrightnessController():
         dimming_state{NONE},
         original_brightness{0},
         logind_manager{NULL},
         udev_client{NULL},
         backlight_device{NULL},
-        dimmer_task_cancellable{NULL}
-    {
-        const gchar * const subsystems[] = {"backlight", NULL};
-        udev_client = g_udev_client_new(subsystems);
-    }
+        dimmer_task_cancellable{NULL},
+        dimmer_context{NULL}
+    {}
 
     DbusBrightnessController::~DbusBrightnessController() {
-        g_object_unref(udev_client);
+        // The session is going away, possibly in the middle of dimming.
+        // Detach from the dimmer thread instead of waiting for it (which
+        // would mean running the main loop from here), and restore the
+        // brightness right away.
+        if (dimmer_context) {
+            g_mutex_lock(&dimmer_context->lock);
+            dimmer_context->detached = true;
+            g_mutex_unlock(&dimmer_context->lock);
+            g_cancellable_cancel(dimmer_task_cancellable);
+            g_debug("Restoring original brightness to %d", original_brightness);
+            logind_manager->set_brightness(g_udev_device_get_name(backlight_device), original_brightness);
+            g_object_unref(dimmer_task_cancellable);
+        }
+        if (udev_client) {
+            g_object_unref(udev_client);
+        }
         if (backlight_device) {
             g_object_unref(backlight_device);
         }
@@ -116,11 +143,42 @@ namespace Xidlechain {
     bool DbusBrightnessController::init(LogindManager *logind_manager) {
         g_assert_nonnull(logind_manager);
         this->logind_manager = logind_manager;
+        if (backlight_device) {
+            // already initialized
+            return true;
+        }
+        if (!udev_client) {
+            const gchar * const subsystems[] = {"backlight", NULL};
+            udev_client = g_udev_client_new(subsystems);
+        }
         return get_backlight_device();
     }
 
-    void DbusBrightnessController::dimmer_task_func(GTask *task) {
-        g_debug("Starting to dim from brightness = %d", original_brightness);
+    bool DbusBrightnessController::stop() {
+        switch (dimming_state) {
+        case NONE:
+            break;
+        case DIMMED:
+            restore_brightness();
+            break;
+        case DIMMING:
+        case CANCELLED:
+            // The dimmer task is still using the device
+            return false;
+        }
+        if (backlight_device) {
+            g_object_unref(backlight_device);
+            backlight_device = NULL;
+        }
+        if (udev_client) {
+            g_object_unref(udev_client);
+            udev_client = NULL;
+        }
+        return true;
+    }
+
+    void DbusBrightnessController::dimmer_task_func(GTask *task, DimmerContext *context) {
+        g_debug("Starting to dim from brightness = %d", context->original_brightness);
         // Maybe we should make these configurable?
         const int step_millis = 100;
         const int64_t total_millis = 5000;
@@ -130,7 +188,7 @@ namespace Xidlechain {
             .tv_sec = 0,
             .tv_nsec = step_millis * NANOSEC_PER_MILLISEC
         };
-        const char * const device_name = g_udev_device_get_name(backlight_device);
+        const char * const device_name = context->device_name;
         if (clock_gettime(CLOCK_BOOTTIME, &now) < 0) {
             g_warning("clock_gettime: %s", strerror(errno));
             g_task_return_pointer(task, NULL, NULL);
@@ -139,13 +197,13 @@ namespace Xidlechain {
         timespec start_time = now;
         timespec target_time;
         add_nanoseconds_to_timespec(&now, total_millis * NANOSEC_PER_MILLISEC, &target_time);
-        int cur_brightness = original_brightness;
+        int cur_brightness = context->original_brightness;
         // On laptops using intel_backlight, the firmware/BIOS will set the
         // brightness to 100% after resuming from sleep if it was at 0 before
         // entering sleep. So we don't want to go all the way down to 0.
         // See https://bbs.archlinux.org/viewtopic.php?id=231909.
         const int min_brightness =
-            (g_strcmp0(g_udev_device_get_name(backlight_device), "intel_backlight") == 0) ? 1 : 0;
+            (g_strcmp0(device_name, "intel_backlight") == 0) ? 1 : 0;
         if (cur_brightness <= min_brightness) {
             // Nothing to do
             g_task_return_pointer(task, NULL, NULL);
@@ -168,21 +226,40 @@ namespace Xidlechain {
             //      = total_delta - (millis_elapsed * total_delta) / total_millis
             int next_brightness = (int)(total_delta - ((int64_t)millis_elapsed * total_delta) / total_millis);
             if (next_brightness != cur_brightness) {
-                logind_manager->set_brightness(device_name, (unsigned)next_brightness);
+                g_mutex_lock(&context->lock);
+                bool detached = context->detached;
+                if (!detached) {
+                    context->logind_manager->set_brightness(device_name, (unsigned)next_brightness);
+                }
+                g_mutex_unlock(&context->lock);
+                if (detached) {
+                    g_task_return_pointer(task, NULL, NULL);
+                    return;
+                }
                 cur_brightness = next_brightness;
             }
 
             g_task_set_return_on_cancel(task, TRUE);
         }
         if (cur_brightness > min_brightness) {
-            logind_manager->set_brightness(device_name, (unsigned)min_brightness);
+            g_mutex_lock(&context->lock);
+            if (!context->detached) {
+                context->logind_manager->set_brightness(device_name, (unsigned)min_brightness);
+            }
+            g_mutex_unlock(&context->lock);
         }
         g_task_return_pointer(task, NULL, NULL);
     }
 
     void DbusBrightnessController::static_dimmer_task_func(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
-        DbusBrightnessController *_this = static_cast<DbusBrightnessController*>(task_data);
-        _this->dimmer_task_func(task);
+        dimmer_task_func(task, static_cast<DimmerContext*>(task_data));
+    }
+
+    void DbusBrightnessController::static_free_dimmer_context(gpointer data) {
+        DimmerContext *context = static_cast<DimmerContext*>(data);
+        g_mutex_clear(&context->lock);
+        g_free(context->device_name);
+        delete context;
     }
 
     void DbusBrightnessController::dimmer_task_complete_cb() {
@@ -200,15 +277,24 @@ namespace Xidlechain {
         }
         g_object_unref(dimmer_task_cancellable);
         dimmer_task_cancellable = NULL;
+        dimmer_context = NULL;
     }
 
     void DbusBrightnessController::static_dimmer_task_complete_cb(GObject *source_object, GAsyncResult *res, gpointer user_data) {
         g_debug("dimmer task completed");
-        DbusBrightnessController *_this = static_cast<DbusBrightnessController*>(user_data);
-        _this->dimmer_task_complete_cb();
+        DimmerContext *context = static_cast<DimmerContext*>(g_task_get_task_data(G_TASK(res)));
+        if (context->detached) {
+            // The controller is gone, and already restored the brightness
+            return;
+        }
+        context->controller->dimmer_task_complete_cb();
     }
 
     bool DbusBrightnessController::dim() {
+        if (!backlight_device) {
+            g_warning("Cannot dim: no backlight device");
+            return false;
+        }
         if (dimming_state != NONE) {
             g_warning("already dimming or dimmed");
             return false;
@@ -216,8 +302,15 @@ namespace Xidlechain {
         dimming_state = DIMMING;
         original_brightness = get_current_brightness();
         dimmer_task_cancellable = g_cancellable_new();
-        GTask *task = g_task_new(NULL, dimmer_task_cancellable, static_dimmer_task_complete_cb, this);
-        g_task_set_task_data(task, this, NULL);
+        dimmer_context = new DimmerContext;
+        g_mutex_init(&dimmer_context->lock);
+        dimmer_context->detached = false;
+        dimmer_context->controller = this;
+        dimmer_context->logind_manager = logind_manager;
+        dimmer_context->device_name = g_strdup(g_udev_device_get_name(backlight_device));
+        dimmer_context->original_brightness = original_brightness;
+        GTask *task = g_task_new(NULL, dimmer_task_cancellable, static_dimmer_task_complete_cb, NULL);
+        g_task_set_task_data(task, dimmer_context, static_free_dimmer_context);
         g_task_run_in_thread(task, static_dimmer_task_func);
         g_object_unref(task);
         return true;
@@ -14,6 +14,9 @@ namespace Xidlechain {
     class BrightnessController {
     public:
         virtual bool init(LogindManager *logind_manager) = 0;
+        // Releases the backlight device. Returns false if the controller
+        // is busy dimming, in which case it stays initialized.
+        virtual bool stop() = 0;
         virtual bool dim() = 0;
         virtual void restore_brightness() = 0;
     protected:
@@ -39,12 +42,17 @@ namespace Xidlechain {
         GUdevClient *udev_client;
         GUdevDevice *backlight_device;
         GCancellable *dimmer_task_cancellable;
+        // What the dimmer thread needs. It is owned by the task, so that
+        // the controller can be destroyed while the thread is running.
+        struct DimmerContext;
+        DimmerContext *dimmer_context;
 
         bool get_backlight_device();
         int get_current_brightness();
 
-        void dimmer_task_func(GTask *task);
+        static void dimmer_task_func(GTask *task, DimmerContext *context);
         static void static_dimmer_task_func(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable);
+        static void static_free_dimmer_context(gpointer data);
         void dimmer_task_complete_cb();
         static void static_dimmer_task_complete_cb(GObject *source_object, GAsyncResult *res, gpointer user_data);
     public:
@@ -52,6 +60,7 @@ namespace Xidlechain {
         ~DbusBrightnessController();
 
         bool init(LogindManager *logind_manager) override;
+        bool stop() override;
         bool dim() override;
         void restore_brightness() override;
     };
@@ -0,0 +1,69 @@
+#include "change_log.h"
+
+#include "command.h"
+
+namespace Xidlechain {
+    ChangeLog::ChangeLog() {
+        g_autofree gchar *uuid = g_uuid_string_random();
+        instance_id = uuid;
+    }
+
+    void ChangeLog::record(const Event &event) {
+        switch (event.type) {
+        case EVENT_CONFIG_CHANGED:
+            config_generation = ++generation;
+            break;
+        case EVENT_COMMAND_ADDED:
+            action_generations[event.command_info().cmd->id] = ++generation;
+            break;
+        case EVENT_COMMAND_CHANGED:
+            action_generations[event.property_change_info().cmd->id] = ++generation;
+            break;
+        case EVENT_COMMAND_REMOVED:
+            action_generations.erase(event.command_info().cmd->id);
+            removed_actions.emplace_back(++generation, event.command_info().cmd->id);
+            if (removed_actions.size() > MAX_REMOVED_ACTIONS) {
+                oldest_generation = removed_actions.front().first;
+                removed_actions.pop_front();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    bool ChangeLog::update_state(RuntimeState new_state) {
+        if (new_state == state) {
+            return false;
+        }
+        state = std::move(new_state);
+        state_generation = ++generation;
+        return true;
+    }
+
+    bool ChangeLog::is_complete(const char *instance, guint64 since) const {
+        // A generation from the future was made up; either way the client
+        // has to start over
+        return instance_id != instance
+            || since < oldest_generation
+            || since > generation;
+    }
+
+    bool ChangeLog::action_changed_since(int id, guint64 since) const {
+        unordered_map<int, guint64>::const_iterator it = action_generations.find(id);
+        return it != action_generations.end() && it->second > since;
+    }
+
+    vector<int> ChangeLog::removed_since(guint64 since) const {
+        vector<int> ids;
+        // The newest removals are at the back
+        for (
+            deque<pair<guint64, int>>::const_reverse_iterator it = removed_actions.rbegin();
+            it != removed_actions.rend() && it->first > since;
+            ++it
+        ) {
+            ids.push_back(it->second);
+        }
+        return ids;
+    }
+}
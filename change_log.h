@@ -0,0 +1,93 @@
+#ifndef _CHANGE_LOG_H_
+#define _CHANGE_LOG_H_
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glib.h>
+
+#include "event_receiver.h"
+
+using std::deque;
+using std::pair;
+using std::size_t;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace Xidlechain {
+    // Keeps track of what changed when, for the GetSnapshot and
+    // GetChangesSince D-Bus methods. The generation is incremented on
+    // every change. Generations only mean something together with the
+    // instance ID, which is different every time the daemon starts, so a
+    // client which kept a generation across a restart is told to start
+    // over instead of getting a wrong answer.
+    class ChangeLog {
+    public:
+        // The runtime state which GetSnapshot returns, apart from the
+        // idle time
+        struct RuntimeState {
+            bool idle = false;
+            gint64 idle_state_since = 0;
+            vector<int> activated;
+            bool audio_playing = false;
+            bool paused = false;
+            unsigned int inhibitors = 0;
+
+            bool operator==(const RuntimeState &other) const {
+                return idle == other.idle
+                    && idle_state_since == other.idle_state_since
+                    && activated == other.activated
+                    && audio_playing == other.audio_playing
+                    && paused == other.paused
+                    && inhibitors == other.inhibitors;
+            }
+        };
+        // How many removed actions can be reported
+        static constexpr size_t MAX_REMOVED_ACTIONS = 256;
+    private:
+        string instance_id;
+        guint64 generation = 0;
+        // When the [Main] settings last changed
+        guint64 config_generation = 0;
+        // When each action was added or last changed; missing if it
+        // didn't change since the daemon started
+        unordered_map<int, guint64> action_generations;
+        // (generation, ID) of the actions which were removed, oldest first
+        deque<pair<guint64, int>> removed_actions;
+        // Removals up to this generation were forgotten
+        guint64 oldest_generation = 0;
+        RuntimeState state;
+        guint64 state_generation = 0;
+    public:
+        ChangeLog();
+        ChangeLog(const ChangeLog&) = delete;
+        ChangeLog& operator=(const ChangeLog&) = delete;
+
+        const string &get_instance_id() const { return instance_id; }
+        guint64 get_generation() const { return generation; }
+        // Called for every config change
+        void record(const Event &event);
+        // The runtime state is only compared when it is asked for, so
+        // that following it costs nothing on the event path. Returns true
+        // if |new_state| differs from the last one.
+        bool update_state(RuntimeState new_state);
+        const RuntimeState &get_state() const { return state; }
+
+        // True if the changes after |since| can't be told, i.e. everything
+        // has to be sent again
+        bool is_complete(const char *instance, guint64 since) const;
+        bool config_changed_since(guint64 since) const { return config_generation > since; }
+        bool state_changed_since(guint64 since) const { return state_generation > since; }
+        bool action_changed_since(int id, guint64 since) const;
+        // The IDs of the actions which were removed after |since|, newest
+        // first
+        vector<int> removed_since(guint64 since) const;
+    };
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <sstream>
+#include <utility>
 
 #include <glib.h>
 
@@ -7,7 +8,10 @@
 #include "command.h"
 #include "errors.h"
 #include "logind_manager.h"
+#include "probes.h"
 #include "process_spawner.h"
+#include "stall_monitor.h"
+#include "trace.h"
 
 using std::abort;
 using std::char_traits;
@@ -22,7 +26,36 @@ static bool read_int_from_string(const char *s, int &result) {
     return !iss.fail();
 }
 
+static const struct {
+    Xidlechain::Command::InhibitSource source;
+    const char *name;
+} inhibit_source_names[] = {
+    {Xidlechain::Command::INHIBIT_AUDIO, "audio"},
+    {Xidlechain::Command::INHIBIT_FULLSCREEN, "fullscreen"},
+    {Xidlechain::Command::INHIBIT_PAUSED, "paused"},
+    {Xidlechain::Command::INHIBIT_LOGIND, "logind"},
+    {Xidlechain::Command::INHIBIT_PRESSURE, "pressure"},
+};
+
 namespace Xidlechain {
+    // Builtins are timed here, for as long as the call takes (see
+    // ActionMetrics::duration_us). Shell commands are timed by the
+    // ProcessSpawner, since an async command only finishes later.
+    static void run_action(Command::Action &action, const Command::ActionExecutors &executors, bool sync) {
+        action.metrics->num_runs++;
+        if (action.spawns_process()) {
+            if (sync) {
+                action.execute_sync(executors);
+            } else {
+                action.execute(executors);
+            }
+            return;
+        }
+        gint64 start_time = g_get_monotonic_time();
+        bool success = sync ? action.execute_sync(executors) : action.execute(executors);
+        action.metrics->record_exit(g_get_monotonic_time() - start_time, success ? 0 : 1);
+    }
+
     unique_ptr<Command::Action> Command::Action::factory(const char *cmd_str, GError **error) {
         static constexpr const char * const builtin_cmd_prefix = "builtin:";
         static constexpr const int builtin_cmd_prefix_len = char_traits<char>::length(builtin_cmd_prefix);
@@ -76,13 +109,13 @@ namespace Xidlechain {
 
     bool Command::ShellAction::execute(const Command::ActionExecutors &executors) {
         ProcessSpawner *process_spawner = executors.process_spawner;
-        process_spawner->exec_cmd_async(cmd);
+        process_spawner->exec_cmd_async(cmd, metrics);
         return true;
     }
 
     bool Command::ShellAction::execute_sync(const Command::ActionExecutors &executors) {
         ProcessSpawner *process_spawner = executors.process_spawner;
-        process_spawner->exec_cmd_sync(cmd);
+        process_spawner->exec_cmd_sync(cmd, metrics);
         return true;
     }
 
@@ -114,6 +147,11 @@ namespace Xidlechain {
         return "builtin:suspend";
     }
 
+    unsigned int Command::SuspendAction::get_inhibit_mask() const {
+        // Don't suspend in the middle of a long build or render
+        return INHIBIT_DEFAULT | INHIBIT_PRESSURE;
+    }
+
     bool Command::SetIdleHintAction::execute(const Command::ActionExecutors &executors) {
         LogindManager *logind_manager = executors.logind_manager;
         return logind_manager->set_idle_hint(true);
@@ -123,6 +161,11 @@ namespace Xidlechain {
         return "builtin:set_idle_hint";
     }
 
+    unsigned int Command::SetIdleHintAction::get_inhibit_mask() const {
+        // The session is still idle if the user is watching a video
+        return INHIBIT_PAUSED | INHIBIT_LOGIND;
+    }
+
     bool Command::UnsetIdleHintAction::execute(const Command::ActionExecutors &executors) {
         LogindManager *logind_manager = executors.logind_manager;
         return logind_manager->set_idle_hint(false);
@@ -136,9 +179,21 @@ namespace Xidlechain {
         id{0},
         trigger{NONE},
         timeout_ms{0},
+        has_custom_inhibit_mask{false},
+        custom_inhibit_mask{0},
         activated{false}
     {}
 
+    void Command::take_settings(Command &other) {
+        name = std::move(other.name);
+        trigger = other.trigger;
+        timeout_ms = other.timeout_ms;
+        activation_action = std::move(other.activation_action);
+        deactivation_action = std::move(other.deactivation_action);
+        has_custom_inhibit_mask = other.has_custom_inhibit_mask;
+        custom_inhibit_mask = other.custom_inhibit_mask;
+    }
+
     char *Command::static_get_trigger_str(Trigger trigger, int timeout_ms) {
         switch (trigger) {
         case TIMEOUT:
@@ -190,11 +245,10 @@ namespace Xidlechain {
             activated = true;
         }
         if (!activation_action) return;
-        if (sync) {
-            activation_action->execute_sync(executors);
-        } else {
-            activation_action->execute(executors);
-        }
+        Trace::record(TRACE_ACTIVATE, 0, id);
+        XIDLECHAIN_PROBE(command_activate, id, name.c_str());
+        StallMonitor::enter_command(id);
+        run_action(*activation_action, executors, sync);
     }
 
     void Command::deactivate(const Command::ActionExecutors &executors, bool sync) {
@@ -204,14 +258,78 @@ namespace Xidlechain {
             activated = false;
         }
         if (!deactivation_action) return;
-        if (sync) {
-            deactivation_action->execute_sync(executors);
-        } else {
-            deactivation_action->execute(executors);
-        }
+        Trace::record(TRACE_DEACTIVATE, 0, id);
+        XIDLECHAIN_PROBE(command_deactivate, id, name.c_str());
+        StallMonitor::enter_command(id);
+        run_action(*deactivation_action, executors, sync);
     }
 
     bool Command::is_activated() const {
         return activated;
     }
+
+    unsigned int Command::get_inhibit_mask() const {
+        if (has_custom_inhibit_mask) {
+            return custom_inhibit_mask;
+        }
+        return activation_action ? activation_action->get_inhibit_mask() : INHIBIT_DEFAULT;
+    }
+
+    bool Command::uses_brightness_controller() const {
+        return (activation_action && activation_action->uses_brightness_controller())
+            || (deactivation_action && deactivation_action->uses_brightness_controller());
+    }
+
+    char *Command::get_inhibited_by_str() const {
+        if (!has_custom_inhibit_mask) {
+            return g_strdup("");
+        }
+        if (custom_inhibit_mask == 0) {
+            return g_strdup("none");
+        }
+        return static_get_inhibit_mask_str(custom_inhibit_mask);
+    }
+
+    char *Command::static_get_inhibit_mask_str(unsigned int mask) {
+        GString *str = g_string_new(NULL);
+        for (const auto &entry : inhibit_source_names) {
+            if (mask & entry.source) {
+                if (str->len > 0) {
+                    g_string_append(str, ",");
+                }
+                g_string_append(str, entry.name);
+            }
+        }
+        return g_string_free(str, FALSE);
+    }
+
+    bool Command::set_inhibited_by_from_str(const char *val, GError **error) {
+        if (val[0] == '\0') {
+            has_custom_inhibit_mask = false;
+            custom_inhibit_mask = 0;
+            return true;
+        }
+        unsigned int mask = 0;
+        if (g_strcmp0(val, "none") != 0) {
+            g_auto(GStrv) names = g_strsplit(val, ",", -1);
+            for (int i = 0; names[i] != NULL; i++) {
+                const char *name = g_strstrip(names[i]);
+                bool found = false;
+                for (const auto &entry : inhibit_source_names) {
+                    if (g_strcmp0(name, entry.name) == 0) {
+                        mask |= entry.source;
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) {
+                    g_set_error(error, XIDLECHAIN_ERROR, XIDLECHAIN_ERROR_INVALID_INHIBITOR, "Unknown inhibitor '%s'", name);
+                    return false;
+                }
+            }
+        }
+        has_custom_inhibit_mask = true;
+        custom_inhibit_mask = mask;
+        return true;
+    }
 }
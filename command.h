@@ -7,7 +7,11 @@
 
 #include <glib.h>
 
+#include "action_metrics.h"
+
 using std::int64_t;
+using std::make_shared;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 
@@ -18,6 +22,19 @@ namespace Xidlechain {
 
     class Command {
     public:
+        // Sources which can keep a TIMEOUT command from being activated.
+        // These are used as bit flags in inhibit masks.
+        enum InhibitSource {
+            INHIBIT_AUDIO = 1 << 0,
+            INHIBIT_FULLSCREEN = 1 << 1,
+            INHIBIT_PAUSED = 1 << 2,
+            // "idle" block inhibitor locks held in logind
+            INHIBIT_LOGIND = 1 << 3,
+            INHIBIT_PRESSURE = 1 << 4,
+        };
+        static constexpr unsigned int INHIBIT_DEFAULT =
+            INHIBIT_AUDIO | INHIBIT_FULLSCREEN | INHIBIT_PAUSED | INHIBIT_LOGIND;
+
         struct ActionExecutors {
             BrightnessController *brightness_controller;
             ProcessSpawner *process_spawner;
@@ -26,6 +43,10 @@ namespace Xidlechain {
 
         class Action {
         public:
+            // Shared with the ProcessSpawner, which may still be waiting
+            // for a command after the action was replaced
+            const shared_ptr<ActionMetrics> metrics = make_shared<ActionMetrics>();
+
             // If cmd_str is empty, null is returned and error is not set.
             // If cmd_str is invalid, null is returned and error is set.
             // Otherwise, a valid Action pointer is returned and error is
@@ -37,6 +58,22 @@ namespace Xidlechain {
             virtual bool execute_sync(const ActionExecutors &executors) {
                 return execute(executors);
             }
+            // Returns the InhibitSources which should prevent this action
+            // from being executed after a timeout, unless the user
+            // specified them explicitly.
+            virtual unsigned int get_inhibit_mask() const {
+                return INHIBIT_DEFAULT;
+            }
+            // Whether executing this action requires the brightness
+            // controller to be initialized.
+            virtual bool uses_brightness_controller() const {
+                return false;
+            }
+            // Whether executing this action spawns a process, whose run
+            // is recorded in |metrics| by the ProcessSpawner.
+            virtual bool spawns_process() const {
+                return false;
+            }
             virtual ~Action() = default;
         };
 
@@ -47,30 +84,35 @@ namespace Xidlechain {
             const char *get_cmd_str() const override;
             bool execute(const ActionExecutors &executors) override;
             bool execute_sync(const ActionExecutors &executors) override;
+            bool spawns_process() const override { return true; }
         };
 
         class DimAction: public Action {
         public:
             const char *get_cmd_str() const override;
             bool execute(const ActionExecutors &executors) override;
+            bool uses_brightness_controller() const override { return true; }
         };
 
         class UndimAction: public Action {
         public:
             const char *get_cmd_str() const override;
             bool execute(const ActionExecutors &executors) override;
+            bool uses_brightness_controller() const override { return true; }
         };
 
         class SuspendAction: public Action {
         public:
             const char *get_cmd_str() const override;
             bool execute(const ActionExecutors &executors) override;
+            unsigned int get_inhibit_mask() const override;
         };
 
         class SetIdleHintAction: public Action {
         public:
             const char *get_cmd_str() const override;
             bool execute(const ActionExecutors &executors) override;
+            unsigned int get_inhibit_mask() const override;
         };
 
         class UnsetIdleHintAction: public Action {
@@ -95,14 +137,29 @@ namespace Xidlechain {
         unique_ptr<Action> deactivation_action;
 
         Command();
+        // Replaces the settings (everything but the ID and whether the
+        // command is activated) with those of |other|, which are moved
+        void take_settings(Command &other);
         void activate(const ActionExecutors &executors, bool sync=false);
         void deactivate(const ActionExecutors &executors, bool sync=false);
         bool is_activated() const;
+        unsigned int get_inhibit_mask() const;
+        bool uses_brightness_controller() const;
         static char *static_get_trigger_str(Trigger trigger, int timeout_ms);
         char *get_trigger_str() const;
         bool is_valid(GError **error) const;
         bool set_trigger_from_str(const char *val, GError **error);
+        // Returns an empty string if the default inhibit mask is used.
+        char *get_inhibited_by_str() const;
+        // The comma-separated names of the InhibitSources in |mask|
+        static char *static_get_inhibit_mask_str(unsigned int mask);
+        // Accepts a comma-separated list of inhibit source names, "none",
+        // or an empty string to restore the default inhibit mask.
+        bool set_inhibited_by_from_str(const char *val, GError **error);
     private:
+        // Set if the user overrode the inhibit mask of the activation action
+        bool has_custom_inhibit_mask;
+        unsigned int custom_inhibit_mask;
         // Only used for TIMEOUT commands
         // We need this because when activity is detected, we need to
         // run the deactivation actions only for the commands which have
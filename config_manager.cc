@@ -1,25 +1,48 @@
 #include "config_manager.h"
 
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <memory>
-#include <fstream>
 #include <string>
 #include <unordered_set>
 #include <utility>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "command.h"
+#include "event_receiver.h"
 #include "filter.h"
 #include "map.h"
+#include "metrics.h"
 
 using std::abort;
 using std::char_traits;
-using std::ofstream;
+using std::sscanf;
 using std::make_unique;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::unordered_set;
+using std::vector;
 using Xidlechain::Command;
+using Xidlechain::ConfigManager;
+
+// The [Main] settings which are applied when the config file is reloaded.
+// The others only take effect after a restart.
+static const struct {
+    Xidlechain::PropertyId property;
+    bool ConfigManager::*field;
+} reloadable_settings[] = {
+    {Xidlechain::PROPERTY_IGNORE_AUDIO, &ConfigManager::ignore_audio},
+    {Xidlechain::PROPERTY_IGNORE_FULLSCREEN, &ConfigManager::ignore_fullscreen},
+    {Xidlechain::PROPERTY_WAIT_BEFORE_SLEEP, &ConfigManager::wait_before_sleep},
+    {Xidlechain::PROPERTY_DISABLE_AUTOMATIC_DPMS_ACTIVATION, &ConfigManager::disable_automatic_dpms_activation},
+    {Xidlechain::PROPERTY_DISABLE_SCREENSAVER, &ConfigManager::disable_screensaver},
+    {Xidlechain::PROPERTY_WAKE_RESUMES_ACTIVITY, &ConfigManager::wake_resumes_activity},
+};
 
 static string get_xdg_config_home() {
     char *xdg_config_home = getenv("XDG_CONFIG_HOME");
@@ -56,6 +79,47 @@ static bool read_bool(GKeyFile *key_file, gchar *group, gchar *key, bool &result
     return true;
 }
 
+static const unsigned int PSI_UNPRIVILEGED_WINDOW_US = 2000000;
+static const unsigned int PSI_MAX_WINDOW_US = 10000000;
+
+// Checks that val looks like "<some|full> <stall us> <window us>".
+// The kernel performs its own validation when the trigger is registered,
+// but only then, so the window is also checked here: unprivileged
+// triggers are refused unless the window is a multiple of 2 s, and no
+// window may be longer than 10 s.
+static bool is_valid_pressure_trigger(const char *val) {
+    char kind[5];
+    unsigned int stall_us, window_us;
+    int end = -1;
+    if (
+        sscanf(val, "%4s %u %u %n", kind, &stall_us, &window_us, &end) != 3
+        || end < 0
+        || val[end] != '\0'
+    ) {
+        return false;
+    }
+    if (
+        (g_strcmp0(kind, "some") != 0 && g_strcmp0(kind, "full") != 0)
+        || stall_us == 0
+        || stall_us > window_us
+    ) {
+        return false;
+    }
+    if (window_us % PSI_UNPRIVILEGED_WINDOW_US != 0 || window_us > PSI_MAX_WINDOW_US) {
+        g_warning("The window of pressure trigger '%s' must be a multiple of 2 s, up to 10 s", val);
+        return false;
+    }
+    return true;
+}
+
+static void set_or_remove_value(GKeyFile *key_file, const gchar *group, const gchar *key, const string &value) {
+    if (!value.empty()) {
+        g_key_file_set_value(key_file, group, key, value.c_str());
+    } else if (g_key_file_has_key(key_file, group, key, NULL)) {
+        g_key_file_remove_key(key_file, group, key, NULL);
+    }
+}
+
 // Returns null iff val is invalid or empty.
 static unique_ptr<Command::Action> get_action(const char *val) {
     g_autoptr(GError) error = NULL;
@@ -72,7 +136,26 @@ static unique_ptr<Command::Action> read_action(GKeyFile *key_file, gchar *group,
     return get_action(val);
 }
 
+static const char *get_action_str(const unique_ptr<Command::Action> &action) {
+    return action ? action->get_cmd_str() : "";
+}
+
 namespace Xidlechain {
+    ConfigManager::~ConfigManager() {
+        flush_pending_save();
+        // A write might still be running in a worker thread; make sure
+        // its callback doesn't touch us.
+        g_cancellable_cancel(save_cancellable);
+        g_object_unref(save_cancellable);
+        if (reload_source_id) {
+            g_source_remove(reload_source_id);
+        }
+        if (file_monitor) {
+            g_signal_handlers_disconnect_by_data(file_monitor, this);
+            g_object_unref(file_monitor);
+        }
+    }
+
     CommandMapValues ConfigManager::get_all_commands() {
         // For some reason, when I defined this inline in the Map
         // constructor, it didn't work. I'm still not sure why.
@@ -161,6 +244,15 @@ namespace Xidlechain {
         return true;
     }
 
+    bool ConfigManager::set_command_inhibited_by(Command &cmd, const char *val) {
+        g_autoptr(GError) error = NULL;
+        if (!cmd.set_inhibited_by_from_str(val, &error)) {
+            g_warning("Could not set inhibitors for action %d: %s", cmd.id, error->message);
+            return false;
+        }
+        return true;
+    }
+
     bool ConfigManager::parse_action_section(GKeyFile *key_file, gchar *group) {
         g_autoptr(GError) error = NULL;
         g_auto(GStrv) keys = NULL;
@@ -181,6 +273,14 @@ namespace Xidlechain {
                 cmd->activation_action = read_action(key_file, group, key);
             } else if (g_strcmp0(key, "resume_exec") == 0) {
                 cmd->deactivation_action = read_action(key_file, group, key);
+            } else if (g_strcmp0(key, "inhibited_by") == 0) {
+                g_autofree gchar *val = g_key_file_get_value(key_file, group, key, NULL);
+                // An empty value would mean "use the default", which is
+                // confusing in a config file
+                if (*val == '\0' || !set_command_inhibited_by(*cmd, val)) {
+                    g_warning("Invalid value for inhibited_by in section %s", group);
+                    return false;
+                }
             } else {
                 g_warning("Unrecognized key '%s' in section %s", key, group);
                 return false;
@@ -210,6 +310,13 @@ namespace Xidlechain {
                 ) {
                     return false;
                 }
+            } else if (g_strcmp0(key, "ignore_fullscreen") == 0) {
+                if (
+                    !read_bool(key_file, group, key, bool_value)
+                    || !set_ignore_fullscreen(bool_value)
+                ) {
+                    return false;
+                }
             } else if (g_strcmp0(key, "wait_before_sleep") == 0) {
                 if (
                     !read_bool(key_file, group, key, bool_value)
@@ -245,6 +352,23 @@ namespace Xidlechain {
                 ) {
                     return false;
                 }
+            } else if (g_strcmp0(key, "cpu_pressure_trigger") == 0) {
+                g_autofree gchar *val = g_key_file_get_value(key_file, group, key, NULL);
+                if (!set_cpu_pressure_trigger(val)) {
+                    return false;
+                }
+            } else if (g_strcmp0(key, "io_pressure_trigger") == 0) {
+                g_autofree gchar *val = g_key_file_get_value(key_file, group, key, NULL);
+                if (!set_io_pressure_trigger(val)) {
+                    return false;
+                }
+            } else if (g_strcmp0(key, "pressure_use_cgroup") == 0) {
+                if (
+                    !read_bool(key_file, group, key, bool_value)
+                    || !set_pressure_use_cgroup(bool_value)
+                ) {
+                    return false;
+                }
             } else {
                 g_warning("Unrecognized key '%s' in Main section", key);
                 return false;
@@ -257,6 +381,10 @@ namespace Xidlechain {
         ignore_audio = value;
         return true;
     }
+    bool ConfigManager::set_ignore_fullscreen(bool value) {
+        ignore_fullscreen = value;
+        return true;
+    }
     bool ConfigManager::set_wait_before_sleep(bool value) {
         wait_before_sleep = value;
         return true;
@@ -277,40 +405,102 @@ namespace Xidlechain {
         enable_dbus = value;
         return true;
     }
+    bool ConfigManager::set_cpu_pressure_trigger(const char *value) {
+        if (*value && !is_valid_pressure_trigger(value)) {
+            g_warning("Invalid value for cpu_pressure_trigger: '%s'", value);
+            return false;
+        }
+        cpu_pressure_trigger = value;
+        return true;
+    }
+    bool ConfigManager::set_io_pressure_trigger(const char *value) {
+        if (*value && !is_valid_pressure_trigger(value)) {
+            g_warning("Invalid value for io_pressure_trigger: '%s'", value);
+            return false;
+        }
+        io_pressure_trigger = value;
+        return true;
+    }
+    bool ConfigManager::set_pressure_use_cgroup(bool value) {
+        pressure_use_cgroup = value;
+        return true;
+    }
 
-    gboolean ConfigManager::static_save_config_to_file(gpointer user_data) {
-        ConfigManager *_this = (ConfigManager*)user_data;
-        _this->save_config_to_file();
-        return FALSE;
+    // Applies the differences between |base| and |ours| to |target|
+    static void apply_key_file_changes(GKeyFile *base, GKeyFile *ours, GKeyFile *target) {
+        g_auto(GStrv) base_groups = g_key_file_get_groups(base, NULL);
+        for (int i = 0; base_groups[i] != NULL; i++) {
+            if (!g_key_file_has_group(ours, base_groups[i])) {
+                g_key_file_remove_group(target, base_groups[i], NULL);
+                continue;
+            }
+            g_auto(GStrv) keys = g_key_file_get_keys(base, base_groups[i], NULL, NULL);
+            for (int j = 0; keys[j] != NULL; j++) {
+                if (!g_key_file_has_key(ours, base_groups[i], keys[j], NULL)) {
+                    g_key_file_remove_key(target, base_groups[i], keys[j], NULL);
+                }
+            }
+        }
+        g_auto(GStrv) groups = g_key_file_get_groups(ours, NULL);
+        for (int i = 0; groups[i] != NULL; i++) {
+            g_auto(GStrv) keys = g_key_file_get_keys(ours, groups[i], NULL, NULL);
+            for (int j = 0; keys[j] != NULL; j++) {
+                g_autofree gchar *value = g_key_file_get_value(ours, groups[i], keys[j], NULL);
+                g_autofree gchar *base_value = g_key_file_get_value(base, groups[i], keys[j], NULL);
+                if (g_strcmp0(value, base_value) != 0) {
+                    g_key_file_set_value(target, groups[i], keys[j], value);
+                }
+            }
+        }
     }
 
-    void ConfigManager::save_config_to_file() {
-        if (config_file_path.empty()) {
-            g_warning("config file path is not set; not saving config");
-            return;
+    bool ConfigManager::is_known_contents(const gchar *contents, gsize length) const {
+        if (file_contents.compare(0, string::npos, contents, length) == 0) {
+            return true;
         }
+        for (const auto &entry : known_contents) {
+            if (entry.second.compare(0, string::npos, contents, length) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
 
+    void ConfigManager::forget_known_contents(guint64 generation) {
+        while (!known_contents.empty() && known_contents.front().first < generation) {
+            known_contents.pop_front();
+        }
+    }
+
+    // Merges the current settings into the last contents of the config
+    // file, so that comments and unknown keys are preserved. If the file
+    // was edited since then (and the edit wasn't reloaded yet, or was
+    // rejected), only our changes are applied to it, and |merged_edit|
+    // is set.
+    bool ConfigManager::serialize_config(string &data, bool &merged_edit) {
         g_autoptr(GKeyFile) key_file = NULL;
         g_autoptr(GError) error = NULL;
         g_auto(GStrv) groups = NULL;
 
+        merged_edit = false;
         key_file = g_key_file_new();
-        if (!g_key_file_load_from_file(key_file, config_file_path.c_str(), key_file_flags, &error)) {
-            if (error->code == G_FILE_ERROR_NOENT) {
-                g_warning("Config file %s does not exist; creating a new file", config_file_path.c_str());
-                g_error_free(error);
-                error = NULL;
-            } else {
-                g_warning("Could not read config file %s: %s", config_file_path.c_str(), error->message);
-                return;
-            }
+        if (
+            !file_contents.empty()
+            && !g_key_file_load_from_data(key_file, file_contents.data(), file_contents.size(), key_file_flags, &error)
+        ) {
+            g_warning("Could not parse config file %s: %s", config_file_path.c_str(), error->message);
+            return false;
         }
         g_key_file_set_value(key_file, "Main", "ignore_audio", bool_to_str(ignore_audio));
+        g_key_file_set_value(key_file, "Main", "ignore_fullscreen", bool_to_str(ignore_fullscreen));
         g_key_file_set_value(key_file, "Main", "wait_before_sleep", bool_to_str(wait_before_sleep));
         g_key_file_set_value(key_file, "Main", "disable_automatic_dpms_activation", bool_to_str(disable_automatic_dpms_activation));
         g_key_file_set_value(key_file, "Main", "disable_screensaver", bool_to_str(disable_screensaver));
         g_key_file_set_value(key_file, "Main", "wake_resumes_activity", bool_to_str(wake_resumes_activity));
         g_key_file_set_value(key_file, "Main", "enable_dbus", bool_to_str(enable_dbus));
+        set_or_remove_value(key_file, "Main", "cpu_pressure_trigger", cpu_pressure_trigger);
+        set_or_remove_value(key_file, "Main", "io_pressure_trigger", io_pressure_trigger);
+        g_key_file_set_value(key_file, "Main", "pressure_use_cgroup", bool_to_str(pressure_use_cgroup));
 
         unordered_set<string> command_names;
         for (shared_ptr<Command> cmd : get_all_commands()) {
@@ -330,7 +520,7 @@ namespace Xidlechain {
                 }
             } else {
                 g_warning("Unexpected section name '%s'; not saving config", group);
-                return;
+                return false;
             }
         }
 
@@ -349,27 +539,277 @@ namespace Xidlechain {
             } else if (g_key_file_has_key(key_file, group_name.c_str(), "resume_exec", NULL)) {
                 g_key_file_remove_key(key_file, group_name.c_str(), "resume_exec", NULL);
             }
+            g_autofree gchar *inhibited_by = cmd->get_inhibited_by_str();
+            set_or_remove_value(key_file, group_name.c_str(), "inhibited_by", inhibited_by);
         }
 
-        g_autofree gchar *data = g_key_file_to_data(key_file, NULL, NULL);
-        ofstream output(config_file_path);
-        output << data;
-        if (output.fail()) {
-            g_warning("error saving config to file");
+        g_autofree gchar *disk_contents = NULL;
+        gsize disk_length = 0;
+        if (
+            !g_file_get_contents(config_file_path.c_str(), &disk_contents, &disk_length, NULL)
+            || is_known_contents(disk_contents, disk_length)
+        ) {
+            g_autofree gchar *new_data = g_key_file_to_data(key_file, NULL, NULL);
+            data = new_data;
+            return true;
         }
-        g_debug("saved new config to file");
+        g_autoptr(GKeyFile) base_key_file = g_key_file_new();
+        g_autoptr(GKeyFile) disk_key_file = g_key_file_new();
+        if (
+            !file_contents.empty()
+            && !g_key_file_load_from_data(base_key_file, file_contents.data(), file_contents.size(), key_file_flags, NULL)
+        ) {
+            return false;
+        }
+        if (!g_key_file_load_from_data(disk_key_file, disk_contents, disk_length, key_file_flags, &error)) {
+            g_warning("Config file %s was changed and can't be parsed (%s); not overwriting it",
+                      config_file_path.c_str(), error->message);
+            return false;
+        }
+        apply_key_file_changes(base_key_file, key_file, disk_key_file);
+        g_autofree gchar *new_data = g_key_file_to_data(disk_key_file, NULL, NULL);
+        data = new_data;
+        merged_edit = true;
+        return true;
+    }
+
+    // Runs in a worker thread. The new contents are written to a temporary
+    // file which is then renamed over the config file, so a crash can never
+    // leave a partially written config behind. If the config file is a
+    // symlink, its target is replaced.
+    static bool write_file_atomically(const string &config_path, const string &data, GError **error) {
+        char *resolved_path = realpath(config_path.c_str(), NULL);
+        string path = resolved_path ? resolved_path : config_path;
+        free(resolved_path);
+        string tmp_path = path + ".XXXXXX";
+        int fd = g_mkstemp_full(&tmp_path[0], O_WRONLY | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            int saved_errno = errno;
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                        "Could not create %s: %s", tmp_path.c_str(), g_strerror(saved_errno));
+            return false;
+        }
+        // Keep the permissions of the existing file
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            fchmod(fd, st.st_mode & 07777);
+        }
+        const char *buf = data.data();
+        size_t remaining = data.size();
+        while (remaining > 0) {
+            ssize_t n = write(fd, buf, remaining);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            buf += n;
+            remaining -= n;
+        }
+        if (remaining > 0 || fsync(fd) != 0) {
+            int saved_errno = errno;
+            close(fd);
+            unlink(tmp_path.c_str());
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                        "Could not write %s: %s", tmp_path.c_str(), g_strerror(saved_errno));
+            return false;
+        }
+        close(fd);
+        if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+            int saved_errno = errno;
+            unlink(tmp_path.c_str());
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                        "Could not rename %s: %s", tmp_path.c_str(), g_strerror(saved_errno));
+            return false;
+        }
+        // The rename itself only survives a crash once the directory is
+        // on disk
+        g_autofree gchar *dir_path = g_path_get_dirname(path.c_str());
+        int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0 || fsync(dir_fd) != 0) {
+            g_warning("Could not sync %s: %s", dir_path, g_strerror(errno));
+        }
+        if (dir_fd >= 0) {
+            close(dir_fd);
+        }
+        return true;
+    }
+
+    // Shared by a ConfigManager and its write threads. Writes hold the
+    // lock, and a write is skipped if a newer one already reached the
+    // file, so the synchronous write from the destructor can neither
+    // interleave with nor be overwritten by one which is still running.
+    struct ConfigSaveState {
+        GMutex lock;
+        guint64 written_generation = 0;
+
+        ConfigSaveState() { g_mutex_init(&lock); }
+        ~ConfigSaveState() { g_mutex_clear(&lock); }
+    };
+
+    shared_ptr<ConfigSaveState> ConfigManager::new_save_state() {
+        return std::make_shared<ConfigSaveState>();
+    }
+
+    struct SaveTaskData {
+        string path;
+        string data;
+        guint64 generation;
+        shared_ptr<ConfigSaveState> state;
+    };
+
+    static void save_task_data_free(gpointer p) {
+        delete (SaveTaskData*)p;
+    }
+
+    static void save_thread_func(
+        GTask *task,
+        gpointer source_object,
+        gpointer task_data,
+        GCancellable *cancellable
+    ) {
+        SaveTaskData *save_data = (SaveTaskData*)task_data;
+        GError *error = NULL;
+        bool ok = true;
+        g_mutex_lock(&save_data->state->lock);
+        if (save_data->generation > save_data->state->written_generation) {
+            ok = write_file_atomically(save_data->path, save_data->data, &error);
+            if (ok) {
+                save_data->state->written_generation = save_data->generation;
+            }
+        }
+        g_mutex_unlock(&save_data->state->lock);
+        if (!ok) {
+            g_task_return_error(task, error);
+            return;
+        }
+        g_task_return_boolean(task, TRUE);
+    }
+
+    void ConfigManager::save_config_to_file() {
+        if (config_file_path.empty()) {
+            g_warning("config file path is not set; not saving config");
+            return;
+        }
+        if (save_in_progress) {
+            // We'll be called again once the current write finishes
+            return;
+        }
+        string data;
+        bool merged_edit;
+        if (!serialize_config(data, merged_edit)) {
+            return;
+        }
+        guint64 generation = ++write_generation;
+        if (merged_edit) {
+            // The edit which we merged is about to be overwritten, and
+            // reloads of it will be ignored, so take it in now
+            g_autofree gchar *disk_contents = NULL;
+            gsize disk_length = 0;
+            if (g_file_get_contents(config_file_path.c_str(), &disk_contents, &disk_length, NULL)) {
+                known_contents.emplace_back(generation, string(disk_contents, disk_length));
+            }
+            if (!apply_config_data(data.data(), data.size())) {
+                g_warning("Config file was changed, but is invalid; keeping the current config");
+            }
+        }
+        // Reloads of the file which we are about to write are ignored,
+        // even if another write is started before they happen
+        known_contents.emplace_back(generation, data);
+        save_pending = false;
+        save_in_progress = true;
+        SaveTaskData *save_data = new SaveTaskData{config_file_path, std::move(data), generation, save_state};
+        GTask *task = g_task_new(NULL, save_cancellable, static_on_config_saved, this);
+        g_task_set_task_data(task, save_data, save_task_data_free);
+        g_task_run_in_thread(task, save_thread_func);
+        g_object_unref(task);
+    }
+
+    void ConfigManager::static_on_config_saved(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+        GTask *task = G_TASK(res);
+        if (g_cancellable_is_cancelled(g_task_get_cancellable(task))) {
+            // The ConfigManager was destroyed
+            return;
+        }
+        ConfigManager *_this = (ConfigManager*)user_data;
+        SaveTaskData *save_data = (SaveTaskData*)g_task_get_task_data(task);
+        g_autoptr(GError) error = NULL;
+        _this->save_in_progress = false;
+        if (g_task_propagate_boolean(task, &error)) {
+            if (save_data->generation == _this->write_generation) {
+                // Unless flush_pending_save() wrote something newer
+                _this->file_contents = save_data->data;
+            }
+            // Older contents can't show up any more
+            _this->forget_known_contents(save_data->generation);
+            _this->saves_performed++;
+            Metrics::config_saves_performed++;
+            g_debug("saved new config to file (%" G_GUINT64_FORMAT " writes for %" G_GUINT64_FORMAT " requests)",
+                    _this->saves_performed, _this->saves_requested);
+        } else {
+            g_warning("error saving config to file: %s", error->message);
+            // The file still has what it had before
+            _this->forget_known_contents(save_data->generation + 1);
+        }
+        if (_this->save_pending && !_this->save_source_id) {
+            // More changes came in while we were writing
+            _this->save_config_to_file();
+        }
+    }
+
+    gboolean ConfigManager::static_save_config_to_file(gpointer user_data) {
+        ConfigManager *_this = (ConfigManager*)user_data;
+        _this->save_source_id = 0;
+        _this->save_config_to_file();
+        return G_SOURCE_REMOVE;
     }
 
     void ConfigManager::save_config_to_file_async() {
-        g_idle_add(static_save_config_to_file, this);
+        saves_requested++;
+        Metrics::config_saves_requested++;
+        save_pending = true;
+        // Changes usually come in bursts (e.g. a GUI setting several
+        // properties), so wait until they stop before writing
+        if (save_source_id) {
+            g_source_remove(save_source_id);
+        }
+        save_source_id = g_timeout_add(save_delay_ms, static_save_config_to_file, this);
+    }
+
+    void ConfigManager::flush_pending_save() {
+        if (save_source_id) {
+            g_source_remove(save_source_id);
+            save_source_id = 0;
+        }
+        if (!save_pending || config_file_path.empty()) {
+            return;
+        }
+        // Wait for the write which is in flight, if any. Its completion
+        // callback may never run, but the file is read again before
+        // merging, so its changes are kept.
+        g_mutex_lock(&save_state->lock);
+        string data;
+        bool merged_edit;
+        if (serialize_config(data, merged_edit)) {
+            guint64 generation = ++write_generation;
+            g_autoptr(GError) error = NULL;
+            if (write_file_atomically(config_file_path, data, &error)) {
+                save_state->written_generation = generation;
+                file_contents = data;
+                save_pending = false;
+                saves_performed++;
+                Metrics::config_saves_performed++;
+            } else {
+                g_warning("error saving config to file: %s", error->message);
+            }
+        }
+        g_mutex_unlock(&save_state->lock);
     }
 
     bool ConfigManager::parse_config_file(const string &filename) {
-        g_autoptr(GKeyFile) key_file = NULL;
         g_autoptr(GError) error = NULL;
-        g_auto(GStrv) groups = NULL;
+        g_autofree gchar *contents = NULL;
+        gsize length;
 
-        key_file = g_key_file_new();
         if (filename.empty()) {
             config_file_path = get_default_config_file_path();
             if (config_file_path.empty()) {
@@ -379,13 +819,30 @@ namespace Xidlechain {
         } else {
             config_file_path = filename;
         }
-        if (!g_key_file_load_from_file(key_file, config_file_path.c_str(), key_file_flags, &error)) {
+        if (!g_file_get_contents(config_file_path.c_str(), &contents, &length, &error)) {
             if (error->code == G_FILE_ERROR_NOENT) {
                 // TODO: create file if it doesn't exist
             }
             g_warning("Could not read config file %s: %s", config_file_path.c_str(), error->message);
             return false;
         }
+        if (!parse_config_data(contents, length)) {
+            return false;
+        }
+        file_contents.assign(contents, length);
+        return true;
+    }
+
+    bool ConfigManager::parse_config_data(const gchar *data, gsize length) {
+        g_autoptr(GKeyFile) key_file = NULL;
+        g_autoptr(GError) error = NULL;
+        g_auto(GStrv) groups = NULL;
+
+        key_file = g_key_file_new();
+        if (!g_key_file_load_from_data(key_file, data, length, key_file_flags, &error)) {
+            g_warning("Could not parse config file %s: %s", config_file_path.c_str(), error->message);
+            return false;
+        }
         groups = g_key_file_get_groups(key_file, NULL);
         for (int i = 0; groups[i] != NULL; i++) {
             gchar *group = groups[i];
@@ -404,4 +861,183 @@ namespace Xidlechain {
         }
         return true;
     }
+
+    bool ConfigManager::watch_config_file(EventReceiver *receiver) {
+        g_return_val_if_fail(receiver != NULL, FALSE);
+        g_return_val_if_fail(!config_file_path.empty(), FALSE);
+        reload_receiver = receiver;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GFile) file = g_file_new_for_path(config_file_path.c_str());
+        file_monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, &error);
+        if (error) {
+            g_warning("Could not watch config file %s: %s", config_file_path.c_str(), error->message);
+            return false;
+        }
+        g_signal_connect(file_monitor, "changed", G_CALLBACK(static_on_file_changed), this);
+        return true;
+    }
+
+    void ConfigManager::static_on_file_changed(
+        GFileMonitor *monitor,
+        GFile *file,
+        GFile *other_file,
+        GFileMonitorEvent event_type,
+        gpointer user_data
+    ) {
+        ConfigManager *_this = (ConfigManager*)user_data;
+        switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CHANGED:
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_CREATED:
+            // Editors often write a file in several steps (or write a new
+            // file and rename it), so wait for things to settle down.
+            if (_this->reload_source_id) {
+                g_source_remove(_this->reload_source_id);
+            }
+            _this->reload_source_id = g_timeout_add(200, static_reload_config_file, _this);
+            break;
+        default:
+            break;
+        }
+    }
+
+    gboolean ConfigManager::static_reload_config_file(gpointer user_data) {
+        ConfigManager *_this = (ConfigManager*)user_data;
+        _this->reload_source_id = 0;
+        _this->reload_config_file();
+        return G_SOURCE_REMOVE;
+    }
+
+    bool ConfigManager::reload_config_file() {
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *contents = NULL;
+        gsize length;
+
+        if (!g_file_get_contents(config_file_path.c_str(), &contents, &length, &error)) {
+            g_warning("Could not read config file %s: %s", config_file_path.c_str(), error->message);
+            return false;
+        }
+        if (is_known_contents(contents, length)) {
+            g_debug("Config file did not change (or we wrote it); not reloading");
+            return true;
+        }
+        if (!apply_config_data(contents, length)) {
+            g_warning("Config file is invalid; keeping the current config");
+            return false;
+        }
+        g_info("Reloaded config file %s", config_file_path.c_str());
+        return true;
+    }
+
+    bool ConfigManager::apply_config_data(const gchar *data, gsize length) {
+        ConfigManager staging;
+        staging.config_file_path = config_file_path;
+        if (!staging.parse_config_data(data, length)) {
+            return false;
+        }
+        file_contents.assign(data, length);
+        if (reload_receiver) {
+            reload_receiver->begin_batch();
+        }
+        apply_staged_config(staging);
+        if (reload_receiver) {
+            reload_receiver->end_batch();
+        }
+        return true;
+    }
+
+    // Only the differences between the current config and |staging| are
+    // applied. Commands are matched by name; unchanged commands are left
+    // alone, so they keep their ID, their timeout and their activated state.
+    void ConfigManager::apply_staged_config(ConfigManager &staging) {
+        for (const auto &setting : reloadable_settings) {
+            bool old_value = this->*setting.field;
+            if (old_value == staging.*setting.field) {
+                continue;
+            }
+            this->*setting.field = staging.*setting.field;
+            g_autoptr(GVariant) old_variant = g_variant_new_boolean(old_value);
+            if (reload_receiver) {
+                reload_receiver->receive(Event::config_changed(setting.property, old_variant));
+            }
+        }
+        if (
+            enable_dbus != staging.enable_dbus
+            || cpu_pressure_trigger != staging.cpu_pressure_trigger
+            || io_pressure_trigger != staging.io_pressure_trigger
+            || pressure_use_cgroup != staging.pressure_use_cgroup
+        ) {
+            g_warning("Some settings will only take effect after restarting");
+        }
+
+        unordered_map<string, shared_ptr<Command>> current_by_name;
+        for (shared_ptr<Command> cmd : get_all_commands()) {
+            current_by_name.emplace(cmd->name, cmd);
+        }
+        vector<shared_ptr<Command>> added_cmds;
+        for (shared_ptr<Command> staged_cmd : staging.get_all_commands()) {
+            unordered_map<string, shared_ptr<Command>>::iterator it =
+                current_by_name.find(staged_cmd->name);
+            if (it == current_by_name.end()) {
+                added_cmds.push_back(staged_cmd);
+                continue;
+            }
+            apply_staged_command(it->second, *staged_cmd);
+            current_by_name.erase(it);
+        }
+        // Whatever is left over was removed from the file
+        for (const auto &p : current_by_name) {
+            shared_ptr<Command> cmd = p.second;
+            g_debug("Action '%s' was removed", cmd->name.c_str());
+            remove_command(cmd->id);
+            if (reload_receiver) {
+                reload_receiver->receive(Event::command_removed(cmd));
+            }
+        }
+        for (shared_ptr<Command> cmd : added_cmds) {
+            g_debug("Action '%s' was added", cmd->name.c_str());
+            cmd->id = 0;
+            add_command(cmd);
+            if (reload_receiver) {
+                reload_receiver->receive(Event::command_added(cmd));
+            }
+        }
+    }
+
+    void ConfigManager::apply_staged_command(shared_ptr<Command> cmd, Command &staged_cmd) {
+        if (
+            cmd->trigger != staged_cmd.trigger
+            || cmd->timeout_ms != staged_cmd.timeout_ms
+        ) {
+            g_autoptr(GVariant) old_value = g_variant_new_int32(cmd->trigger);
+            cmd->trigger = staged_cmd.trigger;
+            cmd->timeout_ms = staged_cmd.timeout_ms;
+            if (reload_receiver) {
+                reload_receiver->receive(Event::command_changed(cmd, PROPERTY_TRIGGER, old_value));
+            }
+        }
+        if (g_strcmp0(get_action_str(cmd->activation_action), get_action_str(staged_cmd.activation_action)) != 0) {
+            g_autoptr(GVariant) old_value = g_variant_new_string(get_action_str(cmd->activation_action));
+            cmd->activation_action = std::move(staged_cmd.activation_action);
+            if (reload_receiver) {
+                reload_receiver->receive(Event::command_changed(cmd, PROPERTY_EXEC, old_value));
+            }
+        }
+        if (g_strcmp0(get_action_str(cmd->deactivation_action), get_action_str(staged_cmd.deactivation_action)) != 0) {
+            g_autoptr(GVariant) old_value = g_variant_new_string(get_action_str(cmd->deactivation_action));
+            cmd->deactivation_action = std::move(staged_cmd.deactivation_action);
+            if (reload_receiver) {
+                reload_receiver->receive(Event::command_changed(cmd, PROPERTY_RESUME_EXEC, old_value));
+            }
+        }
+        g_autofree gchar *old_inhibited_by = cmd->get_inhibited_by_str();
+        g_autofree gchar *new_inhibited_by = staged_cmd.get_inhibited_by_str();
+        if (g_strcmp0(old_inhibited_by, new_inhibited_by) != 0) {
+            g_autoptr(GVariant) old_value = g_variant_new_string(old_inhibited_by);
+            cmd->set_inhibited_by_from_str(new_inhibited_by, NULL);
+            if (reload_receiver) {
+                reload_receiver->receive(Event::command_changed(cmd, PROPERTY_INHIBITED_BY, old_value));
+            }
+        }
+    }
 }
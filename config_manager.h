@@ -1,10 +1,13 @@
 #ifndef _CONFIG_MANAGER_H_
 #define _CONFIG_MANAGER_H_
 
+#include <deque>
 #include <string>
 #include <memory>
 #include <unordered_map>
+#include <utility>
 
+#include <gio/gio.h>
 #include <glib.h>
 
 #include "command.h"
@@ -12,12 +15,17 @@
 #include "map.h"
 
 using std::char_traits;
+using std::deque;
+using std::pair;
 using std::string;
 using std::shared_ptr;
 using std::unique_ptr;
 using std::unordered_map;
 
 namespace Xidlechain {
+    class EventReceiver;
+    struct ConfigSaveState;
+
     using CommandMapValues =
         Map<
             unordered_map<int, shared_ptr<Command>>::iterator,
@@ -33,15 +41,62 @@ namespace Xidlechain {
         unordered_map<int, shared_ptr<Command>> id_to_command;
         int command_id_counter = 0;
         string config_file_path;
+        // The contents of the config file which correspond to the current
+        // settings, i.e. the ones we last parsed or saved. Our changes are
+        // merged into the file relative to these.
+        string file_contents;
+        // Contents which the file may still show while our writes land,
+        // tagged with the generation of the write which made us expect
+        // them. The settings already match these, so reloads of them are
+        // ignored. Entries are dropped once a later write completes.
+        deque<pair<guint64, string>> known_contents;
+        guint64 write_generation = 0;
+        GFileMonitor *file_monitor = nullptr;
+        guint reload_source_id = 0;
+        EventReceiver *reload_receiver = nullptr;
+        // Saves are coalesced: a write happens once no further changes
+        // have been requested for save_delay_ms, and only one write is
+        // in flight at any time.
+        static constexpr guint save_delay_ms = 500;
+        guint save_source_id = 0;
+        bool save_pending = false;
+        bool save_in_progress = false;
+        GCancellable *save_cancellable = g_cancellable_new();
+        // Shared with the write threads
+        shared_ptr<ConfigSaveState> save_state = new_save_state();
+        guint64 saves_requested = 0;
+        guint64 saves_performed = 0;
 
         bool parse_main_section(GKeyFile *key_file, gchar *group);
         bool parse_action_section(GKeyFile *key_file, gchar *group);
+        bool parse_config_data(const gchar *data, gsize length);
+        bool is_known_contents(const gchar *contents, gsize length) const;
+        void forget_known_contents(guint64 generation);
+        bool serialize_config(string &data, bool &merged_edit);
+        bool apply_config_data(const gchar *data, gsize length);
+        static shared_ptr<ConfigSaveState> new_save_state();
         void save_config_to_file();
         static gboolean static_save_config_to_file(gpointer user_data);
+        static void static_on_config_saved(GObject *source_object, GAsyncResult *res, gpointer user_data);
+        void apply_staged_config(ConfigManager &staging);
+        void apply_staged_command(shared_ptr<Command> cmd, Command &staged_cmd);
+        static void static_on_file_changed(
+            GFileMonitor *monitor,
+            GFile *file,
+            GFile *other_file,
+            GFileMonitorEvent event_type,
+            gpointer user_data
+        );
+        static gboolean static_reload_config_file(gpointer user_data);
 
         template<Command::Trigger trigger>
         FilteredCommands get_commands();
     public:
+        ConfigManager() = default;
+        ~ConfigManager();
+        ConfigManager(const ConfigManager&) = delete;
+        ConfigManager& operator=(const ConfigManager&) = delete;
+
         CommandMapValues get_all_commands();
         FilteredCommands get_timeout_commands();
         FilteredCommands get_sleep_commands();
@@ -50,6 +105,9 @@ namespace Xidlechain {
         bool ignore_audio = false;
         bool set_ignore_audio(bool value);
 
+        bool ignore_fullscreen = false;
+        bool set_ignore_fullscreen(bool value);
+
         bool wait_before_sleep = true;
         bool set_wait_before_sleep(bool value);
 
@@ -65,28 +123,43 @@ namespace Xidlechain {
         bool enable_dbus = true;
         bool set_enable_dbus(bool value);
 
+        // PSI trigger strings, e.g. "some 150000 1000000". Empty if unset.
+        string cpu_pressure_trigger;
+        bool set_cpu_pressure_trigger(const char *value);
+
+        string io_pressure_trigger;
+        bool set_io_pressure_trigger(const char *value);
+
+        bool pressure_use_cgroup = false;
+        bool set_pressure_use_cgroup(bool value);
+
         bool parse_config_file(const string &filename);
+        // Watches the config file for changes made outside of xidlechain.
+        // When it changes, only the differences are applied, and the
+        // corresponding CONFIG_CHANGED, COMMAND_ADDED, COMMAND_REMOVED
+        // and COMMAND_CHANGED events are sent to |receiver|.
+        bool watch_config_file(EventReceiver *receiver);
+        // Rereads the config file and applies the differences.
+        // Returns false if the file could not be read or is invalid.
+        bool reload_config_file();
+        // Schedules the config to be written to the config file.
+        // The file is written atomically from a worker thread.
         void save_config_to_file_async();
+        // Synchronously writes a save which is scheduled, after waiting
+        // for the one which is being written (if any).
+        void flush_pending_save();
+        guint64 get_saves_requested() const { return saves_requested; }
+        guint64 get_saves_performed() const { return saves_performed; }
         shared_ptr<Command> lookup_command(int cmd_id);
         bool set_command_name(Command &cmd, const char *val);
         bool set_command_trigger(Command &cmd, const char *val);
         bool set_command_activation_action(Command &cmd, const char *val);
         bool set_command_deactivation_action(Command &cmd, const char *val);
+        bool set_command_inhibited_by(Command &cmd, const char *val);
         int add_command(unique_ptr<Command> &&cmd);
         int add_command(shared_ptr<Command> cmd);
         bool remove_command(int cmd_id);
     };
-
-    struct ConfigChangeInfo {
-        const gchar *name;
-        GVariant *old_value;
-    };
-    struct CommandChangeInfo: public ConfigChangeInfo {
-        shared_ptr<Command> cmd;
-    };
-    struct RemovedCommandInfo {
-        shared_ptr<Command> cmd;
-    };
 }
 
 #endif
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <gio/gio.h>
@@ -8,7 +13,10 @@
 #include "app.h"
 #include "config_manager.h"
 #include "dbus_request_handler.h"
+#include "event_manager.h"
 #include "event_receiver.h"
+#include "service_notifier.h"
+#include "startup_timeline.h"
 #include "xidlechain_action_generated.h"
 #include "xidlechain_generated.h"
 
@@ -16,6 +24,9 @@ using std::abort;
 using std::make_shared;
 using std::memcpy;
 using std::sscanf;
+using std::string;
+using std::unordered_map;
+using std::unordered_set;
 using std::vector;
 
 template<typename T>
@@ -25,32 +36,64 @@ class VTableReplacer {
         return &custom_vtable;
     }
 public:
+    using GetPropertiesFunc = GVariant *(*)(GDBusInterfaceSkeleton*);
     static GDBusInterfaceSetPropertyFunc original_set_property_func;
-    static void replace_set_property_method(T *object, GDBusInterfaceSetPropertyFunc new_set_property_func) {
+    static GDBusInterfaceGetPropertyFunc original_get_property_func;
+    static GetPropertiesFunc original_get_properties_func;
+    // If |new_get_property_func| is null, the autogenerated one is kept
+    static void replace_property_methods(
+        T *object,
+        GDBusInterfaceSetPropertyFunc new_set_property_func,
+        GDBusInterfaceGetPropertyFunc new_get_property_func = nullptr
+    ) {
         GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON(object);
         GDBusInterfaceSkeletonClass *skeleton_class = G_DBUS_INTERFACE_SKELETON_GET_CLASS(skeleton);
         if (skeleton_class->get_vtable == get_custom_vtable) {
-            // We already replaced the set_property method for this clas
+            // We already replaced the property methods for this class
             return;
         }
         GDBusInterfaceVTable *vtable = skeleton_class->get_vtable(skeleton);
         original_set_property_func = vtable->set_property;
+        original_get_property_func = vtable->get_property;
         // The autogenerated vtable is const, so we have to create a new one
         memcpy(&custom_vtable, vtable, sizeof(GDBusInterfaceVTable));
         custom_vtable.set_property = new_set_property_func;
+        if (new_get_property_func) {
+            custom_vtable.get_property = new_get_property_func;
+        }
         skeleton_class->get_vtable = get_custom_vtable;
     }
+    // get_properties() is what GetManagedObjects and InterfacesAdded use.
+    // It reads the stored values directly instead of going through the
+    // vtable, so computed properties have to be filled in here as well.
+    static void replace_get_properties(T *object, GetPropertiesFunc new_get_properties_func) {
+        GDBusInterfaceSkeletonClass *skeleton_class = G_DBUS_INTERFACE_SKELETON_GET_CLASS(object);
+        if (skeleton_class->get_properties == new_get_properties_func) {
+            return;
+        }
+        original_get_properties_func = skeleton_class->get_properties;
+        skeleton_class->get_properties = new_get_properties_func;
+    }
 };
 
 template<>
 GDBusInterfaceSetPropertyFunc VTableReplacer<CXidlechain>::original_set_property_func = nullptr;
 
+template<>
+GDBusInterfaceGetPropertyFunc VTableReplacer<CXidlechain>::original_get_property_func = nullptr;
+
 template<>
 GDBusInterfaceVTable VTableReplacer<CXidlechain>::custom_vtable{};
 
 template<>
 GDBusInterfaceSetPropertyFunc VTableReplacer<CXidlechainAction>::original_set_property_func = nullptr;
 
+template<>
+GDBusInterfaceGetPropertyFunc VTableReplacer<CXidlechainAction>::original_get_property_func = nullptr;
+
+template<>
+VTableReplacer<CXidlechainAction>::GetPropertiesFunc VTableReplacer<CXidlechainAction>::original_get_properties_func = nullptr;
+
 template<>
 GDBusInterfaceVTable VTableReplacer<CXidlechainAction>::custom_vtable{};
 
@@ -103,34 +146,39 @@ namespace Xidlechain {
         // Otherwise, we return true.
         bool success = false;
         g_autoptr(GVariant) old_value = NULL;
-        ConfigChangeInfo cfg_info;
-        cfg_info.name = property_name;
+        PropertyId property = property_id_from_name(property_name);
         if (
-            g_strcmp0(property_name, "IgnoreAudio") == 0
+            property == PROPERTY_IGNORE_AUDIO
             && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)
         ) {
             old_value = g_variant_new_boolean(cfg->ignore_audio);
             success = cfg->set_ignore_audio(g_variant_get_boolean(value));
         } else if (
-            g_strcmp0(property_name, "WaitBeforeSleep") == 0
+            property == PROPERTY_IGNORE_FULLSCREEN
+            && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)
+        ) {
+            old_value = g_variant_new_boolean(cfg->ignore_fullscreen);
+            success = cfg->set_ignore_fullscreen(g_variant_get_boolean(value));
+        } else if (
+            property == PROPERTY_WAIT_BEFORE_SLEEP
             && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)
         ) {
             old_value = g_variant_new_boolean(cfg->wait_before_sleep);
             success = cfg->set_wait_before_sleep(g_variant_get_boolean(value));
         } else if (
-            g_strcmp0(property_name, "DisableAutomaticDPMSActivation") == 0
+            property == PROPERTY_DISABLE_AUTOMATIC_DPMS_ACTIVATION
             && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)
         ) {
             old_value = g_variant_new_boolean(cfg->disable_automatic_dpms_activation);
             success = cfg->set_disable_automatic_dpms_activation(g_variant_get_boolean(value));
         } else if (
-            g_strcmp0(property_name, "DisableScreensaver") == 0
+            property == PROPERTY_DISABLE_SCREENSAVER
             && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)
         ) {
             old_value = g_variant_new_boolean(cfg->disable_screensaver);
             success = cfg->set_disable_screensaver(g_variant_get_boolean(value));
         } else if (
-            g_strcmp0(property_name, "WakeResumesActivity") == 0
+            property == PROPERTY_WAKE_RESUMES_ACTIVITY
             && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)
         ) {
             old_value = g_variant_new_boolean(cfg->wake_resumes_activity);
@@ -146,8 +194,7 @@ namespace Xidlechain {
         }
 
         g_assert_nonnull(old_value);
-        cfg_info.old_value = old_value;
-        event_receiver->receive(EVENT_CONFIG_CHANGED, &cfg_info);
+        forward(Event::config_changed(property, old_value));
         cfg->save_config_to_file_async();
         return TRUE;
     }
@@ -183,6 +230,114 @@ namespace Xidlechain {
         );
     }
 
+    bool DbusRequestHandler::parse_action_id(const gchar *object_path, int &action_id) {
+        g_autofree gchar *format_str = g_strdup_printf("%s/action/%%d", DBUS_OBJECT_BASE_PATH);
+        if (sscanf(object_path, format_str, &action_id) != 1) {
+            g_warning("Could not parse action ID from DBus object path: %s", object_path);
+            return false;
+        }
+        return true;
+    }
+
+    static GVariant *histogram_to_variant(const Histogram &histogram) {
+        return g_variant_new_fixed_array(
+            G_VARIANT_TYPE_UINT32,
+            histogram.buckets.data(),
+            histogram.buckets.size(),
+            sizeof(histogram.buckets[0])
+        );
+    }
+
+    static GVariant *metrics_to_variant(const ActionMetrics *metrics) {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+        if (!metrics) {
+            // The action has no command
+            return g_variant_builder_end(&builder);
+        }
+        g_variant_builder_add(&builder, "{sv}", "Runs", g_variant_new_uint64(metrics->num_runs));
+        g_variant_builder_add(&builder, "{sv}", "Failures", g_variant_new_uint64(metrics->num_failures));
+        g_variant_builder_add(&builder, "{sv}", "Timeouts", g_variant_new_uint64(metrics->num_timeouts));
+        g_variant_builder_add(&builder, "{sv}", "Running", g_variant_new_uint32(metrics->num_running));
+        g_variant_builder_add(&builder, "{sv}", "LastExitStatus", g_variant_new_int32(metrics->last_exit_status));
+        g_variant_builder_add(&builder, "{sv}", "SpawnLatency", histogram_to_variant(metrics->spawn_latency_us));
+        g_variant_builder_add(&builder, "{sv}", "Duration", histogram_to_variant(metrics->duration_us));
+        return g_variant_builder_end(&builder);
+    }
+
+    GVariant *DbusRequestHandler::static_get_property_func_for_action(
+        GDBusConnection *connection,
+        const gchar *sender,
+        const gchar *object_path,
+        const gchar *interface_name,
+        const gchar *property_name,
+        GError **error,
+        gpointer user_data
+    ) {
+        GVariant *value = INSTANCE->handle_get_property_for_action(object_path, property_name);
+        if (value) {
+            return value;
+        }
+        return VTableReplacer<CXidlechainAction>::original_get_property_func(
+            connection,
+            sender,
+            object_path,
+            interface_name,
+            property_name,
+            error,
+            user_data
+        );
+    }
+
+    // The metrics change whenever a command runs, so rather than keeping
+    // the exported properties up to date, they are read from the Command
+    // on each Get or GetAll, and whenever all properties are collected
+    // (see static_get_properties_func_for_action()). Returns null for the
+    // other properties, which are handled by the autogenerated function.
+    GVariant *DbusRequestHandler::handle_get_property_for_action(
+        const gchar *object_path,
+        const gchar *property_name
+    ) {
+        bool exec_metrics = g_strcmp0(property_name, "ExecMetrics") == 0;
+        if (!exec_metrics && g_strcmp0(property_name, "ResumeExecMetrics") != 0) {
+            return NULL;
+        }
+        int action_id;
+        if (!parse_action_id(object_path, action_id)) {
+            return NULL;
+        }
+        shared_ptr<Command> cmd = cfg->lookup_command(action_id);
+        if (!cmd) {
+            g_warning("Action ID not found: %d", action_id);
+            return NULL;
+        }
+        const unique_ptr<Command::Action> &action =
+            exec_metrics ? cmd->activation_action : cmd->deactivation_action;
+        return metrics_to_variant(action ? action->metrics.get() : NULL);
+    }
+
+    GVariant *DbusRequestHandler::static_get_properties_func_for_action(GDBusInterfaceSkeleton *skeleton) {
+        g_autoptr(GVariant) properties = g_variant_ref_sink(
+            VTableReplacer<CXidlechainAction>::original_get_properties_func(skeleton));
+        GDBusObject *object = g_dbus_interface_get_object(G_DBUS_INTERFACE(skeleton));
+        if (!object || !INSTANCE) {
+            return g_variant_ref(properties);
+        }
+        const gchar *object_path = g_dbus_object_get_object_path(object);
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+        GVariantIter iter;
+        const gchar *name;
+        GVariant *value;
+        g_variant_iter_init(&iter, properties);
+        while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+            GVariant *computed = INSTANCE->handle_get_property_for_action(object_path, name);
+            g_variant_builder_add(&builder, "{sv}", name, computed ? computed : value);
+            g_variant_unref(value);
+        }
+        return g_variant_builder_end(&builder);
+    }
+
     gboolean DbusRequestHandler::handle_set_property_for_action(
         const gchar *object_path,
         const gchar *property_name,
@@ -190,9 +345,7 @@ namespace Xidlechain {
         GError **error
     ) {
         int action_id;
-        g_autofree gchar *format_str = g_strdup_printf("%s/action/%%d", DBUS_OBJECT_BASE_PATH);
-        if (sscanf(object_path, format_str, &action_id) != 1) {
-            g_warning("Could not parse action ID from DBus object path: %s", object_path);
+        if (!parse_action_id(object_path, action_id)) {
             g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "Internal error: could not parse action ID");
             return FALSE;
         }
@@ -202,55 +355,83 @@ namespace Xidlechain {
             g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "Internal error: could not find action ID");
             return FALSE;
         }
-        bool success = false;
-        CommandChangeInfo info;
-        info.cmd = cmd;
-        info.name = property_name;
-        g_autoptr(GVariant) old_value = NULL;
+        PropertyId property = property_id_from_name(property_name);
         if (
-            g_strcmp0(property_name, "Name") == 0
-            && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
-        ) {
-            old_value = g_variant_new_string(cmd->name.c_str());
-            success = cfg->set_command_name(*cmd, g_variant_get_string(value, NULL));
-        } else if (
-            g_strcmp0(property_name, "Trigger") == 0
-            && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
-        ) {
-            old_value = g_variant_new_int32(cmd->trigger);
-            success = cfg->set_command_trigger(*cmd, g_variant_get_string(value, NULL));
-        } else if (
-            g_strcmp0(property_name, "Exec") == 0
-            && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
-        ) {
-            old_value = g_variant_new_string(
-                cmd->activation_action ? cmd->activation_action->get_cmd_str() : ""
-            );
-            success = cfg->set_command_activation_action(*cmd, g_variant_get_string(value, NULL));
-        } else if (
-            g_strcmp0(property_name, "ResumeExec") == 0
-            && g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
+            !is_action_property(property)
+            || !g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
         ) {
-            old_value = g_variant_new_string(
-                cmd->deactivation_action ? cmd->deactivation_action->get_cmd_str() : ""
-            );
-            success = cfg->set_command_deactivation_action(*cmd, g_variant_get_string(value, NULL));
-        } else {
             // Invalid property name or value type; let the autogenerated
             // function handle the error.
             return TRUE;
         }
-        if (!success) {
+        if (
+            property == PROPERTY_NAME
+            && is_name_taken(g_variant_get_string(value, NULL), action_id)
+        ) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "An action with this name already exists");
+            return FALSE;
+        }
+        g_autoptr(GVariant) old_value = NULL;
+        if (!set_action_property(*cmd, property, g_variant_get_string(value, NULL), &old_value)) {
             g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid value for property %s", property_name);
             return FALSE;
         }
-        g_assert_nonnull(old_value);
-        info.old_value = old_value;
-        event_receiver->receive(EVENT_COMMAND_CHANGED, &info);
+        forward(Event::command_changed(cmd, property, old_value));
         cfg->save_config_to_file_async();
         return TRUE;
     }
 
+    // The value of one of the properties of an [Action ...] section, in
+    // the form which the COMMAND_CHANGED event expects as the old value
+    static GVariant *get_action_property(const Command &cmd, PropertyId property) {
+        switch (property) {
+        case PROPERTY_NAME:
+            return g_variant_ref_sink(g_variant_new_string(cmd.name.c_str()));
+        case PROPERTY_TRIGGER:
+            return g_variant_ref_sink(g_variant_new_int32(cmd.trigger));
+        case PROPERTY_EXEC:
+            return g_variant_ref_sink(g_variant_new_string(
+                cmd.activation_action ? cmd.activation_action->get_cmd_str() : ""
+            ));
+        case PROPERTY_RESUME_EXEC:
+            return g_variant_ref_sink(g_variant_new_string(
+                cmd.deactivation_action ? cmd.deactivation_action->get_cmd_str() : ""
+            ));
+        case PROPERTY_INHIBITED_BY:
+            return g_variant_ref_sink(g_variant_new_take_string(cmd.get_inhibited_by_str()));
+        default:
+            g_assert_not_reached();
+            return NULL;
+        }
+    }
+
+    // Sets one of the properties of an [Action ...] section from its
+    // D-Bus value. |old_value| is set to the previous value, in the form
+    // which the COMMAND_CHANGED event expects.
+    bool DbusRequestHandler::set_action_property(
+        Command &cmd,
+        PropertyId property,
+        const char *value,
+        GVariant **old_value
+    ) {
+        *old_value = get_action_property(cmd, property);
+        switch (property) {
+        case PROPERTY_NAME:
+            return cfg->set_command_name(cmd, value);
+        case PROPERTY_TRIGGER:
+            return cfg->set_command_trigger(cmd, value);
+        case PROPERTY_EXEC:
+            return cfg->set_command_activation_action(cmd, value);
+        case PROPERTY_RESUME_EXEC:
+            return cfg->set_command_deactivation_action(cmd, value);
+        case PROPERTY_INHIBITED_BY:
+            return cfg->set_command_inhibited_by(cmd, value);
+        default:
+            g_assert_not_reached();
+            return false;
+        }
+    }
+
     gboolean DbusRequestHandler::static_on_add_action(
         CXidlechain *object,
         GDBusMethodInvocation *invocation,
@@ -296,8 +477,12 @@ namespace Xidlechain {
             g_dbus_method_invocation_return_dbus_error(invocation, DBUS_ERROR_NAME, error->message);
             return;
         }
+        if (is_name_taken(cmd->name, -1)) {
+            g_dbus_method_invocation_return_dbus_error(invocation, DBUS_ERROR_NAME, "duplicate name");
+            return;
+        }
         int id = cfg->add_command(cmd);
-        event_receiver->receive(EVENT_COMMAND_ADDED, (gpointer)(long)id);
+        forward(Event::command_added(cmd));
         cfg->save_config_to_file_async();
 
         add_action_to_object_manager(*cmd);
@@ -327,8 +512,7 @@ namespace Xidlechain {
             return;
         }
         cfg->remove_command(id);
-        RemovedCommandInfo info = {cmd};
-        event_receiver->receive(EVENT_COMMAND_REMOVED, &info);
+        forward(Event::command_removed(cmd));
         cfg->save_config_to_file_async();
 
         g_autofree gchar *path = g_strdup_printf("%s/action/%d", DBUS_OBJECT_BASE_PATH, id);
@@ -338,6 +522,269 @@ namespace Xidlechain {
         c_xidlechain_complete_remove_action(object, invocation);
     }
 
+    // One entry of an ApplyChanges call, once it has been validated
+    struct StagedChange {
+        enum Operation {
+            ADD,
+            SET,
+            REMOVE,
+        } operation;
+        int id;
+        // The action which is changed or removed
+        shared_ptr<Command> cmd;
+        // The action as it will look after the change. For ADD, this is
+        // the new action itself.
+        shared_ptr<Command> staged;
+        // Owned; unref'd once the call is complete
+        GVariant *properties;
+        string error;
+    };
+
+    gboolean DbusRequestHandler::static_on_apply_changes(
+        CXidlechain *object,
+        GDBusMethodInvocation *invocation,
+        GVariant *changes,
+        gpointer user_data
+    ) {
+        g_debug("Applying %zu changes", g_variant_n_children(changes));
+        DbusRequestHandler *_this = (DbusRequestHandler*)user_data;
+        _this->on_apply_changes(object, invocation, changes);
+        return TRUE;
+    }
+
+    // Every change is validated against a staged copy of its action
+    // before any of them is applied, so that a batch with a single
+    // invalid change leaves the config alone. The EventManager sees the
+    // whole batch at once, and the config is saved once.
+    void DbusRequestHandler::on_apply_changes(
+        CXidlechain *object,
+        GDBusMethodInvocation *invocation,
+        GVariant *changes
+    ) {
+        vector<StagedChange> staged_changes(g_variant_n_children(changes));
+        unordered_set<int> changed_ids;
+        bool valid = true;
+        for (size_t i = 0; i < staged_changes.size(); i++) {
+            StagedChange &change = staged_changes[i];
+            const gchar *operation;
+            g_variant_get_child(changes, i, "(i&s@a{sv})", &change.id, &operation, &change.properties);
+            if (!stage_change(change.id, operation, change.properties, change)) {
+                valid = false;
+            } else if (
+                change.operation != StagedChange::ADD
+                && !changed_ids.insert(change.id).second
+            ) {
+                change.error = "action is changed more than once";
+                valid = false;
+            }
+        }
+        if (valid) {
+            valid = check_names(staged_changes);
+        }
+
+        if (valid) {
+            event_receiver->begin_batch();
+            for (StagedChange &change : staged_changes) {
+                apply_change(change);
+            }
+            event_receiver->end_batch();
+            if (!staged_changes.empty()) {
+                cfg->save_config_to_file_async();
+            }
+        }
+
+        GVariantBuilder results;
+        g_variant_builder_init(&results, G_VARIANT_TYPE("a(is)"));
+        for (StagedChange &change : staged_changes) {
+            g_variant_builder_add(&results, "(is)", change.id, change.error.c_str());
+            g_variant_unref(change.properties);
+        }
+        c_xidlechain_complete_apply_changes(object, invocation, valid, g_variant_builder_end(&results));
+    }
+
+    // Fills in |change|, or sets its error and returns false if the
+    // change is invalid.
+    bool DbusRequestHandler::stage_change(
+        int id,
+        const gchar *operation,
+        GVariant *properties,
+        StagedChange &change
+    ) {
+        if (g_strcmp0(operation, "add") == 0) {
+            change.operation = StagedChange::ADD;
+            change.staged = make_shared<Command>();
+        } else if (g_strcmp0(operation, "set") == 0) {
+            change.operation = StagedChange::SET;
+        } else if (g_strcmp0(operation, "remove") == 0) {
+            change.operation = StagedChange::REMOVE;
+        } else {
+            change.error = string("unknown operation ") + operation;
+            return false;
+        }
+        if (change.operation != StagedChange::ADD) {
+            change.cmd = cfg->lookup_command(id);
+            if (!change.cmd) {
+                change.error = "action not found";
+                return false;
+            }
+        }
+        if (change.operation == StagedChange::REMOVE) {
+            return true;
+        }
+        if (change.operation == StagedChange::SET) {
+            // Copy the action through its string properties, which is
+            // how it would be saved and parsed again
+            Command &cmd = *change.cmd;
+            change.staged = make_shared<Command>();
+            change.staged->id = cmd.id;
+            g_autofree gchar *trigger = cmd.get_trigger_str();
+            g_autofree gchar *inhibited_by = cmd.get_inhibited_by_str();
+            const char *values[PROPERTY_COUNT] = {};
+            values[PROPERTY_NAME] = cmd.name.c_str();
+            values[PROPERTY_TRIGGER] = trigger;
+            values[PROPERTY_EXEC] = cmd.activation_action ? cmd.activation_action->get_cmd_str() : "";
+            values[PROPERTY_RESUME_EXEC] = cmd.deactivation_action ? cmd.deactivation_action->get_cmd_str() : "";
+            values[PROPERTY_INHIBITED_BY] = inhibited_by;
+            for (int i = PROPERTY_NAME; i < PROPERTY_COUNT; i++) {
+                g_autoptr(GVariant) old_value = NULL;
+                if (!set_action_property(*change.staged, (PropertyId)i, values[i], &old_value)) {
+                    change.error = "internal error: could not copy the action";
+                    return false;
+                }
+            }
+        }
+
+        GVariantIter iter;
+        const gchar *name;
+        GVariant *value;
+        bool has_name = false;
+        g_variant_iter_init(&iter, properties);
+        while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+            g_autoptr(GVariant) owned_value = value;
+            PropertyId property = property_id_from_name(name);
+            if (!is_action_property(property)) {
+                change.error = string("unknown property ") + name;
+                return false;
+            }
+            if (!g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+                change.error = string("property ") + name + " must be a string";
+                return false;
+            }
+            g_autoptr(GVariant) old_value = NULL;
+            if (!set_action_property(*change.staged, property, g_variant_get_string(value, NULL), &old_value)) {
+                change.error = string("invalid value for property ") + name;
+                return false;
+            }
+            has_name = has_name || property == PROPERTY_NAME;
+        }
+        if (change.operation == StagedChange::ADD && !has_name) {
+            change.error = "a new action needs a Name";
+            return false;
+        }
+        g_autoptr(GError) error = NULL;
+        if (!change.staged->is_valid(&error)) {
+            change.error = error->message;
+            return false;
+        }
+        return true;
+    }
+
+    // Checks that every action still has a name of its own once the
+    // whole batch is applied, so that one action can take the name which
+    // another one gives up in the same batch. Sets the error of each
+    // change which would duplicate a name.
+    bool DbusRequestHandler::check_names(vector<StagedChange> &staged_changes) {
+        unordered_set<int> changed_ids;
+        for (const StagedChange &change : staged_changes) {
+            if (change.operation != StagedChange::ADD) {
+                changed_ids.insert(change.id);
+            }
+        }
+        // Names of the actions which the batch leaves alone
+        unordered_map<string, int> names;
+        for (shared_ptr<Command> cmd : cfg->get_all_commands()) {
+            if (changed_ids.count(cmd->id) == 0) {
+                names.emplace(cmd->name, cmd->id);
+            }
+        }
+        bool valid = true;
+        for (StagedChange &change : staged_changes) {
+            if (change.operation == StagedChange::REMOVE) {
+                continue;
+            }
+            if (!names.emplace(change.staged->name, change.id).second) {
+                change.error = "an action named " + change.staged->name + " already exists";
+                valid = false;
+            }
+        }
+        return valid;
+    }
+
+    bool DbusRequestHandler::is_name_taken(const string &name, int except_id) {
+        for (shared_ptr<Command> cmd : cfg->get_all_commands()) {
+            if (cmd->id != except_id && cmd->name == name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Applies a validated change, and exports it over D-Bus
+    void DbusRequestHandler::apply_change(StagedChange &change) {
+        switch (change.operation) {
+        case StagedChange::ADD:
+            change.id = cfg->add_command(change.staged);
+            forward(Event::command_added(change.staged));
+            add_action_to_object_manager(*change.staged);
+            break;
+        case StagedChange::SET: {
+            // Swap in the staged copy in one step, and only then send the
+            // usual COMMAND_CHANGED event for each property, so that no
+            // receiver sees the action with only some of the properties
+            // set
+            GVariant *old_values[PROPERTY_COUNT] = {};
+            GVariantIter iter;
+            const gchar *name;
+            g_variant_iter_init(&iter, change.properties);
+            while (g_variant_iter_next(&iter, "{&sv}", &name, NULL)) {
+                PropertyId property = property_id_from_name(name);
+                if (!old_values[property]) {
+                    old_values[property] = get_action_property(*change.cmd, property);
+                }
+            }
+            // Keep the actions which weren't set, along with their metrics
+            if (!old_values[PROPERTY_EXEC]) {
+                change.staged->activation_action = std::move(change.cmd->activation_action);
+            }
+            if (!old_values[PROPERTY_RESUME_EXEC]) {
+                change.staged->deactivation_action = std::move(change.cmd->deactivation_action);
+            }
+            change.cmd->take_settings(*change.staged);
+            for (int i = PROPERTY_NAME; i < PROPERTY_COUNT; i++) {
+                if (old_values[i]) {
+                    forward(Event::command_changed(change.cmd, (PropertyId)i, old_values[i]));
+                    g_variant_unref(old_values[i]);
+                }
+            }
+            CXidlechainAction *action = lookup_action(change.id);
+            if (action) {
+                set_action_properties(action, *change.cmd);
+                g_object_unref(action);
+            }
+            break;
+        }
+        case StagedChange::REMOVE: {
+            cfg->remove_command(change.id);
+            forward(Event::command_removed(change.cmd));
+            g_autofree gchar *path = g_strdup_printf("%s/action/%d", DBUS_OBJECT_BASE_PATH, change.id);
+            if (!g_dbus_object_manager_server_unexport(object_manager, path)) {
+                g_warning("Command %d was not removed", change.id);
+            }
+            break;
+        }
+        }
+    }
+
     gboolean DbusRequestHandler::static_on_pause(
         CXidlechain *object,
         GDBusMethodInvocation *invocation,
@@ -353,7 +800,7 @@ namespace Xidlechain {
         CXidlechain *object,
         GDBusMethodInvocation *invocation
     ) {
-        event_receiver->receive(EVENT_PAUSED, NULL);
+        forward(Event(EVENT_PAUSED));
         c_xidlechain_set_paused(object, TRUE);
         c_xidlechain_complete_pause(object, invocation);
     }
@@ -373,7 +820,7 @@ namespace Xidlechain {
         CXidlechain *object,
         GDBusMethodInvocation *invocation
     ) {
-        event_receiver->receive(EVENT_UNPAUSED, NULL);
+        forward(Event(EVENT_UNPAUSED));
         c_xidlechain_set_paused(object, FALSE);
         c_xidlechain_complete_unpause(object, invocation);
     }
@@ -384,9 +831,10 @@ namespace Xidlechain {
         const gchar *name
     ) {
         // Export the [Main] section
-        CXidlechain *config_iface = c_xidlechain_skeleton_new();
-        VTableReplacer<CXidlechain>::replace_set_property_method(config_iface, static_set_property_func);
+        config_iface = c_xidlechain_skeleton_new();
+        VTableReplacer<CXidlechain>::replace_property_methods(config_iface, static_set_property_func);
         c_xidlechain_set_ignore_audio(config_iface, cfg->ignore_audio);
+        c_xidlechain_set_ignore_fullscreen(config_iface, cfg->ignore_fullscreen);
         c_xidlechain_set_wait_before_sleep(config_iface, cfg->wait_before_sleep);
         c_xidlechain_set_disable_automatic_dpmsactivation(config_iface, cfg->disable_automatic_dpms_activation);
         c_xidlechain_set_disable_screensaver(config_iface, cfg->disable_screensaver);
@@ -400,6 +848,7 @@ namespace Xidlechain {
         )) {
             g_warning(error->message);
             g_object_unref(config_iface);
+            config_iface = nullptr;
             return;
         }
 
@@ -410,6 +859,7 @@ namespace Xidlechain {
             add_action_to_object_manager(*cmd);
         }
         g_dbus_object_manager_server_set_connection(object_manager, connection);
+        update_state_properties();
 
         // Add handlers for the methods
         g_signal_connect(config_iface,
@@ -420,6 +870,18 @@ namespace Xidlechain {
                          "handle-remove-action",
                          G_CALLBACK(static_on_remove_action),
                          this);
+        g_signal_connect(config_iface,
+                         "handle-apply-changes",
+                         G_CALLBACK(static_on_apply_changes),
+                         this);
+        g_signal_connect(config_iface,
+                         "handle-get-snapshot",
+                         G_CALLBACK(static_on_get_snapshot),
+                         this);
+        g_signal_connect(config_iface,
+                         "handle-get-changes-since",
+                         G_CALLBACK(static_on_get_changes_since),
+                         this);
         g_signal_connect(config_iface,
                          "handle-pause",
                          G_CALLBACK(static_on_pause),
@@ -432,6 +894,198 @@ namespace Xidlechain {
         // config_iface doesn't get unref'd (LEAK)
     }
 
+    // Every config change passes through here on its way to the
+    // EventManager, which is where the generations are kept.
+    void DbusRequestHandler::forward(const Event &event) {
+        change_log.record(event);
+        event_receiver->receive(event);
+    }
+
+    ChangeLog::RuntimeState DbusRequestHandler::get_runtime_state() {
+        ChangeLog::RuntimeState state;
+        state.idle = event_manager->is_idle();
+        state.idle_state_since = event_manager->get_idle_state_since();
+        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
+            if (cmd->is_activated()) {
+                state.activated.push_back(cmd->id);
+            }
+        }
+        // The commands are kept in a hash map
+        std::sort(state.activated.begin(), state.activated.end());
+        state.audio_playing = event_manager->is_audio_playing();
+        state.paused = event_manager->is_paused();
+        state.inhibitors = event_manager->get_active_inhibitors();
+        return state;
+    }
+
+    void DbusRequestHandler::update_state_generation() {
+        change_log.update_state(get_runtime_state());
+    }
+
+    GVariant *DbusRequestHandler::config_to_variant() {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+        const pair<PropertyId, bool> settings[] = {
+            {PROPERTY_IGNORE_AUDIO, cfg->ignore_audio},
+            {PROPERTY_IGNORE_FULLSCREEN, cfg->ignore_fullscreen},
+            {PROPERTY_WAIT_BEFORE_SLEEP, cfg->wait_before_sleep},
+            {PROPERTY_DISABLE_AUTOMATIC_DPMS_ACTIVATION, cfg->disable_automatic_dpms_activation},
+            {PROPERTY_DISABLE_SCREENSAVER, cfg->disable_screensaver},
+            {PROPERTY_WAKE_RESUMES_ACTIVITY, cfg->wake_resumes_activity},
+        };
+        for (const pair<PropertyId, bool> &setting : settings) {
+            g_variant_builder_add(&builder, "{sv}", PROPERTY_NAMES[setting.first],
+                                  g_variant_new_boolean(setting.second));
+        }
+        return g_variant_builder_end(&builder);
+    }
+
+    GVariant *DbusRequestHandler::action_to_variant(Command &cmd) {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add(&builder, "{sv}", "Name", g_variant_new_string(cmd.name.c_str()));
+        g_variant_builder_add(&builder, "{sv}", "Trigger", g_variant_new_take_string(cmd.get_trigger_str()));
+        g_variant_builder_add(&builder, "{sv}", "Exec", g_variant_new_string(
+            cmd.activation_action ? cmd.activation_action->get_cmd_str() : ""));
+        g_variant_builder_add(&builder, "{sv}", "ResumeExec", g_variant_new_string(
+            cmd.deactivation_action ? cmd.deactivation_action->get_cmd_str() : ""));
+        g_variant_builder_add(&builder, "{sv}", "InhibitedBy", g_variant_new_take_string(cmd.get_inhibited_by_str()));
+        return g_variant_builder_end(&builder);
+    }
+
+    GVariant *DbusRequestHandler::state_to_variant(const ChangeLog::RuntimeState &state) {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+        gint64 idle_time_ms = state.idle
+            ? (g_get_monotonic_time() - state.idle_state_since) / 1000 : 0;
+        g_variant_builder_add(&builder, "{sv}", "Idle", g_variant_new_boolean(state.idle));
+        g_variant_builder_add(&builder, "{sv}", "IdleTime", g_variant_new_uint64(idle_time_ms));
+        g_variant_builder_add(&builder, "{sv}", "IdleStateSince", g_variant_new_int64(state.idle_state_since));
+        g_variant_builder_add(&builder, "{sv}", "Activated", g_variant_new_fixed_array(
+            G_VARIANT_TYPE_INT32, state.activated.data(), state.activated.size(), sizeof(int)));
+        g_variant_builder_add(&builder, "{sv}", "AudioPlaying", g_variant_new_boolean(state.audio_playing));
+        g_variant_builder_add(&builder, "{sv}", "Paused", g_variant_new_boolean(state.paused));
+        g_variant_builder_add(&builder, "{sv}", "InhibitedBy",
+                              g_variant_new_take_string(Command::static_get_inhibit_mask_str(state.inhibitors)));
+        return g_variant_builder_end(&builder);
+    }
+
+    // Called by the EventManager after every event. The properties are
+    // updated through a Throttle, so that a burst of events in one main
+    // loop iteration only updates them once, and at most every
+    // STATE_UPDATE_INTERVAL_US, so that flapping inputs (e.g. audio)
+    // don't flood the bus. The skeletons only send PropertiesChanged for
+    // the values which actually changed.
+    void DbusRequestHandler::static_on_state_changed(gpointer user_data) {
+        DbusRequestHandler *_this = (DbusRequestHandler*)user_data;
+        if (_this->object_manager) {
+            _this->state_update_throttle.schedule();
+        }
+    }
+
+    void DbusRequestHandler::static_update_state_properties(gpointer user_data) {
+        DbusRequestHandler *_this = (DbusRequestHandler*)user_data;
+        _this->update_state_properties();
+    }
+
+    void DbusRequestHandler::update_state_properties() {
+        unsigned int inhibitors = event_manager->get_active_inhibitors();
+        bool timeouts_enabled = false;
+        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
+            if ((cmd->get_inhibit_mask() & inhibitors) == 0) {
+                timeouts_enabled = true;
+            }
+            CXidlechainAction *action = lookup_action(cmd->id);
+            if (action) {
+                c_xidlechain_action_set_activated(action, cmd->is_activated());
+                g_object_unref(action);
+            }
+        }
+        c_xidlechain_set_audio_playing(config_iface, event_manager->is_audio_playing());
+        c_xidlechain_set_timeouts_enabled(config_iface, timeouts_enabled);
+        c_xidlechain_set_idle_state_since(config_iface, event_manager->get_idle_state_since());
+    }
+
+    gboolean DbusRequestHandler::static_on_get_snapshot(
+        CXidlechain *object,
+        GDBusMethodInvocation *invocation,
+        gpointer user_data
+    ) {
+        DbusRequestHandler *_this = (DbusRequestHandler*)user_data;
+        _this->on_get_snapshot(object, invocation);
+        return TRUE;
+    }
+
+    void DbusRequestHandler::on_get_snapshot(
+        CXidlechain *object,
+        GDBusMethodInvocation *invocation
+    ) {
+        update_state_generation();
+        GVariantBuilder actions;
+        g_variant_builder_init(&actions, G_VARIANT_TYPE("a{ia{sv}}"));
+        for (shared_ptr<Command> cmd : cfg->get_all_commands()) {
+            g_variant_builder_add(&actions, "{i@a{sv}}", cmd->id, action_to_variant(*cmd));
+        }
+        c_xidlechain_complete_get_snapshot(
+            object,
+            invocation,
+            change_log.get_instance_id().c_str(),
+            change_log.get_generation(),
+            config_to_variant(),
+            g_variant_builder_end(&actions),
+            state_to_variant(change_log.get_state())
+        );
+    }
+
+    gboolean DbusRequestHandler::static_on_get_changes_since(
+        CXidlechain *object,
+        GDBusMethodInvocation *invocation,
+        const gchar *instance,
+        guint64 since,
+        gpointer user_data
+    ) {
+        DbusRequestHandler *_this = (DbusRequestHandler*)user_data;
+        _this->on_get_changes_since(object, invocation, instance, since);
+        return TRUE;
+    }
+
+    void DbusRequestHandler::on_get_changes_since(
+        CXidlechain *object,
+        GDBusMethodInvocation *invocation,
+        const gchar *instance,
+        guint64 since
+    ) {
+        update_state_generation();
+        bool complete = change_log.is_complete(instance, since);
+        GVariantBuilder actions;
+        g_variant_builder_init(&actions, G_VARIANT_TYPE("a{ia{sv}}"));
+        for (shared_ptr<Command> cmd : cfg->get_all_commands()) {
+            if (complete || change_log.action_changed_since(cmd->id, since)) {
+                g_variant_builder_add(&actions, "{i@a{sv}}", cmd->id, action_to_variant(*cmd));
+            }
+        }
+        GVariantBuilder removed;
+        g_variant_builder_init(&removed, G_VARIANT_TYPE("ai"));
+        if (!complete) {
+            for (int id : change_log.removed_since(since)) {
+                g_variant_builder_add(&removed, "i", id);
+            }
+        }
+        c_xidlechain_complete_get_changes_since(
+            object,
+            invocation,
+            change_log.get_instance_id().c_str(),
+            change_log.get_generation(),
+            complete,
+            complete || change_log.config_changed_since(since)
+                ? config_to_variant() : g_variant_new("a{sv}", NULL),
+            g_variant_builder_end(&actions),
+            g_variant_builder_end(&removed),
+            complete || change_log.state_changed_since(since)
+                ? state_to_variant(change_log.get_state()) : g_variant_new("a{sv}", NULL)
+        );
+    }
+
     void DbusRequestHandler::static_on_bus_acquired(
         GDBusConnection *connection,
         const gchar *name,
@@ -461,6 +1115,8 @@ namespace Xidlechain {
         gpointer user_data
     ) {
         g_debug("Acquired name %s", name);
+        StartupTimeline::mark("acquired D-Bus name");
+        ServiceNotifier::release_ready();
     }
 
     void DbusRequestHandler::add_action_to_object_manager(Command &cmd) {
@@ -471,29 +1127,113 @@ namespace Xidlechain {
         g_autofree gchar *object_path = g_strdup_printf("%s/action/%d", DBUS_OBJECT_BASE_PATH, cmd.id);
         CObjectSkeleton *object = c_object_skeleton_new(object_path);
         CXidlechainAction *action = c_xidlechain_action_skeleton_new();
-        VTableReplacer<CXidlechainAction>::replace_set_property_method(action, static_set_property_func_for_action);
+        VTableReplacer<CXidlechainAction>::replace_property_methods(
+            action, static_set_property_func_for_action, static_get_property_func_for_action);
+        VTableReplacer<CXidlechainAction>::replace_get_properties(
+            action, static_get_properties_func_for_action);
+        set_action_properties(action, cmd);
+        c_object_skeleton_set_xidlechain_action(object, action);
+        g_object_unref(action);
+        g_dbus_object_manager_server_export(object_manager, G_DBUS_OBJECT_SKELETON(object));
+        g_object_unref(object);
+    }
+
+    void DbusRequestHandler::set_action_properties(CXidlechainAction *action, Command &cmd) {
         c_xidlechain_action_set_name(action, cmd.name.c_str());
         g_autofree gchar *trigger = cmd.get_trigger_str();
         c_xidlechain_action_set_trigger(action, trigger);
-        if (cmd.activation_action) {
-            c_xidlechain_action_set_exec(action, cmd.activation_action->get_cmd_str());
-        }
-        if (cmd.deactivation_action) {
-            c_xidlechain_action_set_resume_exec(action, cmd.deactivation_action->get_cmd_str());
+        c_xidlechain_action_set_exec(
+            action,
+            cmd.activation_action ? cmd.activation_action->get_cmd_str() : ""
+        );
+        c_xidlechain_action_set_resume_exec(
+            action,
+            cmd.deactivation_action ? cmd.deactivation_action->get_cmd_str() : ""
+        );
+        g_autofree gchar *inhibited_by = cmd.get_inhibited_by_str();
+        c_xidlechain_action_set_inhibited_by(action, inhibited_by);
+        c_xidlechain_action_set_activated(action, cmd.is_activated());
+    }
+
+    // Returns a new reference, or null if the action was not exported.
+    CXidlechainAction *DbusRequestHandler::lookup_action(int cmd_id) {
+        g_autofree gchar *object_path = g_strdup_printf("%s/action/%d", DBUS_OBJECT_BASE_PATH, cmd_id);
+        GDBusObject *object = g_dbus_object_manager_get_object(
+            G_DBUS_OBJECT_MANAGER(object_manager), object_path);
+        if (!object) {
+            return NULL;
         }
-        c_object_skeleton_set_xidlechain_action(object, action);
-        g_object_unref(action);
-        g_dbus_object_manager_server_export(object_manager, G_DBUS_OBJECT_SKELETON(object));
+        CXidlechainAction *action = c_object_get_xidlechain_action(C_OBJECT(object));
         g_object_unref(object);
+        return action;
+    }
+
+    void DbusRequestHandler::receive(const Event &event) {
+        forward(event);
+        if (!object_manager) {
+            // We haven't acquired the bus yet; the current config will
+            // be exported once we do.
+            return;
+        }
+        switch (event.type) {
+        case EVENT_CONFIG_CHANGED:
+            c_xidlechain_set_ignore_audio(config_iface, cfg->ignore_audio);
+            c_xidlechain_set_ignore_fullscreen(config_iface, cfg->ignore_fullscreen);
+            c_xidlechain_set_wait_before_sleep(config_iface, cfg->wait_before_sleep);
+            c_xidlechain_set_disable_automatic_dpmsactivation(config_iface, cfg->disable_automatic_dpms_activation);
+            c_xidlechain_set_disable_screensaver(config_iface, cfg->disable_screensaver);
+            c_xidlechain_set_wake_resumes_activity(config_iface, cfg->wake_resumes_activity);
+            break;
+        case EVENT_COMMAND_CHANGED:
+            {
+                const PropertyChangeInfo &info = event.property_change_info();
+                CXidlechainAction *action = lookup_action(info.cmd->id);
+                if (!action) {
+                    g_warning("Command %d is not exported", info.cmd->id);
+                    break;
+                }
+                set_action_properties(action, *info.cmd);
+                g_object_unref(action);
+            }
+            break;
+        case EVENT_COMMAND_ADDED:
+            add_action_to_object_manager(*event.command_info().cmd);
+            break;
+        case EVENT_COMMAND_REMOVED:
+            {
+                int id = event.command_info().cmd->id;
+                g_autofree gchar *path = g_strdup_printf("%s/action/%d", DBUS_OBJECT_BASE_PATH, id);
+                if (!g_dbus_object_manager_server_unexport(object_manager, path)) {
+                    g_warning("Command %d was not removed", id);
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void DbusRequestHandler::begin_batch() {
+        event_receiver->begin_batch();
+    }
+
+    void DbusRequestHandler::end_batch() {
+        event_receiver->end_batch();
     }
 
     void DbusRequestHandler::init(
         ConfigManager *config_manager,
-        EventReceiver *event_receiver
+        EventManager *event_manager
     ) {
         cfg = config_manager;
-        this->event_receiver = event_receiver;
+        this->event_manager = event_manager;
+        event_receiver = event_manager;
+        update_state_generation();
+        event_manager->set_state_changed_func(static_on_state_changed, this);
         INSTANCE = this;
+        // READY=1 waits for the name. Not getting it is fatal, so there
+        // is no failure to wait for.
+        ServiceNotifier::hold_ready();
         bus_identifier = g_bus_own_name(
             G_BUS_TYPE_SESSION,
             DBUS_BUS_NAME,
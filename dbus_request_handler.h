@@ -6,21 +6,36 @@
 
 #include <gio/gio.h>
 
+#include "change_log.h"
 #include "command.h"
+#include "event_receiver.h"
+#include "throttle.h"
 
 using std::shared_ptr;
 using std::vector;
 
 struct _CXidlechain;
+struct _CXidlechainAction;
 
 namespace Xidlechain {
     class ConfigManager;
-    class EventReceiver;
+    class EventManager;
+    struct StagedChange;
+
+    // Config changes which were not made over DBus (i.e. the config file
+    // was reloaded) are sent to this class, which forwards them to the
+    // real event receiver and updates the exported objects accordingly.
+    class DbusRequestHandler: public EventReceiver {
+        // The runtime state properties are updated at most this often
+        static constexpr gint64 STATE_UPDATE_INTERVAL_US = 100 * 1000;
 
-    class DbusRequestHandler {
         ConfigManager *cfg = nullptr;
+        EventManager *event_manager = nullptr;
         EventReceiver *event_receiver = nullptr;
+        ChangeLog change_log;
+        Throttle state_update_throttle{STATE_UPDATE_INTERVAL_US, static_update_state_properties, this};
         guint bus_identifier = 0;
+        _CXidlechain *config_iface = nullptr;
         GDBusObjectManagerServer *object_manager = nullptr;
         // There'll only be one instance of this class for the lifetime
         // of the program
@@ -58,6 +73,27 @@ namespace Xidlechain {
             GVariant *value,
             GError **error
         );
+        static GVariant *static_get_property_func_for_action(
+            GDBusConnection *connection,
+            const gchar *sender,
+            const gchar *object_path,
+            const gchar *interface_name,
+            const gchar *property_name,
+            GError **error,
+            gpointer user_data
+        );
+        GVariant *handle_get_property_for_action(
+            const gchar *object_path,
+            const gchar *property_name
+        );
+        static GVariant *static_get_properties_func_for_action(GDBusInterfaceSkeleton *skeleton);
+        static bool parse_action_id(const gchar *object_path, int &action_id);
+        bool set_action_property(
+            Command &cmd,
+            PropertyId property,
+            const char *value,
+            GVariant **old_value
+        );
         static gboolean static_on_add_action(
             _CXidlechain *object,
             GDBusMethodInvocation *invocation,
@@ -86,6 +122,57 @@ namespace Xidlechain {
             GDBusMethodInvocation *invocation,
             gint id
         );
+        static gboolean static_on_apply_changes(
+            _CXidlechain *object,
+            GDBusMethodInvocation *invocation,
+            GVariant *changes,
+            gpointer user_data
+        );
+        void on_apply_changes(
+            _CXidlechain *object,
+            GDBusMethodInvocation *invocation,
+            GVariant *changes
+        );
+        bool stage_change(
+            int id,
+            const gchar *operation,
+            GVariant *properties,
+            StagedChange &change
+        );
+        bool check_names(vector<StagedChange> &staged_changes);
+        bool is_name_taken(const string &name, int except_id);
+        void apply_change(StagedChange &change);
+        static gboolean static_on_get_snapshot(
+            _CXidlechain *object,
+            GDBusMethodInvocation *invocation,
+            gpointer user_data
+        );
+        void on_get_snapshot(
+            _CXidlechain *object,
+            GDBusMethodInvocation *invocation
+        );
+        static gboolean static_on_get_changes_since(
+            _CXidlechain *object,
+            GDBusMethodInvocation *invocation,
+            const gchar *instance,
+            guint64 since,
+            gpointer user_data
+        );
+        void on_get_changes_since(
+            _CXidlechain *object,
+            GDBusMethodInvocation *invocation,
+            const gchar *instance,
+            guint64 since
+        );
+        void forward(const Event &event);
+        static void static_on_state_changed(gpointer user_data);
+        static void static_update_state_properties(gpointer user_data);
+        void update_state_properties();
+        ChangeLog::RuntimeState get_runtime_state();
+        void update_state_generation();
+        GVariant *config_to_variant();
+        GVariant *state_to_variant(const ChangeLog::RuntimeState &state);
+        static GVariant *action_to_variant(Command &cmd);
         static gboolean static_on_pause(
             _CXidlechain *object,
             GDBusMethodInvocation *invocation,
@@ -125,11 +212,16 @@ namespace Xidlechain {
             gpointer user_data
         );
         void add_action_to_object_manager(Command &cmd);
+        void set_action_properties(_CXidlechainAction *action, Command &cmd);
+        _CXidlechainAction *lookup_action(int cmd_id);
     public:
         void init(
             ConfigManager *config_manager,
-            EventReceiver *event_receiver
+            EventManager *event_manager
         );
+        void receive(const Event &event) override;
+        void begin_batch() override;
+        void end_batch() override;
     };
 }
 
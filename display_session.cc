@@ -0,0 +1,108 @@
+#include "dbus_request_handler.h"
+#include "display_session.h"
+#include "startup_timeline.h"
+
+namespace Xidlechain {
+    DisplaySession::DisplaySession(
+        const char *display_name,
+        const string &config_file_path,
+        SharedAudioDetector *shared_audio_detector
+    ):
+        display_name(display_name ? display_name : ""),
+        config_file_path(config_file_path),
+        event_manager(&config_manager),
+        activity_detector(&x_connection),
+        audio_detector(shared_audio_detector),
+        fullscreen_detector(&x_connection),
+        logind_manager(display_name),
+        process_spawner(display_name),
+        connection_lost_func(NULL),
+        connection_lost_data(NULL)
+    {}
+
+    bool DisplaySession::init(DbusRequestHandler *request_handler) {
+        if (!x_connection.open(display_name.empty() ? NULL : display_name.c_str())) {
+            return false;
+        }
+        x_connection.set_connection_lost_func(static_on_connection_lost, this);
+        StartupTimeline::mark("connected to X server");
+
+        if (!config_manager.parse_config_file(config_file_path)) {
+            return false;
+        }
+        StartupTimeline::mark("parsed config file");
+
+        // The idle timeouts only depend on the X server, so arm them first.
+        // The other subsystems are only needed once the main loop is running,
+        // and the slow ones (logind, PulseAudio, D-Bus) connect concurrently
+        // in the background. The EventManager starts the optional subsystems
+        // (audio detector, brightness controller) only if the config
+        // needs them.
+        event_manager.set_display_name(get_display_name());
+        if (!activity_detector.init(&event_manager)) {
+            return false;
+        }
+        if (!event_manager.init(&activity_detector,
+                                &logind_manager,
+                                &audio_detector,
+                                &process_spawner,
+                                &brightness_controller))
+        {
+            return false;
+        }
+        // Status bars can do without it
+        if (status_page.open(StatusPage::default_path(display_name.empty() ? NULL : display_name.c_str()))) {
+            event_manager.set_status_page(&status_page);
+        }
+        if (!logind_manager.init(&event_manager)) {
+            return false;
+        }
+        if (request_handler && config_manager.enable_dbus) {
+            request_handler->init(&config_manager, &event_manager);
+            // Changes from the config file also need to show up on DBus
+            config_manager.watch_config_file(request_handler);
+        } else {
+            config_manager.watch_config_file(&event_manager);
+        }
+        if (!fullscreen_detector.init(&event_manager)) {
+            return false;
+        }
+        pressure_detector.reset(new PsiPressureDetector(config_manager.pressure_use_cgroup));
+        // The pressure inhibitor is optional, and kernels without PSI (or
+        // without unprivileged triggers) don't have it, so carry on
+        // without a trigger which can't be registered
+        if (
+            !config_manager.cpu_pressure_trigger.empty()
+            && !pressure_detector->add_trigger("cpu", config_manager.cpu_pressure_trigger)
+        ) {
+            g_warning("Not inhibiting actions on CPU pressure");
+        }
+        if (
+            !config_manager.io_pressure_trigger.empty()
+            && !pressure_detector->add_trigger("io", config_manager.io_pressure_trigger)
+        ) {
+            g_warning("Not inhibiting actions on I/O pressure");
+        }
+        return pressure_detector->init(&event_manager);
+    }
+
+    void DisplaySession::set_connection_lost_func(void (*func)(DisplaySession*, gpointer), gpointer data) {
+        connection_lost_func = func;
+        connection_lost_data = data;
+    }
+
+    const char *DisplaySession::get_display_name() const {
+        return display_name.empty() ? g_getenv("DISPLAY") : display_name.c_str();
+    }
+
+    string DisplaySession::get_status() {
+        return event_manager.get_status();
+    }
+
+    void DisplaySession::static_on_connection_lost(gpointer user_data) {
+        DisplaySession *_this = static_cast<DisplaySession*>(user_data);
+        if (_this->connection_lost_func) {
+            _this->connection_lost_func(_this, _this->connection_lost_data);
+        }
+    }
+}
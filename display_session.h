@@ -0,0 +1,75 @@
+#ifndef _DISPLAY_SESSION_H_
+#define _DISPLAY_SESSION_H_
+
+#include <memory>
+#include <string>
+
+#include <glib.h>
+
+#include "activity_detector.h"
+#include "audio_detector.h"
+#include "brightness_controller.h"
+#include "config_manager.h"
+#include "event_manager.h"
+#include "fullscreen_detector.h"
+#include "logind_manager.h"
+#include "pressure_detector.h"
+#include "process_spawner.h"
+#include "status_page.h"
+#include "x_connection.h"
+
+using std::string;
+using std::unique_ptr;
+
+namespace Xidlechain {
+    class DbusRequestHandler;
+
+    // Everything which is needed to manage the idle state of one X
+    // display. Normally there is only one of these, but in multi-display
+    // mode a single process serves several displays. The sessions share
+    // the main loop (and with it the timers and child process watches)
+    // and the connection to the sound server.
+    class DisplaySession {
+        string display_name;
+        string config_file_path;
+        XConnection x_connection;
+        ConfigManager config_manager;
+        // Declared before the EventManager which publishes to it, so that
+        // it is destroyed after it
+        StatusPage status_page;
+        EventManager event_manager;
+        XcbActivityDetector activity_detector;
+        SharedAudioDetector::Client audio_detector;
+        EwmhFullscreenDetector fullscreen_detector;
+        // The pressure_use_cgroup option is only known once the config
+        // file has been parsed
+        unique_ptr<PsiPressureDetector> pressure_detector;
+        DbusLogindManager logind_manager;
+        GProcessSpawner process_spawner;
+        DbusBrightnessController brightness_controller;
+        void (*connection_lost_func)(DisplaySession*, gpointer);
+        gpointer connection_lost_data;
+
+        static void static_on_connection_lost(gpointer user_data);
+    public:
+        // If |display_name| is null, $DISPLAY is used, and the logind
+        // session is the one we were started from. If |config_file_path|
+        // is empty, the default config file is used.
+        DisplaySession(const char *display_name,
+                       const string &config_file_path,
+                       SharedAudioDetector *shared_audio_detector);
+        DisplaySession(const DisplaySession&) = delete;
+        DisplaySession& operator=(const DisplaySession&) = delete;
+
+        // If |request_handler| is not null and D-Bus is enabled in the
+        // config, the settings of this session are exported over D-Bus.
+        bool init(DbusRequestHandler *request_handler);
+        // |func| is called once if the X server closes the connection.
+        // The session may be destroyed from an idle callback afterwards.
+        void set_connection_lost_func(void (*func)(DisplaySession*, gpointer), gpointer data);
+        const char *get_display_name() const;
+        string get_status();
+    };
+}
+
+#endif
@@ -12,7 +12,8 @@ typedef enum {
     XIDLECHAIN_ERROR_INVALID_TRIGGER,
     XIDLECHAIN_ERROR_INVALID_ACTION,
     XIDLECHAIN_ERROR_MISSING_TRIGGER,
-    XIDLECHAIN_ERROR_MISSING_ACTION
+    XIDLECHAIN_ERROR_MISSING_ACTION,
+    XIDLECHAIN_ERROR_INVALID_INHIBITOR
 } XidlechainError;
 
 G_END_DECLS
@@ -1,5 +1,5 @@
+#include <algorithm>
 #include <cstdlib>
-#include <cstdint>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -8,22 +8,40 @@
 #include "brightness_controller.h"
 #include "config_manager.h"
 #include "event_manager.h"
+#include "event_stream.h"
 #include "logind_manager.h"
 #include "map.h"
+#include "metrics.h"
+#include "probes.h"
 #include "process_spawner.h"
-
-using std::uintptr_t;
+#include "stall_monitor.h"
+#include "status_page.h"
+#include "startup_timeline.h"
+#include "trace.h"
 
 namespace Xidlechain {
     EventManager::EventManager(ConfigManager *cfg):
         audio_playing{false},
         paused{false},
-        timeouts_are_enabled{false},
+        idle_inhibited{false},
+        fullscreen{false},
+        under_pressure{false},
+        active_inhibitors{0},
+        idle_since{0},
+        last_resume_time{g_get_monotonic_time()},
+        status_page{NULL},
+        state_changed_func{NULL},
+        state_changed_data{NULL},
         activity_detector{NULL},
         cfg{cfg},
         logind_manager{NULL},
+        audio_detector{NULL},
         process_spawner{NULL},
-        brightness_controller{NULL}
+        brightness_controller{NULL},
+        audio_detector_running{false},
+        brightness_controller_running{false},
+        batch_depth{0},
+        subsystems_stale{false}
     {}
 
     bool EventManager::init(
@@ -40,18 +58,89 @@ namespace Xidlechain {
         g_return_val_if_fail(brightness_controller != NULL, FALSE);
         this->activity_detector = activity_detector;
         this->logind_manager = logind_manager;
+        this->audio_detector = audio_detector;
         this->process_spawner = process_spawner;
         this->brightness_controller = brightness_controller;
         if (cfg->disable_automatic_dpms_activation) {
-            process_spawner->exec_cmd_sync("xset dpms 0 0 0");
+            activity_detector->disable_dpms_timeouts();
         }
         if (cfg->disable_screensaver) {
-            process_spawner->exec_cmd_sync("xset s off");
+            activity_detector->disable_screensaver();
         }
-        enable_all_timeouts();
+        active_inhibitors = compute_active_inhibitors();
+        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
+            enable_timeout_for_new_command(*cmd);
+        }
+        StartupTimeline::mark("idle timeouts armed");
+        update_subsystems();
         return true;
     }
 
+    string EventManager::get_status() {
+        GString *status = g_string_new(NULL);
+        if (idle_since) {
+            g_string_append_printf(status, "idle for %lld ms",
+                                   (long long)((g_get_monotonic_time() - idle_since) / 1000));
+        } else {
+            g_string_append(status, "active");
+        }
+        bool first = true;
+        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
+            if (cmd->is_activated()) {
+                g_string_append(status, first ? "; activated: " : ", ");
+                g_string_append(status, cmd->name.c_str());
+                first = false;
+            }
+        }
+        if (active_inhibitors) {
+            g_autofree char *inhibitors = Command::static_get_inhibit_mask_str(active_inhibitors);
+            g_string_append_printf(status, "; inhibited by: %s", inhibitors);
+        }
+        g_autofree gchar *str = g_string_free(status, FALSE);
+        return str;
+    }
+
+    void EventManager::set_status_page(StatusPage *page) {
+        status_page = page;
+        if (status_page) {
+            publish_status();
+        }
+    }
+
+    void EventManager::set_state_changed_func(void (*func)(gpointer), gpointer data) {
+        state_changed_func = func;
+        state_changed_data = data;
+    }
+
+    void EventManager::publish_status() {
+        StatusPage::Snapshot snapshot;
+        snapshot.idle = is_idle();
+        snapshot.idle_state_since_us = get_idle_state_since();
+        // The slot of an action is its position in order of increasing
+        // timeout, which (unlike its ID) stays small
+        vector<Command*> &sorted = status_commands;
+        sorted.clear();
+        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
+            sorted.push_back(cmd.get());
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const Command *a, const Command *b) {
+            return a->timeout_ms != b->timeout_ms ? a->timeout_ms < b->timeout_ms : a->id < b->id;
+        });
+        for (size_t slot = 0; slot < sorted.size(); slot++) {
+            if (!sorted[slot]->is_activated()) {
+                continue;
+            }
+            snapshot.num_activated++;
+            if (slot < 64) {
+                snapshot.activated_slots |= (uint64_t)1 << slot;
+            }
+        }
+        snapshot.paused = paused;
+        snapshot.audio_playing = audio_playing;
+        snapshot.inhibitors = active_inhibitors;
+        status_page->publish(snapshot);
+    }
+
     Command::ActionExecutors EventManager::get_executors() const {
         return {brightness_controller, process_spawner, logind_manager};
     }
@@ -64,77 +153,155 @@ namespace Xidlechain {
         cmd.deactivate(get_executors(), sync);
     }
 
-    void EventManager::enable_timeout_for_new_command(Command &cmd) {
-        g_assert(cmd.trigger == Command::TIMEOUT);
-        if (timeouts_should_be_disabled()) {
-            // cmd will get added later once timeouts are re-enabled
-            g_debug("Not adding '%s' because timeouts are disabled", cmd.name.c_str());
-            return;
+    unsigned int EventManager::compute_active_inhibitors() const {
+        unsigned int inhibitors = 0;
+        if (audio_playing && !cfg->ignore_audio) {
+            inhibitors |= Command::INHIBIT_AUDIO;
         }
-        activity_detector->add_idle_timeout(cmd.timeout_ms, (gpointer)(long)cmd.id);
+        if (fullscreen && !cfg->ignore_fullscreen) {
+            inhibitors |= Command::INHIBIT_FULLSCREEN;
+        }
+        if (paused) {
+            inhibitors |= Command::INHIBIT_PAUSED;
+        }
+        if (idle_inhibited) {
+            inhibitors |= Command::INHIBIT_LOGIND;
+        }
+        if (under_pressure) {
+            inhibitors |= Command::INHIBIT_PRESSURE;
+        }
+        return inhibitors;
     }
 
-    void EventManager::disable_timeout_for_deleted_command(Command &cmd) {
-        g_assert(cmd.trigger == Command::TIMEOUT);
-        if (!timeouts_are_enabled) {
-            g_debug("Not removing '%s' because timeouts are already disabled", cmd.name.c_str());
+    bool EventManager::is_inhibited(const Command &cmd) const {
+        return (cmd.get_inhibit_mask() & active_inhibitors) != 0;
+    }
+
+    // Recomputes the active inhibitors, and only adds or removes the
+    // timeouts of the commands whose inhibited state actually changed.
+    void EventManager::update_inhibitors() {
+        unsigned int old_inhibitors = active_inhibitors;
+        unsigned int new_inhibitors = compute_active_inhibitors();
+        unsigned int changed = old_inhibitors ^ new_inhibitors;
+        if (changed == 0) {
             return;
         }
-        activity_detector->remove_idle_timeout((gpointer)(long)cmd.id);
+        active_inhibitors = new_inhibitors;
+        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
+            unsigned int mask = cmd->get_inhibit_mask();
+            if ((mask & changed) == 0) {
+                continue;
+            }
+            bool was_inhibited = (mask & old_inhibitors) != 0;
+            bool now_inhibited = (mask & new_inhibitors) != 0;
+            if (was_inhibited && !now_inhibited) {
+                g_debug("Restoring timeout for '%s'", cmd->name.c_str());
+                activity_detector->add_idle_timeout(cmd->timeout_ms, cmd->id);
+            } else if (!was_inhibited && now_inhibited) {
+                g_debug("Removing timeout for inhibited '%s'", cmd->name.c_str());
+                activity_detector->remove_idle_timeout(cmd->id);
+            }
+        }
     }
 
-    void EventManager::enable_all_timeouts() {
-        if (timeouts_are_enabled) {
-            g_debug("Timeouts are already enabled");
-            return;
+    // Starts the subsystems which the current config needs, and stops the
+    // ones which it doesn't need anymore.
+    void EventManager::update_subsystems() {
+        bool need_audio = false,
+             need_brightness = false,
+             need_sleep_lock = false;
+        for (shared_ptr<Command> cmd : cfg->get_all_commands()) {
+            if (
+                cmd->trigger == Command::TIMEOUT
+                && (cmd->get_inhibit_mask() & Command::INHIBIT_AUDIO)
+            ) {
+                need_audio = true;
+            }
+            if (cmd->trigger == Command::SLEEP) {
+                need_sleep_lock = true;
+            }
+            if (cmd->uses_brightness_controller()) {
+                need_brightness = true;
+            }
         }
-        if (timeouts_should_be_disabled()) {
-            g_debug("Timeouts remain disabled");
-            return;
+        if (cfg->ignore_audio) {
+            need_audio = false;
         }
-        for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
-            activity_detector->add_idle_timeout(cmd->timeout_ms, (gpointer)(long)cmd->id);
+
+        if (need_audio && !audio_detector_running) {
+            g_debug("Starting audio detector");
+            audio_detector_running = audio_detector->init(this);
+        } else if (!need_audio && audio_detector_running) {
+            g_debug("Stopping audio detector");
+            audio_detector->stop();
+            audio_detector_running = false;
+            if (audio_playing) {
+                audio_playing = false;
+                update_inhibitors();
+            }
         }
-        timeouts_are_enabled = true;
+        if (need_brightness && !brightness_controller_running) {
+            g_debug("Starting brightness controller");
+            brightness_controller_running = brightness_controller->init(logind_manager);
+        } else if (!need_brightness && brightness_controller_running) {
+            g_debug("Stopping brightness controller");
+            // This fails if we're in the middle of dimming; we'll try
+            // again the next time the config changes.
+            brightness_controller_running = !brightness_controller->stop();
+        }
+        logind_manager->set_sleep_lock_enabled(need_sleep_lock);
     }
 
-    void EventManager::disable_all_timeouts() {
-        if (!timeouts_are_enabled) {
-            g_debug("Timeouts are already disabled");
+    // update_subsystems() looks at every command, so a batch which adds
+    // or changes many commands only runs it once, at the end.
+    void EventManager::reconcile_subsystems() {
+        if (batch_depth > 0) {
+            subsystems_stale = true;
             return;
         }
-        activity_detector->clear_timeouts();
-        timeouts_are_enabled = false;
+        update_subsystems();
     }
 
-    void EventManager::handle_config_ignore_audio_changed(const ConfigChangeInfo *info) {
-        bool old_value = g_variant_get_boolean(info->old_value);
-        bool new_value = cfg->ignore_audio;
-        if (old_value == new_value) {
-            // no change
+    void EventManager::begin_batch() {
+        batch_depth++;
+    }
+
+    void EventManager::end_batch() {
+        g_return_if_fail(batch_depth > 0);
+        if (--batch_depth > 0 || !subsystems_stale) {
             return;
         }
-        if (!audio_playing) {
-            // nothing to do since timeouts are always enabled
-            // if audio is not running
+        subsystems_stale = false;
+        update_subsystems();
+        if (status_page) {
+            publish_status();
+        }
+        if (state_changed_func) {
+            state_changed_func(state_changed_data);
+        }
+    }
+
+    void EventManager::enable_timeout_for_new_command(Command &cmd) {
+        g_assert(cmd.trigger == Command::TIMEOUT);
+        if (is_inhibited(cmd)) {
+            // cmd will get added later once its inhibitors are released
+            g_debug("Not adding '%s' because it is inhibited", cmd.name.c_str());
             return;
         }
-        if (new_value) {
-            // NOT IGNORE AUDIO -> IGNORE AUDIO
-            // TIMEOUTS DISABLED -> TIMEOUTS ENABLED
-            g_debug("Re-enabling timeouts because we are now ignoring audio");
-            enable_all_timeouts();
-        } else {
-            // IGNORE AUDIO -> NOT IGNORE AUDIO
-            // TIMEOUTS ENABLED -> TIMEOUTS DISABLED
-            g_debug("Disabling timeouts because we are no longer ignoring audio");
-            disable_all_timeouts();
+        activity_detector->add_idle_timeout(cmd.timeout_ms, cmd.id);
+    }
+
+    void EventManager::disable_timeout_for_deleted_command(Command &cmd) {
+        // The command's inhibit mask might have changed since its timeout
+        // was added, so we can't tell whether it has one.
+        if (!activity_detector->remove_idle_timeout(cmd.id)) {
+            g_debug("'%s' did not have a timeout", cmd.name.c_str());
         }
     }
 
-    void EventManager::handle_command_trigger_changed(const CommandChangeInfo *info) {
-        shared_ptr<Command> cmd = info->cmd;
-        Command::Trigger old_trigger = (Command::Trigger) g_variant_get_int32(info->old_value);
+    void EventManager::handle_command_trigger_changed(const PropertyChangeInfo &info) {
+        shared_ptr<Command> cmd = info.cmd;
+        Command::Trigger old_trigger = (Command::Trigger) g_variant_get_int32(info.old_value);
         Command::Trigger new_trigger = cmd->trigger;
 
         if (old_trigger == Command::Trigger::TIMEOUT) {
@@ -151,123 +318,203 @@ namespace Xidlechain {
         }
     }
 
-    void EventManager::handle_activity_resumed() {
+    void EventManager::handle_command_inhibit_mask_changed(const PropertyChangeInfo &info) {
+        shared_ptr<Command> cmd = info.cmd;
+        if (cmd->trigger != Command::TIMEOUT) {
+            return;
+        }
+        // The command might be subject to different inhibitors now,
+        // so treat it like a new command.
+        disable_timeout_for_deleted_command(*cmd);
+        enable_timeout_for_new_command(*cmd);
+    }
+
+    void EventManager::handle_activity_resumed(gint64 time) {
+        if (idle_since) {
+            last_resume_time = time;
+        }
+        idle_since = 0;
         for (shared_ptr<Command> cmd : cfg->get_timeout_commands()) {
             deactivate(*cmd);
         }
     }
 
-    /* Possible transitions:
-     * disabled and should be enabled -> enabled and should be enabled
-     * enabled and should be enabled -> enabled and should be disabled
-     * enabled and should be disabled -> disabled and should be disabled
-     * disabled and should be disabled -> disabled and should be enabled
-     */
-    bool EventManager::timeouts_should_be_disabled() const {
-        return (audio_playing && !cfg->ignore_audio) || paused;
+    void EventManager::handle_activity_timeout(const Event &event) {
+        shared_ptr<Command> cmd = cfg->lookup_command(event.timeout_info().timeout_id);
+        if (!cmd) {
+            g_warning("Received timeout for unknown command %d", event.timeout_info().timeout_id);
+            return;
+        }
+        gint64 since = event.timestamp - cmd->timeout_ms * 1000;
+        if (idle_since == 0 || since < idle_since) {
+            idle_since = since;
+        }
+        activate(*cmd);
     }
 
-    void EventManager::receive(EventType event, gpointer data) {
-        switch (event) {
-        case EVENT_ACTIVITY_TIMEOUT:
-            {
-                shared_ptr<Command> cmd = cfg->lookup_command((uintptr_t)data);
-                activate(*cmd);
-            }
-            break;
-        case EVENT_ACTIVITY_RESUME:
-            handle_activity_resumed();
-            break;
-        case EVENT_SLEEP:
-            for (shared_ptr<Command> cmd : cfg->get_sleep_commands()) {
-                activate(*cmd, cfg->wait_before_sleep);
-            }
-            break;
-        case EVENT_WAKE:
-            for (shared_ptr<Command> cmd : cfg->get_sleep_commands()) {
-                deactivate(*cmd);
-            }
-            if (cfg->wake_resumes_activity) {
-                handle_activity_resumed();
-            }
-            break;
-        case EVENT_LOCK:
-            for (shared_ptr<Command> cmd : cfg->get_lock_commands()) {
-                activate(*cmd);
-            }
-            break;
-        case EVENT_UNLOCK:
-            for (shared_ptr<Command> cmd : cfg->get_lock_commands()) {
-                deactivate(*cmd);
-            }
-            break;
+    void EventManager::handle_activity_resume(const Event &event) {
+        handle_activity_resumed(event.timestamp);
+    }
+
+    void EventManager::handle_sleep(const Event &event) {
+        for (shared_ptr<Command> cmd : cfg->get_sleep_commands()) {
+            activate(*cmd, cfg->wait_before_sleep);
+        }
+    }
+
+    void EventManager::handle_wake(const Event &event) {
+        for (shared_ptr<Command> cmd : cfg->get_sleep_commands()) {
+            deactivate(*cmd);
+        }
+        if (cfg->wake_resumes_activity) {
+            handle_activity_resumed(event.timestamp);
+        }
+    }
+
+    void EventManager::handle_lock(const Event &event) {
+        for (shared_ptr<Command> cmd : cfg->get_lock_commands()) {
+            activate(*cmd);
+        }
+    }
+
+    void EventManager::handle_unlock(const Event &event) {
+        for (shared_ptr<Command> cmd : cfg->get_lock_commands()) {
+            deactivate(*cmd);
+        }
+    }
+
+    void EventManager::handle_config_changed(const Event &event) {
+        PropertyId property = event.property_change_info().property;
+        if (
+            property == PROPERTY_IGNORE_AUDIO
+            || property == PROPERTY_IGNORE_FULLSCREEN
+        ) {
+            update_inhibitors();
+        }
+        if (property == PROPERTY_IGNORE_AUDIO) {
+            reconcile_subsystems();
+        }
+    }
+
+    void EventManager::handle_command_changed(const Event &event) {
+        const PropertyChangeInfo &info = event.property_change_info();
+        if (info.property == PROPERTY_TRIGGER) {
+            handle_command_trigger_changed(info);
+        } else if (
+            info.property == PROPERTY_EXEC
+            || info.property == PROPERTY_INHIBITED_BY
+        ) {
+            handle_command_inhibit_mask_changed(info);
+        }
+        reconcile_subsystems();
+    }
+
+    void EventManager::handle_command_added(const Event &event) {
+        shared_ptr<Command> cmd = event.command_info().cmd;
+        if (cmd->trigger == Command::TIMEOUT) {
+            enable_timeout_for_new_command(*cmd);
+        }
+        reconcile_subsystems();
+    }
+
+    void EventManager::handle_command_removed(const Event &event) {
+        shared_ptr<Command> cmd = event.command_info().cmd;
+        if (cmd->trigger == Command::TIMEOUT) {
+            disable_timeout_for_deleted_command(*cmd);
+        }
+        reconcile_subsystems();
+    }
+
+    // The inhibit sources come in pairs of events which turn them on
+    // and off.
+    void EventManager::handle_inhibit_source_event(const Event &event) {
+        switch (event.type) {
         case EVENT_AUDIO_RUNNING:
-            if (audio_playing) {  // no change
-                break;
-            }
-            audio_playing = true;
-            if (cfg->ignore_audio) {
-                g_debug("Audio running; ignoring");
-                break;
-            }
-            g_debug("Audio running, disabling timeouts");
-            disable_all_timeouts();
-            break;
         case EVENT_AUDIO_STOPPED:
-            if (!audio_playing) {  // no change
-                break;
-            }
-            audio_playing = false;
-            if (cfg->ignore_audio) {
-                g_debug("Audio stopped; ignoring");
-                break;
-            }
-            g_debug("Audio stopped, re-enabling timeouts");
-            enable_all_timeouts();
-            break;
-        case EVENT_CONFIG_CHANGED:
-            {
-                const ConfigChangeInfo *info = (const ConfigChangeInfo*)data;
-                if (g_strcmp0(info->name, "IgnoreAudio") == 0) {
-                    handle_config_ignore_audio_changed(info);
-                }
-            }
-            break;
-        case EVENT_COMMAND_CHANGED:
-            {
-                const CommandChangeInfo *info = (const CommandChangeInfo*)data;
-                if (g_strcmp0(info->name, "Trigger") == 0) {
-                    handle_command_trigger_changed(info);
-                }
-            }
+            audio_playing = event.type == EVENT_AUDIO_RUNNING;
+            g_debug("Audio %s", audio_playing ? "running" : "stopped");
             break;
-        case EVENT_COMMAND_ADDED:
-            {
-                int id = (uintptr_t)data;
-                shared_ptr<Command> cmd = cfg->lookup_command(id);
-                if (cmd->trigger == Command::TIMEOUT) {
-                    enable_timeout_for_new_command(*cmd);
-                }
-            }
+        case EVENT_PAUSED:
+        case EVENT_UNPAUSED:
+            paused = event.type == EVENT_PAUSED;
             break;
-        case EVENT_COMMAND_REMOVED:
-            {
-                const RemovedCommandInfo *info = (const RemovedCommandInfo*)data;
-                if (info->cmd->trigger == Command::TIMEOUT) {
-                    disable_timeout_for_deleted_command(*info->cmd);
-                }
-            }
+        case EVENT_IDLE_INHIBITED:
+        case EVENT_IDLE_UNINHIBITED:
+            idle_inhibited = event.type == EVENT_IDLE_INHIBITED;
+            g_debug("Idle %s by logind", idle_inhibited ? "inhibited" : "no longer inhibited");
             break;
-        case EVENT_PAUSED:
-            paused = true;
-            disable_all_timeouts();
+        case EVENT_FULLSCREEN_ENTERED:
+        case EVENT_FULLSCREEN_EXITED:
+            fullscreen = event.type == EVENT_FULLSCREEN_ENTERED;
+            g_debug("Fullscreen window %s", fullscreen ? "focused" : "unfocused");
             break;
-        case EVENT_UNPAUSED:
-            paused = false;
-            enable_all_timeouts();
+        case EVENT_PRESSURE_HIGH:
+        case EVENT_PRESSURE_NORMAL:
+            under_pressure = event.type == EVENT_PRESSURE_HIGH;
+            g_debug("System %s pressure", under_pressure ? "under" : "no longer under");
             break;
         default:
-            g_warning("Received unknown event type %d", event);
+            g_assert_not_reached();
+        }
+        update_inhibitors();
+    }
+
+    // Not constexpr: calling this while building the dispatch table makes
+    // the build fail.
+    static void missing_event_handler() {}
+
+    constexpr array<EventManager::EventHandler, EVENT_TYPE_COUNT> EventManager::make_dispatch_table() {
+        array<EventHandler, EVENT_TYPE_COUNT> table{};
+        table[EVENT_ACTIVITY_TIMEOUT] = &EventManager::handle_activity_timeout;
+        table[EVENT_ACTIVITY_RESUME] = &EventManager::handle_activity_resume;
+        table[EVENT_SLEEP] = &EventManager::handle_sleep;
+        table[EVENT_WAKE] = &EventManager::handle_wake;
+        table[EVENT_LOCK] = &EventManager::handle_lock;
+        table[EVENT_UNLOCK] = &EventManager::handle_unlock;
+        table[EVENT_AUDIO_RUNNING] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_AUDIO_STOPPED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_CONFIG_CHANGED] = &EventManager::handle_config_changed;
+        table[EVENT_COMMAND_CHANGED] = &EventManager::handle_command_changed;
+        table[EVENT_COMMAND_ADDED] = &EventManager::handle_command_added;
+        table[EVENT_COMMAND_REMOVED] = &EventManager::handle_command_removed;
+        table[EVENT_PAUSED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_UNPAUSED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_IDLE_INHIBITED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_IDLE_UNINHIBITED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_FULLSCREEN_ENTERED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_FULLSCREEN_EXITED] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_PRESSURE_HIGH] = &EventManager::handle_inhibit_source_event;
+        table[EVENT_PRESSURE_NORMAL] = &EventManager::handle_inhibit_source_event;
+        for (int i = 1; i < EVENT_TYPE_COUNT; i++) {
+            if (!table[i]) {
+                missing_event_handler();
+            }
+        }
+        return table;
+    }
+
+    constexpr array<EventManager::EventHandler, EVENT_TYPE_COUNT> EventManager::dispatch_table =
+        EventManager::make_dispatch_table();
+
+    void EventManager::receive(const Event &event) {
+        if (event.type <= 0 || event.type >= EVENT_TYPE_COUNT) {
+            g_warning("Received unknown event type %d", event.type);
+            return;
+        }
+        Metrics::events[event.type]++;
+        StallMonitor::enter_event(event.type);
+        EventStream::publish(event, display_name.c_str());
+        XIDLECHAIN_PROBE(event_receive_entry, (int)event.type, event.timestamp);
+        Trace::record(TRACE_DISPATCHED, event.type,
+                      event.type == EVENT_ACTIVITY_TIMEOUT ? event.timeout_info().timeout_id : 0,
+                      event.timestamp * 1000);
+        (this->*dispatch_table[event.type])(event);
+        if (status_page) {
+            publish_status();
+        }
+        if (state_changed_func) {
+            state_changed_func(state_changed_data);
         }
+        XIDLECHAIN_PROBE(event_receive_exit, (int)event.type, event.timestamp);
     }
 }
@@ -1,7 +1,9 @@
 #ifndef _EVENT_MANAGER_H_
 #define _EVENT_MANAGER_H_
 
+#include <array>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <glib.h>
@@ -9,6 +11,8 @@
 #include "command.h"
 #include "event_receiver.h"
 
+using std::array;
+using std::string;
 using std::vector;
 
 namespace Xidlechain {
@@ -18,30 +22,77 @@ namespace Xidlechain {
     class LogindManager;
     class AudioDetector;
     class ProcessSpawner;
-    struct ConfigChangeInfo;
-    struct CommandChangeInfo;
+    class StatusPage;
 
     class EventManager: public EventReceiver {
+        // The raw state of each inhibit source. Whether a source actually
+        // inhibits anything also depends on the config (e.g. ignore_audio).
         bool audio_playing;
         bool paused;
-        bool timeouts_are_enabled;
+        bool idle_inhibited;
+        bool fullscreen;
+        bool under_pressure;
+        // Bitwise OR of the Command::InhibitSources which are active.
+        // A TIMEOUT command has an idle timeout iff its inhibit mask
+        // and this mask are disjoint.
+        unsigned int active_inhibitors;
+        // When the user went idle (g_get_monotonic_time()), as far as we
+        // can tell from the timeouts which fired, or 0 if they're active
+        gint64 idle_since;
+        // When activity was last detected after being idle
+        gint64 last_resume_time;
+        StatusPage *status_page;
+        // Reused by publish_status(), to avoid an allocation per event
+        vector<Command*> status_commands;
+        // The display which the events are about, for the event stream
+        string display_name;
+        void (*state_changed_func)(gpointer);
+        gpointer state_changed_data;
         ActivityDetector *activity_detector;
         ConfigManager *cfg;
         LogindManager *logind_manager;
+        AudioDetector *audio_detector;
         ProcessSpawner *process_spawner;
         BrightnessController *brightness_controller;
+        // The optional subsystems are only started while the config
+        // needs them.
+        bool audio_detector_running;
+        bool brightness_controller_running;
+        // While in a batch, update_subsystems() is put off until the end
+        int batch_depth;
+        bool subsystems_stale;
 
         Command::ActionExecutors get_executors() const;
-        bool timeouts_should_be_disabled() const;
+        unsigned int compute_active_inhibitors() const;
+        bool is_inhibited(const Command &cmd) const;
+        void update_inhibitors();
+        void update_subsystems();
+        void reconcile_subsystems();
         void enable_timeout_for_new_command(Command &cmd);
         void disable_timeout_for_deleted_command(Command &cmd);
-        void disable_all_timeouts();
-        void enable_all_timeouts();
         void activate(Command &cmd, bool sync=false);
         void deactivate(Command &cmd, bool sync=false);
-        void handle_activity_resumed();
-        void handle_config_ignore_audio_changed(const ConfigChangeInfo *info);
-        void handle_command_trigger_changed(const CommandChangeInfo *info);
+        void handle_activity_resumed(gint64 time);
+        void publish_status();
+        void handle_command_trigger_changed(const PropertyChangeInfo &info);
+        void handle_command_inhibit_mask_changed(const PropertyChangeInfo &info);
+
+        // One handler per event type, looked up in a table which is
+        // built (and checked for completeness) at compile time.
+        using EventHandler = void (EventManager::*)(const Event &event);
+        void handle_activity_timeout(const Event &event);
+        void handle_activity_resume(const Event &event);
+        void handle_sleep(const Event &event);
+        void handle_wake(const Event &event);
+        void handle_lock(const Event &event);
+        void handle_unlock(const Event &event);
+        void handle_config_changed(const Event &event);
+        void handle_command_changed(const Event &event);
+        void handle_command_added(const Event &event);
+        void handle_command_removed(const Event &event);
+        void handle_inhibit_source_event(const Event &event);
+        static constexpr array<EventHandler, EVENT_TYPE_COUNT> make_dispatch_table();
+        static const array<EventHandler, EVENT_TYPE_COUNT> dispatch_table;
     public:
         EventManager(ConfigManager *cfg);
         // Crude dependency injection.
@@ -50,7 +101,29 @@ namespace Xidlechain {
                   AudioDetector *audio_detector,
                   ProcessSpawner *process_spawner,
                   BrightnessController *brightness_controller);
-        void receive(EventType event, gpointer data) override;
+        void receive(const Event &event) override;
+        void begin_batch() override;
+        void end_batch() override;
+        // The state is published to |page| after every event, if it changed
+        void set_status_page(StatusPage *page);
+        void set_display_name(const char *name) { display_name = name ? name : ""; }
+        // |func| is called after every event (or batch of events), since
+        // the state may have changed. It should put off any real work.
+        void set_state_changed_func(void (*func)(gpointer), gpointer data);
+        // A one-line summary of the idle state, activated actions and
+        // inhibitors, for the service manager
+        string get_status();
+        bool is_idle() const { return idle_since != 0; }
+        // When the idle state last changed (g_get_monotonic_time()): while
+        // idle, when the user went idle; otherwise when activity was
+        // detected after being idle. Input while active doesn't move it,
+        // since the activity detector only hears about timeouts.
+        gint64 get_idle_state_since() const {
+            return idle_since ? idle_since : last_resume_time;
+        }
+        bool is_paused() const { return paused; }
+        bool is_audio_playing() const { return audio_playing; }
+        unsigned int get_active_inhibitors() const { return active_inhibitors; }
     };
 }
 
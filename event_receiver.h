@@ -1,9 +1,19 @@
 #ifndef _EVENT_RECEVER_H_
 #define _EVENT_RECEVER_H_
 
+#include <cstring>
+#include <memory>
+#include <variant>
+
 #include <glib.h>
 
+#include "trace.h"
+
+using std::shared_ptr;
+
 namespace Xidlechain {
+    class Command;
+
     enum EventType {
         EVENT_ACTIVITY_TIMEOUT = 1,
         EVENT_ACTIVITY_RESUME,
@@ -19,11 +29,192 @@ namespace Xidlechain {
         EVENT_COMMAND_REMOVED,
         EVENT_PAUSED,
         EVENT_UNPAUSED,
+        EVENT_IDLE_INHIBITED,
+        EVENT_IDLE_UNINHIBITED,
+        EVENT_FULLSCREEN_ENTERED,
+        EVENT_FULLSCREEN_EXITED,
+        EVENT_PRESSURE_HIGH,
+        EVENT_PRESSURE_NORMAL,
+        // Not an event; the number of event types plus one
+        EVENT_TYPE_COUNT
+    };
+
+    // The names of the event types without the EVENT_ prefix, as they
+    // appear in traces
+    inline const char * const EVENT_TYPE_NAMES[EVENT_TYPE_COUNT] = {
+        NULL,
+        "ACTIVITY_TIMEOUT",
+        "ACTIVITY_RESUME",
+        "SLEEP",
+        "WAKE",
+        "LOCK",
+        "UNLOCK",
+        "AUDIO_RUNNING",
+        "AUDIO_STOPPED",
+        "CONFIG_CHANGED",
+        "COMMAND_CHANGED",
+        "COMMAND_ADDED",
+        "COMMAND_REMOVED",
+        "PAUSED",
+        "UNPAUSED",
+        "IDLE_INHIBITED",
+        "IDLE_UNINHIBITED",
+        "FULLSCREEN_ENTERED",
+        "FULLSCREEN_EXITED",
+        "PRESSURE_HIGH",
+        "PRESSURE_NORMAL",
+    };
+
+    // Returns 0 if |name| is not a known event type.
+    inline int event_type_from_name(const char *name) {
+        for (int i = 1; i < EVENT_TYPE_COUNT; i++) {
+            if (std::strcmp(EVENT_TYPE_NAMES[i], name) == 0) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    // The settings and action properties which can change at runtime.
+    // Their names are interned where they enter the program (D-Bus,
+    // config reloads), so receivers never need to compare strings.
+    enum PropertyId {
+        PROPERTY_NONE = 0,
+        // [Main] section
+        PROPERTY_IGNORE_AUDIO,
+        PROPERTY_IGNORE_FULLSCREEN,
+        PROPERTY_WAIT_BEFORE_SLEEP,
+        PROPERTY_DISABLE_AUTOMATIC_DPMS_ACTIVATION,
+        PROPERTY_DISABLE_SCREENSAVER,
+        PROPERTY_WAKE_RESUMES_ACTIVITY,
+        // [Action ...] sections
+        PROPERTY_NAME,
+        PROPERTY_TRIGGER,
+        PROPERTY_EXEC,
+        PROPERTY_RESUME_EXEC,
+        PROPERTY_INHIBITED_BY,
+        PROPERTY_COUNT
+    };
+
+    // The D-Bus names of the properties, indexed by PropertyId
+    inline const char * const PROPERTY_NAMES[PROPERTY_COUNT] = {
+        NULL,
+        "IgnoreAudio",
+        "IgnoreFullscreen",
+        "WaitBeforeSleep",
+        "DisableAutomaticDPMSActivation",
+        "DisableScreensaver",
+        "WakeResumesActivity",
+        "Name",
+        "Trigger",
+        "Exec",
+        "ResumeExec",
+        "InhibitedBy",
+    };
+
+    // Returns PROPERTY_NONE if |name| is not a known property.
+    inline PropertyId property_id_from_name(const char *name) {
+        for (int i = 1; i < PROPERTY_COUNT; i++) {
+            if (std::strcmp(PROPERTY_NAMES[i], name) == 0) {
+                return (PropertyId)i;
+            }
+        }
+        return PROPERTY_NONE;
+    }
+
+    // Whether |property| is set on an [Action ...] section
+    inline bool is_action_property(PropertyId property) {
+        return property >= PROPERTY_NAME && property < PROPERTY_COUNT;
+    }
+
+    // Payload of ACTIVITY_TIMEOUT: the ID which was passed to
+    // ActivityDetector::add_idle_timeout().
+    struct TimeoutInfo {
+        int timeout_id;
+    };
+
+    // Payload of COMMAND_ADDED and COMMAND_REMOVED.
+    struct CommandInfo {
+        shared_ptr<Command> cmd;
+    };
+
+    // Payload of CONFIG_CHANGED and COMMAND_CHANGED. |cmd| is null for
+    // the settings of the [Main] section.
+    struct PropertyChangeInfo {
+        PropertyId property;
+        // The value before the change. Only valid while the event is
+        // being delivered.
+        GVariant *old_value;
+        shared_ptr<Command> cmd;
+    };
+
+    struct Event {
+        EventType type;
+        // When the event was produced, from g_get_monotonic_time()
+        gint64 timestamp;
+        std::variant<std::monostate, TimeoutInfo, CommandInfo, PropertyChangeInfo> payload;
+
+        // For the events which carry no payload. The detectors trace the
+        // events they create themselves; events are also made for config
+        // changes and copied for each session, which are not detections.
+        explicit Event(EventType type):
+            Event(type, g_get_monotonic_time())
+        {}
+        // For events which happened at another time than now, e.g. the
+        // ones which the replay tool feeds in on a virtual clock
+        Event(EventType type, gint64 timestamp):
+            type(type), timestamp(timestamp)
+        {}
+
+        static Event activity_timeout(int timeout_id) {
+            return activity_timeout(timeout_id, g_get_monotonic_time());
+        }
+        static Event activity_timeout(int timeout_id, gint64 timestamp) {
+            Event event(EVENT_ACTIVITY_TIMEOUT, timestamp);
+            event.payload = TimeoutInfo{timeout_id};
+            return event;
+        }
+        static Event command_added(shared_ptr<Command> cmd) {
+            Event event(EVENT_COMMAND_ADDED);
+            event.payload = CommandInfo{cmd};
+            return event;
+        }
+        static Event command_removed(shared_ptr<Command> cmd) {
+            Event event(EVENT_COMMAND_REMOVED);
+            event.payload = CommandInfo{cmd};
+            return event;
+        }
+        static Event config_changed(PropertyId property, GVariant *old_value) {
+            Event event(EVENT_CONFIG_CHANGED);
+            event.payload = PropertyChangeInfo{property, old_value, NULL};
+            return event;
+        }
+        static Event command_changed(shared_ptr<Command> cmd, PropertyId property, GVariant *old_value) {
+            Event event(EVENT_COMMAND_CHANGED);
+            event.payload = PropertyChangeInfo{property, old_value, cmd};
+            return event;
+        }
+
+        // These abort if the event carries a different payload.
+        const TimeoutInfo &timeout_info() const {
+            return std::get<TimeoutInfo>(payload);
+        }
+        const CommandInfo &command_info() const {
+            return std::get<CommandInfo>(payload);
+        }
+        const PropertyChangeInfo &property_change_info() const {
+            return std::get<PropertyChangeInfo>(payload);
+        }
     };
 
     class EventReceiver {
     public:
-        virtual void receive(EventType event, gpointer data) = 0;
+        virtual void receive(const Event &event) = 0;
+        // Bracket a burst of config events (a reload, or a batch of
+        // changes over D-Bus), so that a receiver can do the work which
+        // depends on the whole config once, at the end. Batches may nest.
+        virtual void begin_batch() {}
+        virtual void end_batch() {}
     protected:
         ~EventReceiver() = default;
     };
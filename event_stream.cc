@@ -0,0 +1,136 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+
+#include "command.h"
+#include "event_stream.h"
+#include "metrics.h"
+
+namespace Xidlechain {
+    static int command_id_of(const Event &event) {
+        switch (event.type) {
+        case EVENT_ACTIVITY_TIMEOUT:
+            return event.timeout_info().timeout_id;
+        case EVENT_COMMAND_ADDED:
+        case EVENT_COMMAND_REMOVED:
+            return event.command_info().cmd->id;
+        case EVENT_COMMAND_CHANGED: {
+            const shared_ptr<Command> &cmd = event.property_change_info().cmd;
+            return cmd ? cmd->id : 0;
+        }
+        default:
+            return 0;
+        }
+    }
+
+    size_t EventStream::format(const Event &event, const char *display, char *buffer, size_t size) {
+        int n = snprintf(buffer, size, "%lld %s %d %s\n",
+                         (long long)event.timestamp, EVENT_TYPE_NAMES[event.type], command_id_of(event),
+                         display && display[0] ? display : "-");
+        return n < 0 ? 0 : MIN((size_t)n, size - 1);
+    }
+
+    string EventStream::default_path() {
+        g_autofree gchar *path = g_build_filename(g_get_user_runtime_dir(), "xidlechain.events", NULL);
+        return path;
+    }
+
+    bool EventStream::start(const string &socket_path) {
+        g_return_val_if_fail(listen_fd < 0, FALSE);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            g_warning("Socket path is too long: %s", socket_path.c_str());
+            return false;
+        }
+        strcpy(addr.sun_path, socket_path.c_str());
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            g_warning("Could not create a socket: %s", g_strerror(errno));
+            return false;
+        }
+        // A previous instance which crashed may have left its socket behind
+        g_unlink(socket_path.c_str());
+        if (
+            bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || listen(fd, 8) < 0
+        ) {
+            g_warning("Could not listen on %s: %s", socket_path.c_str(), g_strerror(errno));
+            close(fd);
+            return false;
+        }
+        path = socket_path;
+        listen_fd = fd;
+        listen_source_id = g_unix_fd_add(listen_fd, G_IO_IN, static_on_client, this);
+        instance = this;
+        return true;
+    }
+
+    EventStream::~EventStream() {
+        if (listen_fd < 0) {
+            return;
+        }
+        if (instance == this) {
+            instance = NULL;
+        }
+        while (num_subscribers > 0) {
+            drop_subscriber(num_subscribers - 1);
+        }
+        g_source_remove(listen_source_id);
+        close(listen_fd);
+        g_unlink(path.c_str());
+    }
+
+    gboolean EventStream::static_on_client(gint fd, GIOCondition condition, gpointer user_data) {
+        EventStream *_this = (EventStream*)user_data;
+        int client_fd;
+        while ((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            if (_this->num_subscribers == MAX_SUBSCRIBERS) {
+                g_debug("Too many event subscribers");
+                close(client_fd);
+                continue;
+            }
+            int size = SEND_BUFFER_SIZE;
+            setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+            _this->subscribers[_this->num_subscribers++] = client_fd;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            g_warning("Could not accept an event subscriber: %s", g_strerror(errno));
+        }
+        return G_SOURCE_CONTINUE;
+    }
+
+    void EventStream::drop_subscriber(int index) {
+        close(subscribers[index]);
+        // The order of the subscribers doesn't matter
+        subscribers[index] = subscribers[--num_subscribers];
+    }
+
+    void EventStream::send(const Event &event, const char *display) {
+        if (num_subscribers == 0) {
+            return;
+        }
+        char record[MAX_RECORD_SIZE];
+        size_t len = format(event, display, record, sizeof(record));
+        for (int i = num_subscribers - 1; i >= 0; i--) {
+            if (::send(subscribers[i], record, len, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                g_info("Disconnecting an event subscriber which fell behind");
+                Metrics::event_subscribers_dropped++;
+            } else if (errno != EPIPE && errno != ECONNRESET) {
+                g_debug("Could not send an event: %s", g_strerror(errno));
+            }
+            drop_subscriber(i);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _EVENT_STREAM_H_
+#define _EVENT_STREAM_H_
+
+#include <cstddef>
+#include <string>
+
+#include <glib.h>
+
+#include "event_receiver.h"
+
+using std::size_t;
+using std::string;
+
+namespace Xidlechain {
+    // Pushes every event which the EventManagers receive to the clients
+    // of a Unix SOCK_SEQPACKET socket, so that scripts can react to idle,
+    // lock and sleep transitions without polling or D-Bus. Each event is
+    // one packet holding one line:
+    //
+    //     <timestamp in us, CLOCK_MONOTONIC> <event type> <command ID> <display>
+    //
+    // where the command ID is 0 if the event isn't about a command, and
+    // the display is the X display of the EventManager (or "-" if it is
+    // unknown), which tells the displays apart in multi-display mode. A
+    // record is formatted once, on the stack, and sent to every client
+    // without blocking. A client which doesn't keep up fills its socket
+    // buffer and is disconnected, instead of being buffered for.
+    class EventStream {
+    public:
+        static constexpr int MAX_SUBSCRIBERS = 32;
+        // The kernel also caps the queue of each subscriber at
+        // net.unix.max_dgram_qlen packets, whichever is hit first
+        static constexpr int SEND_BUFFER_SIZE = 16384;
+        static constexpr size_t MAX_RECORD_SIZE = 128;
+    private:
+        // The stream which publish() sends to, if any
+        static inline EventStream *instance = NULL;
+        string path;
+        int listen_fd = -1;
+        guint listen_source_id = 0;
+        int subscribers[MAX_SUBSCRIBERS];
+        int num_subscribers = 0;
+
+        static gboolean static_on_client(gint fd, GIOCondition condition, gpointer user_data);
+        void drop_subscriber(int index);
+    public:
+        EventStream() = default;
+        ~EventStream();
+        EventStream(const EventStream&) = delete;
+        EventStream& operator=(const EventStream&) = delete;
+
+        // The socket which start() uses by default
+        static string default_path();
+        // Replaces any stale socket at |path| and starts accepting
+        // subscribers.
+        bool start(const string &path);
+        void send(const Event &event, const char *display);
+        int get_num_subscribers() const { return num_subscribers; }
+
+        // Writes the record for |event| on |display| into |buffer| and
+        // returns its length
+        static size_t format(const Event &event, const char *display, char *buffer, size_t size);
+        // Called by the EventManagers; does nothing unless a stream was
+        // started
+        static void publish(const Event &event, const char *display) {
+            if (instance) {
+                instance->send(event, display);
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include <cstdlib>
+#include <cstring>
+#include <glib.h>
+#include "fullscreen_detector.h"
+#include "trace.h"
+
+using std::free;
+using std::strlen;
+
+namespace Xidlechain {
+    EwmhFullscreenDetector::EwmhFullscreenDetector(XConnection *connection):
+        event_receiver(NULL),
+        connection(connection),
+        conn(NULL),
+        root_window(XCB_NONE),
+        active_window(XCB_NONE),
+        net_active_window_atom(XCB_NONE),
+        net_wm_state_atom(XCB_NONE),
+        net_wm_state_fullscreen_atom(XCB_NONE),
+        is_fullscreen(false)
+    {}
+
+    EwmhFullscreenDetector::~EwmhFullscreenDetector() {
+        if (conn) {
+            connection->remove_event_handler(this);
+            watch_active_window(XCB_NONE);
+        }
+    }
+
+    bool EwmhFullscreenDetector::init(EventReceiver *receiver) {
+        g_return_val_if_fail(receiver != NULL, FALSE);
+        event_receiver = receiver;
+
+        conn = connection->get_connection();
+        g_return_val_if_fail(conn != NULL, FALSE);
+        root_window = connection->get_root_window();
+
+        // Send all of the requests before waiting for any of the replies
+        const char *atom_names[] = {
+            "_NET_ACTIVE_WINDOW",
+            "_NET_WM_STATE",
+            "_NET_WM_STATE_FULLSCREEN",
+        };
+        xcb_atom_t *atoms[] = {
+            &net_active_window_atom,
+            &net_wm_state_atom,
+            &net_wm_state_fullscreen_atom,
+        };
+        xcb_intern_atom_cookie_t atom_cookies[G_N_ELEMENTS(atom_names)];
+        for (size_t i = 0; i < G_N_ELEMENTS(atom_names); i++) {
+            atom_cookies[i] = xcb_intern_atom(
+                conn, 0, strlen(atom_names[i]), atom_names[i]);
+        }
+        xcb_get_window_attributes_cookie_t attrs_cookie =
+            xcb_get_window_attributes(conn, root_window);
+        for (size_t i = 0; i < G_N_ELEMENTS(atom_names); i++) {
+            xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(conn, atom_cookies[i], NULL);
+            if (reply) {
+                *atoms[i] = reply->atom;
+                free(reply);
+            }
+        }
+
+        // Keep any events which were already selected on the root window,
+        // since the event mask replaces the whole mask for our client.
+        xcb_get_window_attributes_reply_t *attrs =
+            xcb_get_window_attributes_reply(conn, attrs_cookie, NULL);
+        if (!attrs) {
+            g_critical("Could not get root window attributes");
+            return false;
+        }
+        uint32_t event_mask = attrs->your_event_mask | XCB_EVENT_MASK_PROPERTY_CHANGE;
+        free(attrs);
+        xcb_change_window_attributes(conn, root_window, XCB_CW_EVENT_MASK, &event_mask);
+        connection->add_event_handler(this);
+
+        watch_active_window(get_active_window());
+        update_fullscreen_state();
+        return true;
+    }
+
+    xcb_window_t EwmhFullscreenDetector::get_active_window() {
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(
+            conn,
+            xcb_get_property(conn, 0, root_window, net_active_window_atom,
+                             XCB_ATOM_WINDOW, 0, 1),
+            NULL);
+        xcb_window_t window = XCB_NONE;
+        if (reply && reply->type == XCB_ATOM_WINDOW && reply->format == 32
+            && xcb_get_property_value_length(reply) == sizeof(xcb_window_t))
+        {
+            window = *(xcb_window_t*)xcb_get_property_value(reply);
+        }
+        free(reply);
+        return window;
+    }
+
+    bool EwmhFullscreenDetector::window_is_fullscreen(xcb_window_t window) {
+        // The window may be destroyed at any time, in which case we get
+        // an error instead of a reply.
+        xcb_generic_error_t *error = NULL;
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(
+            conn,
+            xcb_get_property(conn, 0, window, net_wm_state_atom,
+                             XCB_ATOM_ATOM, 0, 64),
+            &error);
+        free(error);
+        bool fullscreen = false;
+        if (reply && reply->type == XCB_ATOM_ATOM && reply->format == 32) {
+            xcb_atom_t *states = (xcb_atom_t*)xcb_get_property_value(reply);
+            int num_items = xcb_get_property_value_length(reply) / sizeof(xcb_atom_t);
+            for (int i = 0; i < num_items; i++) {
+                if (states[i] == net_wm_state_fullscreen_atom) {
+                    fullscreen = true;
+                    break;
+                }
+            }
+        }
+        free(reply);
+        return fullscreen;
+    }
+
+    void EwmhFullscreenDetector::watch_active_window(xcb_window_t window) {
+        if (window == active_window) {
+            return;
+        }
+        // Errors for windows which were destroyed in the meantime are
+        // dropped by the XConnection.
+        if (active_window != XCB_NONE) {
+            uint32_t event_mask = XCB_EVENT_MASK_NO_EVENT;
+            xcb_change_window_attributes(conn, active_window, XCB_CW_EVENT_MASK, &event_mask);
+        }
+        if (window != XCB_NONE) {
+            uint32_t event_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+            xcb_change_window_attributes(conn, window, XCB_CW_EVENT_MASK, &event_mask);
+        }
+        active_window = window;
+    }
+
+    void EwmhFullscreenDetector::update_fullscreen_state() {
+        bool fullscreen = active_window != XCB_NONE && window_is_fullscreen(active_window);
+        if (fullscreen == is_fullscreen) {
+            return;
+        }
+        is_fullscreen = fullscreen;
+        if (fullscreen) {
+            g_info("Active window 0x%x is fullscreen", active_window);
+            Trace::record(TRACE_DETECTED, EVENT_FULLSCREEN_ENTERED, 0);
+            event_receiver->receive(Event(EVENT_FULLSCREEN_ENTERED));
+        } else {
+            g_info("Active window is no longer fullscreen");
+            Trace::record(TRACE_DETECTED, EVENT_FULLSCREEN_EXITED, 0);
+            event_receiver->receive(Event(EVENT_FULLSCREEN_EXITED));
+        }
+    }
+
+    void EwmhFullscreenDetector::handle_x_event(const xcb_generic_event_t *event) {
+        if ((event->response_type & ~0x80) != XCB_PROPERTY_NOTIFY) {
+            return;
+        }
+        const xcb_property_notify_event_t *prop_event =
+            reinterpret_cast<const xcb_property_notify_event_t*>(event);
+        if (prop_event->window == root_window
+            && prop_event->atom == net_active_window_atom)
+        {
+            watch_active_window(get_active_window());
+            update_fullscreen_state();
+        } else if (prop_event->window == active_window
+                   && prop_event->atom == net_wm_state_atom)
+        {
+            update_fullscreen_state();
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef _FULLSCREEN_DETECTOR_H_
+#define _FULLSCREEN_DETECTOR_H_
+
+#include <xcb/xcb.h>
+#include "event_receiver.h"
+#include "x_connection.h"
+
+namespace Xidlechain {
+    class FullscreenDetector {
+    public:
+        // Emits a FULLSCREEN_ENTERED event when the focused window becomes
+        // fullscreen, and a FULLSCREEN_EXITED event when the focused window
+        // is no longer fullscreen (or another window receives focus).
+        virtual bool init(EventReceiver *receiver) = 0;
+    protected:
+        virtual ~FullscreenDetector() = default;
+    };
+
+    // Relies on the window manager to maintain the EWMH _NET_ACTIVE_WINDOW
+    // and _NET_WM_STATE properties. Only PropertyNotify events are used,
+    // so nothing is polled.
+    class EwmhFullscreenDetector: public FullscreenDetector, public XEventHandler {
+        EventReceiver *event_receiver;
+        XConnection *connection;
+        xcb_connection_t *conn;
+        xcb_window_t root_window;
+        // The window whose _NET_WM_STATE we are currently watching
+        xcb_window_t active_window;
+        xcb_atom_t net_active_window_atom,
+                   net_wm_state_atom,
+                   net_wm_state_fullscreen_atom;
+        bool is_fullscreen;
+
+        xcb_window_t get_active_window();
+        bool window_is_fullscreen(xcb_window_t window);
+        void watch_active_window(xcb_window_t window);
+        void update_fullscreen_state();
+    public:
+        EwmhFullscreenDetector(XConnection *connection);
+        ~EwmhFullscreenDetector();
+        EwmhFullscreenDetector(const EwmhFullscreenDetector&) = delete;
+        EwmhFullscreenDetector& operator=(const EwmhFullscreenDetector&) = delete;
+
+        bool init(EventReceiver *receiver) override;
+        void handle_x_event(const xcb_generic_event_t *event) override;
+    };
+}
+
+#endif
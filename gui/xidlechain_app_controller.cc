@@ -58,20 +58,21 @@ static void show_error_dialog(GtkWindow *parent, const char *message) {
     gtk_widget_destroy (dialog);
 }
 
-bool XidlechainAppController::set_action_property(
-    GDBusProxy *action_proxy,
-    const char *property_name,
-    const char *value,
+// Sets the |properties| (a{sv}) of an action in a single ApplyChanges
+// call, so that the daemon only reconciles and saves once.
+bool XidlechainAppController::set_action_properties(
+    int action_id,
+    GVariant *properties,
     string &error_message
 ) {
     g_autoptr(GError) err = NULL;
+    GVariantBuilder changes;
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a(isa{sv})"));
+    g_variant_builder_add(&changes, "(is@a{sv})", action_id, "set", properties);
     g_autoptr(GVariant) res = g_dbus_proxy_call_sync(
-        action_proxy,
-        "org.freedesktop.DBus.Properties.Set",
-        g_variant_new("(ssv)",
-                      Xidlechain::DBUS_ACTION_IFACE,
-                      property_name,
-                      g_variant_new_string(value)),
+        proxy,
+        "ApplyChanges",
+        g_variant_new("(a(isa{sv}))", &changes),
         G_DBUS_CALL_FLAGS_NONE,
         -1,
         NULL,
@@ -81,7 +82,17 @@ bool XidlechainAppController::set_action_property(
         error_message = string(err->message);
         return false;
     }
-    return true;
+    gboolean applied;
+    g_autoptr(GVariantIter) results = NULL;
+    g_variant_get(res, "(ba(is))", &applied, &results);
+    gint id;
+    const gchar *error;
+    while (g_variant_iter_loop(results, "(i&s)", &id, &error)) {
+        if (error[0] != '\0') {
+            error_message = string(error);
+        }
+    }
+    return applied;
 }
 
 void XidlechainAppController::static_on_action_edit_clicked(GtkButton*, gpointer user_data) {
@@ -144,81 +155,75 @@ bool XidlechainAppController::on_action_edited(XidlechainAppEditAction *dialog,
             return false;
         }
     }
-    g_autofree gchar *object_path = g_strdup_printf("%s/action/%d", Xidlechain::DBUS_OBJECT_BASE_PATH, cmd->id);
-    g_autoptr(GDBusProxy) action_proxy = g_dbus_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SESSION,
-        G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-        NULL,
-        Xidlechain::DBUS_BUS_NAME,
-        object_path,
-        "org.freedesktop.DBus.Properties",
-        NULL,
-        &error
-    );
-    if (error) {
-        show_error_dialog(GTK_WINDOW(dialog), error->message);
-        return false;
-    }
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+    bool changed = false;
 
     const char *name = gtk_entry_get_text(GTK_ENTRY(name_entry));
-    if (g_strcmp0(name, cmd->name.c_str()) != 0) {
-        if (!set_action_property(action_proxy, "Name", name, error_message)) {
-            show_error_dialog(GTK_WINDOW(dialog), error_message.c_str());
-            return false;
-        }
-        cmd->name = string(name);
-        GtkWidget *name_label = id_to_action_info.find(cmd->id)->second.name_label;
-        gtk_label_set_text(GTK_LABEL(name_label), name);
+    bool name_changed = g_strcmp0(name, cmd->name.c_str()) != 0;
+    if (name_changed) {
+        g_variant_builder_add(&properties, "{sv}", "Name", g_variant_new_string(name));
+        changed = true;
     }
 
-    g_autofree gchar *trigger_str = NULL;
     int timeout_ms = timeout_sec * 1000;
     if (trigger != cmd->trigger || (trigger == Command::TIMEOUT && timeout_ms != cmd->timeout_ms)) {
-        trigger_str = Command::static_get_trigger_str(trigger, timeout_ms);
-        if (!set_action_property(action_proxy, "Trigger", trigger_str, error_message)) {
-            show_error_dialog(GTK_WINDOW(dialog), error_message.c_str());
-            return false;
-        }
-        cmd->trigger = trigger;
-        if (trigger == Command::TIMEOUT) {
-            cmd->timeout_ms = timeout_ms;
-        }
+        g_autofree gchar *trigger_str = Command::static_get_trigger_str(trigger, timeout_ms);
+        g_variant_builder_add(&properties, "{sv}", "Trigger", g_variant_new_string(trigger_str));
+        changed = true;
     }
 
     const char *activate_str = gtk_entry_get_text(GTK_ENTRY(activate_entry));
-    if (
+    bool activate_changed =
         (activate_str[0] != '\0' && !cmd->activation_action)
         || (
             cmd->activation_action
             && g_strcmp0(activate_str, cmd->activation_action->get_cmd_str()) != 0
-        )
-    ) {
-        if (!set_action_property(action_proxy, "Exec", activate_str, error_message)) {
-
-            show_error_dialog(GTK_WINDOW(dialog), error_message.c_str());
-            return false;
-        }
-        cmd->activation_action = Command::Action::factory(activate_str, &error);
-        g_assert(error == NULL);
+        );
+    if (activate_changed) {
+        g_variant_builder_add(&properties, "{sv}", "Exec", g_variant_new_string(activate_str));
+        changed = true;
     }
 
     const char *deactivate_str = gtk_entry_get_text(GTK_ENTRY(deactivate_entry));
-    if (
+    bool deactivate_changed =
         (deactivate_str[0] != '\0' && !cmd->deactivation_action)
         || (
             cmd->deactivation_action
             && g_strcmp0(deactivate_str, cmd->deactivation_action->get_cmd_str()) != 0
-        )
-    ) {
-        if (!set_action_property(action_proxy, "ResumeExec", deactivate_str, error_message)) {
+        );
+    if (deactivate_changed) {
+        g_variant_builder_add(&properties, "{sv}", "ResumeExec", g_variant_new_string(deactivate_str));
+        changed = true;
+    }
 
-            show_error_dialog(GTK_WINDOW(dialog), error_message.c_str());
-            return false;
-        }
+    if (!changed) {
+        g_variant_builder_clear(&properties);
+        return true;
+    }
+    if (!set_action_properties(cmd->id, g_variant_builder_end(&properties), error_message)) {
+        show_error_dialog(GTK_WINDOW(dialog), error_message.c_str());
+        return false;
+    }
+
+    // Either all of the changes were applied, or none were
+    if (name_changed) {
+        cmd->name = string(name);
+        GtkWidget *name_label = id_to_action_info.find(cmd->id)->second.name_label;
+        gtk_label_set_text(GTK_LABEL(name_label), name);
+    }
+    cmd->trigger = trigger;
+    if (trigger == Command::TIMEOUT) {
+        cmd->timeout_ms = timeout_ms;
+    }
+    if (activate_changed) {
+        cmd->activation_action = Command::Action::factory(activate_str, &error);
+        g_assert(error == NULL);
+    }
+    if (deactivate_changed) {
         cmd->deactivation_action = Command::Action::factory(deactivate_str, &error);
         g_assert(error == NULL);
     }
-
     return true;
 }
 
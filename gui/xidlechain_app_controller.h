@@ -34,10 +34,9 @@ class XidlechainAppController {
     void on_action_edit_clicked(gpointer user_data);
     void on_action_delete_clicked(gpointer user_data);
     bool on_action_edited(_XidlechainAppEditAction *dialog, std::shared_ptr<Xidlechain::Command> cmd);
-    bool set_action_property(
-        GDBusProxy *action_proxy,
-        const char *property_name,
-        const char *value,
+    bool set_action_properties(
+        int action_id,
+        GVariant *properties,
         std::string &error_message
     );
 public:
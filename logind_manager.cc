@@ -6,25 +6,81 @@
 #include <gio/gunixfdlist.h>
 
 #include "app.h"
-#include "defer.h"
 #include "event_receiver.h"
 #include "logind_manager.h"
+#include "metrics.h"
+#include "probes.h"
+#include "service_notifier.h"
+#include "startup_timeline.h"
+#include "trace.h"
+
+// Returns true if |what|, a colon-separated list of inhibitor lock types
+// (e.g. "sleep:idle"), contains the "idle" lock type.
+static bool contains_idle_lock(const char *what) {
+    g_auto(GStrv) lock_types = g_strsplit(what, ":", -1);
+    return g_strv_contains(lock_types, "idle");
+}
+
+// Strips the screen number, if any, so that ":1.0" matches ":1".
+static string display_without_screen(const char *display_name) {
+    string display(display_name);
+    size_t colon_pos = display.rfind(':');
+    size_t dot_pos = display.rfind('.');
+    if (colon_pos != string::npos && dot_pos != string::npos && dot_pos > colon_pos) {
+        display.erase(dot_pos);
+    }
+    return display;
+}
+
+static bool is_cancelled(const GError *error) {
+    return g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+}
 
 namespace Xidlechain {
+    struct InhibitorQuery {
+        DbusLogindManager *manager;
+        guint serial;
+    };
+
+    // Looks up the Display property of every session in parallel.
+    struct SessionLookup {
+        DbusLogindManager *manager;
+        int num_pending;
+        bool found;
+    };
+
+    struct SessionDisplayQuery {
+        SessionLookup *lookup;
+        gchar *session_object_path;
+    };
+
     const char * const DbusLogindManager::BUS_NAME = "org.freedesktop.login1",
                * const DbusLogindManager::MANAGER_OBJECT_PATH = "/org/freedesktop/login1",
                * const DbusLogindManager::MANAGER_INTERFACE_NAME = "org.freedesktop.login1.Manager",
                * const DbusLogindManager::SESSION_INTERFACE_NAME = "org.freedesktop.login1.Session";
 
-    DbusLogindManager::DbusLogindManager():
+    DbusLogindManager::DbusLogindManager(const char *display_name):
         event_receiver(NULL),
+        display_name(display_name ? display_without_screen(display_name) : ""),
         manager_proxy(NULL),
         session_proxy(NULL),
-        sleep_lock_fd(-1)
+        cancellable(g_cancellable_new()),
+        sleep_lock_fd(-1),
+        sleep_lock_pending(false),
+        sleep_lock_enabled(true),
+        holding_ready(false),
+        idle_inhibited(false),
+        inhibitor_query_serial(0)
     {}
 
     DbusLogindManager::~DbusLogindManager() {
+        g_cancellable_cancel(cancellable);
+        g_object_unref(cancellable);
         if (manager_proxy) {
+            GDBusConnection *conn = g_dbus_proxy_get_connection(manager_proxy);
+            for (guint id : signal_subscription_ids) {
+                g_dbus_connection_signal_unsubscribe(conn, id);
+            }
             g_object_unref(manager_proxy);
         }
         if (session_proxy) {
@@ -33,82 +89,249 @@ namespace Xidlechain {
         if (sleep_lock_fd >= 0) {
             close(sleep_lock_fd);
         }
+        release_ready();
     }
 
-    bool DbusLogindManager::get_session_object_path(char **result) {
-        char *session_id = getenv("XDG_SESSION_ID");
-        if (session_id && session_id[0] != '\0') {
-            g_autoptr(GError) err = NULL;
-            g_autoptr(GVariant) res = g_dbus_proxy_call_sync(
-                manager_proxy,
-                "GetSession",
-                g_variant_new("(s)", session_id),
-                G_DBUS_CALL_FLAGS_NONE,
-                -1,
-                NULL,
-                &err);
-            if (err) {
-                g_warning(err->message);
-                return false;
-            }
-            g_variant_get(res, "(o)", result);
-        } else {
-            *result = g_strdup("/org/freedesktop/login1/session/auto");
-        }
-        return true;
-    }
-
+    // None of the steps below block; the independent ones (e.g. acquiring
+    // the sleep lock and looking up our session) run concurrently.
     bool DbusLogindManager::init(EventReceiver *receiver) {
         g_return_val_if_fail(receiver != NULL, FALSE);
         event_receiver = receiver;
+        // Dependent units shouldn't start before we can delay sleep
+        ServiceNotifier::hold_ready();
+        holding_ready = true;
 
-        GError *err = NULL;
-        g_autofree gchar *session_object_path = NULL;
-        Defer defer([&]{
-            if (err) {
-                g_warning(err->message);
-                g_error_free(err);
-            }
-        });
-
-        manager_proxy = g_dbus_proxy_new_for_bus_sync(
+        g_dbus_proxy_new_for_bus(
             G_BUS_TYPE_SYSTEM,
             G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
             NULL,
             BUS_NAME,
             MANAGER_OBJECT_PATH,
             MANAGER_INTERFACE_NAME,
+            cancellable,
+            manager_proxy_ready_cb,
+            this
+        );
+        return true;
+    }
+
+    void DbusLogindManager::manager_proxy_ready_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
+        g_autoptr(GError) error = NULL;
+        GDBusProxy *proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
+        if (is_cancelled(error)) {
+            return;
+        } else if (error) {
+            g_warning("Could not connect to logind: %s", error->message);
+            _this->release_ready();
+            return;
+        }
+        _this->manager_proxy = proxy;
+        StartupTimeline::mark("logind manager proxy ready");
+
+        // subscribe to the PrepareForSleep signal
+        _this->subscribe_to_prepare_for_sleep_signal();
+        // Track "idle" block inhibitors held by other programs (e.g.
+        // presentation tools). The initial state has to be queried
+        // explicitly; after that we only react to PropertiesChanged.
+        _this->subscribe_to_properties_changed_signal();
+        _this->query_idle_inhibitors();
+        // acquire an Inhibitor lock
+        if (_this->sleep_lock_enabled) {
+            _this->acquire_sleep_lock();
+        } else {
+            _this->release_ready();
+        }
+
+        char *session_id = getenv("XDG_SESSION_ID");
+        if (!_this->display_name.empty()) {
+            _this->find_session_by_display();
+        } else if (session_id && session_id[0] != '\0') {
+            g_dbus_proxy_call(
+                _this->manager_proxy,
+                "GetSession",
+                g_variant_new("(s)", session_id),
+                G_DBUS_CALL_FLAGS_NONE,
+                -1,
+                _this->cancellable,
+                get_session_cb,
+                _this
+            );
+        } else {
+            _this->create_session_proxy("/org/freedesktop/login1/session/auto");
+        }
+    }
+
+    void DbusLogindManager::get_session_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) result = g_dbus_proxy_call_finish(
+            G_DBUS_PROXY(source_object), res, &error);
+        if (is_cancelled(error)) {
+            return;
+        } else if (error) {
+            g_warning("Could not get logind session: %s", error->message);
+            return;
+        }
+        const gchar *session_object_path;
+        g_variant_get(result, "(&o)", &session_object_path);
+        _this->create_session_proxy(session_object_path);
+    }
+
+    // logind has no method to look up a session by its display, so we
+    // ask every session for its Display property.
+    void DbusLogindManager::find_session_by_display() {
+        g_dbus_proxy_call(
+            manager_proxy,
+            "ListSessions",
             NULL,
-            &err
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            list_sessions_cb,
+            this
         );
-        if (err) return false;
+    }
 
-        if (!get_session_object_path(&session_object_path)) return false;
+    void DbusLogindManager::list_sessions_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) result = g_dbus_proxy_call_finish(
+            G_DBUS_PROXY(source_object), res, &error);
+        if (is_cancelled(error)) {
+            return;
+        } else if (error) {
+            g_warning("Could not list logind sessions: %s", error->message);
+            return;
+        }
+        GDBusConnection *conn = g_dbus_proxy_get_connection(_this->manager_proxy);
+        SessionLookup *lookup = g_new(SessionLookup, 1);
+        lookup->manager = _this;
+        lookup->num_pending = 0;
+        lookup->found = false;
+        g_autoptr(GVariantIter) iter = NULL;
+        const gchar *session_id, *user_name, *seat_id, *session_object_path;
+        guint32 uid;
+        g_variant_get(result, "(a(susso))", &iter);
+        while (g_variant_iter_loop(iter, "(&su&s&s&o)", &session_id, &uid,
+                                   &user_name, &seat_id, &session_object_path))
+        {
+            SessionDisplayQuery *query = g_new(SessionDisplayQuery, 1);
+            query->lookup = lookup;
+            query->session_object_path = g_strdup(session_object_path);
+            lookup->num_pending++;
+            g_dbus_connection_call(
+                conn,
+                BUS_NAME,
+                session_object_path,
+                "org.freedesktop.DBus.Properties",
+                "Get",
+                g_variant_new("(ss)", SESSION_INTERFACE_NAME, "Display"),
+                G_VARIANT_TYPE("(v)"),
+                G_DBUS_CALL_FLAGS_NONE,
+                -1,
+                _this->cancellable,
+                get_session_display_cb,
+                query
+            );
+        }
+        if (lookup->num_pending == 0) {
+            g_warning("No logind session found for display %s", _this->display_name.c_str());
+            g_free(lookup);
+        }
+    }
 
-        session_proxy = g_dbus_proxy_new_for_bus_sync(
-            G_BUS_TYPE_SYSTEM,
+    void DbusLogindManager::get_session_display_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        SessionDisplayQuery *query = static_cast<SessionDisplayQuery*>(user_data);
+        g_autofree gchar *session_object_path = query->session_object_path;
+        SessionLookup *lookup = query->lookup;
+        g_free(query);
+        lookup->num_pending--;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) result = g_dbus_connection_call_finish(
+            G_DBUS_CONNECTION(source_object), res, &error);
+        if (is_cancelled(error)) {
+            // The manager is gone
+            if (lookup->num_pending == 0) {
+                g_free(lookup);
+            }
+            return;
+        }
+        DbusLogindManager *_this = lookup->manager;
+        if (result && !lookup->found) {
+            g_autoptr(GVariant) value = NULL;
+            g_variant_get(result, "(v)", &value);
+            if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)
+                && display_without_screen(g_variant_get_string(value, NULL)) == _this->display_name)
+            {
+                lookup->found = true;
+                _this->create_session_proxy(session_object_path);
+            }
+        }
+        // Sessions may disappear while we are asking them, so errors are
+        // only a problem if no session matched.
+        if (lookup->num_pending == 0) {
+            if (!lookup->found) {
+                g_warning("No logind session found for display %s", _this->display_name.c_str());
+            }
+            g_free(lookup);
+        }
+    }
+
+    void DbusLogindManager::create_session_proxy(const char *session_object_path) {
+        g_dbus_proxy_new(
+            g_dbus_proxy_get_connection(manager_proxy),
             G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
             NULL,
             BUS_NAME,
             session_object_path,
             SESSION_INTERFACE_NAME,
-            NULL,
-            &err
+            cancellable,
+            session_proxy_ready_cb,
+            this
         );
-        if (err) return false;
+    }
 
-        // subscribe to Lock, Unlock, and PrepareForSleep signals
-        // TODO: unsubscribe from these signals in the destructor
-        subscribe_to_lock_and_unlock_signals(session_object_path);
-        subscribe_to_prepare_for_sleep_signal();
-        // acquire an Inhibitor lock
-        if (!acquire_sleep_lock()) return false;
-        return true;
+    void DbusLogindManager::session_proxy_ready_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
+        g_autoptr(GError) error = NULL;
+        GDBusProxy *proxy = g_dbus_proxy_new_finish(res, &error);
+        if (is_cancelled(error)) {
+            return;
+        } else if (error) {
+            g_warning("Could not connect to logind session: %s", error->message);
+            return;
+        }
+        _this->session_proxy = proxy;
+        StartupTimeline::mark("logind session proxy ready");
+        // subscribe to Lock and Unlock signals
+        _this->subscribe_to_lock_and_unlock_signals(
+            g_dbus_proxy_get_object_path(_this->session_proxy));
     }
 
     void DbusLogindManager::subscribe_to_prepare_for_sleep_signal() {
         GDBusConnection *manager_conn = g_dbus_proxy_get_connection(manager_proxy);
-        g_dbus_connection_signal_subscribe(
+        guint id = g_dbus_connection_signal_subscribe(
             manager_conn,
             BUS_NAME,
             MANAGER_INTERFACE_NAME,
@@ -120,13 +343,32 @@ namespace Xidlechain {
             this,
             NULL
         );
+        signal_subscription_ids.push_back(id);
+    }
+
+    void DbusLogindManager::subscribe_to_properties_changed_signal() {
+        GDBusConnection *manager_conn = g_dbus_proxy_get_connection(manager_proxy);
+        guint id = g_dbus_connection_signal_subscribe(
+            manager_conn,
+            BUS_NAME,
+            "org.freedesktop.DBus.Properties",
+            "PropertiesChanged",
+            MANAGER_OBJECT_PATH,
+            // arg0 is the name of the interface whose properties changed
+            MANAGER_INTERFACE_NAME,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            login1_manager_properties_changed_cb,
+            this,
+            NULL
+        );
+        signal_subscription_ids.push_back(id);
     }
 
     void DbusLogindManager::subscribe_to_lock_and_unlock_signals(const char *session_object_path) {
         GDBusConnection *session_conn = g_dbus_proxy_get_connection(session_proxy);
         const char *signal_names[] = {"Lock", "Unlock"};
         for (int i = 0; i < 2; i++) {
-            g_dbus_connection_signal_subscribe(
+            guint id = g_dbus_connection_signal_subscribe(
                 session_conn,
                 BUS_NAME,
                 SESSION_INTERFACE_NAME,
@@ -138,26 +380,17 @@ namespace Xidlechain {
                 this,
                 NULL
             );
+            signal_subscription_ids.push_back(id);
         }
     }
 
-    bool DbusLogindManager::acquire_sleep_lock() {
-        if (sleep_lock_fd >= 0) return true;
-
-        GError *err = NULL;
-        g_autoptr(GVariant) res = NULL;
-        g_autoptr(GUnixFDList) fd_list = NULL;
-        gint32 fd_index = 0;
-        Defer defer([&]{
-            if (err) {
-                g_warning(err->message);
-                g_error_free(err);
-            }
-        });
+    void DbusLogindManager::acquire_sleep_lock() {
+        if (sleep_lock_fd >= 0 || sleep_lock_pending) return;
+        sleep_lock_pending = true;
 
         // Apparently you have to use the unix_fd_list version to
         // actually extract the fd
-        res = g_dbus_proxy_call_with_unix_fd_list_sync(
+        g_dbus_proxy_call_with_unix_fd_list(
             manager_proxy,
             "Inhibit",
             g_variant_new(
@@ -170,21 +403,185 @@ namespace Xidlechain {
             G_DBUS_CALL_FLAGS_NONE,
             -1,
             NULL,
-            &fd_list,
-            NULL,
-            &err
+            cancellable,
+            inhibit_cb,
+            this
         );
-        if (err) return false;
-        g_variant_get(res, "(h)", &fd_index);
+    }
+
+    void DbusLogindManager::release_ready() {
+        if (holding_ready) {
+            holding_ready = false;
+            ServiceNotifier::release_ready();
+        }
+    }
+
+    void DbusLogindManager::inhibit_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GUnixFDList) fd_list = NULL;
+        gint32 fd_index = 0;
+        g_autoptr(GVariant) result = g_dbus_proxy_call_with_unix_fd_list_finish(
+            G_DBUS_PROXY(source_object), &fd_list, res, &error);
+        if (is_cancelled(error)) {
+            return;
+        }
+        _this->sleep_lock_pending = false;
+        // Whether or not we got the lock, there's no point in waiting
+        _this->release_ready();
+        if (error) {
+            g_warning("Could not acquire sleep lock: %s", error->message);
+            return;
+        }
+        g_variant_get(result, "(h)", &fd_index);
         // I'm not sure why we need to duplicate the file descriptor,
         // but apparently it's necessary...
-        sleep_lock_fd = g_unix_fd_list_get(fd_list, fd_index, &err);
-        if (err) return false;
-        return true;
+        _this->sleep_lock_fd = g_unix_fd_list_get(fd_list, fd_index, &error);
+        if (error) {
+            g_warning("Could not acquire sleep lock: %s", error->message);
+            return;
+        }
+        StartupTimeline::mark("logind sleep lock acquired");
+        _this->query_inhibit_delay();
+        if (!_this->sleep_lock_enabled) {
+            // It was disabled while the call was in flight
+            _this->set_sleep_lock_enabled(false);
+        }
+    }
+
+    // The budget against which the sleep pipeline is measured. It is only
+    // read for the metrics, so failures aren't worth a warning.
+    void DbusLogindManager::query_inhibit_delay() {
+        g_dbus_connection_call(
+            g_dbus_proxy_get_connection(manager_proxy),
+            BUS_NAME,
+            MANAGER_OBJECT_PATH,
+            "org.freedesktop.DBus.Properties",
+            "Get",
+            g_variant_new("(ss)", MANAGER_INTERFACE_NAME, "InhibitDelayMaxUSec"),
+            G_VARIANT_TYPE("(v)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            inhibit_delay_cb,
+            this
+        );
+    }
+
+    void DbusLogindManager::inhibit_delay_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) result = g_dbus_connection_call_finish(
+            G_DBUS_CONNECTION(source_object), res, &error);
+        if (error) {
+            g_debug("Could not get InhibitDelayMaxUSec: %s", error->message);
+            return;
+        }
+        g_autoptr(GVariant) value = NULL;
+        g_variant_get(result, "(v)", &value);
+        if (!g_variant_is_of_type(value, G_VARIANT_TYPE_UINT64)) {
+            g_debug("InhibitDelayMaxUSec has the wrong type");
+            return;
+        }
+        Metrics::sleep_budget_us = (int64_t)g_variant_get_uint64(value);
+    }
+
+    void DbusLogindManager::set_sleep_lock_enabled(bool enabled) {
+        sleep_lock_enabled = enabled;
+        if (!manager_proxy) {
+            // The lock will be acquired once we are connected
+            return;
+        }
+        if (enabled) {
+            acquire_sleep_lock();
+        } else if (sleep_lock_fd >= 0) {
+            g_debug("Releasing sleep lock");
+            close(sleep_lock_fd);
+            sleep_lock_fd = -1;
+        }
+    }
+
+    void DbusLogindManager::set_idle_inhibited(bool inhibited) {
+        if (inhibited == idle_inhibited) {
+            return;
+        }
+        idle_inhibited = inhibited;
+        if (inhibited) {
+            g_info("Idle is now inhibited by logind");
+            XIDLECHAIN_PROBE(logind_signal, (int)EVENT_IDLE_INHIBITED);
+            Trace::record(TRACE_DETECTED, EVENT_IDLE_INHIBITED, 0);
+            event_receiver->receive(Event(EVENT_IDLE_INHIBITED));
+        } else {
+            g_info("Idle is no longer inhibited by logind");
+            XIDLECHAIN_PROBE(logind_signal, (int)EVENT_IDLE_UNINHIBITED);
+            Trace::record(TRACE_DETECTED, EVENT_IDLE_UNINHIBITED, 0);
+            event_receiver->receive(Event(EVENT_IDLE_UNINHIBITED));
+        }
+    }
+
+    void DbusLogindManager::query_idle_inhibitors() {
+        InhibitorQuery *query = g_new(InhibitorQuery, 1);
+        query->manager = this;
+        query->serial = ++inhibitor_query_serial;
+        g_dbus_proxy_call(
+            manager_proxy,
+            "ListInhibitors",
+            NULL,
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            cancellable,
+            list_inhibitors_cb,
+            query
+        );
+    }
+
+    void DbusLogindManager::list_inhibitors_cb(
+        GObject *source_object,
+        GAsyncResult *res,
+        gpointer user_data
+    ) {
+        g_autofree InhibitorQuery *query = static_cast<InhibitorQuery*>(user_data);
+        DbusLogindManager *_this = query->manager;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) result = g_dbus_proxy_call_finish(
+            G_DBUS_PROXY(source_object), res, &error);
+        if (is_cancelled(error)) {
+            return;
+        } else if (error) {
+            g_warning("Could not list inhibitors: %s", error->message);
+            return;
+        }
+        if (query->serial != _this->inhibitor_query_serial) {
+            // The inhibitor state changed while this call was in flight.
+            g_debug("Discarding stale ListInhibitors reply");
+            return;
+        }
+        g_autoptr(GVariantIter) iter = NULL;
+        const gchar *what, *who, *why, *mode;
+        guint32 uid, pid;
+        bool inhibited = false;
+        g_variant_get(result, "(a(ssssuu))", &iter);
+        while (g_variant_iter_loop(iter, "(&s&s&s&suu)", &what, &who, &why, &mode, &uid, &pid)) {
+            if (g_strcmp0(mode, "block") == 0 && contains_idle_lock(what)) {
+                g_debug("Idle inhibitor held by %s (pid %u): %s", who, pid, why);
+                inhibited = true;
+            }
+        }
+        _this->set_idle_inhibited(inhibited);
     }
 
     bool DbusLogindManager::set_idle_hint(bool idle) {
-        g_return_val_if_fail(session_proxy != NULL, FALSE);
+        if (!session_proxy) {
+            g_warning("Cannot set idle hint: not connected to the logind session");
+            return false;
+        }
         GError *err = NULL;
         g_info("Setting idle hint to %s", idle ? "true" : "false");
         g_dbus_proxy_call_sync(
@@ -203,7 +600,13 @@ namespace Xidlechain {
     }
 
     bool DbusLogindManager::set_brightness(const char *subsystem, unsigned int value) {
+        if (!session_proxy) {
+            g_warning("Cannot set brightness: not connected to the logind session");
+            return false;
+        }
         g_autoptr(GError) error = NULL;
+        Metrics::brightness_writes.fetch_add(1, std::memory_order_relaxed);
+        XIDLECHAIN_PROBE(brightness_write, subsystem, value);
         g_autoptr(GVariant) res = g_dbus_proxy_call_sync(
             session_proxy,
             "SetBrightness",
@@ -215,12 +618,17 @@ namespace Xidlechain {
         );
         if (error) {
             g_warning("Could not set brightness of %s to %u: %s", subsystem, value, error->message);
+            Metrics::brightness_write_failures.fetch_add(1, std::memory_order_relaxed);
             return false;
         }
         return true;
     }
 
     bool DbusLogindManager::suspend() {
+        if (!manager_proxy) {
+            g_warning("Cannot suspend: not connected to logind");
+            return false;
+        }
         g_autoptr(GError) error = NULL;
         g_autoptr(GVariant) res = g_dbus_proxy_call_sync(
             manager_proxy,
@@ -250,10 +658,14 @@ namespace Xidlechain {
         DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
         if (strcmp(signal_name, "Lock") == 0) {
             g_debug("Received Lock signal");
-            _this->event_receiver->receive(EVENT_LOCK, NULL);
+            XIDLECHAIN_PROBE(logind_signal, (int)EVENT_LOCK);
+            Trace::record(TRACE_DETECTED, EVENT_LOCK, 0);
+            _this->event_receiver->receive(Event(EVENT_LOCK));
         } else if (strcmp(signal_name, "Unlock") == 0) {
             g_debug("Received Unlock signal");
-            _this->event_receiver->receive(EVENT_UNLOCK, NULL);
+            XIDLECHAIN_PROBE(logind_signal, (int)EVENT_UNLOCK);
+            Trace::record(TRACE_DETECTED, EVENT_UNLOCK, 0);
+            _this->event_receiver->receive(Event(EVENT_UNLOCK));
         }
     }
 
@@ -274,14 +686,53 @@ namespace Xidlechain {
         g_variant_get(parameters, "(b)", &preparing_for_sleep);
         if (preparing_for_sleep) {
             g_info("Preparing for sleep");
-            _this->event_receiver->receive(EVENT_SLEEP, NULL);
+            XIDLECHAIN_PROBE(logind_signal, (int)EVENT_SLEEP);
+            Event event(EVENT_SLEEP);
+            Trace::record(TRACE_DETECTED, EVENT_SLEEP, 0);
+            _this->event_receiver->receive(event);
             // close the Inhibitor lock to let systemd know that we're done
-            close(_this->sleep_lock_fd);
-            _this->sleep_lock_fd = -1;
+            if (_this->sleep_lock_fd >= 0) {
+                close(_this->sleep_lock_fd);
+                _this->sleep_lock_fd = -1;
+                Metrics::record_sleep_pipeline(g_get_monotonic_time() - event.timestamp);
+            }
         } else {
             g_info("Waking up from sleep");
-            _this->event_receiver->receive(EVENT_WAKE, NULL);
-            _this->acquire_sleep_lock();
+            XIDLECHAIN_PROBE(logind_signal, (int)EVENT_WAKE);
+            Trace::record(TRACE_DETECTED, EVENT_WAKE, 0);
+            _this->event_receiver->receive(Event(EVENT_WAKE));
+            if (_this->sleep_lock_enabled) {
+                _this->acquire_sleep_lock();
+            }
+        }
+    }
+
+    void DbusLogindManager::login1_manager_properties_changed_cb(
+        GDBusConnection *connection,
+        const gchar *sender_name,
+        const gchar *object_path,
+        const gchar *interface_name,
+        const gchar *signal_name,
+        GVariant *parameters,
+        gpointer user_data
+    ) {
+        DbusLogindManager *_this = static_cast<DbusLogindManager*>(user_data);
+        const gchar *changed_interface_name;
+        g_autoptr(GVariant) changed_properties = NULL;
+        g_autofree const gchar **invalidated_properties = NULL;
+        g_variant_get(parameters, "(&s@a{sv}^a&s)",
+                      &changed_interface_name,
+                      &changed_properties,
+                      &invalidated_properties);
+        const gchar *block_inhibited;
+        if (g_variant_lookup(changed_properties, "BlockInhibited", "&s", &block_inhibited)) {
+            // Any ListInhibitors reply still in flight is now out of date.
+            _this->inhibitor_query_serial++;
+            _this->set_idle_inhibited(contains_idle_lock(block_inhibited));
+        } else if (g_strv_contains(invalidated_properties, "BlockInhibited")) {
+            // The new value was not sent along with the signal, so we
+            // need to ask logind for the list of inhibitors.
+            _this->query_idle_inhibitors();
         }
     }
 }
@@ -1,39 +1,121 @@
 #ifndef _LOGIND_MANAGER_H_
 #define _LOGIND_MANAGER_H_
 
+#include <string>
+#include <vector>
+
 #include <gio/gio.h>
 
+using std::string;
+using std::vector;
+
 namespace Xidlechain {
     class EventReceiver;
 
     class LogindManager {
     public:
         // Initializes the detector and specifies the event receiver.
+        // The connection to logind is established asynchronously, and
+        // errors which happen along the way are only logged.
         // Emits the following signals (with NULL as data) upon
-        // detection from logind: LOCK, UNLOCK, SLEEP, WAKE.
+        // detection from logind: LOCK, UNLOCK, SLEEP, WAKE,
+        // IDLE_INHIBITED, IDLE_UNINHIBITED.
         virtual bool init(EventReceiver *receiver) = 0;
         // Sets the value of the "IdleHint" (see systemd-logind docs).
         virtual bool set_idle_hint(bool idle) = 0;
         virtual bool set_brightness(const char *subsystem, unsigned int value) = 0;
         virtual bool suspend() = 0;
+        // Whether to hold a "sleep" delay inhibitor lock, which is only
+        // needed to run actions before the system goes to sleep.
+        // Enabled by default.
+        virtual void set_sleep_lock_enabled(bool enabled) = 0;
     protected:
         virtual ~LogindManager() = default;
     };
 
     class DbusLogindManager: public LogindManager {
         EventReceiver *event_receiver;
+        // If set, the session is the one on this X display instead of
+        // the one we were started from.
+        string display_name;
         GDBusProxy *manager_proxy,
                    *session_proxy;
+        // Cancels the calls which are in flight when we are destroyed
+        GCancellable *cancellable;
+        vector<guint> signal_subscription_ids;
         int sleep_lock_fd;
+        bool sleep_lock_pending;
+        bool sleep_lock_enabled;
+        // Whether READY=1 is still waiting for us to take the sleep lock
+        bool holding_ready;
+        // Whether some other program is holding an "idle" block inhibitor.
+        bool idle_inhibited;
+        // Incremented every time the inhibitor state changes so that
+        // stale ListInhibitors replies can be discarded.
+        guint inhibitor_query_serial;
         static const char * const BUS_NAME,
                           * const MANAGER_OBJECT_PATH,
                           * const MANAGER_INTERFACE_NAME,
                           * const SESSION_INTERFACE_NAME;
 
-        bool get_session_object_path(char **result);
+        void find_session_by_display();
+        void create_session_proxy(const char *session_object_path);
         void subscribe_to_lock_and_unlock_signals(const char *session_object_path);
         void subscribe_to_prepare_for_sleep_signal();
-        bool acquire_sleep_lock();
+        void subscribe_to_properties_changed_signal();
+        void acquire_sleep_lock();
+        void release_ready();
+        void query_inhibit_delay();
+        void set_idle_inhibited(bool inhibited);
+        void query_idle_inhibitors();
+
+        static void manager_proxy_ready_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void get_session_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void list_sessions_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void get_session_display_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void session_proxy_ready_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void inhibit_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void inhibit_delay_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
+
+        static void list_inhibitors_cb(
+            GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data
+        );
 
         static void login1_session_signal_cb(
             GDBusConnection *connection,
@@ -54,14 +136,27 @@ namespace Xidlechain {
             GVariant *parameters,
             gpointer user_data
         );
+
+        static void login1_manager_properties_changed_cb(
+            GDBusConnection *connection,
+            const gchar *sender_name,
+            const gchar *object_path,
+            const gchar *interface_name,
+            const gchar *signal_name,
+            GVariant *parameters,
+            gpointer user_data
+        );
     public:
-        DbusLogindManager();
+        DbusLogindManager(const char *display_name = NULL);
         ~DbusLogindManager();
+        DbusLogindManager(const DbusLogindManager&) = delete;
+        DbusLogindManager& operator=(const DbusLogindManager&) = delete;
 
         bool init(EventReceiver *receiver) override;
         bool set_idle_hint(bool idle) override;
         bool set_brightness(const char *subsystem, unsigned int value) override;
         bool suspend() override;
+        void set_sleep_lock_enabled(bool enabled) override;
     };
 }
 
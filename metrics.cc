@@ -0,0 +1,198 @@
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+
+#include "metrics.h"
+
+namespace Xidlechain {
+    // Appends to a fixed buffer, dropping whatever doesn't fit
+    class MetricsWriter {
+        char *buffer;
+        size_t size;
+        size_t len = 0;
+    public:
+        MetricsWriter(char *buffer, size_t size): buffer(buffer), size(size) {}
+
+        G_GNUC_PRINTF(2, 3)
+        void append(const char *format, ...) {
+            if (len >= size - 1) {
+                return;
+            }
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buffer + len, size - len, format, args);
+            va_end(args);
+            if (n > 0) {
+                len = MIN(len + n, size - 1);
+            }
+        }
+        bool truncated() const { return len >= size - 1; }
+        size_t length() const { return len; }
+    };
+
+    // OpenMetrics wants a '.' whatever the locale says
+    struct MetricsNumber {
+        char str[G_ASCII_DTOSTR_BUF_SIZE];
+        MetricsNumber(double value) {
+            g_ascii_formatd(str, sizeof(str), "%.6f", value);
+        }
+    };
+
+    static void append_counter(MetricsWriter &w, const char *name, const char *help, uint64_t value) {
+        w.append("# TYPE %s counter\n# HELP %s %s\n%s_total %llu\n",
+                 name, name, help, name, (unsigned long long)value);
+    }
+
+    static void append_gauge(MetricsWriter &w, const char *name, const char *help, double value) {
+        w.append("# TYPE %s gauge\n# HELP %s %s\n%s %s\n", name, name, help, name, MetricsNumber(value).str);
+    }
+
+    // The buckets are cumulative in OpenMetrics; bucket i of a Histogram
+    // is below 2^i us.
+    static void append_histogram(MetricsWriter &w, const char *name, const char *help,
+                                 const Histogram &histogram, int64_t sum_us) {
+        w.append("# TYPE %s histogram\n# HELP %s %s\n", name, name, help);
+        uint64_t count = 0;
+        for (int i = 0; i < Histogram::NUM_BUCKETS - 1; i++) {
+            count += histogram.buckets[i];
+            w.append("%s_bucket{le=\"%s\"} %llu\n",
+                     name, MetricsNumber(((int64_t)1 << i) / 1e6).str, (unsigned long long)count);
+        }
+        count += histogram.buckets[Histogram::NUM_BUCKETS - 1];
+        w.append("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+        w.append("%s_count %llu\n%s_sum %s\n", name, (unsigned long long)count, name, MetricsNumber(sum_us / 1e6).str);
+    }
+
+    size_t MetricsExporter::render() {
+        MetricsWriter w(buffer, BUFFER_SIZE);
+        w.append("# TYPE xidlechain_events counter\n"
+                 "# HELP xidlechain_events Events received, by type.\n");
+        for (int i = 1; i < EVENT_TYPE_COUNT; i++) {
+            w.append("xidlechain_events_total{type=\"%s\"} %llu\n",
+                     EVENT_TYPE_NAMES[i], (unsigned long long)Metrics::events[i]);
+        }
+        append_counter(w, "xidlechain_x_alarms_armed",
+                       "IDLETIME alarms created on the X server.",
+                       Metrics::x_alarms_armed);
+        append_counter(w, "xidlechain_audio_transitions",
+                       "Changes between playing and not playing audio.",
+                       Metrics::audio_transitions);
+        append_counter(w, "xidlechain_brightness_writes",
+                       "Backlight brightness changes requested from logind.",
+                       Metrics::brightness_writes.load(std::memory_order_relaxed));
+        append_counter(w, "xidlechain_brightness_write_failures",
+                       "Backlight brightness changes which logind rejected.",
+                       Metrics::brightness_write_failures.load(std::memory_order_relaxed));
+        append_counter(w, "xidlechain_spawns",
+                       "Shell commands started.",
+                       Metrics::spawns);
+        append_counter(w, "xidlechain_spawn_failures",
+                       "Shell commands which could not be started.",
+                       Metrics::spawn_failures);
+        append_histogram(w, "xidlechain_sleep_pipeline_seconds",
+                         "Time from PrepareForSleep until the sleep lock was released.",
+                         Metrics::sleep_pipeline_us, Metrics::sleep_pipeline_sum_us);
+        append_counter(w, "xidlechain_sleep_pipeline_over_budget",
+                       "Sleeps which took longer than logind's InhibitDelayMaxUSec.",
+                       Metrics::sleep_pipeline_over_budget);
+        append_gauge(w, "xidlechain_sleep_budget_seconds",
+                     "logind's InhibitDelayMaxUSec.",
+                     Metrics::sleep_budget_us / 1e6);
+        append_counter(w, "xidlechain_main_loop_stalls",
+                       "Times the main loop was blocked for longer than 50 ms.",
+                       Metrics::main_loop_stalls);
+        w.append("# TYPE xidlechain_main_loop_stall_seconds counter\n"
+                 "# HELP xidlechain_main_loop_stall_seconds Time the main loop was blocked, in stalls longer than 50 ms.\n"
+                 "xidlechain_main_loop_stall_seconds_total %s\n",
+                 MetricsNumber(Metrics::main_loop_stall_sum_us / 1e6).str);
+        append_gauge(w, "xidlechain_main_loop_stall_max_seconds",
+                     "The longest time the main loop was blocked.",
+                     Metrics::main_loop_stall_max_us / 1e6);
+        append_counter(w, "xidlechain_event_subscribers_dropped",
+                       "Event stream clients disconnected for falling behind.",
+                       Metrics::event_subscribers_dropped);
+        append_counter(w, "xidlechain_config_saves_requested",
+                       "Changes which asked for the config file to be saved.",
+                       Metrics::config_saves_requested);
+        append_counter(w, "xidlechain_config_saves_performed",
+                       "Writes of the config file.",
+                       Metrics::config_saves_performed);
+        w.append("# EOF\n");
+        if (w.truncated()) {
+            g_warning("The metrics do not fit into %zu bytes", BUFFER_SIZE);
+        }
+        return w.length();
+    }
+
+    string MetricsExporter::default_path() {
+        g_autofree gchar *path = g_build_filename(g_get_user_runtime_dir(), "xidlechain.metrics", NULL);
+        return path;
+    }
+
+    bool MetricsExporter::start(const string &socket_path) {
+        g_return_val_if_fail(listen_fd < 0, FALSE);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            g_warning("Socket path is too long: %s", socket_path.c_str());
+            return false;
+        }
+        strcpy(addr.sun_path, socket_path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            g_warning("Could not create a socket: %s", g_strerror(errno));
+            return false;
+        }
+        // A previous instance which crashed may have left its socket behind
+        g_unlink(socket_path.c_str());
+        if (
+            bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || listen(fd, 8) < 0
+        ) {
+            g_warning("Could not listen on %s: %s", socket_path.c_str(), g_strerror(errno));
+            close(fd);
+            return false;
+        }
+        path = socket_path;
+        listen_fd = fd;
+        listen_source_id = g_unix_fd_add(listen_fd, G_IO_IN, static_on_client, this);
+        return true;
+    }
+
+    MetricsExporter::~MetricsExporter() {
+        if (listen_fd < 0) {
+            return;
+        }
+        g_source_remove(listen_source_id);
+        close(listen_fd);
+        g_unlink(path.c_str());
+    }
+
+    gboolean MetricsExporter::static_on_client(gint fd, GIOCondition condition, gpointer user_data) {
+        MetricsExporter *_this = (MetricsExporter*)user_data;
+        int client_fd;
+        while ((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            size_t len = _this->render();
+            // The whole scrape fits into an empty socket buffer, so this
+            // only comes up short if the client is misbehaving
+            ssize_t written = send(client_fd, _this->buffer, len, MSG_NOSIGNAL);
+            if (written != (ssize_t)len) {
+                g_debug("Could not send the metrics to a client");
+            }
+            close(client_fd);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            g_warning("Could not accept a metrics client: %s", g_strerror(errno));
+        }
+        return G_SOURCE_CONTINUE;
+    }
+}
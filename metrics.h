@@ -0,0 +1,98 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <glib.h>
+
+#include "action_metrics.h"
+#include "event_receiver.h"
+
+using std::int64_t;
+using std::size_t;
+using std::string;
+using std::uint64_t;
+
+namespace Xidlechain {
+    // Daemon-wide counters, which the MetricsExporter publishes. Like the
+    // Trace, they are static so that the detectors can bump them without
+    // being handed another pointer. Everything runs on the main thread,
+    // except for the brightness writes made by the dimmer thread.
+    class Metrics {
+    public:
+        // Events received by the EventManagers, by EventType
+        static inline uint64_t events[EVENT_TYPE_COUNT] = {};
+        // IDLETIME alarms created by the XcbActivityDetectors
+        static inline uint64_t x_alarms_armed = 0;
+        // AUDIO_RUNNING and AUDIO_STOPPED events sent by PulseAudioDetector
+        static inline uint64_t audio_transitions = 0;
+        static inline std::atomic<uint64_t> brightness_writes{0};
+        static inline std::atomic<uint64_t> brightness_write_failures{0};
+        static inline uint64_t spawns = 0;
+        static inline uint64_t spawn_failures = 0;
+        // From PrepareForSleep(true) until we released the sleep lock
+        static inline Histogram sleep_pipeline_us;
+        static inline int64_t sleep_pipeline_sum_us = 0;
+        static inline uint64_t sleep_pipeline_over_budget = 0;
+        // logind's InhibitDelayMaxUSec, which is 5 s unless configured
+        // otherwise. Updated once we have asked logind.
+        static inline int64_t sleep_budget_us = 5 * 1000 * 1000;
+        // Times the StallMonitor's heartbeat was dispatched more than
+        // STALL_THRESHOLD_US late, and by how much
+        static inline uint64_t main_loop_stalls = 0;
+        static inline int64_t main_loop_stall_sum_us = 0;
+        static inline int64_t main_loop_stall_max_us = 0;
+        // Clients of the EventStream which were disconnected for not
+        // reading their events
+        static inline uint64_t event_subscribers_dropped = 0;
+        // Config saves asked for by the ConfigManagers, and the writes
+        // which they were coalesced into
+        static inline uint64_t config_saves_requested = 0;
+        static inline uint64_t config_saves_performed = 0;
+
+        static void record_sleep_pipeline(int64_t duration_us) {
+            sleep_pipeline_us.add(duration_us);
+            sleep_pipeline_sum_us += duration_us;
+            if (duration_us > sleep_budget_us) {
+                sleep_pipeline_over_budget++;
+            }
+        }
+    };
+
+    // Serves the Metrics in the OpenMetrics text format on a Unix stream
+    // socket: each client which connects is sent the current values, and
+    // the connection is closed. Scrapes are rendered into a fixed buffer
+    // and written without blocking, so a slow or stuck client never holds
+    // up the main loop and a scrape costs the same however long the
+    // daemon has been running.
+    class MetricsExporter {
+    public:
+        static constexpr size_t BUFFER_SIZE = 16384;
+    private:
+        string path;
+        int listen_fd = -1;
+        guint listen_source_id = 0;
+        char buffer[BUFFER_SIZE];
+
+        static gboolean static_on_client(gint fd, GIOCondition condition, gpointer user_data);
+    public:
+        MetricsExporter() = default;
+        ~MetricsExporter();
+        MetricsExporter(const MetricsExporter&) = delete;
+        MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+        // The socket which start() uses by default
+        static string default_path();
+        // Replaces any stale socket at |path| and starts serving.
+        bool start(const string &path);
+        // Renders the current values into the internal buffer and returns
+        // their length. The output is cut short if it doesn't fit.
+        size_t render();
+        const char *get_buffer() const { return buffer; }
+    };
+}
+
+#endif
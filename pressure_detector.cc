@@ -0,0 +1,187 @@
+#include "pressure_detector.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+
+#include "event_receiver.h"
+#include "trace.h"
+
+using std::sscanf;
+using std::strerror;
+using std::strlen;
+using std::string;
+
+// Returns the cgroup v2 path of this process, relative to the cgroup root.
+static string get_own_cgroup() {
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL)) {
+        return string{};
+    }
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    for (int i = 0; lines[i] != NULL; i++) {
+        // The cgroup v2 hierarchy has ID 0 and no controllers
+        if (g_str_has_prefix(lines[i], "0::")) {
+            return string(lines[i] + 3);
+        }
+    }
+    return string{};
+}
+
+// Strips everything below the user@UID.service component of |cgroup|, so
+// that the other services of the same user are included. systemd only
+// delegates that subtree to the user; the pressure files of user-UID.slice
+// above it belong to root, so a trigger can't be registered there. If
+// this process isn't in the user's service manager (e.g. it was started
+// from the session scope), its own cgroup is used.
+static string get_user_service(const string &cgroup) {
+    g_autofree gchar *user_service = g_strdup_printf("/user@%u.service", getuid());
+    string::size_type pos = cgroup.find(user_service);
+    if (pos == string::npos) {
+        return cgroup;
+    }
+    return cgroup.substr(0, pos + strlen(user_service));
+}
+
+namespace Xidlechain {
+    PsiPressureDetector::PsiPressureDetector(bool use_cgroup):
+        event_receiver(NULL),
+        use_cgroup(use_cgroup),
+        under_pressure(false),
+        release_source_id(0)
+    {}
+
+    PsiPressureDetector::~PsiPressureDetector() {
+        for (Trigger *trigger : triggers) {
+            if (trigger->source_id) {
+                g_source_remove(trigger->source_id);
+            }
+            close(trigger->fd);
+            delete trigger;
+        }
+        if (release_source_id) {
+            g_source_remove(release_source_id);
+        }
+    }
+
+    string PsiPressureDetector::get_pressure_file_path(const char *resource) {
+        if (!use_cgroup) {
+            return string("/proc/pressure/") + resource;
+        }
+        string cgroup = get_own_cgroup();
+        if (cgroup.empty()) {
+            g_warning("Could not determine cgroup; using system-wide pressure");
+            return string("/proc/pressure/") + resource;
+        }
+        return "/sys/fs/cgroup" + get_user_service(cgroup) + "/" + resource + ".pressure";
+    }
+
+    bool PsiPressureDetector::add_trigger(const char *resource, const string &trigger_str) {
+        g_return_val_if_fail(event_receiver == NULL, FALSE);
+        string path = get_pressure_file_path(resource);
+        int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            g_warning("Could not open %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        // The trigger is registered by writing it (including the
+        // terminating null byte) to the pressure file. It stays active
+        // for as long as the file descriptor is open.
+        if (write(fd, trigger_str.c_str(), trigger_str.size() + 1) < 0) {
+            // Kernels before 6.5 only let CAP_SYS_RESOURCE register
+            // triggers
+            g_warning("Could not register pressure trigger '%s' on %s: %s%s",
+                      trigger_str.c_str(), path.c_str(), strerror(errno),
+                      errno == EPERM ? " (the kernel may be too old for unprivileged triggers)" : "");
+            close(fd);
+            return false;
+        }
+        if (!add_trigger_fd(fd, path, trigger_str)) {
+            return false;
+        }
+        g_info("Registered pressure trigger '%s' on %s", trigger_str.c_str(), path.c_str());
+        return true;
+    }
+
+    PsiPressureDetector::Trigger *PsiPressureDetector::add_trigger_fd(
+        int fd,
+        const string &path,
+        const string &trigger_str
+    ) {
+        g_return_val_if_fail(event_receiver == NULL, NULL);
+        unsigned int stall_us, window_us;
+        if (sscanf(trigger_str.c_str(), "%*s %u %u", &stall_us, &window_us) != 2) {
+            g_warning("Invalid pressure trigger '%s'", trigger_str.c_str());
+            close(fd);
+            return NULL;
+        }
+        Trigger *trigger = new Trigger;
+        trigger->path = path;
+        trigger->fd = fd;
+        trigger->source_id = 0;
+        trigger->hold_ms = 2 * (window_us / 1000);
+        trigger->detector = this;
+        triggers.push_back(trigger);
+        return trigger;
+    }
+
+    bool PsiPressureDetector::init(EventReceiver *receiver) {
+        g_return_val_if_fail(receiver != NULL, FALSE);
+        event_receiver = receiver;
+        for (Trigger *trigger : triggers) {
+            trigger->source_id = g_unix_fd_add(
+                trigger->fd,
+                (GIOCondition)(G_IO_PRI | G_IO_ERR),
+                static_trigger_cb,
+                trigger
+            );
+        }
+        return true;
+    }
+
+    void PsiPressureDetector::trigger_fired(Trigger *trigger) {
+        g_debug("Pressure trigger fired on %s", trigger->path.c_str());
+        if (release_source_id) {
+            g_source_remove(release_source_id);
+        }
+        // A single one-shot timer which is pushed back every time a trigger
+        // fires; it only exists while we are under pressure.
+        release_source_id = g_timeout_add(trigger->hold_ms, static_release_cb, this);
+        if (!under_pressure) {
+            under_pressure = true;
+            g_info("System is under pressure");
+            Trace::record(TRACE_DETECTED, EVENT_PRESSURE_HIGH, 0);
+            event_receiver->receive(Event(EVENT_PRESSURE_HIGH));
+        }
+    }
+
+    void PsiPressureDetector::release() {
+        release_source_id = 0;
+        under_pressure = false;
+        g_info("System is no longer under pressure");
+        Trace::record(TRACE_DETECTED, EVENT_PRESSURE_NORMAL, 0);
+        event_receiver->receive(Event(EVENT_PRESSURE_NORMAL));
+    }
+
+    gboolean PsiPressureDetector::static_trigger_cb(gint fd, GIOCondition condition, gpointer user_data) {
+        Trigger *trigger = static_cast<Trigger*>(user_data);
+        if (condition & G_IO_ERR) {
+            // e.g. the cgroup was removed
+            g_warning("Pressure trigger on %s is no longer valid", trigger->path.c_str());
+            trigger->source_id = 0;
+            return G_SOURCE_REMOVE;
+        }
+        trigger->detector->trigger_fired(trigger);
+        return G_SOURCE_CONTINUE;
+    }
+
+    gboolean PsiPressureDetector::static_release_cb(gpointer user_data) {
+        PsiPressureDetector *_this = static_cast<PsiPressureDetector*>(user_data);
+        _this->release();
+        return G_SOURCE_REMOVE;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef _PRESSURE_DETECTOR_H_
+#define _PRESSURE_DETECTOR_H_
+
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+using std::string;
+using std::vector;
+
+namespace Xidlechain {
+    class EventReceiver;
+
+    class PressureDetector {
+    public:
+        // Emits a PRESSURE_HIGH event when the system comes under
+        // pressure, and a PRESSURE_NORMAL event once the pressure has
+        // subsided.
+        virtual bool init(EventReceiver *receiver) = 0;
+    protected:
+        virtual ~PressureDetector() = default;
+    };
+
+    // Uses kernel pressure stall information (PSI) triggers, see
+    // https://docs.kernel.org/accounting/psi.html.
+    // The kernel notifies us (with POLLPRI) at most once per tracking
+    // window while the stall threshold is exceeded, so the pressure is
+    // considered to have subsided once a trigger has stayed quiet for
+    // two of its windows.
+    class PsiPressureDetector: public PressureDetector {
+    protected:
+        struct Trigger {
+            string path;
+            int fd;
+            guint source_id;
+            guint hold_ms;
+            PsiPressureDetector *detector;
+        };
+    private:
+        EventReceiver *event_receiver;
+        bool use_cgroup;
+        vector<Trigger*> triggers;
+        bool under_pressure;
+        guint release_source_id;
+
+        string get_pressure_file_path(const char *resource);
+        static gboolean static_trigger_cb(gint fd, GIOCondition condition, gpointer user_data);
+        static gboolean static_release_cb(gpointer user_data);
+    protected:
+        // Takes over |fd|, on which |trigger_str| was registered, and
+        // watches it once init() is called. Returns null (and closes
+        // |fd|) if |trigger_str| can't be parsed. The tests pass a pipe
+        // here instead of a pressure file.
+        Trigger *add_trigger_fd(int fd, const string &path, const string &trigger_str);
+        void trigger_fired(Trigger *trigger);
+        void release();
+    public:
+        // If use_cgroup is true, the pressure of the user's delegated
+        // cgroup (user@UID.service) is monitored instead of the whole
+        // system.
+        PsiPressureDetector(bool use_cgroup = false);
+        ~PsiPressureDetector();
+        PsiPressureDetector(const PsiPressureDetector&) = delete;
+        PsiPressureDetector& operator=(const PsiPressureDetector&) = delete;
+
+        // Registers a trigger such as "some 150000 1000000" on the
+        // pressure file for |resource| ("cpu", "io" or "memory").
+        // Must be called before init().
+        bool add_trigger(const char *resource, const string &trigger);
+        bool init(EventReceiver *receiver) override;
+    };
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+// USDT probes for bpftrace, perf and SystemTap, e.g.
+//   bpftrace -e 'usdt:./xidlechain:xidlechain:command_activate { printf("%s\n", str(arg1)); }'
+// See tests/latency.bt for a script which uses most of them.
+//
+// An unattached probe is a single nop, plus whatever it takes to have
+// the arguments in registers, so the arguments must be cheap to compute.
+// Without <sys/sdt.h> (or with -DXIDLECHAIN_NO_PROBES), the probes
+// compile to nothing.
+//
+// The probes and their arguments:
+//   x_alarm(timeout_id, idle_time_ms)
+//       An IDLETIME alarm fired. timeout_id is -1 for activity.
+//   event_receive_entry(event_type, detected_us)
+//   event_receive_exit(event_type, detected_us)
+//       Around EventManager::receive. detected_us is when the event was
+//       created, on the g_get_monotonic_time() clock (CLOCK_MONOTONIC).
+//   command_activate(command_id, name)
+//   command_deactivate(command_id, name)
+//       Just before a command's exec or resume_exec action runs.
+//   spawn_start(cmd, sync)
+//   spawn_exit(pid, exit_status, duration_us)
+//       A shell command is about to be spawned, and it has exited. pid is
+//       0 for synchronous commands, and exit_status is -1 if the command
+//       could not be started.
+//   brightness_write(device, value)
+//       The dimmer (or the restore) is setting the backlight brightness.
+//   logind_signal(event_type)
+//       A Lock, Unlock or PrepareForSleep signal arrived from logind, or
+//       the idle inhibitors changed.
+
+#if defined(__has_include) && !defined(XIDLECHAIN_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define XIDLECHAIN_PROBE(name, ...) STAP_PROBEV(xidlechain, name, ##__VA_ARGS__)
+#endif
+#endif
+
+#ifndef XIDLECHAIN_PROBE
+#define XIDLECHAIN_PROBE(name, ...) do {} while (0)
+#endif
+
+#endif
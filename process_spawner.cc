@@ -2,19 +2,40 @@
 
 #include <cerrno>
 #include <string>
+#include <sys/wait.h>
 
 #include <glib.h>
 
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
+
 using std::string;
 
 namespace Xidlechain {
-    void GProcessSpawner::exec_cmd(const string &cmd, bool wait) {
+    GProcessSpawner::GProcessSpawner(const char *display):
+        envp(NULL)
+    {
+        if (display) {
+            envp = g_environ_setenv(g_get_environ(), "DISPLAY", display, TRUE);
+        }
+    }
+
+    GProcessSpawner::~GProcessSpawner() {
+        g_strfreev(envp);
+    }
+
+    void GProcessSpawner::exec_cmd(const string &cmd, bool wait, const shared_ptr<ActionMetrics> &metrics) {
         if (cmd.empty()) return;
         g_debug("Executing command '%s'", cmd.c_str());
         const gchar *argv[] = {"sh", "-c", cmd.c_str(), NULL};
         GSpawnFlags flags = G_SPAWN_SEARCH_PATH;
         GError *err = NULL;
         gboolean success;
+        gint wait_status = 0;
+        GPid pid = 0;
+        gint64 start_time = g_get_monotonic_time();
+        XIDLECHAIN_PROBE(spawn_start, cmd.c_str(), (int)wait);
 
         /*
         Internally, GLib casts argv to const gchar * const *,
@@ -22,25 +43,68 @@ namespace Xidlechain {
         See https://gitlab.gnome.org/GNOME/glib/-/blob/main/glib/gspawn.c
         */
 
-        if (wait) {
-            success = g_spawn_sync(
-                NULL, (gchar**)argv, NULL, flags, NULL, NULL, NULL, NULL,
-                NULL, &err);
-        } else {
-            success = g_spawn_async(
-                NULL, (gchar**)argv, NULL, flags, NULL, NULL, NULL, &err);
-        }
+        // We reap the child ourselves to find out how it exited. Even sync
+        // commands are spawned asynchronously, so that the spawn latency
+        // can be told apart from the time the command took.
+        success = g_spawn_async(
+            NULL, (gchar**)argv, envp, (GSpawnFlags)(flags | G_SPAWN_DO_NOT_REAP_CHILD),
+            NULL, NULL, &pid, &err);
         if (!success) {
             g_critical("%s", err->message);
             g_error_free(err);
+            Metrics::spawn_failures++;
+            if (metrics) {
+                metrics->record_spawn_failure();
+            }
+            Trace::record(TRACE_SPAWNED, 0, -1);
+            XIDLECHAIN_PROBE(spawn_exit, 0, -1, (int64_t)0);
+            return;
+        }
+        Metrics::spawns++;
+        if (metrics) {
+            metrics->spawn_latency_us.add(g_get_monotonic_time() - start_time);
+        }
+        int exit_status = 0;
+        if (wait) {
+            while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR) {}
+            exit_status = ActionMetrics::exit_status_from_wait_status(wait_status);
+            int64_t duration_us = g_get_monotonic_time() - start_time;
+            if (metrics) {
+                metrics->record_exit(duration_us, exit_status);
+            }
+            XIDLECHAIN_PROBE(spawn_exit, (int)pid, exit_status, duration_us);
+            g_spawn_close_pid(pid);
+        } else {
+            if (metrics) {
+                metrics->num_running++;
+            }
+            g_child_watch_add(pid, static_child_exited, new ChildWatch{metrics, start_time});
+        }
+        // For async commands, this is when the child was forked
+        Trace::record(TRACE_SPAWNED, 0, exit_status);
+    }
+
+    void GProcessSpawner::static_child_exited(GPid pid, gint wait_status, gpointer user_data) {
+        ChildWatch *watch = (ChildWatch*)user_data;
+        int exit_status = ActionMetrics::exit_status_from_wait_status(wait_status);
+        if (exit_status != 0) {
+            g_debug("Process %d exited with status %d", (int)pid, exit_status);
+        }
+        int64_t duration_us = g_get_monotonic_time() - watch->start_time;
+        if (watch->metrics) {
+            watch->metrics->num_running--;
+            watch->metrics->record_exit(duration_us, exit_status);
         }
+        XIDLECHAIN_PROBE(spawn_exit, (int)pid, exit_status, duration_us);
+        g_spawn_close_pid(pid);
+        delete watch;
     }
 
-    void GProcessSpawner::exec_cmd_sync(const string &cmd) {
-        exec_cmd(cmd, true);
+    void GProcessSpawner::exec_cmd_sync(const string &cmd, const shared_ptr<ActionMetrics> &metrics) {
+        exec_cmd(cmd, true, metrics);
     }
 
-    void GProcessSpawner::exec_cmd_async(const string &cmd) {
-        exec_cmd(cmd, false);
+    void GProcessSpawner::exec_cmd_async(const string &cmd, const shared_ptr<ActionMetrics> &metrics) {
+        exec_cmd(cmd, false, metrics);
     }
 }
@@ -1,27 +1,50 @@
 #ifndef _PROCESS_SPAWNER_H_
 #define _PROCESS_SPAWNER_H_
 
+#include <memory>
 #include <string>
 
+#include <glib.h>
+
+#include "action_metrics.h"
+
+using std::shared_ptr;
 using std::string;
 
 namespace Xidlechain {
     class ProcessSpawner {
     public:
         // Spawns a new process for |cmd|. Blocks until the process exits.
-        virtual void exec_cmd_sync(const string &cmd) = 0;
+        // The run is recorded in |metrics|, if it is set.
+        virtual void exec_cmd_sync(const string &cmd, const shared_ptr<ActionMetrics> &metrics) = 0;
         // Spawns a new process for |cmd|. Does not wait for the process to
-        // exit.
-        virtual void exec_cmd_async(const string &cmd) = 0;
+        // exit; |metrics| is kept until it does.
+        virtual void exec_cmd_async(const string &cmd, const shared_ptr<ActionMetrics> &metrics) = 0;
     protected:
         ~ProcessSpawner() = default;
     };
 
     class GProcessSpawner: public ProcessSpawner {
-        void exec_cmd(const string &cmd, bool wait);
+        // The environment of the child processes, or NULL to inherit ours
+        char **envp;
+
+        struct ChildWatch {
+            shared_ptr<ActionMetrics> metrics;
+            gint64 start_time;
+        };
+
+        void exec_cmd(const string &cmd, bool wait, const shared_ptr<ActionMetrics> &metrics);
+        static void static_child_exited(GPid pid, gint wait_status, gpointer user_data);
     public:
-        void exec_cmd_sync(const string &cmd) override;
-        void exec_cmd_async(const string &cmd) override;
+        // If |display| is set, the commands are run with DISPLAY set to
+        // it instead of our own DISPLAY.
+        GProcessSpawner(const char *display = NULL);
+        ~GProcessSpawner();
+        GProcessSpawner(const GProcessSpawner&) = delete;
+        GProcessSpawner& operator=(const GProcessSpawner&) = delete;
+
+        void exec_cmd_sync(const string &cmd, const shared_ptr<ActionMetrics> &metrics) override;
+        void exec_cmd_async(const string &cmd, const shared_ptr<ActionMetrics> &metrics) override;
     };
 }
 
@@ -0,0 +1,149 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "service_notifier.h"
+#include "startup_timeline.h"
+
+namespace Xidlechain {
+    bool ServiceNotifier::enabled() {
+        return getenv("NOTIFY_SOCKET") != NULL;
+    }
+
+    bool ServiceNotifier::notify(const char *state) {
+        const char *socket_path = getenv("NOTIFY_SOCKET");
+        if (!socket_path) {
+            return false;
+        }
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        size_t path_len = strlen(socket_path);
+        if (
+            path_len < 2 || path_len >= sizeof(addr.sun_path)
+            || (socket_path[0] != '/' && socket_path[0] != '@')
+        ) {
+            g_debug("Ignoring NOTIFY_SOCKET=%s", socket_path);
+            return false;
+        }
+        memcpy(addr.sun_path, socket_path, path_len);
+        // An abstract socket, whose name doesn't end at a null byte
+        if (addr.sun_path[0] == '@') {
+            addr.sun_path[0] = '\0';
+        }
+        int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            g_debug("Could not create a socket: %s", g_strerror(errno));
+            return false;
+        }
+        ssize_t sent = sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr*)&addr,
+                              offsetof(struct sockaddr_un, sun_path) + path_len);
+        int saved_errno = errno;
+        close(fd);
+        if (sent < 0) {
+            g_debug("Could not notify the service manager: %s", g_strerror(saved_errno));
+            return false;
+        }
+        return true;
+    }
+
+    void ServiceNotifier::hold_ready() {
+        pending_steps++;
+    }
+
+    void ServiceNotifier::release_ready() {
+        g_return_if_fail(pending_steps > 0);
+        pending_steps--;
+        send_ready_if_done();
+    }
+
+    // Returns "STATUS=..." if the status changed since it was last sent
+    // (or |force| is set), and an empty string otherwise.
+    string ServiceNotifier::status_assignment(bool force) {
+        if (!status_func) {
+            return "";
+        }
+        string status = status_func(status_data);
+        if (!force && status == last_status) {
+            return "";
+        }
+        last_status = status;
+        // Each assignment is a single line
+        for (char &c : status) {
+            if (c == '\n') {
+                c = ' ';
+            }
+        }
+        return "STATUS=" + status;
+    }
+
+    void ServiceNotifier::send_ready_if_done() {
+        if (!started || ready || pending_steps > 0 || ready_source_id) {
+            return;
+        }
+        // Let the main loop run once first, so that requests which were
+        // only queued (e.g. the IDLETIME alarms) have been flushed
+        ready_source_id = g_idle_add(static_send_ready, NULL);
+    }
+
+    gboolean ServiceNotifier::static_send_ready(gpointer user_data) {
+        ready_source_id = 0;
+        ready = true;
+        StartupTimeline::mark("ready");
+        string state = "READY=1";
+        string status = status_assignment(true);
+        if (!status.empty()) {
+            state += "\n" + status;
+        }
+        notify(state.c_str());
+        return G_SOURCE_REMOVE;
+    }
+
+    gboolean ServiceNotifier::static_update_status(gpointer user_data) {
+        if (!ready) {
+            return G_SOURCE_CONTINUE;
+        }
+        string state = status_assignment(false);
+        if (!state.empty()) {
+            notify(state.c_str());
+        }
+        return G_SOURCE_CONTINUE;
+    }
+
+    void ServiceNotifier::start(StatusFunc func, gpointer user_data, guint status_interval_ms) {
+        g_return_if_fail(!started);
+        if (!enabled()) {
+            return;
+        }
+        started = true;
+        status_func = func;
+        status_data = user_data;
+        if (func) {
+            status_source_id = g_timeout_add(status_interval_ms, static_update_status, NULL);
+        }
+        send_ready_if_done();
+    }
+
+    void ServiceNotifier::stop() {
+        if (ready_source_id) {
+            g_source_remove(ready_source_id);
+            ready_source_id = 0;
+        }
+        if (status_source_id) {
+            g_source_remove(status_source_id);
+            status_source_id = 0;
+        }
+        pending_steps = 0;
+        started = false;
+        ready = false;
+        status_func = NULL;
+        status_data = NULL;
+        last_status.clear();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef _SERVICE_NOTIFIER_H_
+#define _SERVICE_NOTIFIER_H_
+
+#include <string>
+
+#include <glib.h>
+
+using std::string;
+
+namespace Xidlechain {
+    // Talks to systemd (or any service manager which sets NOTIFY_SOCKET)
+    // with the sd_notify(3) protocol, which is just a datagram of
+    // newline-separated assignments, so libsystemd isn't needed. Nothing
+    // is sent, and no timers are started, unless NOTIFY_SOCKET is set.
+    //
+    // READY=1 is sent once every startup step which was announced with
+    // hold_ready() has called release_ready(), so that units which are
+    // ordered after a Type=notify xidlechain service only start once the
+    // idle timeouts are armed, the D-Bus name is owned and the sleep lock
+    // is held. Like the Trace and the StartupTimeline, it is static so
+    // that the components don't have to be handed another pointer.
+    class ServiceNotifier {
+    public:
+        using StatusFunc = string (*)(gpointer user_data);
+        static constexpr guint STATUS_INTERVAL_MS = 5000;
+    private:
+        static inline int pending_steps = 0;
+        static inline bool started = false;
+        static inline bool ready = false;
+        static inline guint ready_source_id = 0;
+        static inline guint status_source_id = 0;
+        static inline StatusFunc status_func = NULL;
+        static inline gpointer status_data = NULL;
+        static inline string last_status;
+
+        static void send_ready_if_done();
+        static gboolean static_send_ready(gpointer user_data);
+        static gboolean static_update_status(gpointer user_data);
+        static string status_assignment(bool force);
+    public:
+        // Sends |state|, e.g. "WATCHDOG=1". Returns false if there is no
+        // service manager or it couldn't be reached.
+        static bool notify(const char *state);
+        static bool enabled();
+        // Announces a startup step which READY=1 has to wait for. Each
+        // call must be matched by a call to release_ready(), whether or
+        // not the step succeeded.
+        static void hold_ready();
+        static void release_ready();
+        // Called once the main loop is about to run. |func| describes the
+        // current state for STATUS=, which is sent with READY=1 and then
+        // every |status_interval_ms| if it changed.
+        static void start(StatusFunc func, gpointer user_data,
+                          guint status_interval_ms = STATUS_INTERVAL_MS);
+        // Stops the status updates and forgets the startup steps
+        static void stop();
+        static bool is_ready() { return ready; }
+    };
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include <cstdlib>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "event_receiver.h"
+#include "metrics.h"
+#include "service_notifier.h"
+#include "stall_monitor.h"
+#include "trace.h"
+
+namespace Xidlechain {
+    static const char *event_type_name(int event_type) {
+        return event_type > 0 && event_type < EVENT_TYPE_COUNT ? EVENT_TYPE_NAMES[event_type] : "nothing";
+    }
+
+    StallMonitor::StallMonitor() {
+        g_mutex_init(&mutex);
+        g_cond_init(&cond);
+    }
+
+    StallMonitor::~StallMonitor() {
+        if (watcher) {
+            g_mutex_lock(&mutex);
+            stopping = true;
+            g_cond_signal(&cond);
+            g_mutex_unlock(&mutex);
+            g_thread_join(watcher);
+        }
+        if (heartbeat_source_id) {
+            g_source_remove(heartbeat_source_id);
+        }
+        g_cond_clear(&cond);
+        g_mutex_clear(&mutex);
+    }
+
+    void StallMonitor::start(guint heartbeat_interval_ms) {
+        g_return_if_fail(heartbeat_source_id == 0);
+        interval_ms = heartbeat_interval_ms;
+        // systemd wants a ping at least every WATCHDOG_USEC, and
+        // recommends pinging twice as often
+        const char *watchdog_usec_str = getenv("WATCHDOG_USEC");
+        const char *watchdog_pid_str = getenv("WATCHDOG_PID");
+        if (
+            watchdog_usec_str
+            && (!watchdog_pid_str || g_ascii_strtoll(watchdog_pid_str, NULL, 10) == getpid())
+        ) {
+            watchdog_usec = g_ascii_strtoll(watchdog_usec_str, NULL, 10);
+        }
+        if (watchdog_usec > 0) {
+            g_debug("Sending watchdog pings every %ld ms", (long)(watchdog_usec / 2000));
+            interval_ms = (guint)MIN((int64_t)interval_ms, MAX(watchdog_usec / 2000, (int64_t)1));
+        }
+        next_beat_time.store(g_get_monotonic_time() + (int64_t)interval_ms * 1000, std::memory_order_relaxed);
+        heartbeat_source_id = g_timeout_add(interval_ms, static_heartbeat, this);
+        watcher = g_thread_new("stall-watcher", static_watch, this);
+    }
+
+    void StallMonitor::send_watchdog_ping() {
+        ServiceNotifier::notify("WATCHDOG=1");
+    }
+
+    // The heartbeat is due every interval_ms; if it is dispatched much
+    // later than that, something blocked the main loop in between.
+    gboolean StallMonitor::static_heartbeat(gpointer user_data) {
+        StallMonitor *_this = (StallMonitor*)user_data;
+        gint64 now = g_get_monotonic_time();
+        int64_t due = _this->next_beat_time.load(std::memory_order_relaxed);
+        int64_t lateness_us = now - due;
+        if (lateness_us > STALL_THRESHOLD_US) {
+            int event_type = current_event.load(std::memory_order_relaxed);
+            int command_id = current_command.load(std::memory_order_relaxed);
+            g_info("The main loop was blocked for %ld ms after handling %s (command %d)",
+                   (long)(lateness_us / 1000), event_type_name(event_type), command_id);
+            Metrics::main_loop_stalls++;
+            Metrics::main_loop_stall_sum_us += lateness_us;
+            Metrics::main_loop_stall_max_us = MAX(Metrics::main_loop_stall_max_us, lateness_us);
+            // The delay shown by --dump-trace is the length of the stall
+            Trace::record(TRACE_STALL, event_type, command_id, due * 1000);
+        }
+        // Only blame what ran since this heartbeat for the next stall
+        current_event.store(0, std::memory_order_relaxed);
+        current_command.store(-1, std::memory_order_relaxed);
+        _this->next_beat_time.store(now + (int64_t)_this->interval_ms * 1000, std::memory_order_relaxed);
+        if (_this->watchdog_usec > 0) {
+            _this->send_watchdog_ping();
+        }
+        return G_SOURCE_CONTINUE;
+    }
+
+    gpointer StallMonitor::static_watch(gpointer user_data) {
+        StallMonitor *_this = (StallMonitor*)user_data;
+        // The heartbeat which we last warned about, to warn once per hang
+        int64_t warned_due = 0;
+        g_mutex_lock(&_this->mutex);
+        while (!_this->stopping) {
+            g_cond_wait_until(&_this->cond, &_this->mutex, g_get_monotonic_time() + HANG_THRESHOLD_US);
+            if (_this->stopping) {
+                break;
+            }
+            int64_t due = _this->next_beat_time.load(std::memory_order_relaxed);
+            int64_t lateness_us = g_get_monotonic_time() - due;
+            if (lateness_us > HANG_THRESHOLD_US && due != warned_due) {
+                warned_due = due;
+                g_warning("The main loop has been blocked for %ld ms, while handling %s (command %d)",
+                          (long)(lateness_us / 1000),
+                          event_type_name(current_event.load(std::memory_order_relaxed)),
+                          current_command.load(std::memory_order_relaxed));
+            }
+        }
+        g_mutex_unlock(&_this->mutex);
+        return NULL;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef _STALL_MONITOR_H_
+#define _STALL_MONITOR_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include <glib.h>
+
+using std::int64_t;
+
+namespace Xidlechain {
+    // Notices when the main loop is blocked, e.g. by a synchronous
+    // command or D-Bus call. A heartbeat timer on the main loop measures
+    // how late it was dispatched; stalls above STALL_THRESHOLD_US are
+    // counted in the Metrics and recorded in the Trace, along with the
+    // last event and command which were handled before the heartbeat got
+    // to run. Since a heartbeat which never comes can't report anything,
+    // a watcher thread warns about the main loop while it is still hung.
+    //
+    // If systemd asked for watchdog pings (WATCHDOG_USEC), the heartbeat
+    // sends them through the ServiceNotifier, so that a hung daemon gets
+    // restarted.
+    class StallMonitor {
+    public:
+        static constexpr guint HEARTBEAT_INTERVAL_MS = 1000;
+        static constexpr int64_t STALL_THRESHOLD_US = 50 * 1000;
+        // How long the main loop must be blocked before the watcher warns
+        static constexpr int64_t HANG_THRESHOLD_US = 5 * 1000 * 1000;
+    private:
+        // What the main loop is doing. Written by the main thread and
+        // read by the watcher, so they are atomic.
+        static inline std::atomic<int> current_event{0};
+        static inline std::atomic<int> current_command{-1};
+
+        guint interval_ms = 0;
+        guint heartbeat_source_id = 0;
+        // When the next heartbeat is due
+        std::atomic<int64_t> next_beat_time{0};
+        int64_t watchdog_usec = 0;
+        GThread *watcher = NULL;
+        GMutex mutex;
+        GCond cond;
+        bool stopping = false;
+
+        static gboolean static_heartbeat(gpointer user_data);
+        static gpointer static_watch(gpointer user_data);
+        void send_watchdog_ping();
+    public:
+        StallMonitor();
+        ~StallMonitor();
+        StallMonitor(const StallMonitor&) = delete;
+        StallMonitor& operator=(const StallMonitor&) = delete;
+
+        // Starts the heartbeat and the watcher. The heartbeat is made more
+        // frequent if the systemd watchdog needs it.
+        void start(guint heartbeat_interval_ms = HEARTBEAT_INTERVAL_MS);
+
+        // Called by the EventManager and the Commands, so that stalls
+        // can be blamed on something.
+        static void enter_event(int event_type) {
+            current_event.store(event_type, std::memory_order_relaxed);
+            current_command.store(-1, std::memory_order_relaxed);
+        }
+        static void enter_command(int command_id) {
+            current_command.store(command_id, std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif
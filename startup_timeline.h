@@ -0,0 +1,26 @@
+#ifndef _STARTUP_TIMELINE_H_
+#define _STARTUP_TIMELINE_H_
+
+#include <glib.h>
+
+namespace Xidlechain {
+    // Most of the initialization happens asynchronously, so this logs
+    // how long after startup each step finished (run with -d to see it).
+    class StartupTimeline {
+        static inline gint64 start_time = 0;
+    public:
+        static void begin() {
+            start_time = g_get_monotonic_time();
+        }
+        static void mark(const char *step) {
+            if (start_time == 0) {
+                // begin() was never called, e.g. in the tests
+                return;
+            }
+            g_debug("startup +%.1f ms: %s",
+                    (g_get_monotonic_time() - start_time) / 1000.0, step);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "command.h"
+#include "status_page.h"
+
+namespace Xidlechain {
+    string StatusPage::default_path(const char *display_name) {
+        g_autofree gchar *name = display_name
+            ? g_strdup_printf("xidlechain-%s.status", display_name)
+            : g_strdup("xidlechain.status");
+        g_autofree gchar *path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+        return path;
+    }
+
+    bool StatusPage::open(const string &page_path) {
+        g_return_val_if_fail(page == NULL, FALSE);
+        // Like the trace, the page is built next to the old one and
+        // renamed into place, so that readers never see it half-initialized
+        g_autofree gchar *tmp_path = g_strdup_printf("%s.XXXXXX", page_path.c_str());
+        int fd = g_mkstemp(tmp_path);
+        if (fd < 0) {
+            g_warning("Could not create %s: %s", tmp_path, g_strerror(errno));
+            return false;
+        }
+        if (ftruncate(fd, sizeof(Page)) < 0) {
+            g_warning("Could not resize %s: %s", tmp_path, g_strerror(errno));
+            ::close(fd);
+            g_unlink(tmp_path);
+            return false;
+        }
+        void *addr = mmap(NULL, sizeof(Page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            g_warning("Could not map %s: %s", tmp_path, g_strerror(errno));
+            g_unlink(tmp_path);
+            return false;
+        }
+        Page *new_page = static_cast<Page*>(addr);
+        new_page->magic = MAGIC;
+        new_page->version = VERSION;
+        new_page->page_size = sizeof(Page);
+        new_page->pid = getpid();
+        if (g_rename(tmp_path, page_path.c_str()) < 0) {
+            g_warning("Could not rename %s: %s", tmp_path, g_strerror(errno));
+            munmap(addr, sizeof(Page));
+            g_unlink(tmp_path);
+            return false;
+        }
+        page = new_page;
+        path = page_path;
+        last = Snapshot();
+        return true;
+    }
+
+    StatusPage::~StatusPage() {
+        if (!page) {
+            return;
+        }
+        munmap(page, sizeof(Page));
+        page = NULL;
+        // A stale page would tell status bars that nothing is going on
+        g_unlink(path.c_str());
+    }
+
+    void StatusPage::publish(const Snapshot &snapshot) {
+        if (!page || (last.generation > 0 && snapshot.same_state(last))) {
+            return;
+        }
+        uint64_t seq = page->seq.load(std::memory_order_relaxed);
+        page->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        page->idle_state_since_us.store(snapshot.idle_state_since_us, std::memory_order_relaxed);
+        page->activated_slots.store(snapshot.activated_slots, std::memory_order_relaxed);
+        page->num_activated.store(snapshot.num_activated, std::memory_order_relaxed);
+        page->inhibitors.store(snapshot.inhibitors, std::memory_order_relaxed);
+        page->flags.store((snapshot.idle ? FLAG_IDLE : 0)
+                          | (snapshot.paused ? FLAG_PAUSED : 0)
+                          | (snapshot.audio_playing ? FLAG_AUDIO_PLAYING : 0),
+                          std::memory_order_relaxed);
+        page->seq.store(seq + 2, std::memory_order_release);
+        last = snapshot;
+        last.generation = (seq + 2) / 2;
+    }
+
+    bool StatusPage::read(const string &page_path, Snapshot &snapshot) {
+        int fd = ::open(page_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            g_printerr("Could not open %s: %s\n", page_path.c_str(), g_strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Page)) {
+            g_printerr("%s is not a status page\n", page_path.c_str());
+            ::close(fd);
+            return false;
+        }
+        void *addr = mmap(NULL, sizeof(Page), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            g_printerr("Could not map %s: %s\n", page_path.c_str(), g_strerror(errno));
+            return false;
+        }
+        const Page *p = static_cast<const Page*>(addr);
+        if (p->magic != MAGIC || p->version != VERSION || p->page_size != sizeof(Page)) {
+            g_printerr("%s was written by an incompatible version of xidlechain\n", page_path.c_str());
+            munmap(addr, sizeof(Page));
+            return false;
+        }
+        snapshot.pid = p->pid;
+        // An update only takes a few stores, so unless the daemon died in
+        // the middle of one, this succeeds within a few tries
+        bool consistent = false;
+        for (int tries = 0; tries < MAX_READ_TRIES && !consistent; tries++) {
+            uint64_t seq = p->seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                sched_yield();
+                continue;
+            }
+            snapshot.idle_state_since_us = p->idle_state_since_us.load(std::memory_order_relaxed);
+            snapshot.activated_slots = p->activated_slots.load(std::memory_order_relaxed);
+            snapshot.num_activated = p->num_activated.load(std::memory_order_relaxed);
+            snapshot.inhibitors = p->inhibitors.load(std::memory_order_relaxed);
+            uint32_t flags = p->flags.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (p->seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            snapshot.generation = seq / 2;
+            snapshot.idle = flags & FLAG_IDLE;
+            snapshot.paused = flags & FLAG_PAUSED;
+            snapshot.audio_playing = flags & FLAG_AUDIO_PLAYING;
+            consistent = true;
+        }
+        munmap(addr, sizeof(Page));
+        if (!consistent) {
+            g_printerr("%s is not being updated consistently\n", page_path.c_str());
+        }
+        return consistent;
+    }
+
+    bool StatusPage::query(const string &page_path, const char * const *fields, int num_fields, FILE *out) {
+        Snapshot s;
+        if (!read(page_path, s)) {
+            return false;
+        }
+        int64_t since_state_ms = s.idle_state_since_us ? (g_get_monotonic_time() - s.idle_state_since_us) / 1000 : 0;
+        string activated;
+        for (int i = 0; i < 64; i++) {
+            if (s.activated_slots & ((uint64_t)1 << i)) {
+                if (!activated.empty()) {
+                    activated += ',';
+                }
+                activated += std::to_string(i);
+            }
+        }
+        g_autofree char *inhibitors = Command::static_get_inhibit_mask_str(s.inhibitors);
+        // A daemon which crashed leaves its page behind
+        bool running = kill((pid_t)s.pid, 0) == 0 || errno == EPERM;
+        const struct {
+            const char *name;
+            string value;
+        } values[] = {
+            {"pid", std::to_string(s.pid)},
+            {"running", running ? "1" : "0"},
+            {"generation", std::to_string(s.generation)},
+            {"idle", s.idle ? "1" : "0"},
+            {"idle_ms", std::to_string(s.idle ? since_state_ms : 0)},
+            {"idle_state_ms", std::to_string(since_state_ms)},
+            {"activated", activated},
+            {"num_activated", std::to_string(s.num_activated)},
+            {"paused", s.paused ? "1" : "0"},
+            {"audio_playing", s.audio_playing ? "1" : "0"},
+            {"inhibitors", inhibitors},
+        };
+        if (num_fields == 0) {
+            for (const auto &entry : values) {
+                fprintf(out, "%s %s\n", entry.name, entry.value.c_str());
+            }
+            return true;
+        }
+        for (int i = 0; i < num_fields; i++) {
+            bool found = false;
+            for (const auto &entry : values) {
+                if (strcmp(fields[i], entry.name) == 0) {
+                    fprintf(out, "%s\n", entry.value.c_str());
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                g_printerr("Unknown field '%s'\n", fields[i]);
+                return false;
+            }
+        }
+        return true;
+    }
+}
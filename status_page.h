@@ -0,0 +1,112 @@
+#ifndef _STATUS_PAGE_H_
+#define _STATUS_PAGE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using std::int64_t;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace Xidlechain {
+    // A small file under $XDG_RUNTIME_DIR, mapped into memory, which holds
+    // the current idle state of one display, so that status bars can read
+    // it (with `xidlechain --query`) without forking xprintidle or talking
+    // to D-Bus every second. Only the EventManager writes to it, from the
+    // main thread; readers use the sequence number like a seqlock: it is
+    // odd while the page is being written, and a reader which sees it
+    // change while copying the page tries again.
+    class StatusPage {
+    public:
+        static constexpr uint32_t MAGIC = 0x58494453;  // "XIDS"
+        static constexpr uint32_t VERSION = 2;
+        static constexpr int MAX_READ_TRIES = 10000;
+
+        struct Snapshot {
+            // Incremented whenever anything else changes
+            uint64_t generation = 0;
+            int64_t pid = 0;
+            bool idle = false;
+            // CLOCK_MONOTONIC, in us, when the idle state last changed:
+            // while idle, when the user went idle; otherwise when activity
+            // was detected after being idle (or when the daemon started).
+            // This is not the time of the last input.
+            int64_t idle_state_since_us = 0;
+            // Bit i is set if the i-th timeout action, in order of
+            // increasing timeout (then ID), is activated. The IDs aren't
+            // used since they are never reused, so they soon grow past
+            // 64. Only the first 64 actions have a bit, but all of them
+            // are counted in num_activated.
+            uint64_t activated_slots = 0;
+            uint32_t num_activated = 0;
+            bool paused = false;
+            bool audio_playing = false;
+            // The Command::InhibitSources which are active
+            uint32_t inhibitors = 0;
+
+            bool same_state(const Snapshot &other) const {
+                return idle == other.idle
+                    && idle_state_since_us == other.idle_state_since_us
+                    && activated_slots == other.activated_slots
+                    && num_activated == other.num_activated
+                    && paused == other.paused
+                    && audio_playing == other.audio_playing
+                    && inhibitors == other.inhibitors;
+            }
+        };
+
+    private:
+        struct Page {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t page_size;
+            uint32_t reserved;
+            int64_t pid;
+            // Odd while the fields below are being written
+            std::atomic<uint64_t> seq;
+            std::atomic<int64_t> idle_state_since_us;
+            std::atomic<uint64_t> activated_slots;
+            std::atomic<uint32_t> num_activated;
+            std::atomic<uint32_t> inhibitors;
+            // IDLE, PAUSED and AUDIO_PLAYING
+            std::atomic<uint32_t> flags;
+        };
+        static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                      "the status page is shared with other processes");
+        enum {
+            FLAG_IDLE = 1 << 0,
+            FLAG_PAUSED = 1 << 1,
+            FLAG_AUDIO_PLAYING = 1 << 2,
+        };
+
+        Page *page = NULL;
+        string path;
+        Snapshot last;
+    public:
+        StatusPage() = default;
+        ~StatusPage();
+        StatusPage(const StatusPage&) = delete;
+        StatusPage& operator=(const StatusPage&) = delete;
+
+        // The page of the display served without -x is xidlechain.status,
+        // the others are named after their display
+        static string default_path(const char *display_name);
+        // Creates (or replaces) the page. It is removed again when this
+        // object is destroyed.
+        bool open(const string &path);
+        // Only writes to the page, and increments the generation, if the
+        // state changed since the last call.
+        void publish(const Snapshot &snapshot);
+
+        // Reads a consistent snapshot from the page at |path|
+        static bool read(const string &path, Snapshot &snapshot);
+        // Prints the |fields| of the page at |path|, one value per line,
+        // or every field as "name value" if |fields| is empty.
+        static bool query(const string &path, const char * const *fields, int num_fields, FILE *out);
+    };
+}
+
+#endif
@@ -1,16 +1,16 @@
 #include <iostream>
-#include <gdk/gdk.h>
 #include "activity_detector.h"
 #include "event_receiver.h"
+#include "x_connection.h"
 
 using namespace std;
 
 class MyReceiver: public Xidlechain::EventReceiver {
 public:
-    void receive(Xidlechain::EventType event, gpointer data) override {
-        switch (event) {
+    void receive(const Xidlechain::Event &event) override {
+        switch (event.type) {
             case Xidlechain::EVENT_ACTIVITY_TIMEOUT:
-                cout << "TIMEOUT " << (long)data << endl;
+                cout << "TIMEOUT " << event.timeout_info().timeout_id << endl;
                 break;
             case Xidlechain::EVENT_ACTIVITY_RESUME:
                 cout << "RESUME" << endl;
@@ -22,12 +22,15 @@ public:
 };
 
 int main(int argc, char *argv[]) {
-    gdk_init(&argc, &argv);
+    Xidlechain::XConnection x_connection;
+    if (!x_connection.open(NULL)) {
+        return 1;
+    }
     MyReceiver receiver;
-    Xidlechain::XsyncActivityDetector activity_detector;
+    Xidlechain::XcbActivityDetector activity_detector(&x_connection);
     activity_detector.init(&receiver);
-    activity_detector.add_idle_timeout(2000, (gpointer)1L);
-    activity_detector.add_idle_timeout(5000, (gpointer)2L);
+    activity_detector.add_idle_timeout(2000, 1);
+    activity_detector.add_idle_timeout(5000, 2);
     GMainLoop *loop = g_main_loop_new(NULL, FALSE);
     g_main_loop_run(loop);
 }
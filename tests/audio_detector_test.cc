@@ -7,8 +7,8 @@ using namespace std;
 
 class MyReceiver: public Xidlechain::EventReceiver {
 public:
-    void receive(Xidlechain::EventType event, gpointer data) override {
-        switch (event) {
+    void receive(const Xidlechain::Event &event) override {
+        switch (event.type) {
             case Xidlechain::EVENT_AUDIO_RUNNING:
                 cout << "AUDIO RUNNING" << endl;
                 break;
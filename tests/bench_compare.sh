@@ -0,0 +1,29 @@
+#!/bin/sh
+# Compares two outputs of `make bench`, e.g. from before and after a change:
+#   make bench > old.tsv; (apply the change); make bench > new.tsv
+#   tests/bench_compare.sh old.tsv new.tsv
+# Prints the relative change of each metric, and marks the rows where the
+# time per event grew by more than THRESHOLD percent (default 10).
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 OLD NEW" >&2
+    exit 1
+fi
+
+awk -F '\t' -v threshold="${THRESHOLD:-10}" '
+    function change(old, new) {
+        if (old == "-" || new == "-") return "-"
+        if (old == 0) return new == 0 ? "+0%" : "new"
+        return sprintf("%+.1f%%", (new - old) * 100 / old)
+    }
+    FNR == 1 { next }
+    NR == FNR { ns[$1 "\t" $2] = $4; allocs[$1 "\t" $2] = $5; insns[$1 "\t" $2] = $6; next }
+    {
+        key = $1 "\t" $2
+        if (!(key in ns)) next
+        mark = (ns[key] > 0 && ($4 - ns[key]) * 100 / ns[key] > threshold) ? "  <-- slower" : ""
+        printf "%-20s %6d  ns %10.1f -> %10.1f (%s)  allocs %s  insns %s%s\n",
+            $1, $2, ns[key], $4, change(ns[key], $4), change(allocs[key], $5),
+            change(insns[key], $6), mark
+    }
+' "$1" "$2"
@@ -0,0 +1,118 @@
+#include <locale>
+#include <memory>
+#include <vector>
+
+#include <glib.h>
+
+#include "change_log.h"
+#include "command.h"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+using namespace Xidlechain;
+
+static shared_ptr<Command> make_command(int id) {
+    shared_ptr<Command> cmd = make_shared<Command>();
+    cmd->id = id;
+    return cmd;
+}
+
+static void test_generations(gpointer, gconstpointer) {
+    ChangeLog log;
+    const char *instance = log.get_instance_id().c_str();
+    guint64 start = log.get_generation();
+    g_assert_false(log.is_complete(instance, start));
+
+    shared_ptr<Command> cmd1 = make_command(1), cmd2 = make_command(2);
+    log.record(Event::command_added(cmd1));
+    guint64 after_add = log.get_generation();
+    log.record(Event::command_added(cmd2));
+    g_autoptr(GVariant) old_value = g_variant_ref_sink(g_variant_new_boolean(FALSE));
+    log.record(Event::config_changed(PROPERTY_IGNORE_AUDIO, old_value));
+    log.record(Event::command_removed(cmd1));
+    g_assert_cmpuint(log.get_generation(), ==, start + 4);
+    // Events which aren't config changes don't count
+    log.record(Event(EVENT_LOCK));
+    g_assert_cmpuint(log.get_generation(), ==, start + 4);
+
+    g_assert_false(log.is_complete(instance, after_add));
+    g_assert_false(log.action_changed_since(1, after_add));
+    g_assert_true(log.action_changed_since(2, after_add));
+    g_assert_true(log.config_changed_since(after_add));
+    g_assert_false(log.config_changed_since(log.get_generation()));
+    vector<int> removed = log.removed_since(after_add);
+    g_assert_cmpuint(removed.size(), ==, 1);
+    g_assert_cmpint(removed[0], ==, 1);
+    g_assert_true(log.removed_since(log.get_generation()).empty());
+
+    // A generation from the future, or from another instance, can't be
+    // answered
+    g_assert_true(log.is_complete(instance, log.get_generation() + 1));
+    g_assert_true(log.is_complete("another instance", after_add));
+}
+
+static void test_removal_eviction(gpointer, gconstpointer) {
+    ChangeLog log;
+    const char *instance = log.get_instance_id().c_str();
+    guint64 start = log.get_generation();
+    for (int id = 1; id <= (int)ChangeLog::MAX_REMOVED_ACTIONS; id++) {
+        log.record(Event::command_removed(make_command(id)));
+    }
+    // Everything still fits
+    g_assert_false(log.is_complete(instance, start));
+    g_assert_cmpuint(log.removed_since(start).size(), ==, ChangeLog::MAX_REMOVED_ACTIONS);
+
+    // The oldest removal is forgotten, so a client which didn't see it
+    // has to start over, but one which did is fine
+    log.record(Event::command_removed(make_command(1000)));
+    g_assert_true(log.is_complete(instance, start));
+    g_assert_false(log.is_complete(instance, start + 1));
+    vector<int> removed = log.removed_since(start + 1);
+    g_assert_cmpuint(removed.size(), ==, ChangeLog::MAX_REMOVED_ACTIONS);
+    // Newest first
+    g_assert_cmpint(removed.front(), ==, 1000);
+    g_assert_cmpint(removed.back(), ==, 2);
+}
+
+static void test_lazy_state(gpointer, gconstpointer) {
+    ChangeLog log;
+    ChangeLog::RuntimeState state;
+    state.idle = true;
+    state.idle_state_since = 1234;
+    state.activated = {1, 2};
+    g_assert_true(log.update_state(state));
+    guint64 generation = log.get_generation();
+    g_assert_true(log.state_changed_since(generation - 1));
+    g_assert_false(log.state_changed_since(generation));
+
+    // The same state again doesn't count as a change
+    g_assert_false(log.update_state(state));
+    g_assert_cmpuint(log.get_generation(), ==, generation);
+
+    // Neither do config changes
+    g_autoptr(GVariant) old_value = g_variant_ref_sink(g_variant_new_boolean(FALSE));
+    log.record(Event::config_changed(PROPERTY_IGNORE_AUDIO, old_value));
+    g_assert_false(log.state_changed_since(generation));
+
+    // Only the state at the time of the comparison is recorded, however
+    // often it changed in between
+    state.activated = {1};
+    state.audio_playing = true;
+    g_assert_true(log.update_state(state));
+    g_assert_cmpuint(log.get_generation(), ==, generation + 2);
+    g_assert_true(log.state_changed_since(generation + 1));
+    g_assert_true(log.get_state() == state);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/change-log/generations", void, NULL, NULL, test_generations, NULL);
+    g_test_add("/change-log/removal-eviction", void, NULL, NULL, test_removal_eviction, NULL);
+    g_test_add("/change-log/lazy-state", void, NULL, NULL, test_lazy_state, NULL);
+
+    return g_test_run();
+}
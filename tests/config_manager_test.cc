@@ -0,0 +1,227 @@
+#include <cstring>
+#include <locale>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config_manager.h"
+#include "metrics.h"
+
+using std::strstr;
+using namespace Xidlechain;
+
+static const char * const INITIAL_CONFIG =
+    "# a comment which must survive saving\n"
+    "[Main]\n"
+    "ignore_audio = false\n"
+    "[Action a]\n"
+    "trigger = timeout 2\n"
+    "exec = b1\n";
+
+struct Fixture {
+    gchar *dir;
+    gchar *path;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->dir, "xidlechain.conf", NULL);
+    g_assert_true(g_file_set_contents(fixture->path, INITIAL_CONFIG, -1, &error));
+    g_assert_no_error(error);
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    g_unlink(fixture->path);
+    // This fails if any temporary files were left behind
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->path);
+    g_free(fixture->dir);
+}
+
+static gboolean timeout_cb(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+static void wait_for_saves(ConfigManager &config_manager, guint64 expected) {
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, timeout_cb, &timed_out);
+    while (config_manager.get_saves_performed() < expected && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+}
+
+static gchar *read_file(const gchar *path) {
+    g_autoptr(GError) error = NULL;
+    gchar *contents = NULL;
+    g_assert_true(g_file_get_contents(path, &contents, NULL, &error));
+    g_assert_no_error(error);
+    return contents;
+}
+
+static void test_coalesce(Fixture *fixture, gconstpointer) {
+    ConfigManager config_manager;
+    g_assert_true(config_manager.parse_config_file(fixture->path));
+    uint64_t metrics_requested = Metrics::config_saves_requested;
+    uint64_t metrics_performed = Metrics::config_saves_performed;
+    for (int i = 0; i < 5; i++) {
+        config_manager.set_ignore_audio(i % 2 == 0);
+        config_manager.save_config_to_file_async();
+    }
+    wait_for_saves(config_manager, 1);
+    // Make sure that no other writes are on their way
+    bool settled = false;
+    g_timeout_add(1000, timeout_cb, &settled);
+    while (!settled) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_cmpuint(config_manager.get_saves_requested(), ==, 5);
+    g_assert_cmpuint(config_manager.get_saves_performed(), ==, 1);
+    // The daemon-wide counters which the MetricsExporter publishes
+    g_assert_cmpuint(Metrics::config_saves_requested, ==, metrics_requested + 5);
+    g_assert_cmpuint(Metrics::config_saves_performed, ==, metrics_performed + 1);
+
+    g_autofree gchar *contents = read_file(fixture->path);
+    g_assert_nonnull(strstr(contents, "# a comment which must survive saving"));
+    g_assert_nonnull(strstr(contents, "ignore_audio=true"));
+    g_assert_nonnull(strstr(contents, "[Action a]"));
+}
+
+static void test_save_after_write(Fixture *fixture, gconstpointer) {
+    ConfigManager config_manager;
+    g_assert_true(config_manager.parse_config_file(fixture->path));
+    config_manager.set_ignore_audio(true);
+    config_manager.save_config_to_file_async();
+    wait_for_saves(config_manager, 1);
+    // Later changes must be written too
+    config_manager.set_ignore_audio(false);
+    config_manager.save_config_to_file_async();
+    wait_for_saves(config_manager, 2);
+    g_autofree gchar *contents = read_file(fixture->path);
+    g_assert_nonnull(strstr(contents, "ignore_audio=false"));
+}
+
+static void test_flush_on_destroy(Fixture *fixture, gconstpointer) {
+    {
+        ConfigManager config_manager;
+        g_assert_true(config_manager.parse_config_file(fixture->path));
+        config_manager.set_ignore_audio(true);
+        config_manager.save_config_to_file_async();
+    }
+    g_autofree gchar *contents = read_file(fixture->path);
+    g_assert_nonnull(strstr(contents, "ignore_audio=true"));
+}
+
+static void test_flush_during_write(Fixture *fixture, gconstpointer) {
+    {
+        ConfigManager config_manager;
+        g_assert_true(config_manager.parse_config_file(fixture->path));
+        config_manager.set_ignore_audio(true);
+        config_manager.save_config_to_file_async();
+        // The write starts when the timer fires. Wait for it to land
+        // without running its completion callback, so that it is still
+        // in progress.
+        g_main_context_iteration(NULL, TRUE);
+        for (;;) {
+            g_autofree gchar *contents = read_file(fixture->path);
+            if (strstr(contents, "ignore_audio=true")) {
+                break;
+            }
+            g_usleep(1000);
+        }
+        config_manager.set_ignore_audio(false);
+        config_manager.save_config_to_file_async();
+    }
+    g_autofree gchar *contents = read_file(fixture->path);
+    g_assert_nonnull(strstr(contents, "ignore_audio=false"));
+}
+
+static void test_merge_external_edit(Fixture *fixture, gconstpointer) {
+    ConfigManager config_manager;
+    g_assert_true(config_manager.parse_config_file(fixture->path));
+    // Edited behind our back, and not reloaded yet
+    g_autofree gchar *edited = g_strconcat(INITIAL_CONFIG,
+                                           "# another comment\n"
+                                           "[Action b]\n"
+                                           "trigger = timeout 3\n"
+                                           "exec = b2\n", NULL);
+    g_assert_true(g_file_set_contents(fixture->path, edited, -1, NULL));
+    config_manager.set_ignore_audio(true);
+    config_manager.save_config_to_file_async();
+    wait_for_saves(config_manager, 1);
+
+    g_autofree gchar *contents = read_file(fixture->path);
+    g_assert_nonnull(strstr(contents, "ignore_audio=true"));
+    g_assert_nonnull(strstr(contents, "# another comment"));
+    g_assert_nonnull(strstr(contents, "[Action b]"));
+    // The edit was taken in, since its reload will be ignored
+    bool found = false;
+    for (shared_ptr<Command> cmd : config_manager.get_all_commands()) {
+        found = found || cmd->name == "b";
+    }
+    g_assert_true(found);
+    g_assert_true(config_manager.reload_config_file());
+    g_assert_true(config_manager.ignore_audio);
+}
+
+static void test_save_through_symlink(Fixture *fixture, gconstpointer) {
+    g_autofree gchar *target = g_build_filename(fixture->dir, "real.conf", NULL);
+    g_assert_cmpint(g_rename(fixture->path, target), ==, 0);
+    g_assert_cmpint(symlink("real.conf", fixture->path), ==, 0);
+    ConfigManager config_manager;
+    g_assert_true(config_manager.parse_config_file(fixture->path));
+    config_manager.set_ignore_audio(true);
+    config_manager.save_config_to_file_async();
+    wait_for_saves(config_manager, 1);
+
+    g_assert_true(g_file_test(fixture->path, G_FILE_TEST_IS_SYMLINK));
+    g_autofree gchar *contents = read_file(target);
+    g_assert_nonnull(strstr(contents, "ignore_audio=true"));
+    g_unlink(target);
+}
+
+static void test_pressure_trigger_window(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    g_assert_true(config_manager.set_cpu_pressure_trigger("some 500000 2000000"));
+    g_assert_true(config_manager.set_io_pressure_trigger("full 100000 10000000"));
+    // Unprivileged triggers need a window which is a multiple of 2 s, so
+    // this is caught when the config is parsed instead of at startup
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*must be a multiple of 2 s*");
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "Invalid value for cpu_pressure_trigger*");
+    g_assert_false(config_manager.set_cpu_pressure_trigger("some 150000 1000000"));
+    g_test_assert_expected_messages();
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*must be a multiple of 2 s*");
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "Invalid value for io_pressure_trigger*");
+    g_assert_false(config_manager.set_io_pressure_trigger("some 500000 12000000"));
+    g_test_assert_expected_messages();
+    g_assert_cmpstr(config_manager.cpu_pressure_trigger.c_str(), ==, "some 500000 2000000");
+    g_assert_cmpstr(config_manager.io_pressure_trigger.c_str(), ==, "full 100000 10000000");
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/config-manager/coalesce-saves", Fixture, NULL,
+               fixture_setup, test_coalesce, fixture_teardown);
+    g_test_add("/config-manager/save-after-write", Fixture, NULL,
+               fixture_setup, test_save_after_write, fixture_teardown);
+    g_test_add("/config-manager/flush-on-destroy", Fixture, NULL,
+               fixture_setup, test_flush_on_destroy, fixture_teardown);
+    g_test_add("/config-manager/flush-during-write", Fixture, NULL,
+               fixture_setup, test_flush_during_write, fixture_teardown);
+    g_test_add("/config-manager/merge-external-edit", Fixture, NULL,
+               fixture_setup, test_merge_external_edit, fixture_teardown);
+    g_test_add("/config-manager/save-through-symlink", Fixture, NULL,
+               fixture_setup, test_save_through_symlink, fixture_teardown);
+    g_test_add("/config-manager/pressure-trigger-window", void, NULL,
+               NULL, test_pressure_trigger_window, NULL);
+
+    return g_test_run();
+}
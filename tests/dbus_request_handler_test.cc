@@ -0,0 +1,276 @@
+#include <cstdint>
+#include <locale>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <gio/gio.h>
+
+#include "app.h"
+#include "config_manager.h"
+#include "dbus_request_handler.h"
+#include "event_manager.h"
+#include "tests/mocks.h"
+
+using std::int64_t;
+using std::make_unique;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+using namespace Xidlechain;
+
+// Remembers every timeout which was added, so that the tests can tell
+// which states of an action the EventManager saw on the way
+class RecordingActivityDetector: public MockActivityDetector {
+public:
+    vector<int64_t> added_timeouts;
+    bool add_idle_timeout(int64_t timeout_ms, int timeout_id) override {
+        added_timeouts.push_back(timeout_ms);
+        return MockActivityDetector::add_idle_timeout(timeout_ms, timeout_id);
+    }
+};
+
+static RecordingActivityDetector activity_detector;
+static MockAudioDetector audio_detector;
+static MockLogindManager logind_manager;
+static MockProcessSpawner process_spawner;
+static MockBrightnessController brightness_controller;
+static ConfigManager config_manager;
+// A connection of its own, like a real client
+static GDBusConnection *client = NULL;
+// The actions which the tests change; they are there from the start, so
+// that their timeouts are armed
+static shared_ptr<Command> invalid_cmd, set_cmd;
+
+static shared_ptr<Command> make_command(const char *name, int64_t timeout_ms) {
+    unique_ptr<Command> cmd = make_unique<Command>();
+    cmd->name = name;
+    cmd->trigger = Command::TIMEOUT;
+    cmd->timeout_ms = timeout_ms;
+    cmd->activation_action = Command::Action::factory("true", NULL);
+    int id = config_manager.add_command(std::move(cmd));
+    return config_manager.lookup_command(id);
+}
+
+static gboolean timeout_cb(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+static void on_name_appeared(GDBusConnection*, const gchar*, const gchar*, gpointer user_data) {
+    *(bool*)user_data = true;
+}
+
+static void wait_for_flag(bool &flag) {
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, timeout_cb, &timed_out);
+    while (!flag && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+}
+
+static void on_call_done(GObject *source, GAsyncResult *res, gpointer user_data) {
+    g_autoptr(GError) error = NULL;
+    *(GVariant**)user_data = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    g_assert_no_error(error);
+}
+
+// Calls ApplyChanges from the client while the handler keeps running in
+// the main loop. Returns the (applied, results) reply.
+static GVariant *apply_changes(GVariantBuilder *changes) {
+    GVariant *reply = NULL;
+    g_dbus_connection_call(
+        client, DBUS_BUS_NAME, DBUS_OBJECT_BASE_PATH, DBUS_BUS_NAME,
+        "ApplyChanges", g_variant_new("(a(isa{sv}))", changes),
+        G_VARIANT_TYPE("(ba(is))"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        on_call_done, &reply);
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, timeout_cb, &timed_out);
+    while (!reply && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+    return reply;
+}
+
+// Returns the error of the |index|th change in the results of |reply|
+static const gchar *result_error(GVariant *reply, gsize index) {
+    g_autoptr(GVariant) results = g_variant_get_child_value(reply, 1);
+    const gchar *error;
+    g_variant_get_child(results, index, "(i&s)", NULL, &error);
+    return error;
+}
+
+static void add_change(GVariantBuilder *changes, int id, const char *operation,
+                       const char *property = NULL, const char *value = NULL) {
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+    if (property) {
+        g_variant_builder_add(&properties, "{sv}", property, g_variant_new_string(value));
+    }
+    g_variant_builder_add(changes, "(isa{sv})", id, operation, &properties);
+}
+
+// Adds a change which gives an action a name, and for a new action just
+// enough to make it valid
+static void add_named_change(GVariantBuilder *changes, int id, const char *operation, const char *name) {
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&properties, "{sv}", "Name", g_variant_new_string(name));
+    if (g_strcmp0(operation, "add") == 0) {
+        g_variant_builder_add(&properties, "{sv}", "Trigger", g_variant_new_string("timeout 60"));
+        g_variant_builder_add(&properties, "{sv}", "Exec", g_variant_new_string("true"));
+    }
+    g_variant_builder_add(changes, "(isa{sv})", id, operation, &properties);
+}
+
+static void test_apply_invalid(gpointer, gconstpointer) {
+    shared_ptr<Command> cmd = invalid_cmd;
+    size_t num_commands = config_manager.get_all_commands().size();
+    activity_detector.added_timeouts.clear();
+
+    // One bad change rejects the whole batch, and each change says why
+    GVariantBuilder changes;
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a(isa{sv})"));
+    add_change(&changes, cmd->id, "set", "Trigger", "timeout 20");
+    add_change(&changes, 0, "add", "Trigger", "timeout 30");
+    add_change(&changes, 9999, "remove");
+    add_change(&changes, cmd->id, "set", "Trigger", "nonsense");
+    g_autoptr(GVariant) reply = apply_changes(&changes);
+    gboolean applied;
+    g_variant_get_child(reply, 0, "b", &applied);
+    g_assert_false(applied);
+    g_assert_cmpstr(result_error(reply, 0), ==, "");
+    g_assert_cmpstr(result_error(reply, 1), ==, "a new action needs a Name");
+    g_assert_cmpstr(result_error(reply, 2), ==, "action not found");
+    g_assert_cmpstr(result_error(reply, 3), ==, "invalid value for property Trigger");
+
+    // Nothing was applied, not even the valid change
+    g_assert_cmpint(cmd->timeout_ms, ==, 10000);
+    g_assert_cmpuint(config_manager.get_all_commands().size(), ==, num_commands);
+    g_assert_cmpuint(activity_detector.added_timeouts.size(), ==, 0);
+    g_assert_cmpint(activity_detector.data_by_timeout(10000), ==, cmd->id);
+
+    // The same action can't be changed twice in a batch either
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a(isa{sv})"));
+    add_change(&changes, cmd->id, "set", "Name", "renamed");
+    add_change(&changes, cmd->id, "remove");
+    g_autoptr(GVariant) reply2 = apply_changes(&changes);
+    g_variant_get_child(reply2, 0, "b", &applied);
+    g_assert_false(applied);
+    g_assert_cmpstr(result_error(reply2, 1), ==, "action is changed more than once");
+    g_assert_cmpstr(cmd->name.c_str(), ==, "invalid");
+    g_assert_nonnull(config_manager.lookup_command(cmd->id));
+}
+
+static void test_apply_set(gpointer, gconstpointer) {
+    shared_ptr<Command> cmd = set_cmd;
+    activity_detector.added_timeouts.clear();
+
+    // Setting the inhibitors re-adds the timeout. If the properties were
+    // set one at a time, that would happen while the action still had
+    // its old trigger.
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&properties, "{sv}", "InhibitedBy", g_variant_new_string("none"));
+    g_variant_builder_add(&properties, "{sv}", "Trigger", g_variant_new_string("timeout 50"));
+    GVariantBuilder changes;
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a(isa{sv})"));
+    g_variant_builder_add(&changes, "(isa{sv})", cmd->id, "set", &properties);
+    g_autoptr(GVariant) reply = apply_changes(&changes);
+    gboolean applied;
+    g_variant_get_child(reply, 0, "b", &applied);
+    g_assert_true(applied);
+    g_assert_cmpstr(result_error(reply, 0), ==, "");
+
+    g_assert_cmpint(cmd->timeout_ms, ==, 50000);
+    g_assert_cmpuint(cmd->get_inhibit_mask(), ==, 0);
+    g_assert_cmpuint(activity_detector.added_timeouts.size(), >, 0);
+    for (int64_t timeout_ms : activity_detector.added_timeouts) {
+        g_assert_cmpint(timeout_ms, ==, 50000);
+    }
+    g_assert_cmpint(activity_detector.data_by_timeout(50000), ==, cmd->id);
+    g_assert_cmpint(activity_detector.data_by_timeout(40000), ==, 0);
+}
+
+static void test_apply_names(gpointer, gconstpointer) {
+    size_t num_commands = config_manager.get_all_commands().size();
+
+    // A name may be neither taken from an action which keeps it nor used
+    // twice in the batch
+    GVariantBuilder changes;
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a(isa{sv})"));
+    add_named_change(&changes, 0, "add", "set");
+    add_named_change(&changes, 0, "add", "new");
+    add_named_change(&changes, invalid_cmd->id, "set", "new");
+    g_autoptr(GVariant) reply = apply_changes(&changes);
+    gboolean applied;
+    g_variant_get_child(reply, 0, "b", &applied);
+    g_assert_false(applied);
+    g_assert_cmpstr(result_error(reply, 0), ==, "an action named set already exists");
+    g_assert_cmpstr(result_error(reply, 1), ==, "");
+    g_assert_cmpstr(result_error(reply, 2), ==, "an action named new already exists");
+    g_assert_cmpuint(config_manager.get_all_commands().size(), ==, num_commands);
+    g_assert_cmpstr(invalid_cmd->name.c_str(), ==, "invalid");
+
+    // But it can be taken from an action which gives it up in the same
+    // batch
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a(isa{sv})"));
+    add_named_change(&changes, 0, "add", "invalid");
+    add_named_change(&changes, invalid_cmd->id, "set", "renamed");
+    g_autoptr(GVariant) reply2 = apply_changes(&changes);
+    g_variant_get_child(reply2, 0, "b", &applied);
+    g_assert_true(applied);
+    g_assert_cmpstr(invalid_cmd->name.c_str(), ==, "renamed");
+    g_assert_cmpuint(config_manager.get_all_commands().size(), ==, num_commands + 1);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+    g_autoptr(GError) error = NULL;
+    client = g_dbus_connection_new_for_address_sync(
+        g_test_dbus_get_bus_address(bus),
+        (GDBusConnectionFlags)(
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+            | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION
+        ),
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+
+    invalid_cmd = make_command("invalid", 10000);
+    set_cmd = make_command("set", 40000);
+    EventManager event_manager(&config_manager);
+    g_assert_true(event_manager.init(&activity_detector,
+                                     &logind_manager,
+                                     &audio_detector,
+                                     &process_spawner,
+                                     &brightness_controller));
+    DbusRequestHandler handler;
+    handler.init(&config_manager, &event_manager);
+    // The objects are exported before the name is acquired
+    bool name_appeared = false;
+    guint watch_id = g_bus_watch_name_on_connection(
+        client, DBUS_BUS_NAME, G_BUS_NAME_WATCHER_FLAGS_NONE,
+        on_name_appeared, NULL, &name_appeared, NULL);
+    wait_for_flag(name_appeared);
+    g_bus_unwatch_name(watch_id);
+
+    g_test_add("/dbus-request-handler/apply-invalid", void, NULL, NULL, test_apply_invalid, NULL);
+    g_test_add("/dbus-request-handler/apply-set", void, NULL, NULL, test_apply_set, NULL);
+    g_test_add("/dbus-request-handler/apply-names", void, NULL, NULL, test_apply_names, NULL);
+
+    int ret = g_test_run();
+
+    // The handler never lets go of its bus connection, so the bus can't
+    // be taken down cleanly; GTestDBus kills it once the test exits
+    g_object_unref(client);
+    return ret;
+}
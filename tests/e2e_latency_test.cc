@@ -0,0 +1,501 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <locale>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+
+using std::deque;
+using std::string;
+using std::vector;
+
+// Runs the real xidlechain binary against an X server, a private D-Bus
+// daemon and a stand-in logind, and measures how long it takes from an
+// idle timeout, input, Lock/Unlock or PrepareForSleep until the command of
+// the matching action has started. Run it from the root directory with
+// an X server which nobody else is using, e.g.
+//   xvfb-run tests/e2e_latency_test
+// The path of the binary can be set with XIDLECHAIN, and the number of
+// rounds of each measurement with E2E_ITERATIONS.
+//
+// The commands write a marker line to a FIFO which we read, so the
+// latencies include starting the shell. Audio is ignored in the config,
+// since PulseAudio can't be stood in for with a few lines of code; the
+// SharedAudioDetector test covers the audio events instead.
+
+static const char * const LOGIND_XML =
+    "<node>"
+    "  <interface name='org.freedesktop.login1.Manager'>"
+    "    <method name='GetSession'>"
+    "      <arg direction='in' type='s' name='session_id'/>"
+    "      <arg direction='out' type='o' name='object_path'/>"
+    "    </method>"
+    "    <method name='Inhibit'>"
+    "      <arg direction='in' type='s' name='what'/>"
+    "      <arg direction='in' type='s' name='who'/>"
+    "      <arg direction='in' type='s' name='why'/>"
+    "      <arg direction='in' type='s' name='mode'/>"
+    "      <arg direction='out' type='h' name='pipe_fd'/>"
+    "    </method>"
+    "    <method name='ListInhibitors'>"
+    "      <arg direction='out' type='a(ssssuu)' name='inhibitors'/>"
+    "    </method>"
+    "    <property name='BlockInhibited' type='s' access='read'/>"
+    "    <signal name='PrepareForSleep'>"
+    "      <arg type='b' name='start'/>"
+    "    </signal>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.login1.Session'>"
+    "    <method name='SetIdleHint'>"
+    "      <arg direction='in' type='b' name='idle'/>"
+    "    </method>"
+    "    <signal name='Lock'/>"
+    "    <signal name='Unlock'/>"
+    "  </interface>"
+    "</node>";
+
+static const char * const BUS_NAME = "org.freedesktop.login1";
+static const char * const MANAGER_OBJECT_PATH = "/org/freedesktop/login1";
+static const char * const MANAGER_INTERFACE_NAME = "org.freedesktop.login1.Manager";
+static const char * const SESSION_OBJECT_PATH = "/org/freedesktop/login1/session/auto";
+static const char * const SESSION_INTERFACE_NAME = "org.freedesktop.login1.Session";
+
+// The idle timeout of the config below
+static const gint64 IDLE_TIMEOUT_US = 1000 * 1000;
+// How long to wait for a marker before giving up
+static const gint64 MARKER_TIMEOUT_US = 5 * 1000 * 1000;
+
+struct Marker {
+    string label;
+    gint64 time;
+};
+
+struct Harness {
+    gchar *dir;
+    gchar *fifo_path;
+    gchar *config_path;
+    GTestDBus *bus;
+    GDBusConnection *logind_connection;
+    // Held open so that the sleep lock stays "acquired"
+    vector<int> inhibit_fds;
+    xcb_connection_t *x_conn;
+    xcb_window_t root;
+    int fifo_fd;
+    GString *fifo_buffer;
+    deque<Marker> markers;
+    GPid daemon_pid;
+    int num_iterations;
+    bool pointer_toggle;
+};
+
+static Harness harness;
+
+static void fake_method_call(
+    GDBusConnection *connection,
+    const gchar *sender,
+    const gchar *object_path,
+    const gchar *interface_name,
+    const gchar *method_name,
+    GVariant *parameters,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data
+) {
+    if (g_strcmp0(method_name, "GetSession") == 0) {
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new("(o)", SESSION_OBJECT_PATH));
+    } else if (g_strcmp0(method_name, "Inhibit") == 0) {
+        int fds[2];
+        g_assert_cmpint(pipe(fds), ==, 0);
+        g_autoptr(GUnixFDList) fd_list = g_unix_fd_list_new();
+        gint idx = g_unix_fd_list_append(fd_list, fds[0], NULL);
+        close(fds[0]);
+        harness.inhibit_fds.push_back(fds[1]);
+        g_dbus_method_invocation_return_value_with_unix_fd_list(
+            invocation, g_variant_new("(h)", idx), fd_list);
+    } else if (g_strcmp0(method_name, "ListInhibitors") == 0) {
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new_parsed("(@a(ssssuu) [],)"));
+    } else {
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+}
+
+static GVariant *fake_get_property(
+    GDBusConnection *connection,
+    const gchar *sender,
+    const gchar *object_path,
+    const gchar *interface_name,
+    const gchar *property_name,
+    GError **error,
+    gpointer user_data
+) {
+    return g_variant_new_string("sleep");
+}
+
+static const GDBusInterfaceVTable fake_vtable = {
+    fake_method_call,
+    fake_get_property,
+    NULL,
+    {0}
+};
+
+static void fake_logind_start(const gchar *address) {
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GDBusNodeInfo) node_info = g_dbus_node_info_new_for_xml(LOGIND_XML, &error);
+    g_assert_no_error(error);
+    harness.logind_connection = g_dbus_connection_new_for_address_sync(
+        address,
+        (GDBusConnectionFlags)(
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+            | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION
+        ),
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_dbus_connection_register_object(
+        harness.logind_connection, MANAGER_OBJECT_PATH,
+        g_dbus_node_info_lookup_interface(node_info, MANAGER_INTERFACE_NAME),
+        &fake_vtable, NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_dbus_connection_register_object(
+        harness.logind_connection, SESSION_OBJECT_PATH,
+        g_dbus_node_info_lookup_interface(node_info, SESSION_INTERFACE_NAME),
+        &fake_vtable, NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_autoptr(GVariant) res = g_dbus_connection_call_sync(
+        harness.logind_connection,
+        "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+        "RequestName", g_variant_new("(su)", BUS_NAME, 0x4 /* DO_NOT_QUEUE */),
+        G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    g_assert_no_error(error);
+}
+
+static gint64 emit_logind_signal(const char *object_path, const char *interface_name,
+                                 const char *signal_name, GVariant *parameters) {
+    g_autoptr(GError) error = NULL;
+    gint64 time = g_get_monotonic_time();
+    g_dbus_connection_emit_signal(
+        harness.logind_connection, NULL, object_path, interface_name,
+        signal_name, parameters, &error);
+    g_assert_no_error(error);
+    g_dbus_connection_flush_sync(harness.logind_connection, NULL, &error);
+    g_assert_no_error(error);
+    return time;
+}
+
+static gint64 emit_session_signal(const char *signal_name) {
+    return emit_logind_signal(SESSION_OBJECT_PATH, SESSION_INTERFACE_NAME, signal_name, NULL);
+}
+
+static gint64 emit_prepare_for_sleep(bool start) {
+    return emit_logind_signal(MANAGER_OBJECT_PATH, MANAGER_INTERFACE_NAME,
+                              "PrepareForSleep", g_variant_new("(b)", start));
+}
+
+// Moves the pointer with XTest, which resets the idle time of the server
+// like real input does. Returns the time at which the input was sent.
+static gint64 inject_input() {
+    harness.pointer_toggle = !harness.pointer_toggle;
+    int16_t pos = harness.pointer_toggle ? 10 : 20;
+    gint64 time = g_get_monotonic_time();
+    xcb_test_fake_input(harness.x_conn, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
+                        harness.root, pos, pos, 0);
+    // Wait until the server has processed it
+    free(xcb_get_input_focus_reply(harness.x_conn, xcb_get_input_focus(harness.x_conn), NULL));
+    return time;
+}
+
+static gboolean fifo_readable_cb(gint fd, GIOCondition condition, gpointer user_data) {
+    gint64 time = g_get_monotonic_time();
+    char buf[256];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        g_string_append_len(harness.fifo_buffer, buf, n);
+    }
+    char *newline;
+    while ((newline = strchr(harness.fifo_buffer->str, '\n')) != NULL) {
+        string label(harness.fifo_buffer->str, newline - harness.fifo_buffer->str);
+        harness.markers.push_back({label, time});
+        g_string_erase(harness.fifo_buffer, 0, newline - harness.fifo_buffer->str + 1);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean timeout_cb(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+static void run_main_loop_for(gint64 duration_us) {
+    bool timed_out = false;
+    g_timeout_add(duration_us / 1000, timeout_cb, &timed_out);
+    while (!timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static bool is_activity_marker(const string &label) {
+    return label == "idle" || label == "resume";
+}
+
+// Waits for the next marker, which must have the given label, and
+// returns the time at which it arrived. Returns -1 if it doesn't show up.
+// The idle timeout may fire at any point while we wait for the other
+// actions, so idle and resume markers are skipped in that case.
+static gint64 wait_for_marker(const char *label, gint64 timeout_us = MARKER_TIMEOUT_US) {
+    bool skip_activity = !is_activity_marker(label);
+    bool timed_out = false;
+    guint source_id = g_timeout_add(timeout_us / 1000, timeout_cb, &timed_out);
+    for (;;) {
+        while (
+            skip_activity
+            && !harness.markers.empty()
+            && is_activity_marker(harness.markers.front().label)
+        ) {
+            harness.markers.pop_front();
+        }
+        if (!harness.markers.empty() || timed_out) {
+            break;
+        }
+        g_main_context_iteration(NULL, TRUE);
+    }
+    if (harness.markers.empty()) {
+        return -1;
+    }
+    if (!timed_out) {
+        g_source_remove(source_id);
+    }
+    Marker marker = harness.markers.front();
+    harness.markers.pop_front();
+    g_assert_cmpstr(marker.label.c_str(), ==, label);
+    return marker.time;
+}
+
+// Throws away the markers which arrive within the given time
+static void drain_markers(gint64 duration_us) {
+    run_main_loop_for(duration_us);
+    harness.markers.clear();
+}
+
+// Makes sure that no markers arrive for a while
+static void expect_no_marker(gint64 duration_us) {
+    run_main_loop_for(duration_us);
+    g_assert_true(harness.markers.empty());
+}
+
+static void report(const char *name, vector<double> &latencies_ms) {
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    size_t n = latencies_ms.size();
+    // nearest-rank percentiles
+    auto percentile = [&](int p) {
+        size_t rank = (p * n + 99) / 100;
+        return latencies_ms[rank > 0 ? rank - 1 : 0];
+    };
+    g_test_message("%s latency (ms, %zu samples): p50 %.2f  p90 %.2f  p99 %.2f  max %.2f",
+                   name, n, percentile(50), percentile(90), percentile(99), latencies_ms[n - 1]);
+}
+
+static void test_idle_and_resume(void) {
+    vector<double> idle_latencies, resume_latencies;
+    // End the idle period which began during the warm-up, if any
+    inject_input();
+    drain_markers(200 * 1000);
+    for (int i = 0; i < harness.num_iterations; i++) {
+        gint64 input_time = inject_input();
+        gint64 idle_time = wait_for_marker("idle");
+        g_assert_cmpint(idle_time, !=, -1);
+        // The timeout must not fire early
+        g_assert_cmpint(idle_time, >=, input_time + IDLE_TIMEOUT_US);
+        idle_latencies.push_back((idle_time - input_time - IDLE_TIMEOUT_US) / 1000.0);
+
+        gint64 resume_input_time = inject_input();
+        gint64 resume_time = wait_for_marker("resume");
+        g_assert_cmpint(resume_time, !=, -1);
+        resume_latencies.push_back((resume_time - resume_input_time) / 1000.0);
+    }
+    // Without new input, the timeout fires only once per idle period
+    g_assert_cmpint(wait_for_marker("idle"), !=, -1);
+    expect_no_marker(IDLE_TIMEOUT_US);
+    inject_input();
+    g_assert_cmpint(wait_for_marker("resume"), !=, -1);
+    report("idle", idle_latencies);
+    report("resume", resume_latencies);
+}
+
+static void test_lock_and_unlock(void) {
+    vector<double> lock_latencies, unlock_latencies;
+    for (int i = 0; i < harness.num_iterations; i++) {
+        // Keep the idle timeout out of the way
+        inject_input();
+        gint64 lock_signal_time = emit_session_signal("Lock");
+        gint64 lock_time = wait_for_marker("lock");
+        g_assert_cmpint(lock_time, !=, -1);
+        lock_latencies.push_back((lock_time - lock_signal_time) / 1000.0);
+
+        gint64 unlock_signal_time = emit_session_signal("Unlock");
+        gint64 unlock_time = wait_for_marker("unlock");
+        g_assert_cmpint(unlock_time, !=, -1);
+        unlock_latencies.push_back((unlock_time - unlock_signal_time) / 1000.0);
+    }
+    report("lock", lock_latencies);
+    report("unlock", unlock_latencies);
+}
+
+static void test_sleep_and_wake(void) {
+    vector<double> sleep_latencies, wake_latencies;
+    for (int i = 0; i < harness.num_iterations; i++) {
+        inject_input();
+        gint64 sleep_signal_time = emit_prepare_for_sleep(true);
+        gint64 sleep_time = wait_for_marker("sleep");
+        g_assert_cmpint(sleep_time, !=, -1);
+        sleep_latencies.push_back((sleep_time - sleep_signal_time) / 1000.0);
+
+        gint64 wake_signal_time = emit_prepare_for_sleep(false);
+        gint64 wake_time = wait_for_marker("wake");
+        g_assert_cmpint(wake_time, !=, -1);
+        wake_latencies.push_back((wake_time - wake_signal_time) / 1000.0);
+    }
+    report("sleep", sleep_latencies);
+    report("wake", wake_latencies);
+}
+
+static void write_config() {
+    g_autofree gchar *config = g_strdup_printf(
+        "[Main]\n"
+        "ignore_audio = true\n"
+        "enable_dbus = false\n"
+        "wait_before_sleep = false\n"
+        // Waking up would otherwise also run the resume_exec below
+        "wake_resumes_activity = false\n"
+        "[Action idle]\n"
+        "trigger = timeout %d\n"
+        "exec = echo idle > %s\n"
+        "resume_exec = echo resume > %s\n"
+        "[Action lock]\n"
+        "trigger = lock\n"
+        "exec = echo lock > %s\n"
+        "resume_exec = echo unlock > %s\n"
+        "[Action sleep]\n"
+        "trigger = sleep\n"
+        "exec = echo sleep > %s\n"
+        "resume_exec = echo wake > %s\n",
+        (int)(IDLE_TIMEOUT_US / 1000000),
+        harness.fifo_path, harness.fifo_path, harness.fifo_path,
+        harness.fifo_path, harness.fifo_path, harness.fifo_path);
+    g_autoptr(GError) error = NULL;
+    g_assert_true(g_file_set_contents(harness.config_path, config, -1, &error));
+    g_assert_no_error(error);
+}
+
+static void start_daemon() {
+    const char *binary = g_getenv("XIDLECHAIN");
+    if (!binary) {
+        binary = "./xidlechain";
+    }
+    const gchar *argv[] = {binary, "-c", harness.config_path, NULL};
+    gchar **envp = g_get_environ();
+    envp = g_environ_setenv(envp, "DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(harness.bus), TRUE);
+    envp = g_environ_setenv(envp, "DBUS_SESSION_BUS_ADDRESS", g_test_dbus_get_bus_address(harness.bus), TRUE);
+    envp = g_environ_setenv(envp, "XDG_RUNTIME_DIR", harness.dir, TRUE);
+    envp = g_environ_unsetenv(envp, "XDG_SESSION_ID");
+    g_autoptr(GError) error = NULL;
+    g_spawn_async(NULL, (gchar**)argv, envp, G_SPAWN_DO_NOT_REAP_CHILD,
+                  NULL, NULL, &harness.daemon_pid, &error);
+    g_strfreev(envp);
+    g_assert_no_error(error);
+
+    // The daemon connects to logind in the background. Lock the session
+    // until it reacts, which means that it is subscribed to the signals.
+    bool ready = false;
+    for (int i = 0; i < 50 && !ready; i++) {
+        emit_session_signal("Lock");
+        gint64 lock_time = wait_for_marker("lock", 200 * 1000);
+        if (lock_time != -1) {
+            emit_session_signal("Unlock");
+            g_assert_cmpint(wait_for_marker("unlock"), !=, -1);
+            ready = true;
+        }
+    }
+    g_assert_true(ready);
+    // in case one of the extra Locks arrives late
+    drain_markers(200 * 1000);
+}
+
+static void stop_daemon() {
+    kill(harness.daemon_pid, SIGTERM);
+    waitpid(harness.daemon_pid, NULL, 0);
+    g_spawn_close_pid(harness.daemon_pid);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    const char *iterations = g_getenv("E2E_ITERATIONS");
+    harness.num_iterations = iterations ? atoi(iterations) : 10;
+    g_assert_cmpint(harness.num_iterations, >, 0);
+
+    g_autoptr(GError) error = NULL;
+    harness.dir = g_dir_make_tmp("xidlechain-e2e-XXXXXX", &error);
+    g_assert_no_error(error);
+    harness.fifo_path = g_build_filename(harness.dir, "markers", NULL);
+    harness.config_path = g_build_filename(harness.dir, "xidlechain.conf", NULL);
+    g_assert_cmpint(mkfifo(harness.fifo_path, 0600), ==, 0);
+    // Opened for writing too, so that we never see EOF between commands
+    harness.fifo_fd = open(harness.fifo_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    g_assert_cmpint(harness.fifo_fd, >=, 0);
+    harness.fifo_buffer = g_string_new(NULL);
+    g_unix_fd_add(harness.fifo_fd, G_IO_IN, fifo_readable_cb, NULL);
+    write_config();
+
+    harness.x_conn = xcb_connect(NULL, NULL);
+    g_assert_cmpint(xcb_connection_has_error(harness.x_conn), ==, 0);
+    harness.root = xcb_setup_roots_iterator(xcb_get_setup(harness.x_conn)).data->root;
+
+    harness.bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(harness.bus);
+    fake_logind_start(g_test_dbus_get_bus_address(harness.bus));
+    start_daemon();
+
+    g_test_add_func("/e2e/idle-resume", test_idle_and_resume);
+    g_test_add_func("/e2e/lock-unlock", test_lock_and_unlock);
+    g_test_add_func("/e2e/sleep-wake", test_sleep_and_wake);
+
+    int ret = g_test_run();
+
+    stop_daemon();
+    for (int fd : harness.inhibit_fds) {
+        close(fd);
+    }
+    g_object_unref(harness.logind_connection);
+    g_test_dbus_down(harness.bus);
+    g_object_unref(harness.bus);
+    xcb_disconnect(harness.x_conn);
+    close(harness.fifo_fd);
+    g_string_free(harness.fifo_buffer, TRUE);
+    g_unlink(harness.fifo_path);
+    g_unlink(harness.config_path);
+    // The daemon's trace file, and its status page if it was killed
+    g_autofree gchar *trace_path = g_build_filename(harness.dir, "xidlechain.trace", NULL);
+    g_unlink(trace_path);
+    g_autofree gchar *status_path = g_build_filename(harness.dir, "xidlechain.status", NULL);
+    g_unlink(status_path);
+    g_rmdir(harness.dir);
+    g_free(harness.fifo_path);
+    g_free(harness.config_path);
+    g_free(harness.dir);
+    return ret;
+}
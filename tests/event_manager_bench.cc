@@ -0,0 +1,286 @@
+// Microbenchmarks for the EventManager, run with `make bench`. For each
+// scenario and number of commands, prints one tab-separated line with the
+// time, C++ allocations and instructions per event. See tests/README.txt.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <locale>
+#include <memory>
+#include <new>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "config_manager.h"
+#include "event_manager.h"
+#include "tests/mocks.h"
+
+using std::function;
+using std::int64_t;
+using std::make_unique;
+using std::uint64_t;
+using std::unique_ptr;
+using std::vector;
+using namespace Xidlechain;
+
+// Counts the allocations made through operator new. GLib allocations
+// (g_malloc) are not counted.
+static uint64_t num_allocs = 0;
+
+void *operator new(size_t size) {
+    num_allocs++;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+// Counts the instructions retired in user space, if the kernel lets us
+class InstructionCounter {
+    int fd;
+public:
+    InstructionCounter() {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~InstructionCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    bool available() const {
+        return fd >= 0;
+    }
+    uint64_t read_count() const {
+        uint64_t count = 0;
+        if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+            return 0;
+        }
+        return count;
+    }
+};
+
+static InstructionCounter instruction_counter;
+
+static int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Accumulates the cost of the timed parts of a batch
+class Meter {
+    int64_t start_ns = 0;
+    uint64_t start_allocs = 0;
+    uint64_t start_instructions = 0;
+public:
+    int64_t ns = 0;
+    uint64_t allocs = 0;
+    uint64_t instructions = 0;
+    long events = 0;
+
+    void start() {
+        start_allocs = num_allocs;
+        start_instructions = instruction_counter.read_count();
+        start_ns = now_ns();
+    }
+    void stop(long num_events) {
+        int64_t end_ns = now_ns();
+        uint64_t end_instructions = instruction_counter.read_count();
+        ns += end_ns - start_ns;
+        allocs += num_allocs - start_allocs;
+        instructions += end_instructions - start_instructions;
+        events += num_events;
+    }
+};
+
+struct Bench {
+    MockActivityDetector activity_detector;
+    MockAudioDetector audio_detector;
+    MockLogindManager logind_manager;
+    MockProcessSpawner process_spawner;
+    MockBrightnessController brightness_controller;
+    ConfigManager config_manager;
+    EventManager event_manager;
+    vector<int> ids;
+
+    Bench(): event_manager(&config_manager) {
+        config_manager.ignore_audio = false;
+        config_manager.wait_before_sleep = false;
+    }
+
+    int add_command(int i, Command::Trigger trigger) {
+        unique_ptr<Command> cmd = make_unique<Command>();
+        cmd->name = "bench" + std::to_string(i);
+        cmd->trigger = trigger;
+        cmd->activation_action = Command::Action::factory("true", NULL);
+        cmd->deactivation_action = Command::Action::factory("false", NULL);
+        // Every timeout is distinct, like in a real config
+        cmd->timeout_ms = (int64_t)(i + 1) * 1000;
+        return config_manager.add_command(std::move(cmd));
+    }
+
+    void init(int num_commands, Command::Trigger trigger) {
+        for (int i = 0; i < num_commands; i++) {
+            ids.push_back(add_command(i, trigger));
+        }
+        event_manager.init(&activity_detector,
+                           &logind_manager,
+                           &audio_detector,
+                           &process_spawner,
+                           &brightness_controller);
+    }
+};
+
+// Activates the commands one at a time; the resume which rearms them
+// is not timed.
+static void bench_timeout(Bench &bench, Meter &meter) {
+    vector<Event> events;
+    for (int id : bench.ids) {
+        events.push_back(Event::activity_timeout(id));
+    }
+    meter.start();
+    for (const Event &event : events) {
+        bench.event_manager.receive(event);
+    }
+    meter.stop(events.size());
+    bench.event_manager.receive(Event(EVENT_ACTIVITY_RESUME));
+}
+
+// Deactivates all of the commands at once
+static void bench_resume(Bench &bench, Meter &meter) {
+    for (int id : bench.ids) {
+        bench.event_manager.receive(Event::activity_timeout(id));
+    }
+    Event event(EVENT_ACTIVITY_RESUME);
+    meter.start();
+    bench.event_manager.receive(event);
+    meter.stop(1);
+}
+
+static void bench_sleep_wake(Bench &bench, Meter &meter) {
+    Event sleep_event(EVENT_SLEEP), wake_event(EVENT_WAKE);
+    meter.start();
+    bench.event_manager.receive(sleep_event);
+    bench.event_manager.receive(wake_event);
+    meter.stop(2);
+}
+
+// Each change removes or restores the timeouts of all of the commands
+static void bench_audio_flapping(Bench &bench, Meter &meter) {
+    Event running_event(EVENT_AUDIO_RUNNING), stopped_event(EVENT_AUDIO_STOPPED);
+    meter.start();
+    bench.event_manager.receive(running_event);
+    bench.event_manager.receive(stopped_event);
+    meter.stop(2);
+}
+
+// Includes the ConfigManager bookkeeping, since that's part of every
+// command added or removed over D-Bus or by a config reload
+static void bench_command_add_remove(Bench &bench, Meter &meter) {
+    unique_ptr<Command> cmd = make_unique<Command>();
+    cmd->name = "extra";
+    cmd->trigger = Command::TIMEOUT;
+    cmd->activation_action = Command::Action::factory("true", NULL);
+    cmd->timeout_ms = 1;
+    meter.start();
+    int id = bench.config_manager.add_command(std::move(cmd));
+    bench.event_manager.receive(Event::command_added(bench.config_manager.lookup_command(id)));
+    shared_ptr<Command> removed = bench.config_manager.lookup_command(id);
+    bench.config_manager.remove_command(id);
+    bench.event_manager.receive(Event::command_removed(removed));
+    meter.stop(2);
+}
+
+struct Scenario {
+    const char *name;
+    Command::Trigger trigger;
+    function<void(Bench&, Meter&)> run;
+};
+
+// Each batch runs for at least this long, and the fastest of a few
+// batches is reported to filter out noise.
+static const int64_t MIN_BATCH_NS = 20 * 1000 * 1000;
+static const int NUM_BATCHES = 5;
+
+static void run_scenario(const Scenario &scenario, int num_commands) {
+    Bench bench;
+    bench.init(num_commands, scenario.trigger);
+    // Warm up, so that the vectors in the mocks have grown already
+    Meter warmup;
+    scenario.run(bench, warmup);
+    bench.process_spawner.reset();
+
+    Meter best;
+    for (int batch = 0; batch < NUM_BATCHES; batch++) {
+        Meter meter;
+        int64_t batch_start_ns = now_ns();
+        while (now_ns() - batch_start_ns < MIN_BATCH_NS) {
+            scenario.run(bench, meter);
+            // clear() keeps the capacity, so this doesn't allocate later
+            bench.process_spawner.reset();
+        }
+        if (batch == 0 || meter.ns * best.events < best.ns * meter.events) {
+            best = meter;
+        }
+    }
+    printf("%s\t%d\t%ld\t%.1f\t%.2f\t", scenario.name, num_commands, best.events,
+           (double)best.ns / best.events, (double)best.allocs / best.events);
+    if (instruction_counter.available()) {
+        printf("%.0f\n", (double)best.instructions / best.events);
+    } else {
+        printf("-\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    const Scenario scenarios[] = {
+        {"timeout", Command::TIMEOUT, bench_timeout},
+        {"resume", Command::TIMEOUT, bench_resume},
+        {"sleep_wake", Command::SLEEP, bench_sleep_wake},
+        {"audio_flapping", Command::TIMEOUT, bench_audio_flapping},
+        {"command_add_remove", Command::TIMEOUT, bench_command_add_remove},
+    };
+    const int command_counts[] = {1, 10, 100, 1000, 10000};
+    printf("scenario\tcommands\tevents\tns_per_event\tallocs_per_event\tinstructions_per_event\n");
+    // Only run the scenarios whose names were given, if any
+    for (const Scenario &scenario : scenarios) {
+        if (argc > 1 && std::find_if(argv + 1, argv + argc, [&](const char *arg) {
+                return strcmp(arg, scenario.name) == 0;
+            }) == argv + argc)
+        {
+            continue;
+        }
+        for (int num_commands : command_counts) {
+            run_scenario(scenario, num_commands);
+        }
+    }
+    return EXIT_SUCCESS;
+}
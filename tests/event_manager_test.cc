@@ -8,112 +8,24 @@
 #include <vector>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
-#include "activity_detector.h"
-#include "audio_detector.h"
-#include "brightness_controller.h"
 #include "config_manager.h"
 #include "event_manager.h"
-#include "logind_manager.h"
-#include "process_spawner.h"
+#include "status_page.h"
+#include "tests/mocks.h"
+#include "throttle.h"
 
 using std::int64_t;
+using std::uint32_t;
 using std::make_unique;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::unordered_map;
 using std::vector;
 using namespace Xidlechain;
 
-class MockActivityDetector: public ActivityDetector {
-    unordered_map<int64_t, gpointer> cb_data;
-public:
-    bool init(EventReceiver *receiver) override {
-        return true;
-    }
-    bool add_idle_timeout(int64_t timeout_ms, gpointer data) override {
-        cb_data[timeout_ms] = data;
-        return true;
-    }
-    bool remove_idle_timeout(gpointer data) override {
-        for (unordered_map<int64_t, gpointer>::iterator it = cb_data.begin(); it != cb_data.end(); ++it) {
-            if (it->second == data) {
-                cb_data.erase(it);
-                return true;
-            }
-        }
-        return false;
-    }
-    bool clear_timeouts() override {
-        cb_data.clear();
-        return true;
-    }
-    gpointer data_by_timeout(int64_t timeout_ms) {
-        return cb_data.find(timeout_ms)->second;
-    }
-    int num_data() const {
-        return cb_data.size();
-    }
-    void reset() {
-        cb_data.clear();
-    }
-};
-
-class MockAudioDetector: public AudioDetector {
-public:
-    bool initialized = false;
-    bool init(EventReceiver *receiver) override {
-        initialized = true;
-        return true;
-    }
-    void reset() {
-        initialized = false;
-    }
-};
-
-class MockLogindManager: public LogindManager {
-public:
-    vector<bool> idle_hint_history;
-    bool init(EventReceiver *receiver) override {
-        return true;
-    }
-    bool set_idle_hint(bool idle) override {
-        idle_hint_history.push_back(idle);
-        return true;
-    }
-    void reset() {
-        idle_hint_history.clear();
-    }
-    bool set_brightness(const char *subsystem, unsigned int value) override {
-        return true;
-    }
-    bool suspend() override {
-        return true;
-    }
-};
-
-class MockProcessSpawner: public ProcessSpawner {
-public:
-    vector<const char*> sync_cmds,
-                        async_cmds;
-    void exec_cmd_sync(const string &cmd) override {
-        sync_cmds.push_back(cmd.c_str());
-    }
-    void exec_cmd_async(const string &cmd) override {
-        async_cmds.push_back(cmd.c_str());
-    }
-    void reset() {
-        sync_cmds.clear();
-        async_cmds.clear();
-    }
-};
-
-class MockBrightnessController: public BrightnessController {
-    bool init(LogindManager *logind_manager) { return true; }
-    bool dim() { return true; }
-    void restore_brightness() {}
-};
-
 MockActivityDetector activity_detector;
 MockAudioDetector audio_detector;
 MockLogindManager logind_manager;
@@ -125,6 +37,7 @@ static void fixture_setup(gpointer fixture, gconstpointer user_data) {
     audio_detector.reset();
     logind_manager.reset();
     process_spawner.reset();
+    brightness_controller.reset();
 }
 
 static bool event_manager_init(EventManager &event_manager) {
@@ -165,10 +78,10 @@ static void test_activity_1(gpointer, gconstpointer user_data) {
     event_manager_init(event_manager);
     g_assert_cmpuint(activity_detector.num_data(), ==, 2);
     // trigger each timeout one at a time
-    event_manager.receive(EVENT_ACTIVITY_TIMEOUT, activity_detector.data_by_timeout(2000));
+    event_manager.receive(Event::activity_timeout(activity_detector.data_by_timeout(2000)));
     g_assert_cmpuint(process_spawner.async_cmds.size(), ==, 1);
     if (num_timeouts == 2) {
-        event_manager.receive(EVENT_ACTIVITY_TIMEOUT, activity_detector.data_by_timeout(3000));
+        event_manager.receive(Event::activity_timeout(activity_detector.data_by_timeout(3000)));
         g_assert_cmpuint(process_spawner.async_cmds.size(), ==, 2);
     }
     // verify that the timeouts were executed in order of increasing timeout
@@ -177,7 +90,7 @@ static void test_activity_1(gpointer, gconstpointer user_data) {
         g_assert_cmpstr(process_spawner.async_cmds.at(1), ==, before_cmds[0]);
     }
     // now resume activity
-    event_manager.receive(EVENT_ACTIVITY_RESUME, NULL);
+    event_manager.receive(Event(EVENT_ACTIVITY_RESUME));
     // verify that the "after" commands were run for the timeouts which went off
     g_assert_cmpuint(process_spawner.async_cmds.size(), ==, 2 * num_timeouts);
     if (num_timeouts == 1) {
@@ -206,7 +119,7 @@ static void test_sleep_1(gpointer, gconstpointer user_data) {
     EventManager event_manager(&config_manager);
     event_manager_init(event_manager);
     // send a SLEEP signal
-    event_manager.receive(EVENT_SLEEP, NULL);
+    event_manager.receive(Event(EVENT_SLEEP));
     if (config_manager.wait_before_sleep) {
         g_assert_cmpuint(process_spawner.sync_cmds.size(), ==, 1);
         g_assert_cmpstr(process_spawner.sync_cmds.at(0), ==, "s1");
@@ -215,7 +128,7 @@ static void test_sleep_1(gpointer, gconstpointer user_data) {
         g_assert_cmpstr(process_spawner.async_cmds.at(0), ==, "s1");
     }
     // send a WAKE signal
-    event_manager.receive(EVENT_WAKE, NULL);
+    event_manager.receive(Event(EVENT_WAKE));
     if (config_manager.wait_before_sleep) {
         g_assert_cmpuint(process_spawner.async_cmds.size(), ==, 1);
         g_assert_cmpstr(process_spawner.async_cmds.at(0), ==, "w1");
@@ -236,18 +149,361 @@ static void test_audio_1(gpointer, gconstpointer user_data) {
         g_assert_cmpint(audio_detector.initialized, ==, 0);
         return;
     }
+    g_assert_cmpint(audio_detector.initialized, ==, 1);
 
-    event_manager.receive(EVENT_AUDIO_RUNNING, NULL);
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
     // timeout should have been cleared
     g_assert_cmpuint(activity_detector.num_data(), ==, 0);
-    event_manager.receive(EVENT_AUDIO_STOPPED, NULL);
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
     // timeout should have been restored
     g_assert_cmpuint(activity_detector.num_data(), ==, 1);
-    event_manager.receive(EVENT_ACTIVITY_TIMEOUT, activity_detector.data_by_timeout(2000));
+    event_manager.receive(Event::activity_timeout(activity_detector.data_by_timeout(2000)));
     // "before" command should have been executed
     g_assert_cmpuint(process_spawner.async_cmds.size(), ==, 1);
 }
 
+static void test_idle_inhibitor(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    config_manager.wait_before_sleep = false;
+    config_manager.ignore_audio = false;
+    config_manager.add_command(make_command("b1", "a1", 2000));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+
+    event_manager.receive(Event(EVENT_IDLE_INHIBITED));
+    // timeout should have been cleared
+    g_assert_cmpuint(activity_detector.num_data(), ==, 0);
+    // timeouts should stay disabled while either inhibitor is active
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    event_manager.receive(Event(EVENT_IDLE_UNINHIBITED));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 0);
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
+    // timeout should have been restored
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+}
+
+static void test_fullscreen(gpointer, gconstpointer user_data) {
+    ConfigManager config_manager;
+    config_manager.wait_before_sleep = false;
+    config_manager.ignore_fullscreen = (bool)user_data;
+    config_manager.add_command(make_command("b1", "a1", 2000));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+
+    event_manager.receive(Event(EVENT_FULLSCREEN_ENTERED));
+    if (config_manager.ignore_fullscreen) {
+        g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+        return;
+    }
+    // timeout should have been cleared
+    g_assert_cmpuint(activity_detector.num_data(), ==, 0);
+    event_manager.receive(Event(EVENT_FULLSCREEN_EXITED));
+    // timeout should have been restored
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+}
+
+static void test_pressure(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    config_manager.wait_before_sleep = false;
+    config_manager.ignore_audio = false;
+    config_manager.add_command(make_command("b1", "a1", 2000));
+    config_manager.add_command(make_command("builtin:suspend", "", 3000));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    g_assert_cmpuint(activity_detector.num_data(), ==, 2);
+
+    // only the suspend action should be inhibited
+    event_manager.receive(Event(EVENT_PRESSURE_HIGH));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+    g_assert_cmpint(activity_detector.data_by_timeout(2000), !=, 0);
+    event_manager.receive(Event(EVENT_PRESSURE_NORMAL));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 2);
+
+    // pressure changes while timeouts are disabled must not re-add timeouts
+    event_manager.receive(Event(EVENT_PRESSURE_HIGH));
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    event_manager.receive(Event(EVENT_PRESSURE_NORMAL));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 0);
+    event_manager.receive(Event(EVENT_PRESSURE_HIGH));
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+    event_manager.receive(Event(EVENT_PRESSURE_NORMAL));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 2);
+}
+
+static void test_inhibit_scopes(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    config_manager.wait_before_sleep = false;
+    config_manager.ignore_audio = false;
+    config_manager.add_command(make_command("b1", "a1", 2000));
+    config_manager.add_command(make_command("builtin:set_idle_hint", "builtin:unset_idle_hint", 3000));
+    unique_ptr<Command> cmd = make_command("b3", "a3", 4000);
+    g_assert_true(cmd->set_inhibited_by_from_str("audio, pressure", NULL));
+    config_manager.add_command(std::move(cmd));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    g_assert_cmpuint(activity_detector.num_data(), ==, 3);
+
+    // audio should not inhibit the idle hint
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+    g_assert_cmpint(activity_detector.data_by_timeout(3000), !=, 0);
+    // but pausing should
+    event_manager.receive(Event(EVENT_PAUSED));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 0);
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
+    // only the custom command is not inhibited by pausing
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+    g_assert_cmpint(activity_detector.data_by_timeout(4000), !=, 0);
+    event_manager.receive(Event(EVENT_UNPAUSED));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 3);
+
+    // no timeouts should be added or removed if nothing changed
+    event_manager.receive(Event(EVENT_UNPAUSED));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 3);
+}
+
+static void write_config_file(const gchar *path, const gchar *contents) {
+    g_autoptr(GError) error = NULL;
+    g_assert_true(g_file_set_contents(path, contents, -1, &error));
+    g_assert_no_error(error);
+}
+
+static void test_reload(gpointer, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    g_autofree gchar *path = g_build_filename(dir, "xidlechain.conf", NULL);
+    write_config_file(path,
+        "[Main]\n"
+        "ignore_audio = false\n"
+        "wait_before_sleep = false\n"
+        "[Action a]\n"
+        "trigger = timeout 2\n"
+        "exec = b1\n"
+        "resume_exec = a1\n"
+        "[Action b]\n"
+        "trigger = timeout 3\n"
+        "exec = b2\n"
+        "[Action c]\n"
+        "trigger = timeout 4\n"
+        "exec = b3\n");
+    ConfigManager config_manager;
+    g_assert_true(config_manager.parse_config_file(path));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    g_assert_true(config_manager.watch_config_file(&event_manager));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 3);
+    int a_data = activity_detector.data_by_timeout(2000);
+    event_manager.receive(Event::activity_timeout(a_data));
+
+    // 'a' is unchanged, 'b' gets a new timeout, 'c' is removed and 'd' is new
+    write_config_file(path,
+        "[Main]\n"
+        "ignore_audio = true\n"
+        "wait_before_sleep = false\n"
+        "[Action a]\n"
+        "trigger = timeout 2\n"
+        "exec = b1\n"
+        "resume_exec = a1\n"
+        "[Action b]\n"
+        "trigger = timeout 5\n"
+        "exec = b2\n"
+        "[Action d]\n"
+        "trigger = timeout 6\n"
+        "exec = b4\n");
+    g_assert_true(config_manager.reload_config_file());
+    g_assert_true(config_manager.ignore_audio);
+    g_assert_cmpuint(activity_detector.num_data(), ==, 3);
+    g_assert_true(activity_detector.data_by_timeout(2000) == a_data);
+    g_assert_cmpint(activity_detector.data_by_timeout(5000), !=, 0);
+    g_assert_cmpint(activity_detector.data_by_timeout(6000), !=, 0);
+    // 'a' must still be activated, so it gets deactivated on resume
+    event_manager.receive(Event(EVENT_ACTIVITY_RESUME));
+    g_assert_cmpuint(process_spawner.async_cmds.size(), ==, 2);
+    g_assert_cmpstr(process_spawner.async_cmds.at(1), ==, "a1");
+
+    // an invalid file leaves the current config alone
+    write_config_file(path,
+        "[Action e]\n"
+        "trigger = bogus\n");
+    g_assert_false(config_manager.reload_config_file());
+    g_assert_cmpuint(activity_detector.num_data(), ==, 3);
+    g_assert_true(config_manager.ignore_audio);
+
+    g_unlink(path);
+    g_rmdir(dir);
+}
+
+static void test_x_settings(gpointer, gconstpointer user_data) {
+    bool disable = (bool)user_data;
+    ConfigManager config_manager;
+    config_manager.disable_automatic_dpms_activation = disable;
+    config_manager.disable_screensaver = disable;
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    g_assert_cmpint(activity_detector.dpms_timeouts_disabled, ==, disable);
+    g_assert_cmpint(activity_detector.screensaver_disabled, ==, disable);
+    // this must not require spawning any processes
+    g_assert_cmpuint(process_spawner.sync_cmds.size(), ==, 0);
+}
+
+static void send_config_changed(EventManager &event_manager, PropertyId property, bool old_value) {
+    g_autoptr(GVariant) old_variant = g_variant_new_boolean(old_value);
+    event_manager.receive(Event::config_changed(property, old_variant));
+}
+
+static void test_lazy_subsystems(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    config_manager.ignore_audio = false;
+    // only subject to the pause inhibitor
+    unique_ptr<Command> cmd = make_command("b1", "a1", 2000);
+    g_assert_true(cmd->set_inhibited_by_from_str("paused", NULL));
+    config_manager.add_command(std::move(cmd));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    g_assert_false(audio_detector.initialized);
+    g_assert_false(brightness_controller.initialized);
+    g_assert_false(logind_manager.sleep_lock_enabled);
+
+    // adding commands which need them starts the subsystems
+    int id = config_manager.add_command(make_command("builtin:dim", "builtin:undim", 3000));
+    event_manager.receive(Event::command_added(config_manager.lookup_command(id)));
+    g_assert_true(audio_detector.initialized);
+    g_assert_true(brightness_controller.initialized);
+    int sleep_id = config_manager.add_command(make_command("s1", "w1", 0, Command::SLEEP));
+    event_manager.receive(Event::command_added(config_manager.lookup_command(sleep_id)));
+    g_assert_true(logind_manager.sleep_lock_enabled);
+
+    // ignoring audio stops the audio detector, and lifts its inhibitor
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+    config_manager.ignore_audio = true;
+    send_config_changed(event_manager, PROPERTY_IGNORE_AUDIO, false);
+    g_assert_false(audio_detector.initialized);
+    g_assert_cmpuint(activity_detector.num_data(), ==, 2);
+
+    // removing the commands stops the rest
+    shared_ptr<Command> removed = config_manager.lookup_command(id);
+    config_manager.remove_command(id);
+    event_manager.receive(Event::command_removed(removed));
+    g_assert_false(brightness_controller.initialized);
+    removed = config_manager.lookup_command(sleep_id);
+    config_manager.remove_command(sleep_id);
+    event_manager.receive(Event::command_removed(removed));
+    g_assert_false(logind_manager.sleep_lock_enabled);
+}
+
+static void test_batch(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+
+    // the subsystems are only started once the batch is over
+    event_manager.begin_batch();
+    int dim_id = config_manager.add_command(make_command("builtin:dim", "builtin:undim", 3000));
+    event_manager.receive(Event::command_added(config_manager.lookup_command(dim_id)));
+    event_manager.begin_batch();
+    int sleep_id = config_manager.add_command(make_command("s1", "w1", 0, Command::SLEEP));
+    event_manager.receive(Event::command_added(config_manager.lookup_command(sleep_id)));
+    event_manager.end_batch();
+    g_assert_false(brightness_controller.initialized);
+    g_assert_false(audio_detector.initialized);
+    // but the timeouts are added right away
+    g_assert_cmpuint(activity_detector.num_data(), ==, 1);
+    event_manager.end_batch();
+    g_assert_true(brightness_controller.initialized);
+    g_assert_true(audio_detector.initialized);
+    g_assert_true(logind_manager.sleep_lock_enabled);
+
+    // outside of a batch, nothing is put off
+    shared_ptr<Command> removed = config_manager.lookup_command(dim_id);
+    config_manager.remove_command(dim_id);
+    event_manager.receive(Event::command_removed(removed));
+    g_assert_false(brightness_controller.initialized);
+}
+
+static void count_calls(gpointer data) {
+    (*(int*)data)++;
+}
+
+static void test_state_changed(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    int id = config_manager.add_command(make_command("b1", "a1", 2000));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    int num_calls = 0;
+    event_manager.set_state_changed_func(count_calls, &num_calls);
+    gint64 start_time = event_manager.get_idle_state_since();
+
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    g_assert_cmpint(num_calls, ==, 1);
+    g_assert_true(event_manager.is_audio_playing());
+    g_assert_cmpuint(event_manager.get_active_inhibitors(), ==, Command::INHIBIT_AUDIO);
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
+    g_assert_cmpint(num_calls, ==, 2);
+    g_assert_false(event_manager.is_audio_playing());
+
+    // while idle, the state changed when the user went idle
+    Event timeout = Event::activity_timeout(id);
+    event_manager.receive(timeout);
+    g_assert_cmpint(num_calls, ==, 3);
+    g_assert_true(event_manager.is_idle());
+    g_assert_cmpint(event_manager.get_idle_state_since(), ==, timeout.timestamp - 2000 * 1000);
+    event_manager.receive(Event(EVENT_ACTIVITY_RESUME));
+    g_assert_false(event_manager.is_idle());
+    g_assert_cmpint(event_manager.get_idle_state_since(), >=, start_time);
+}
+
+static gboolean set_flag(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+// Hooks a Throttle up to the EventManager the way the D-Bus state
+// properties are
+static void test_state_changed_throttle(gpointer, gconstpointer) {
+    static constexpr gint64 interval_us = 100 * 1000;
+    ConfigManager config_manager;
+    int id = config_manager.add_command(make_command("b1", "a1", 2000));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    int num_updates = 0;
+    Throttle throttle(interval_us, count_calls, &num_updates);
+    event_manager.set_state_changed_func(
+        [](gpointer data) { ((Throttle*)data)->schedule(); }, &throttle);
+
+    // A burst of events in one iteration makes one update, right away
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    event_manager.receive(Event::activity_timeout(id));
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
+    g_assert_cmpint(num_updates, ==, 0);
+    g_main_context_iteration(NULL, FALSE);
+    g_assert_cmpint(num_updates, ==, 1);
+    g_assert_false(throttle.is_scheduled());
+    gint64 first_update_time = g_get_monotonic_time();
+
+    // The next one waits until the interval is over, and the events in
+    // the meantime are still only one update
+    event_manager.receive(Event(EVENT_ACTIVITY_RESUME));
+    event_manager.receive(Event(EVENT_AUDIO_RUNNING));
+    while (g_main_context_iteration(NULL, FALSE)) {}
+    g_assert_cmpint(num_updates, ==, 1);
+    g_assert_true(throttle.is_scheduled());
+    event_manager.receive(Event(EVENT_AUDIO_STOPPED));
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, set_flag, &timed_out);
+    while (num_updates < 2 && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+    g_assert_cmpint(num_updates, ==, 2);
+    g_assert_cmpint(g_get_monotonic_time() - first_update_time, >=, interval_us);
+    // Nothing else was left behind
+    g_assert_false(throttle.is_scheduled());
+}
+
 static void test_lock(gpointer, gconstpointer) {
     ConfigManager config_manager;
     config_manager.wait_before_sleep = false;
@@ -256,16 +512,98 @@ static void test_lock(gpointer, gconstpointer) {
     EventManager event_manager(&config_manager);
     event_manager_init(event_manager);
 
-    event_manager.receive(EVENT_LOCK, NULL);
+    event_manager.receive(Event(EVENT_LOCK));
     g_assert_cmpstr(process_spawner.async_cmds.at(0), ==, "l1");
     // Even if a LOCK event is sent twice without an UNLOCK event in
     // between, the command should still be exected
-    event_manager.receive(EVENT_LOCK, NULL);
+    event_manager.receive(Event(EVENT_LOCK));
     g_assert_cmpstr(process_spawner.async_cmds.at(1), ==, "l1");
-    event_manager.receive(EVENT_UNLOCK, NULL);
+    event_manager.receive(Event(EVENT_UNLOCK));
     g_assert_cmpstr(process_spawner.async_cmds.at(2), ==, "u1");
 }
 
+static void test_action_metrics(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    config_manager.wait_before_sleep = false;
+    config_manager.ignore_audio = false;
+    int id = config_manager.add_command(make_command("l1", "builtin:undim", 0, Command::LOCK));
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+
+    event_manager.receive(Event(EVENT_LOCK));
+    event_manager.receive(Event(EVENT_UNLOCK));
+    event_manager.receive(Event(EVENT_LOCK));
+    shared_ptr<Command> cmd = config_manager.lookup_command(id);
+    // Shell commands are counted here, but timed by the ProcessSpawner
+    const ActionMetrics &exec_metrics = *cmd->activation_action->metrics;
+    g_assert_cmpuint(exec_metrics.num_runs, ==, 2);
+    g_assert_cmpuint(exec_metrics.duration_us.buckets[0], ==, 0);
+    // Builtins are timed by the Command
+    const ActionMetrics &resume_metrics = *cmd->deactivation_action->metrics;
+    g_assert_cmpuint(resume_metrics.num_runs, ==, 1);
+    uint32_t num_durations = 0;
+    for (uint32_t count : resume_metrics.duration_us.buckets) {
+        num_durations += count;
+    }
+    g_assert_cmpuint(num_durations, ==, 1);
+    g_assert_cmpuint(resume_metrics.num_failures, ==, 0);
+
+    ActionMetrics metrics;
+    metrics.record_exit(ActionMetrics::TIMEOUT_US, 1);
+    g_assert_cmpuint(metrics.num_timeouts, ==, 1);
+    g_assert_cmpuint(metrics.num_failures, ==, 1);
+    g_assert_cmpint(metrics.last_exit_status, ==, 1);
+    metrics.record_spawn_failure();
+    g_assert_cmpuint(metrics.num_failures, ==, 2);
+    g_assert_cmpint(metrics.last_exit_status, ==, -1);
+
+    g_assert_cmpint(Histogram::bucket_for(0), ==, 0);
+    g_assert_cmpint(Histogram::bucket_for(1), ==, 1);
+    g_assert_cmpint(Histogram::bucket_for(1023), ==, 10);
+    g_assert_cmpint(Histogram::bucket_for(1024), ==, 11);
+    g_assert_cmpint(Histogram::bucket_for(INT64_MAX), ==, Histogram::NUM_BUCKETS - 1);
+}
+
+static void test_status_slots(gpointer, gconstpointer) {
+    ConfigManager config_manager;
+    config_manager.ignore_audio = false;
+    // IDs are never reused, so after enough edits they are all above 63
+    for (int i = 0; i < 100; i++) {
+        config_manager.remove_command(config_manager.add_command(make_command("x", "y", 1000)));
+    }
+    int long_id = config_manager.add_command(make_command("b2", "a2", 3000));
+    int short_id = config_manager.add_command(make_command("b1", "a1", 2000));
+    g_assert_cmpint(short_id, >=, 64);
+    EventManager event_manager(&config_manager);
+    event_manager_init(event_manager);
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    g_autofree gchar *path = g_build_filename(dir, "status", NULL);
+    {
+        StatusPage status_page;
+        g_assert_true(status_page.open(path));
+        event_manager.set_status_page(&status_page);
+
+        // The actions are in slots by increasing timeout
+        StatusPage::Snapshot snapshot;
+        event_manager.receive(Event::activity_timeout(short_id));
+        g_assert_true(StatusPage::read(path, snapshot));
+        g_assert_cmpuint(snapshot.activated_slots, ==, 1 << 0);
+        g_assert_cmpuint(snapshot.num_activated, ==, 1);
+        event_manager.receive(Event::activity_timeout(long_id));
+        g_assert_true(StatusPage::read(path, snapshot));
+        g_assert_cmpuint(snapshot.activated_slots, ==, (1 << 0) | (1 << 1));
+        g_assert_cmpuint(snapshot.num_activated, ==, 2);
+        event_manager.receive(Event(EVENT_ACTIVITY_RESUME));
+        g_assert_true(StatusPage::read(path, snapshot));
+        g_assert_cmpuint(snapshot.activated_slots, ==, 0);
+        g_assert_cmpuint(snapshot.num_activated, ==, 0);
+        event_manager.set_status_page(NULL);
+    }
+    g_assert_cmpint(g_rmdir(dir), ==, 0);
+}
+
 int main(int argc, char *argv[]) {
     setlocale(LC_ALL, "");
 
@@ -285,6 +623,34 @@ int main(int argc, char *argv[]) {
                fixture_setup, test_audio_1, NULL);
     g_test_add("/event-manager/lock-unlock", void, NULL,
                fixture_setup, test_lock, NULL);
+    g_test_add("/event-manager/idle-inhibitor", void, NULL,
+               fixture_setup, test_idle_inhibitor, NULL);
+    g_test_add("/event-manager/inhibit-scopes", void, NULL,
+               fixture_setup, test_inhibit_scopes, NULL);
+    g_test_add("/event-manager/pressure", void, NULL,
+               fixture_setup, test_pressure, NULL);
+    g_test_add("/event-manager/disable-x-settings", void, (gconstpointer)1,
+               fixture_setup, test_x_settings, NULL);
+    g_test_add("/event-manager/keep-x-settings", void, (gconstpointer)0,
+               fixture_setup, test_x_settings, NULL);
+    g_test_add("/event-manager/lazy-subsystems", void, NULL,
+               fixture_setup, test_lazy_subsystems, NULL);
+    g_test_add("/event-manager/batch", void, NULL,
+               fixture_setup, test_batch, NULL);
+    g_test_add("/event-manager/state-changed", void, NULL,
+               fixture_setup, test_state_changed, NULL);
+    g_test_add("/event-manager/state-changed-throttle", void, NULL,
+               fixture_setup, test_state_changed_throttle, NULL);
+    g_test_add("/event-manager/reload", void, NULL,
+               fixture_setup, test_reload, NULL);
+    g_test_add("/event-manager/ignore-fullscreen", void, (gconstpointer)1,
+               fixture_setup, test_fullscreen, NULL);
+    g_test_add("/event-manager/no-ignore-fullscreen", void, (gconstpointer)0,
+               fixture_setup, test_fullscreen, NULL);
+    g_test_add("/event-manager/action-metrics", void, NULL,
+               fixture_setup, test_action_metrics, NULL);
+    g_test_add("/event-manager/status-slots", void, NULL,
+               fixture_setup, test_status_slots, NULL);
 
     return g_test_run();
 }
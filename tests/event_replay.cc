@@ -0,0 +1,322 @@
+// Replays a log of events through the EventManager with mock subsystems and
+// a virtual clock, and prints the actions which fired and when. See
+// tests/README.txt for the log format.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <locale>
+#include <vector>
+
+#include <glib.h>
+
+#include "config_manager.h"
+#include "event_manager.h"
+#include "tests/mocks.h"
+
+using std::vector;
+using namespace Xidlechain;
+
+// Not an EventType: user input, which the virtual ActivityDetector turns
+// into ACTIVITY_RESUME events
+static const int INPUT = 0;
+
+struct LogEntry {
+    int64_t time_ms;
+    int event_type;
+};
+
+static int64_t virtual_now_ms = 0;
+
+// The timestamp of an event which happens now on the virtual clock, so
+// that the EventManager sees the same times on every run
+static gint64 virtual_timestamp() {
+    return virtual_now_ms * 1000;
+}
+static bool quiet = false;
+static long num_actions = 0;
+// Config and command changes carry payloads which aren't in the log
+static long num_skipped = 0;
+
+static void report_action(const char *action, bool sync = false) {
+    num_actions++;
+    if (!quiet) {
+        printf("%lld %s%s\n", (long long)virtual_now_ms, action, sync ? " (sync)" : "");
+    }
+}
+
+// Models the IDLETIME counter of the X server: the idle time is the
+// virtual time since the last input, and each timeout fires once per idle
+// period, like a positive transition alarm. A timeout which is added when
+// the idle time is already past it only fires in the next idle period.
+class VirtualActivityDetector: public ActivityDetector {
+    struct IdleTimeout {
+        int64_t timeout_ms;
+        int timeout_id;
+        bool fired;
+    };
+    EventReceiver *event_receiver = NULL;
+    // Sorted by timeout
+    vector<IdleTimeout> timeouts;
+    int64_t last_input_ms = 0;
+    // Whether any timeout fired since the last input
+    bool idle = false;
+public:
+    bool init(EventReceiver *receiver) override {
+        event_receiver = receiver;
+        return true;
+    }
+    bool add_idle_timeout(int64_t timeout_ms, int timeout_id) override {
+        vector<IdleTimeout>::iterator it = timeouts.begin();
+        while (it != timeouts.end() && it->timeout_ms <= timeout_ms) {
+            ++it;
+        }
+        bool passed = virtual_now_ms - last_input_ms >= timeout_ms;
+        timeouts.insert(it, {timeout_ms, timeout_id, passed});
+        return true;
+    }
+    bool remove_idle_timeout(int timeout_id) override {
+        for (vector<IdleTimeout>::iterator it = timeouts.begin(); it != timeouts.end(); ++it) {
+            if (it->timeout_id == timeout_id) {
+                timeouts.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+    bool clear_timeouts() override {
+        timeouts.clear();
+        return true;
+    }
+    bool disable_dpms_timeouts() override { return true; }
+    bool disable_screensaver() override { return true; }
+
+    // Delivers the timeouts which expire up to |now_ms|, in order. The
+    // receiver may add or remove timeouts while handling them, so the
+    // next one is looked up again after each.
+    void advance_to(int64_t now_ms) {
+        for (;;) {
+            vector<IdleTimeout>::iterator it = timeouts.begin();
+            while (it != timeouts.end() && it->fired) {
+                ++it;
+            }
+            if (it == timeouts.end() || last_input_ms + it->timeout_ms > now_ms) {
+                break;
+            }
+            it->fired = true;
+            idle = true;
+            virtual_now_ms = last_input_ms + it->timeout_ms;
+            event_receiver->receive(Event::activity_timeout(it->timeout_id, virtual_timestamp()));
+        }
+        virtual_now_ms = now_ms;
+    }
+
+    void input(int64_t now_ms) {
+        advance_to(now_ms);
+        bool was_idle = idle;
+        last_input_ms = now_ms;
+        idle = false;
+        for (IdleTimeout &timeout : timeouts) {
+            timeout.fired = false;
+        }
+        if (was_idle) {
+            event_receiver->receive(Event(EVENT_ACTIVITY_RESUME, virtual_timestamp()));
+        }
+    }
+};
+
+class ReplayProcessSpawner: public MockProcessSpawner {
+public:
+    void exec_cmd_sync(const string &cmd, const shared_ptr<ActionMetrics> &metrics) override {
+        report_action(cmd.c_str(), true);
+    }
+    void exec_cmd_async(const string &cmd, const shared_ptr<ActionMetrics> &metrics) override {
+        report_action(cmd.c_str());
+    }
+};
+
+class ReplayLogindManager: public MockLogindManager {
+public:
+    bool set_idle_hint(bool idle) override {
+        report_action(idle ? "builtin:set_idle_hint" : "builtin:unset_idle_hint");
+        return true;
+    }
+    bool suspend() override {
+        report_action("builtin:suspend");
+        return true;
+    }
+};
+
+class ReplayBrightnessController: public MockBrightnessController {
+public:
+    bool dim() override {
+        report_action("builtin:dim");
+        return true;
+    }
+    void restore_brightness() override {
+        report_action("builtin:undim");
+    }
+};
+
+// Each line is "<time in ms> <event>", where <event> is the name of an
+// EventType without the EVENT_ prefix, or INPUT. ACTIVITY_RESUME is
+// treated as input and ACTIVITY_TIMEOUT is ignored, since the virtual
+// ActivityDetector derives both from the config.
+static bool read_log(FILE *file, const char *path, vector<LogEntry> &entries) {
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_num = 0;
+    bool ok = true;
+    while (getline(&line, &line_size, file) >= 0) {
+        line_num++;
+        char *p = line;
+        while (g_ascii_isspace(*p)) p++;
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        char *end;
+        double time_ms = g_ascii_strtod(p, &end);
+        if (end == p) {
+            g_printerr("%s:%d: expected a time\n", path, line_num);
+            ok = false;
+            break;
+        }
+        p = end;
+        while (g_ascii_isspace(*p)) p++;
+        end = p;
+        while (*end && !g_ascii_isspace(*end)) end++;
+        *end = '\0';
+        int event_type;
+        if (strcmp(p, "INPUT") == 0 || strcmp(p, "ACTIVITY_RESUME") == 0) {
+            event_type = INPUT;
+        } else if (strcmp(p, "ACTIVITY_TIMEOUT") == 0) {
+            continue;
+        } else {
+            event_type = event_type_from_name(p);
+            if (event_type == 0) {
+                g_printerr("%s:%d: unknown event '%s'\n", path, line_num, p);
+                ok = false;
+                break;
+            }
+            if (
+                event_type == EVENT_CONFIG_CHANGED
+                || event_type == EVENT_COMMAND_CHANGED
+                || event_type == EVENT_COMMAND_ADDED
+                || event_type == EVENT_COMMAND_REMOVED
+            ) {
+                num_skipped++;
+                continue;
+            }
+        }
+        if (!entries.empty() && time_ms < entries.back().time_ms) {
+            g_printerr("%s:%d: time goes backwards\n", path, line_num);
+            ok = false;
+            break;
+        }
+        entries.push_back({(int64_t)time_ms, event_type});
+    }
+    free(line);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    const char *config_file_path = NULL;
+    long repeat = 1;
+    bool show_usage = false;
+    int ch;
+    while ((ch = getopt(argc, argv, "c:n:q")) != -1) {
+        switch (ch) {
+            case 'c':
+                config_file_path = optarg;
+                break;
+            case 'n':
+                repeat = strtol(optarg, NULL, 10);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                show_usage = true;
+                break;
+        }
+    }
+    if (show_usage || !config_file_path || optind != argc - 1 || repeat < 1) {
+        g_printerr("Usage: %s -c CONFIG [-q] [-n REPEAT] LOG\n"
+                   "  -q\tonly print a summary\n"
+                   "  -n\treplay the log this many times in a row\n",
+                   argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *log_path = argv[optind];
+
+    vector<LogEntry> entries;
+    FILE *file = strcmp(log_path, "-") == 0 ? stdin : fopen(log_path, "r");
+    if (!file) {
+        g_printerr("Could not open %s: %s\n", log_path, g_strerror(errno));
+        return EXIT_FAILURE;
+    }
+    bool ok = read_log(file, log_path, entries);
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+    if (entries.empty()) {
+        return EXIT_SUCCESS;
+    }
+
+    ConfigManager config_manager;
+    if (!config_manager.parse_config_file(config_file_path)) {
+        return EXIT_FAILURE;
+    }
+    VirtualActivityDetector activity_detector;
+    MockAudioDetector audio_detector;
+    ReplayLogindManager logind_manager;
+    ReplayProcessSpawner process_spawner;
+    ReplayBrightnessController brightness_controller;
+    EventManager event_manager(&config_manager);
+
+    // Virtual time starts at 0 with the first entry, which counts as the
+    // last input, like a freshly started X server
+    int64_t offset = -entries.front().time_ms;
+    int64_t span = entries.back().time_ms - entries.front().time_ms;
+    virtual_now_ms = 0;
+    activity_detector.init(&event_manager);
+    if (!event_manager.init(&activity_detector,
+                            &logind_manager,
+                            &audio_detector,
+                            &process_spawner,
+                            &brightness_controller))
+    {
+        return EXIT_FAILURE;
+    }
+
+    gint64 start_time = g_get_monotonic_time();
+    for (long i = 0; i < repeat; i++) {
+        for (const LogEntry &entry : entries) {
+            int64_t time_ms = entry.time_ms + offset;
+            if (entry.event_type == INPUT) {
+                activity_detector.input(time_ms);
+            } else {
+                activity_detector.advance_to(time_ms);
+                event_manager.receive(Event((EventType)entry.event_type, virtual_timestamp()));
+            }
+        }
+        offset += span;
+    }
+    gint64 elapsed_us = g_get_monotonic_time() - start_time;
+
+    long num_events = (long)entries.size() * repeat;
+    if (num_skipped) {
+        g_printerr("skipped %ld config changes\n", num_skipped);
+    }
+    g_printerr("%ld events, %ld actions, %.1f s of virtual time replayed in %.3f s (%.0f events/s)\n",
+               num_events, num_actions, virtual_now_ms / 1000.0, elapsed_us / 1e6,
+               elapsed_us > 0 ? num_events * 1e6 / elapsed_us : 0.0);
+    return EXIT_SUCCESS;
+}
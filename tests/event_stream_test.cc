@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "event_stream.h"
+#include "metrics.h"
+
+using std::string;
+using namespace Xidlechain;
+
+struct Fixture {
+    gchar *dir;
+    gchar *path;
+    EventStream *stream;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->dir, "xidlechain.events", NULL);
+    fixture->stream = new EventStream();
+    g_assert_true(fixture->stream->start(fixture->path));
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    delete fixture->stream;
+    // This fails if the socket was left behind
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->path);
+    g_free(fixture->dir);
+}
+
+// Connects to the stream and waits until it has accepted us
+static int subscribe(Fixture *fixture) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    g_assert_cmpint(fd, >=, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, fixture->path);
+    g_assert_cmpint(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), ==, 0);
+    int num_subscribers = fixture->stream->get_num_subscribers();
+    while (fixture->stream->get_num_subscribers() == num_subscribers) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    return fd;
+}
+
+// Returns the next record, or an empty string at the end of the stream
+static string next_record(int fd) {
+    char buf[EventStream::MAX_RECORD_SIZE];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    g_assert_cmpint(n, >=, 0);
+    return string(buf, n);
+}
+
+static void test_fan_out(Fixture *fixture, gconstpointer) {
+    int fds[] = {subscribe(fixture), subscribe(fixture)};
+    Event lock(EVENT_LOCK);
+    Event timeout = Event::activity_timeout(3);
+    EventStream::publish(lock, ":0");
+    EventStream::publish(timeout, ":1");
+
+    g_autofree gchar *lock_record = g_strdup_printf("%lld LOCK 0 :0\n", (long long)lock.timestamp);
+    g_autofree gchar *timeout_record = g_strdup_printf("%lld ACTIVITY_TIMEOUT 3 :1\n", (long long)timeout.timestamp);
+    for (int fd : fds) {
+        // One record per packet
+        g_assert_cmpstr(next_record(fd).c_str(), ==, lock_record);
+        g_assert_cmpstr(next_record(fd).c_str(), ==, timeout_record);
+    }
+
+    // Subscribers which hung up are forgotten
+    close(fds[0]);
+    // The display is "-" if it isn't known
+    EventStream::publish(Event(EVENT_UNLOCK), NULL);
+    g_assert_cmpint(fixture->stream->get_num_subscribers(), ==, 1);
+    g_assert_true(g_str_has_suffix(next_record(fds[1]).c_str(), " UNLOCK 0 -\n"));
+    close(fds[1]);
+}
+
+static void test_slow_subscriber(Fixture *fixture, gconstpointer) {
+    int slow_fd = subscribe(fixture);
+    int fd = subscribe(fixture);
+    uint64_t dropped = Metrics::event_subscribers_dropped;
+    // The slow subscriber never reads, so its buffer runs full
+    int num_sent = 0;
+    while (fixture->stream->get_num_subscribers() == 2) {
+        EventStream::publish(Event(EVENT_AUDIO_RUNNING), ":0");
+        num_sent++;
+        g_assert_true(g_str_has_suffix(next_record(fd).c_str(), " AUDIO_RUNNING 0 :0\n"));
+        g_assert_cmpint(num_sent, <, 100000);
+    }
+    g_assert_cmpuint(Metrics::event_subscribers_dropped, ==, dropped + 1);
+
+    // It gets what fit into its buffer, and then the end of the stream
+    int num_received = 0;
+    while (!next_record(slow_fd).empty()) {
+        num_received++;
+    }
+    g_assert_cmpint(num_received, >, 0);
+    g_assert_cmpint(num_received, <, num_sent);
+    close(slow_fd);
+    close(fd);
+}
+
+static void test_disabled(Fixture *fixture, gconstpointer) {
+    // Nothing is sent (or crashes) once the stream is gone
+    delete fixture->stream;
+    fixture->stream = NULL;
+    EventStream::publish(Event(EVENT_LOCK), ":0");
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/event-stream/fan-out", Fixture, NULL,
+               fixture_setup, test_fan_out, fixture_teardown);
+    g_test_add("/event-stream/slow-subscriber", Fixture, NULL,
+               fixture_setup, test_slow_subscriber, fixture_teardown);
+    g_test_add("/event-stream/disabled", Fixture, NULL,
+               fixture_setup, test_disabled, fixture_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,145 @@
+#include <locale>
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+
+#include "event_receiver.h"
+#include "fullscreen_detector.h"
+#include "x_connection.h"
+
+using namespace Xidlechain;
+
+// This test needs an X server without a window manager, e.g.
+//   xvfb-run tests/fullscreen_detector_test
+// The "window manager" below is a minimal EWMH stand-in which uses its
+// own X connection to update _NET_ACTIVE_WINDOW and _NET_WM_STATE.
+struct FakeWindowManager {
+    Display *xdisplay;
+    Window root;
+    Atom net_active_window,
+         net_wm_state,
+         net_wm_state_fullscreen,
+         net_wm_state_above;
+
+    void init() {
+        xdisplay = XOpenDisplay(NULL);
+        g_assert_nonnull(xdisplay);
+        root = DefaultRootWindow(xdisplay);
+        net_active_window = XInternAtom(xdisplay, "_NET_ACTIVE_WINDOW", False);
+        net_wm_state = XInternAtom(xdisplay, "_NET_WM_STATE", False);
+        net_wm_state_fullscreen = XInternAtom(xdisplay, "_NET_WM_STATE_FULLSCREEN", False);
+        net_wm_state_above = XInternAtom(xdisplay, "_NET_WM_STATE_ABOVE", False);
+    }
+    Window create_window() {
+        Window window = XCreateSimpleWindow(xdisplay, root, 0, 0, 10, 10, 0, 0, 0);
+        XFlush(xdisplay);
+        return window;
+    }
+    void set_active_window(Window window) {
+        XChangeProperty(xdisplay, root, net_active_window, XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char*)&window, 1);
+        XFlush(xdisplay);
+    }
+    void set_fullscreen(Window window, bool fullscreen) {
+        Atom states[] = {net_wm_state_above, net_wm_state_fullscreen};
+        XChangeProperty(xdisplay, window, net_wm_state, XA_ATOM, 32,
+                        PropModeReplace, (unsigned char*)states, fullscreen ? 2 : 1);
+        XFlush(xdisplay);
+    }
+};
+
+class FullscreenReceiver: public EventReceiver {
+public:
+    bool fullscreen = false;
+    int num_events = 0;
+    void receive(const Event &event) override {
+        switch (event.type) {
+        case EVENT_FULLSCREEN_ENTERED:
+            g_assert_false(fullscreen);
+            fullscreen = true;
+            num_events++;
+            break;
+        case EVENT_FULLSCREEN_EXITED:
+            g_assert_true(fullscreen);
+            fullscreen = false;
+            num_events++;
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+static FakeWindowManager wm;
+static FullscreenReceiver receiver;
+
+static gboolean timeout_cb(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+static void process_events() {
+    bool done = false;
+    g_timeout_add(100, timeout_cb, &done);
+    while (!done) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+// Processes X events for a short while, then checks the detector's state.
+static void expect_state(bool fullscreen, int num_events) {
+    process_events();
+    g_assert_cmpint(receiver.fullscreen, ==, fullscreen);
+    g_assert_cmpint(receiver.num_events, ==, num_events);
+}
+
+static void test_fullscreen(void) {
+    Window a = wm.create_window();
+    Window b = wm.create_window();
+
+    wm.set_active_window(a);
+    wm.set_fullscreen(a, false);
+    expect_state(false, 0);
+    // active window becomes fullscreen
+    wm.set_fullscreen(a, true);
+    expect_state(true, 1);
+    // focus moves to a non-fullscreen window
+    wm.set_active_window(b);
+    expect_state(false, 2);
+    // the unfocused window is no longer watched
+    wm.set_fullscreen(a, false);
+    wm.set_fullscreen(a, true);
+    expect_state(false, 2);
+    // focus moves back to the fullscreen window
+    wm.set_active_window(a);
+    expect_state(true, 3);
+    // rapid toggling ends up in the right state
+    for (int i = 0; i < 100; i++) {
+        wm.set_fullscreen(a, i % 2 == 1);
+    }
+    process_events();
+    g_assert_true(receiver.fullscreen);
+    // the window manager clears the active window
+    int num_events = receiver.num_events;
+    wm.set_active_window(None);
+    expect_state(false, num_events + 1);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+    XConnection x_connection;
+    g_assert_true(x_connection.open(NULL));
+
+    wm.init();
+    EwmhFullscreenDetector *detector = new EwmhFullscreenDetector(&x_connection);
+    g_assert_true(detector->init(&receiver));
+
+    g_test_add_func("/fullscreen-detector/ewmh", test_fullscreen);
+
+    int ret = g_test_run();
+    delete detector;
+    XCloseDisplay(wm.xdisplay);
+    return ret;
+}
@@ -0,0 +1,315 @@
+#include <locale>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+
+#include "event_receiver.h"
+#include "logind_manager.h"
+
+using namespace Xidlechain;
+
+// A stand-in for systemd-logind which runs on a private bus in its own
+// thread, so that the (partially synchronous) DbusLogindManager can talk
+// to it from the main thread.
+static const char * const LOGIND_XML =
+    "<node>"
+    "  <interface name='org.freedesktop.login1.Manager'>"
+    "    <method name='GetSession'>"
+    "      <arg direction='in' type='s' name='session_id'/>"
+    "      <arg direction='out' type='o' name='object_path'/>"
+    "    </method>"
+    "    <method name='Inhibit'>"
+    "      <arg direction='in' type='s' name='what'/>"
+    "      <arg direction='in' type='s' name='who'/>"
+    "      <arg direction='in' type='s' name='why'/>"
+    "      <arg direction='in' type='s' name='mode'/>"
+    "      <arg direction='out' type='h' name='pipe_fd'/>"
+    "    </method>"
+    "    <method name='ListInhibitors'>"
+    "      <arg direction='out' type='a(ssssuu)' name='inhibitors'/>"
+    "    </method>"
+    "    <property name='BlockInhibited' type='s' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.login1.Session'>"
+    "    <method name='SetIdleHint'>"
+    "      <arg direction='in' type='b' name='idle'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+static const char * const BUS_NAME = "org.freedesktop.login1";
+static const char * const MANAGER_OBJECT_PATH = "/org/freedesktop/login1";
+static const char * const SESSION_OBJECT_PATH = "/org/freedesktop/login1/session/auto";
+
+struct FakeLogind {
+    GThread *thread = NULL;
+    GMainContext *context = NULL;
+    GMainLoop *loop = NULL;
+    GDBusConnection *connection = NULL;
+    GMutex mutex;
+    GCond ready_cond;
+    bool ready = false;
+    // Only accessed atomically, since it is read from the service thread
+    gint idle_blocked = 0;
+    gint num_list_inhibitors_calls = 0;
+};
+
+static FakeLogind fake_logind;
+
+static void fake_method_call(
+    GDBusConnection *connection,
+    const gchar *sender,
+    const gchar *object_path,
+    const gchar *interface_name,
+    const gchar *method_name,
+    GVariant *parameters,
+    GDBusMethodInvocation *invocation,
+    gpointer user_data
+) {
+    if (g_strcmp0(method_name, "GetSession") == 0) {
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new("(o)", SESSION_OBJECT_PATH));
+    } else if (g_strcmp0(method_name, "Inhibit") == 0) {
+        int fds[2];
+        g_assert_cmpint(pipe(fds), ==, 0);
+        g_autoptr(GUnixFDList) fd_list = g_unix_fd_list_new();
+        gint idx = g_unix_fd_list_append(fd_list, fds[0], NULL);
+        close(fds[0]);
+        close(fds[1]);
+        g_dbus_method_invocation_return_value_with_unix_fd_list(
+            invocation, g_variant_new("(h)", idx), fd_list);
+    } else if (g_strcmp0(method_name, "ListInhibitors") == 0) {
+        g_atomic_int_inc(&fake_logind.num_list_inhibitors_calls);
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ssssuu)"));
+        g_variant_builder_add(&builder, "(ssssuu)",
+                              "sleep", "xidlechain", "callbacks", "delay", 1000, 1);
+        if (g_atomic_int_get(&fake_logind.idle_blocked)) {
+            g_variant_builder_add(&builder, "(ssssuu)",
+                                  "idle:sleep", "presenter", "slides", "block", 1000, 2);
+        }
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new("(a(ssssuu))", &builder));
+    } else {
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+}
+
+static GVariant *fake_get_property(
+    GDBusConnection *connection,
+    const gchar *sender,
+    const gchar *object_path,
+    const gchar *interface_name,
+    const gchar *property_name,
+    GError **error,
+    gpointer user_data
+) {
+    return g_variant_new_string(
+        g_atomic_int_get(&fake_logind.idle_blocked) ? "sleep:idle" : "sleep");
+}
+
+static const GDBusInterfaceVTable fake_vtable = {
+    fake_method_call,
+    fake_get_property,
+    NULL,
+    {0}
+};
+
+static gpointer fake_logind_thread_func(gpointer data) {
+    const gchar *address = (const gchar*)data;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GDBusNodeInfo) node_info = g_dbus_node_info_new_for_xml(LOGIND_XML, &error);
+    g_assert_no_error(error);
+
+    g_main_context_push_thread_default(fake_logind.context);
+    fake_logind.connection = g_dbus_connection_new_for_address_sync(
+        address,
+        (GDBusConnectionFlags)(
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+            | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION
+        ),
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_dbus_connection_register_object(
+        fake_logind.connection, MANAGER_OBJECT_PATH,
+        g_dbus_node_info_lookup_interface(node_info, "org.freedesktop.login1.Manager"),
+        &fake_vtable, NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_dbus_connection_register_object(
+        fake_logind.connection, SESSION_OBJECT_PATH,
+        g_dbus_node_info_lookup_interface(node_info, "org.freedesktop.login1.Session"),
+        &fake_vtable, NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_autoptr(GVariant) res = g_dbus_connection_call_sync(
+        fake_logind.connection,
+        "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+        "RequestName", g_variant_new("(su)", BUS_NAME, 0x4 /* DO_NOT_QUEUE */),
+        G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    g_assert_no_error(error);
+
+    g_mutex_lock(&fake_logind.mutex);
+    fake_logind.ready = true;
+    g_cond_signal(&fake_logind.ready_cond);
+    g_mutex_unlock(&fake_logind.mutex);
+
+    g_main_loop_run(fake_logind.loop);
+    g_main_context_pop_thread_default(fake_logind.context);
+    return NULL;
+}
+
+static void fake_logind_start(const gchar *address) {
+    g_mutex_init(&fake_logind.mutex);
+    g_cond_init(&fake_logind.ready_cond);
+    fake_logind.context = g_main_context_new();
+    fake_logind.loop = g_main_loop_new(fake_logind.context, FALSE);
+    fake_logind.thread = g_thread_new("fake-logind", fake_logind_thread_func, (gpointer)address);
+    g_mutex_lock(&fake_logind.mutex);
+    while (!fake_logind.ready) {
+        g_cond_wait(&fake_logind.ready_cond, &fake_logind.mutex);
+    }
+    g_mutex_unlock(&fake_logind.mutex);
+}
+
+static void fake_logind_stop() {
+    g_main_loop_quit(fake_logind.loop);
+    g_thread_join(fake_logind.thread);
+    g_object_unref(fake_logind.connection);
+    g_main_loop_unref(fake_logind.loop);
+    g_main_context_unref(fake_logind.context);
+}
+
+// Changes the idle inhibitor state and announces it the way logind does,
+// either with the new value or by only invalidating the property.
+static void fake_logind_set_idle_blocked(bool blocked, bool send_value) {
+    g_atomic_int_set(&fake_logind.idle_blocked, blocked);
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    const gchar *invalidated[] = {"BlockInhibited", NULL};
+    if (send_value) {
+        g_variant_builder_add(&changed, "{sv}", "BlockInhibited",
+                              g_variant_new_string(blocked ? "sleep:idle" : "sleep"));
+        invalidated[0] = NULL;
+    }
+    g_dbus_connection_emit_signal(
+        fake_logind.connection, NULL, MANAGER_OBJECT_PATH,
+        "org.freedesktop.DBus.Properties", "PropertiesChanged",
+        g_variant_new("(sa{sv}^as)", "org.freedesktop.login1.Manager",
+                      &changed, invalidated),
+        NULL);
+}
+
+class InhibitReceiver: public EventReceiver {
+public:
+    bool inhibited = false;
+    int num_events = 0;
+    void receive(const Event &event) override {
+        switch (event.type) {
+        case EVENT_IDLE_INHIBITED:
+            // events must alternate
+            g_assert_false(inhibited);
+            inhibited = true;
+            num_events++;
+            break;
+        case EVENT_IDLE_UNINHIBITED:
+            g_assert_true(inhibited);
+            inhibited = false;
+            num_events++;
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+static InhibitReceiver receiver;
+
+static gboolean timeout_cb(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+// Runs the main loop until the receiver has caught up with the stand-in,
+// then keeps running for a bit to make sure no stale events arrive.
+static void wait_for_state(bool expected) {
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, timeout_cb, &timed_out);
+    while (receiver.inhibited != expected && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+    bool settled = false;
+    g_timeout_add(100, timeout_cb, &settled);
+    while (!settled) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_cmpint(receiver.inhibited, ==, expected);
+}
+
+// DbusLogindManager connects asynchronously. It subscribes to
+// PropertiesChanged before querying the initial state, so once the query
+// arrives we know that no signals will be missed.
+static void wait_for_manager() {
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, timeout_cb, &timed_out);
+    while (g_atomic_int_get(&fake_logind.num_list_inhibitors_calls) == 0 && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+}
+
+static void test_toggle(gconstpointer user_data) {
+    bool send_value = GPOINTER_TO_INT(user_data);
+    const int num_toggles = 501;
+    bool blocked = receiver.inhibited;
+    // The events of the earlier runs are still counted
+    int start_events = receiver.num_events;
+    for (int i = 0; i < num_toggles; i++) {
+        blocked = !blocked;
+        fake_logind_set_idle_blocked(blocked, send_value);
+    }
+    wait_for_state(blocked);
+    // Rapid flapping may be coalesced, but never amplified. The events
+    // alternate, and the state ends up flipped, so there is an odd number
+    // of them.
+    int num_flap_events = receiver.num_events - start_events;
+    g_assert_cmpint(num_flap_events, <=, num_toggles);
+    g_assert_cmpint(num_flap_events % 2, ==, 1);
+    // And a single toggle must still get through
+    int num_events = receiver.num_events;
+    fake_logind_set_idle_blocked(!blocked, send_value);
+    wait_for_state(!blocked);
+    g_assert_cmpint(receiver.num_events, ==, num_events + 1);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+    g_setenv("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(bus), TRUE);
+    g_unsetenv("XDG_SESSION_ID");
+    fake_logind_start(g_test_dbus_get_bus_address(bus));
+
+    DbusLogindManager *manager = new DbusLogindManager();
+    g_assert_true(manager->init(&receiver));
+    wait_for_manager();
+    wait_for_state(false);
+
+    g_test_add_data_func("/logind-inhibitor/property-value",
+                         GINT_TO_POINTER(1), test_toggle);
+    g_test_add_data_func("/logind-inhibitor/property-invalidated",
+                         GINT_TO_POINTER(0), test_toggle);
+
+    int ret = g_test_run();
+
+    delete manager;
+    fake_logind_stop();
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+    return ret;
+}
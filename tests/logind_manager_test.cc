@@ -6,8 +6,8 @@ using namespace std;
 
 class MyReceiver: public Xidlechain::EventReceiver {
 public:
-    void receive(Xidlechain::EventType event, gpointer) override {
-        switch (event) {
+    void receive(const Xidlechain::Event &event) override {
+        switch (event.type) {
             case Xidlechain::EVENT_LOCK:
                 cout << "EVENT_LOCK" << endl;
                 break;
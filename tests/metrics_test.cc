@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "metrics.h"
+
+using std::string;
+using namespace Xidlechain;
+
+struct Fixture {
+    gchar *dir;
+    gchar *path;
+    MetricsExporter *exporter;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->dir, "xidlechain.metrics", NULL);
+    fixture->exporter = new MetricsExporter();
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    delete fixture->exporter;
+    // This fails if the socket was left behind
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->path);
+    g_free(fixture->dir);
+}
+
+// Connects to the exporter and returns everything it sends
+static string scrape(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    g_assert_cmpint(fd, >=, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    g_assert_cmpint(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), ==, 0);
+    // The exporter runs on our main loop
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, 0) == 0) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    string result;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        result.append(buf, n);
+    }
+    g_assert_cmpint(n, ==, 0);
+    close(fd);
+    return result;
+}
+
+static void test_scrape(Fixture *fixture, gconstpointer) {
+    g_assert_true(fixture->exporter->start(fixture->path));
+    Metrics::events[EVENT_LOCK] = 3;
+    Metrics::spawns = 7;
+    Metrics::config_saves_requested = 5;
+    Metrics::config_saves_performed = 2;
+    string text = scrape(fixture->path);
+
+    g_assert_true(g_str_has_suffix(text.c_str(), "\n# EOF\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_events_total{type=\"LOCK\"} 3\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_spawns_total 7\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_config_saves_requested_total 5\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_config_saves_performed_total 2\n"));
+    // Every sample is a name, optionally with labels, and a number
+    g_auto(GStrv) lines = g_strsplit(text.c_str(), "\n", -1);
+    for (int i = 0; lines[i] && lines[i][0]; i++) {
+        if (lines[i][0] == '#') {
+            continue;
+        }
+        const char *value = strrchr(lines[i], ' ');
+        g_assert_nonnull(value);
+        char *end;
+        g_ascii_strtod(value + 1, &end);
+        g_assert_cmpint(*end, ==, '\0');
+        g_assert_true(g_str_has_prefix(lines[i], "xidlechain_"));
+    }
+
+    // A second scrape gets the new values
+    Metrics::spawns = 8;
+    text = scrape(fixture->path);
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_spawns_total 8\n"));
+}
+
+static void test_sleep_pipeline(Fixture *fixture, gconstpointer) {
+    Metrics::sleep_budget_us = 5 * 1000 * 1000;
+    Metrics::record_sleep_pipeline(100 * 1000);
+    Metrics::record_sleep_pipeline(6 * 1000 * 1000);
+    g_assert_cmpuint(Metrics::sleep_pipeline_over_budget, ==, 1);
+
+    size_t len = fixture->exporter->render();
+    string text(fixture->exporter->get_buffer(), len);
+    // The buckets are cumulative
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_sleep_pipeline_seconds_bucket{le=\"0.131072\"} 1\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_sleep_pipeline_seconds_bucket{le=\"8.388608\"} 2\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_sleep_pipeline_seconds_bucket{le=\"+Inf\"} 2\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_sleep_pipeline_seconds_count 2\n"));
+    g_assert_nonnull(strstr(text.c_str(), "\nxidlechain_sleep_pipeline_seconds_sum 6.100000\n"));
+}
+
+static void test_stale_socket(Fixture *fixture, gconstpointer) {
+    // Left behind by a daemon which crashed
+    g_assert_true(g_file_set_contents(fixture->path, "", 0, NULL));
+    g_assert_true(fixture->exporter->start(fixture->path));
+    g_assert_true(g_str_has_suffix(scrape(fixture->path).c_str(), "# EOF\n"));
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/metrics/scrape", Fixture, NULL,
+               fixture_setup, test_scrape, fixture_teardown);
+    g_test_add("/metrics/sleep-pipeline", Fixture, NULL,
+               fixture_setup, test_sleep_pipeline, fixture_teardown);
+    g_test_add("/metrics/stale-socket", Fixture, NULL,
+               fixture_setup, test_stale_socket, fixture_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,161 @@
+#ifndef _TESTS_MOCKS_H_
+#define _TESTS_MOCKS_H_
+
+// Stand-ins for the subsystems which the EventManager drives, shared by
+// the EventManager test and the replay tool.
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glib.h>
+
+#include "activity_detector.h"
+#include "audio_detector.h"
+#include "brightness_controller.h"
+#include "logind_manager.h"
+#include "process_spawner.h"
+
+using std::int64_t;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace Xidlechain {
+    class MockActivityDetector: public ActivityDetector {
+        unordered_map<int64_t, int> cb_data;
+        // The reverse of cb_data, so that removing a timeout doesn't
+        // dominate the benchmarks
+        unordered_map<int, int64_t> timeouts_by_id;
+    public:
+        bool dpms_timeouts_disabled = false;
+        bool screensaver_disabled = false;
+        bool init(EventReceiver *receiver) override {
+            return true;
+        }
+        bool add_idle_timeout(int64_t timeout_ms, int timeout_id) override {
+            cb_data[timeout_ms] = timeout_id;
+            timeouts_by_id[timeout_id] = timeout_ms;
+            return true;
+        }
+        bool remove_idle_timeout(int timeout_id) override {
+            unordered_map<int, int64_t>::iterator id_it = timeouts_by_id.find(timeout_id);
+            if (id_it == timeouts_by_id.end()) {
+                return false;
+            }
+            unordered_map<int64_t, int>::iterator it = cb_data.find(id_it->second);
+            timeouts_by_id.erase(id_it);
+            // Another timeout with the same duration may have replaced it
+            if (it == cb_data.end() || it->second != timeout_id) {
+                return false;
+            }
+            cb_data.erase(it);
+            return true;
+        }
+        bool clear_timeouts() override {
+            cb_data.clear();
+            timeouts_by_id.clear();
+            return true;
+        }
+        bool disable_dpms_timeouts() override {
+            dpms_timeouts_disabled = true;
+            return true;
+        }
+        bool disable_screensaver() override {
+            screensaver_disabled = true;
+            return true;
+        }
+        // Returns 0 if there is no such timeout; command IDs start at 1
+        int data_by_timeout(int64_t timeout_ms) {
+            unordered_map<int64_t, int>::iterator it = cb_data.find(timeout_ms);
+            return it == cb_data.end() ? 0 : it->second;
+        }
+        int num_data() const {
+            return cb_data.size();
+        }
+        void reset() {
+            cb_data.clear();
+            timeouts_by_id.clear();
+            dpms_timeouts_disabled = false;
+            screensaver_disabled = false;
+        }
+    };
+
+    class MockAudioDetector: public AudioDetector {
+    public:
+        bool initialized = false;
+        bool init(EventReceiver *receiver) override {
+            initialized = true;
+            return true;
+        }
+        void stop() override {
+            initialized = false;
+        }
+        void reset() {
+            initialized = false;
+        }
+    };
+
+    class MockLogindManager: public LogindManager {
+    public:
+        vector<bool> idle_hint_history;
+        bool sleep_lock_enabled = true;
+        bool init(EventReceiver *receiver) override {
+            return true;
+        }
+        bool set_idle_hint(bool idle) override {
+            idle_hint_history.push_back(idle);
+            return true;
+        }
+        void reset() {
+            idle_hint_history.clear();
+            sleep_lock_enabled = true;
+        }
+        bool set_brightness(const char *subsystem, unsigned int value) override {
+            return true;
+        }
+        bool suspend() override {
+            return true;
+        }
+        void set_sleep_lock_enabled(bool enabled) override {
+            sleep_lock_enabled = enabled;
+        }
+    };
+
+    class MockProcessSpawner: public ProcessSpawner {
+    public:
+        vector<const char*> sync_cmds,
+                            async_cmds;
+        void exec_cmd_sync(const string &cmd, const shared_ptr<ActionMetrics> &metrics) override {
+            sync_cmds.push_back(cmd.c_str());
+        }
+        void exec_cmd_async(const string &cmd, const shared_ptr<ActionMetrics> &metrics) override {
+            async_cmds.push_back(cmd.c_str());
+        }
+        void reset() {
+            sync_cmds.clear();
+            async_cmds.clear();
+        }
+    };
+
+    class MockBrightnessController: public BrightnessController {
+    public:
+        bool initialized = false;
+        bool init(LogindManager *logind_manager) override {
+            initialized = true;
+            return true;
+        }
+        bool stop() override {
+            initialized = false;
+            return true;
+        }
+        bool dim() override { return true; }
+        void restore_brightness() override {}
+        void reset() {
+            initialized = false;
+        }
+    };
+}
+
+#endif
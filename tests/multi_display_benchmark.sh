@@ -0,0 +1,97 @@
+#!/bin/sh
+# Compares serving N displays from one xidlechain process (-x) with
+# running one xidlechain per display. Usage:
+#   tests/multi_display_benchmark.sh [number of displays] [path/to/xidlechain]
+# Needs Xvfb. Prints the total RSS of the daemons and the CPU time they
+# used while the displays were idle with a few short timeouts.
+
+NUM_DISPLAYS=${1:-8}
+XIDLECHAIN=${2:-./xidlechain}
+FIRST_DISPLAY=${FIRST_DISPLAY:-100}
+# How long the daemons run before they are measured
+DURATION=${DURATION:-10}
+
+tmpdir=$(mktemp -d)
+xvfb_pids=""
+cleanup() {
+    kill $daemon_pids $xvfb_pids 2>/dev/null
+    rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+cat > "$tmpdir/xidlechain.conf" <<EOF
+[Main]
+enable_dbus = false
+
+[Action short]
+trigger = timeout 1
+exec = true
+resume_exec = true
+
+[Action long]
+trigger = timeout 3
+exec = true
+resume_exec = true
+EOF
+
+displays=""
+i=0
+while [ $i -lt "$NUM_DISPLAYS" ]; do
+    display=":$((FIRST_DISPLAY + i))"
+    Xvfb "$display" -nolisten tcp >/dev/null 2>&1 &
+    xvfb_pids="$xvfb_pids $!"
+    displays="$displays $display"
+    i=$((i + 1))
+done
+for display in $displays; do
+    n=0
+    while ! [ -e "/tmp/.X11-unix/X${display#:}" ]; do
+        n=$((n + 1))
+        if [ $n -gt 50 ]; then
+            echo "Xvfb did not start on $display" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+done
+
+clock_ticks=$(getconf CLK_TCK)
+
+# Prints the total VmRSS (kB) and CPU time (ms) of the given processes
+measure() {
+    rss_kb=0
+    cpu_ticks=0
+    for pid in "$@"; do
+        rss=$(awk '/^VmRSS:/ {print $2}' "/proc/$pid/status")
+        # utime and stime are fields 14 and 15; the command name in
+        # field 2 has no spaces here
+        ticks=$(awk '{print $14 + $15}' "/proc/$pid/stat")
+        rss_kb=$((rss_kb + rss))
+        cpu_ticks=$((cpu_ticks + ticks))
+    done
+    echo "$# process(es): total VmRSS ${rss_kb} kB, CPU $((cpu_ticks * 1000 / clock_ticks)) ms"
+}
+
+echo "separate daemons:"
+daemon_pids=""
+for display in $displays; do
+    DISPLAY=$display "$XIDLECHAIN" -c "$tmpdir/xidlechain.conf" >/dev/null 2>&1 &
+    daemon_pids="$daemon_pids $!"
+done
+sleep "$DURATION"
+measure $daemon_pids
+kill $daemon_pids
+wait $daemon_pids 2>/dev/null
+
+echo "single daemon:"
+args=""
+for display in $displays; do
+    args="$args -x $display"
+done
+"$XIDLECHAIN" -c "$tmpdir/xidlechain.conf" $args >/dev/null 2>&1 &
+daemon_pids=$!
+sleep "$DURATION"
+measure $daemon_pids
+kill $daemon_pids
+wait $daemon_pids 2>/dev/null
+daemon_pids=""
@@ -0,0 +1,132 @@
+#include <locale>
+#include <unistd.h>
+#include <vector>
+
+#include <glib.h>
+
+#include "event_receiver.h"
+#include "pressure_detector.h"
+
+using std::vector;
+using namespace Xidlechain;
+
+// Stands in for the kernel: the triggers are pipes, and the test fires
+// them directly instead of waiting for POLLPRI
+class TestPressureDetector: public PsiPressureDetector {
+    // The write ends are kept open, since a hung up pipe would always be
+    // ready
+    vector<int> write_fds;
+public:
+    using PsiPressureDetector::Trigger;
+    using PsiPressureDetector::trigger_fired;
+
+    ~TestPressureDetector() {
+        for (int fd : write_fds) {
+            close(fd);
+        }
+    }
+    Trigger *add_pipe_trigger(const char *trigger_str) {
+        int fds[2];
+        g_assert_cmpint(pipe(fds), ==, 0);
+        write_fds.push_back(fds[1]);
+        return add_trigger_fd(fds[0], "pipe", trigger_str);
+    }
+};
+
+class PressureReceiver: public EventReceiver {
+public:
+    int num_high = 0;
+    int num_normal = 0;
+    bool under_pressure = false;
+    void receive(const Event &event) override {
+        switch (event.type) {
+        case EVENT_PRESSURE_HIGH:
+            // events must alternate
+            g_assert_false(under_pressure);
+            under_pressure = true;
+            num_high++;
+            break;
+        case EVENT_PRESSURE_NORMAL:
+            g_assert_true(under_pressure);
+            under_pressure = false;
+            num_normal++;
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+static gboolean timeout_cb(gpointer data) {
+    *(bool*)data = true;
+    return G_SOURCE_REMOVE;
+}
+
+// Runs the main loop for |ms| milliseconds
+static void run_for(guint ms) {
+    bool done = false;
+    g_timeout_add(ms, timeout_cb, &done);
+    while (!done) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static void test_parse(gpointer, gconstpointer) {
+    TestPressureDetector detector;
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "Invalid pressure trigger 'some'");
+    g_assert_null(detector.add_pipe_trigger("some"));
+    g_test_assert_expected_messages();
+
+    // The pressure is held for two windows
+    TestPressureDetector::Trigger *trigger = detector.add_pipe_trigger("some 150000 2000000");
+    g_assert_nonnull(trigger);
+    g_assert_cmpuint(trigger->hold_ms, ==, 4000);
+    trigger = detector.add_pipe_trigger("full 500000 10000000");
+    g_assert_nonnull(trigger);
+    g_assert_cmpuint(trigger->hold_ms, ==, 20000);
+}
+
+static void test_hold(gpointer, gconstpointer) {
+    TestPressureDetector detector;
+    PressureReceiver receiver;
+    // Held for 200 ms
+    TestPressureDetector::Trigger *trigger = detector.add_pipe_trigger("some 10000 100000");
+    g_assert_nonnull(trigger);
+    g_assert_true(detector.init(&receiver));
+
+    detector.trigger_fired(trigger);
+    g_assert_cmpint(receiver.num_high, ==, 1);
+    run_for(150);
+    // Firing again while under pressure pushes the release back instead
+    // of sending another event
+    detector.trigger_fired(trigger);
+    g_assert_cmpint(receiver.num_high, ==, 1);
+    run_for(150);
+    // More than 200 ms since the first firing, but not since the second
+    g_assert_true(receiver.under_pressure);
+    g_assert_cmpint(receiver.num_normal, ==, 0);
+
+    bool timed_out = false;
+    guint source_id = g_timeout_add(5000, timeout_cb, &timed_out);
+    while (receiver.under_pressure && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_false(timed_out);
+    g_source_remove(source_id);
+    g_assert_cmpint(receiver.num_normal, ==, 1);
+
+    // And the next firing starts over
+    detector.trigger_fired(trigger);
+    g_assert_cmpint(receiver.num_high, ==, 2);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/pressure-detector/parse", void, NULL, NULL, test_parse, NULL);
+    g_test_add("/pressure-detector/hold", void, NULL, NULL, test_hold, NULL);
+
+    return g_test_run();
+}
@@ -0,0 +1,138 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <locale>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "service_notifier.h"
+
+using std::string;
+using namespace Xidlechain;
+
+// A stand-in for the service manager's NOTIFY_SOCKET
+struct Fixture {
+    gchar *dir;
+    gchar *path;
+    int fd;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->dir, "notify", NULL);
+    fixture->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    g_assert_cmpint(fixture->fd, >=, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, fixture->path);
+    g_assert_cmpint(bind(fixture->fd, (struct sockaddr*)&addr, sizeof(addr)), ==, 0);
+    g_setenv("NOTIFY_SOCKET", fixture->path, TRUE);
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    ServiceNotifier::stop();
+    g_unsetenv("NOTIFY_SOCKET");
+    close(fixture->fd);
+    g_unlink(fixture->path);
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->path);
+    g_free(fixture->dir);
+}
+
+// Runs the main loop until a message arrives or |timeout_ms| passed.
+// Returns an empty string on timeout.
+static string receive(int fd, int timeout_ms) {
+    gint64 deadline = g_get_monotonic_time() + timeout_ms * 1000;
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) < 0) {
+        if (g_get_monotonic_time() >= deadline) {
+            return "";
+        }
+        g_main_context_iteration(NULL, FALSE);
+        g_usleep(1000);
+    }
+    return string(buf, n);
+}
+
+static string status = "active";
+
+static string get_status(gpointer) {
+    return status;
+}
+
+static void test_ready(Fixture *fixture, gconstpointer) {
+    status = "active";
+    ServiceNotifier::hold_ready();
+    ServiceNotifier::hold_ready();
+    ServiceNotifier::start(get_status, NULL, 20);
+    // The status is only sent once we're ready
+    g_assert_cmpstr(receive(fixture->fd, 100).c_str(), ==, "");
+    ServiceNotifier::release_ready();
+    g_assert_cmpstr(receive(fixture->fd, 100).c_str(), ==, "");
+    g_assert_false(ServiceNotifier::is_ready());
+
+    ServiceNotifier::release_ready();
+    g_assert_cmpstr(receive(fixture->fd, 1000).c_str(), ==, "READY=1\nSTATUS=active");
+    g_assert_true(ServiceNotifier::is_ready());
+
+    // Only changes are sent, one line each
+    g_assert_cmpstr(receive(fixture->fd, 100).c_str(), ==, "");
+    status = "idle for 1000 ms\n; activated: lock";
+    g_assert_cmpstr(receive(fixture->fd, 1000).c_str(), ==, "STATUS=idle for 1000 ms ; activated: lock");
+    g_assert_cmpstr(receive(fixture->fd, 100).c_str(), ==, "");
+}
+
+static void test_nothing_to_wait_for(Fixture *fixture, gconstpointer) {
+    ServiceNotifier::start(NULL, NULL);
+    g_assert_cmpstr(receive(fixture->fd, 1000).c_str(), ==, "READY=1");
+}
+
+static void test_abstract_socket(Fixture *fixture, gconstpointer) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    g_assert_cmpint(fd, >=, 0);
+    g_autofree gchar *name = g_strdup_printf("@xidlechain-test-%d", (int)getpid());
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name + 1, strlen(name) - 1);
+    g_assert_cmpint(bind(fd, (struct sockaddr*)&addr, offsetof(struct sockaddr_un, sun_path) + strlen(name)), ==, 0);
+    g_setenv("NOTIFY_SOCKET", name, TRUE);
+
+    g_assert_true(ServiceNotifier::notify("WATCHDOG=1"));
+    g_assert_cmpstr(receive(fd, 1000).c_str(), ==, "WATCHDOG=1");
+    close(fd);
+}
+
+static void test_no_service_manager(Fixture *fixture, gconstpointer) {
+    g_unsetenv("NOTIFY_SOCKET");
+    g_assert_false(ServiceNotifier::notify("READY=1"));
+    ServiceNotifier::start(get_status, NULL, 20);
+    g_assert_cmpstr(receive(fixture->fd, 100).c_str(), ==, "");
+    g_assert_false(ServiceNotifier::is_ready());
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/service-notifier/ready", Fixture, NULL,
+               fixture_setup, test_ready, fixture_teardown);
+    g_test_add("/service-notifier/nothing-to-wait-for", Fixture, NULL,
+               fixture_setup, test_nothing_to_wait_for, fixture_teardown);
+    g_test_add("/service-notifier/abstract-socket", Fixture, NULL,
+               fixture_setup, test_abstract_socket, fixture_teardown);
+    g_test_add("/service-notifier/no-service-manager", Fixture, NULL,
+               fixture_setup, test_no_service_manager, fixture_teardown);
+
+    return g_test_run();
+}
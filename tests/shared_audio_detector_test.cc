@@ -0,0 +1,135 @@
+#include <locale>
+
+#include <glib.h>
+
+#include "audio_detector.h"
+#include "event_receiver.h"
+
+using namespace Xidlechain;
+
+class MockAudioDetector: public AudioDetector {
+public:
+    EventReceiver *receiver = NULL;
+    int num_inits = 0;
+    int num_stops = 0;
+    bool init(EventReceiver *receiver) override {
+        this->receiver = receiver;
+        num_inits++;
+        return true;
+    }
+    void stop() override {
+        receiver = NULL;
+        num_stops++;
+    }
+};
+
+class AudioReceiver: public EventReceiver {
+public:
+    bool running = false;
+    int num_events = 0;
+    void receive(const Event &event) override {
+        if (event.type == EVENT_AUDIO_RUNNING) {
+            running = true;
+            num_events++;
+        } else if (event.type == EVENT_AUDIO_STOPPED) {
+            running = false;
+            num_events++;
+        }
+    }
+};
+
+static void process_pending_events() {
+    while (g_main_context_iteration(NULL, FALSE));
+}
+
+static void test_fan_out(void) {
+    MockAudioDetector detector;
+    SharedAudioDetector shared(&detector);
+    SharedAudioDetector::Client client1(&shared), client2(&shared);
+    AudioReceiver receiver1, receiver2;
+
+    g_assert_true(client1.init(&receiver1));
+    g_assert_true(client2.init(&receiver2));
+    // Only one connection to the sound server
+    g_assert_cmpint(detector.num_inits, ==, 1);
+
+    detector.receiver->receive(Event(EVENT_AUDIO_RUNNING));
+    g_assert_true(receiver1.running);
+    g_assert_true(receiver2.running);
+
+    // A stopped client no longer receives events, but the others do
+    client1.stop();
+    g_assert_cmpint(detector.num_stops, ==, 0);
+    detector.receiver->receive(Event(EVENT_AUDIO_STOPPED));
+    g_assert_true(receiver1.running);
+    g_assert_false(receiver2.running);
+
+    // The detector is stopped along with the last client
+    client2.stop();
+    g_assert_cmpint(detector.num_stops, ==, 1);
+    g_assert_null(detector.receiver);
+}
+
+static void test_late_client(void) {
+    MockAudioDetector detector;
+    SharedAudioDetector shared(&detector);
+    SharedAudioDetector::Client client1(&shared), client2(&shared);
+    AudioReceiver receiver1, receiver2;
+
+    g_assert_true(client1.init(&receiver1));
+    detector.receiver->receive(Event(EVENT_AUDIO_RUNNING));
+    process_pending_events();
+
+    // A client which joins later still gets the current state, but
+    // not from inside init()
+    g_assert_true(client2.init(&receiver2));
+    g_assert_cmpint(receiver2.num_events, ==, 0);
+    process_pending_events();
+    g_assert_cmpint(receiver2.num_events, ==, 1);
+    g_assert_true(receiver2.running);
+    g_assert_cmpint(receiver1.num_events, ==, 1);
+
+    // A newer event supersedes the pending initial state
+    AudioReceiver receiver3;
+    SharedAudioDetector::Client client3(&shared);
+    g_assert_true(client3.init(&receiver3));
+    detector.receiver->receive(Event(EVENT_AUDIO_STOPPED));
+    process_pending_events();
+    g_assert_cmpint(receiver3.num_events, ==, 1);
+    g_assert_false(receiver3.running);
+    g_assert_cmpint(detector.num_inits, ==, 1);
+}
+
+static void test_restart(void) {
+    MockAudioDetector detector;
+    SharedAudioDetector shared(&detector);
+    AudioReceiver receiver;
+    {
+        SharedAudioDetector::Client client(&shared);
+        g_assert_true(client.init(&receiver));
+        detector.receiver->receive(Event(EVENT_AUDIO_RUNNING));
+    }
+    // Destroying the last client stops the detector
+    g_assert_cmpint(detector.num_stops, ==, 1);
+
+    // The old state must not be replayed after a restart; only the
+    // detector knows the new one
+    SharedAudioDetector::Client client(&shared);
+    AudioReceiver receiver2;
+    g_assert_true(client.init(&receiver2));
+    g_assert_cmpint(detector.num_inits, ==, 2);
+    process_pending_events();
+    g_assert_cmpint(receiver2.num_events, ==, 0);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/shared-audio-detector/fan-out", test_fan_out);
+    g_test_add_func("/shared-audio-detector/late-client", test_late_client);
+    g_test_add_func("/shared-audio-detector/restart", test_restart);
+
+    return g_test_run();
+}
@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "event_receiver.h"
+#include "metrics.h"
+#include "stall_monitor.h"
+#include "trace.h"
+
+using std::string;
+using namespace Xidlechain;
+
+struct Fixture {
+    gchar *dir;
+    gchar *trace_path;
+    gchar *notify_path;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->trace_path = g_build_filename(fixture->dir, "xidlechain.trace", NULL);
+    fixture->notify_path = g_build_filename(fixture->dir, "notify", NULL);
+    g_assert_true(Trace::open(fixture->trace_path));
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    Trace::close();
+    g_unlink(fixture->trace_path);
+    g_unlink(fixture->notify_path);
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->notify_path);
+    g_free(fixture->trace_path);
+    g_free(fixture->dir);
+}
+
+// Blocks the main loop while "handling" a sleep event
+static gboolean block_main_loop(gpointer) {
+    StallMonitor::enter_event(EVENT_SLEEP);
+    StallMonitor::enter_command(3);
+    g_usleep(200 * 1000);
+    return G_SOURCE_REMOVE;
+}
+
+static void test_stall(Fixture *fixture, gconstpointer) {
+    StallMonitor monitor;
+    monitor.start(20);
+    uint64_t stalls = Metrics::main_loop_stalls;
+    g_timeout_add(30, block_main_loop, NULL);
+    while (Metrics::main_loop_stalls == stalls) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_cmpuint(Metrics::main_loop_stalls, ==, stalls + 1);
+    g_assert_cmpint(Metrics::main_loop_stall_max_us, >=, 150 * 1000);
+
+    // The stall is blamed on the sleep event
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    g_assert_true(Trace::dump(fixture->trace_path, out));
+    fclose(out);
+    g_assert_true(g_regex_match_simple(" stall +SLEEP +3  \\+", text, (GRegexCompileFlags)0, (GRegexMatchFlags)0));
+    free(text);
+}
+
+static void test_watchdog(Fixture *fixture, gconstpointer) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    g_assert_cmpint(fd, >=, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, fixture->notify_path);
+    g_assert_cmpint(bind(fd, (struct sockaddr*)&addr, sizeof(addr)), ==, 0);
+    g_setenv("NOTIFY_SOCKET", fixture->notify_path, TRUE);
+    g_setenv("WATCHDOG_USEC", "40000", TRUE);
+    g_autofree gchar *pid = g_strdup_printf("%d", (int)getpid());
+    g_setenv("WATCHDOG_PID", pid, TRUE);
+
+    {
+        // The heartbeat gets faster to keep up with the watchdog
+        StallMonitor monitor;
+        monitor.start();
+        char buf[64];
+        ssize_t n;
+        gint64 deadline = g_get_monotonic_time() + G_USEC_PER_SEC;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) < 0 && g_get_monotonic_time() < deadline) {
+            g_main_context_iteration(NULL, FALSE);
+            g_usleep(1000);
+        }
+        g_assert_cmpint(n, ==, strlen("WATCHDOG=1"));
+        g_assert_cmpmem(buf, n, "WATCHDOG=1", n);
+    }
+
+    g_unsetenv("WATCHDOG_PID");
+    g_unsetenv("WATCHDOG_USEC");
+    g_unsetenv("NOTIFY_SOCKET");
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/stall-monitor/stall", Fixture, NULL,
+               fixture_setup, test_stall, fixture_teardown);
+    g_test_add("/stall-monitor/watchdog", Fixture, NULL,
+               fixture_setup, test_watchdog, fixture_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Measures how long xidlechain takes to start up and how much memory it
+# uses once it is idle. Usage:
+#   tests/startup_benchmark.sh [path/to/xidlechain] [runs]
+# Needs Xvfb. The daemon runs against a private X server and an empty
+# config file, with D-Bus disabled so that it does not clash with an
+# instance which is already running.
+
+XIDLECHAIN=${1:-./xidlechain}
+RUNS=${2:-10}
+DISPLAY_NUM=${DISPLAY_NUM:-97}
+
+tmpdir=$(mktemp -d)
+trap 'kill $xvfb_pid 2>/dev/null; rm -rf "$tmpdir"' EXIT
+
+printf '[Main]\nenable_dbus = false\n' > "$tmpdir/xidlechain.conf"
+
+Xvfb ":$DISPLAY_NUM" -nolisten tcp >/dev/null 2>&1 &
+xvfb_pid=$!
+export DISPLAY=":$DISPLAY_NUM"
+i=0
+while ! [ -e "/tmp/.X11-unix/X$DISPLAY_NUM" ]; do
+    i=$((i + 1))
+    if [ $i -gt 50 ]; then
+        echo "Xvfb did not start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+run=1
+while [ $run -le "$RUNS" ]; do
+    log="$tmpdir/run$run.log"
+    "$XIDLECHAIN" -d -c "$tmpdir/xidlechain.conf" >"$log" 2>&1 &
+    pid=$!
+    i=0
+    while ! grep -q 'entering main loop' "$log"; do
+        i=$((i + 1))
+        if [ $i -gt 100 ]; then
+            echo "xidlechain did not start, see below" >&2
+            cat "$log" >&2
+            exit 1
+        fi
+        sleep 0.05
+    done
+    # Let the background connections (logind, D-Bus) settle
+    sleep 1
+    startup_ms=$(sed -n 's/.*startup +\([0-9.]*\) ms: entering main loop.*/\1/p' "$log")
+    rss_kb=$(awk '/^VmRSS:/ {print $2}' "/proc/$pid/status")
+    hwm_kb=$(awk '/^VmHWM:/ {print $2}' "/proc/$pid/status")
+    echo "run $run: startup ${startup_ms} ms, VmRSS ${rss_kb} kB, VmHWM ${hwm_kb} kB"
+    kill $pid
+    wait $pid 2>/dev/null
+    run=$((run + 1))
+done
@@ -0,0 +1,164 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <string>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "command.h"
+#include "status_page.h"
+
+using std::string;
+using namespace Xidlechain;
+
+struct Fixture {
+    gchar *dir;
+    gchar *path;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->dir, "xidlechain.status", NULL);
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    // This fails if the page or a temporary file was left behind
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->path);
+    g_free(fixture->dir);
+}
+
+static string query(const char *path, const char * const *fields, int num_fields) {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    g_assert_true(StatusPage::query(path, fields, num_fields, out));
+    fclose(out);
+    string result(buf, size);
+    free(buf);
+    return result;
+}
+
+static void test_query(Fixture *fixture, gconstpointer) {
+    StatusPage page;
+    g_assert_true(page.open(fixture->path));
+    StatusPage::Snapshot snapshot;
+    snapshot.idle = true;
+    snapshot.idle_state_since_us = g_get_monotonic_time() - 5000 * 1000;
+    snapshot.activated_slots = (1 << 1) | (1 << 3);
+    snapshot.num_activated = 2;
+    snapshot.paused = true;
+    snapshot.inhibitors = Command::INHIBIT_AUDIO | Command::INHIBIT_PAUSED;
+    page.publish(snapshot);
+
+    string text = query(fixture->path, NULL, 0);
+    g_autofree gchar *pid_line = g_strdup_printf("pid %d\nrunning 1\ngeneration 1\nidle 1\n", (int)getpid());
+    g_assert_true(g_str_has_prefix(text.c_str(), pid_line));
+    g_assert_nonnull(strstr(text.c_str(), "\nactivated 1,3\nnum_activated 2\npaused 1\naudio_playing 0\n"
+                                          "inhibitors audio,paused\n"));
+
+    // Single fields are printed without their names
+    const char *fields[] = {"idle_ms", "activated"};
+    g_auto(GStrv) values = g_strsplit(query(fixture->path, fields, 2).c_str(), "\n", -1);
+    g_assert_cmpuint(g_strv_length(values), ==, 3);
+    g_assert_cmpint(g_ascii_strtoll(values[0], NULL, 10), >=, 5000);
+    g_assert_cmpstr(values[1], ==, "1,3");
+
+    const char *unknown[] = {"bogus"};
+    g_assert_false(StatusPage::query(fixture->path, unknown, 1, stdout));
+}
+
+static void test_generation(Fixture *fixture, gconstpointer) {
+    StatusPage page;
+    g_assert_true(page.open(fixture->path));
+    StatusPage::Snapshot snapshot;
+    StatusPage::Snapshot read_back;
+    page.publish(snapshot);
+    page.publish(snapshot);
+    g_assert_true(StatusPage::read(fixture->path, read_back));
+    g_assert_cmpuint(read_back.generation, ==, 1);
+
+    // Only changes are published
+    snapshot.audio_playing = true;
+    page.publish(snapshot);
+    page.publish(snapshot);
+    g_assert_true(StatusPage::read(fixture->path, read_back));
+    g_assert_cmpuint(read_back.generation, ==, 2);
+    g_assert_true(read_back.audio_playing);
+}
+
+struct Writer {
+    StatusPage *page;
+    int iterations;
+};
+
+// Every field of snapshot i is derived from i
+static StatusPage::Snapshot make_snapshot(int i) {
+    StatusPage::Snapshot snapshot;
+    snapshot.idle = i & 1;
+    snapshot.idle_state_since_us = i;
+    snapshot.activated_slots = (uint64_t)i << 20;
+    snapshot.num_activated = i;
+    snapshot.paused = i & 2;
+    snapshot.audio_playing = i & 4;
+    snapshot.inhibitors = i & 0x1f;
+    return snapshot;
+}
+
+static gpointer write_snapshots(gpointer user_data) {
+    Writer *writer = (Writer*)user_data;
+    for (int i = 1; i <= writer->iterations; i++) {
+        writer->page->publish(make_snapshot(i));
+    }
+    return NULL;
+}
+
+static void test_concurrent(Fixture *fixture, gconstpointer) {
+    StatusPage page;
+    g_assert_true(page.open(fixture->path));
+    Writer writer = {&page, 200000};
+    GThread *thread = g_thread_new("writer", write_snapshots, &writer);
+    StatusPage::Snapshot snapshot;
+    do {
+        g_assert_true(StatusPage::read(fixture->path, snapshot));
+        if (snapshot.generation == 0) {
+            continue;
+        }
+        // A torn read would mix up two snapshots
+        int i = (int)snapshot.idle_state_since_us;
+        g_assert_true(snapshot.same_state(make_snapshot(i)));
+        g_assert_cmpuint(snapshot.generation, ==, i);
+    } while (snapshot.idle_state_since_us < writer.iterations);
+    g_thread_join(thread);
+}
+
+static void test_removed(Fixture *fixture, gconstpointer) {
+    {
+        StatusPage page;
+        g_assert_true(page.open(fixture->path));
+        g_assert_true(g_file_test(fixture->path, G_FILE_TEST_EXISTS));
+    }
+    g_assert_false(g_file_test(fixture->path, G_FILE_TEST_EXISTS));
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/status-page/query", Fixture, NULL,
+               fixture_setup, test_query, fixture_teardown);
+    g_test_add("/status-page/generation", Fixture, NULL,
+               fixture_setup, test_generation, fixture_teardown);
+    g_test_add("/status-page/concurrent", Fixture, NULL,
+               fixture_setup, test_concurrent, fixture_teardown);
+    g_test_add("/status-page/removed", Fixture, NULL,
+               fixture_setup, test_removed, fixture_teardown);
+
+    return g_test_run();
+}
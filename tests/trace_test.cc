@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "event_receiver.h"
+#include "trace.h"
+
+using namespace Xidlechain;
+
+struct Fixture {
+    gchar *dir;
+    gchar *path;
+};
+
+static void fixture_setup(Fixture *fixture, gconstpointer) {
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("xidlechain-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->dir, "xidlechain.trace", NULL);
+}
+
+static void fixture_teardown(Fixture *fixture, gconstpointer) {
+    Trace::close();
+    g_unlink(fixture->path);
+    // This fails if any temporary files were left behind
+    g_assert_cmpint(g_rmdir(fixture->dir), ==, 0);
+    g_free(fixture->path);
+    g_free(fixture->dir);
+}
+
+// Returns the dump as a list of lines, without the header line
+static gchar **dump_lines(const char *path) {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    g_assert_true(Trace::dump(path, out));
+    fclose(out);
+    gchar **lines = g_strsplit(buf, "\n", -1);
+    free(buf);
+    g_assert_nonnull(lines[0]);
+    g_assert_true(g_str_has_prefix(lines[0], "# pid"));
+    // drop the header line and the empty string after the last newline
+    guint n = g_strv_length(lines);
+    g_assert_cmpstr(lines[n - 1], ==, "");
+    g_free(lines[0]);
+    g_free(lines[n - 1]);
+    memmove(lines, lines + 1, (n - 2) * sizeof(gchar*));
+    lines[n - 2] = NULL;
+    return lines;
+}
+
+static void test_disabled(Fixture *fixture, gconstpointer) {
+    // Nothing is recorded (or crashes) before the ring is opened
+    Trace::record(TRACE_DETECTED, EVENT_LOCK, 0);
+    g_assert_false(Trace::dump(fixture->path, stderr));
+}
+
+static void test_records(Fixture *fixture, gconstpointer) {
+    g_assert_true(Trace::open(fixture->path));
+    // Creating an event doesn't trace it; the detector does
+    Event event = Event::activity_timeout(3);
+    Trace::record(TRACE_DETECTED, event.type, 3);
+    Trace::record(TRACE_DISPATCHED, event.type, 3, event.timestamp * 1000);
+    Trace::record(TRACE_ACTIVATE, 0, 3);
+    Trace::record(TRACE_SPAWNED, 0, 0);
+
+    g_auto(GStrv) lines = dump_lines(fixture->path);
+    g_assert_cmpuint(g_strv_length(lines), ==, 4);
+    g_assert_nonnull(strstr(lines[0], "detected"));
+    g_assert_nonnull(strstr(lines[0], "ACTIVITY_TIMEOUT"));
+    g_assert_nonnull(strstr(lines[1], "dispatched"));
+    // the latency since detection is shown for later stages
+    g_assert_nonnull(strstr(lines[1], " us"));
+    g_assert_null(strstr(lines[0], " us"));
+    g_assert_nonnull(strstr(lines[2], "activate"));
+    g_assert_nonnull(strstr(lines[3], "spawned"));
+}
+
+static void test_wraparound(Fixture *fixture, gconstpointer) {
+    g_assert_true(Trace::open(fixture->path));
+    const int num_records = Trace::CAPACITY + 100;
+    for (int i = 0; i < num_records; i++) {
+        Trace::record(TRACE_ACTIVATE, 0, i);
+    }
+    // Only the newest records are left, oldest first
+    g_auto(GStrv) lines = dump_lines(fixture->path);
+    g_assert_cmpuint(g_strv_length(lines), ==, Trace::CAPACITY);
+    for (guint i = 0; i < Trace::CAPACITY; i++) {
+        unsigned long long seq;
+        int arg;
+        g_assert_cmpint(sscanf(lines[i], "%llu %*f %*s %*s %d", &seq, &arg), ==, 2);
+        g_assert_cmpuint(seq, ==, num_records - Trace::CAPACITY + i + 1);
+        g_assert_cmpint(arg, ==, num_records - Trace::CAPACITY + i);
+    }
+}
+
+static void test_replace(Fixture *fixture, gconstpointer) {
+    // A restarted daemon starts a new file; the old mapping stays valid
+    g_assert_true(Trace::open(fixture->path));
+    Trace::record(TRACE_ACTIVATE, 0, 1);
+    Trace::close();
+    g_assert_true(Trace::open(fixture->path));
+    g_auto(GStrv) lines = dump_lines(fixture->path);
+    g_assert_cmpuint(g_strv_length(lines), ==, 0);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/trace/disabled", Fixture, NULL,
+               fixture_setup, test_disabled, fixture_teardown);
+    g_test_add("/trace/records", Fixture, NULL,
+               fixture_setup, test_records, fixture_teardown);
+    g_test_add("/trace/wraparound", Fixture, NULL,
+               fixture_setup, test_wraparound, fixture_teardown);
+    g_test_add("/trace/replace", Fixture, NULL,
+               fixture_setup, test_replace, fixture_teardown);
+
+    return g_test_run();
+}
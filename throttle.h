@@ -0,0 +1,54 @@
+#ifndef _THROTTLE_H_
+#define _THROTTLE_H_
+
+#include <glib.h>
+
+namespace Xidlechain {
+    // Runs a function from the main loop after something changed. All the
+    // changes which are scheduled before it runs are handled by one call,
+    // so a burst of changes in one main loop iteration only costs one, and
+    // the calls are at least |interval_us| apart, so that a flapping input
+    // can't make it run all the time.
+    class Throttle {
+        gint64 interval_us;
+        void (*func)(gpointer);
+        gpointer data;
+        guint source_id = 0;
+        gint64 last_run_time = 0;
+
+        static gboolean static_run(gpointer user_data) {
+            Throttle *_this = static_cast<Throttle*>(user_data);
+            _this->source_id = 0;
+            _this->last_run_time = g_get_monotonic_time();
+            _this->func(_this->data);
+            return G_SOURCE_REMOVE;
+        }
+    public:
+        Throttle(gint64 interval_us, void (*func)(gpointer), gpointer data):
+            interval_us{interval_us}, func{func}, data{data}
+        {}
+        ~Throttle() {
+            if (source_id) {
+                g_source_remove(source_id);
+            }
+        }
+        Throttle(const Throttle&) = delete;
+        Throttle& operator=(const Throttle&) = delete;
+
+        // Does nothing if a call is already scheduled
+        void schedule() {
+            if (source_id) {
+                return;
+            }
+            gint64 delay_us = last_run_time + interval_us - g_get_monotonic_time();
+            if (delay_us <= 0) {
+                source_id = g_idle_add(static_run, this);
+            } else {
+                source_id = g_timeout_add((delay_us + 999) / 1000, static_run, this);
+            }
+        }
+        bool is_scheduled() const { return source_id != 0; }
+    };
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "event_receiver.h"
+#include "trace.h"
+
+namespace Xidlechain {
+    static const char * const STAGE_NAMES[TRACE_STAGE_COUNT] = {
+        NULL,
+        "detected",
+        "dispatched",
+        "activate",
+        "deactivate",
+        "spawned",
+        "stall",
+    };
+
+    string Trace::default_path() {
+        g_autofree gchar *path = g_build_filename(g_get_user_runtime_dir(), "xidlechain.trace", NULL);
+        return path;
+    }
+
+    bool Trace::open(const string &path) {
+        g_return_val_if_fail(ring == NULL, FALSE);
+        // Build the new file next to the old one and rename it into place,
+        // so that a reader never sees a half-initialized header. A daemon
+        // which is still using the old file keeps its own copy.
+        g_autofree gchar *tmp_path = g_strdup_printf("%s.XXXXXX", path.c_str());
+        int fd = g_mkstemp(tmp_path);
+        if (fd < 0) {
+            g_warning("Could not create %s: %s", tmp_path, g_strerror(errno));
+            return false;
+        }
+        if (ftruncate(fd, sizeof(Header)) < 0) {
+            g_warning("Could not resize %s: %s", tmp_path, g_strerror(errno));
+            ::close(fd);
+            g_unlink(tmp_path);
+            return false;
+        }
+        void *addr = mmap(NULL, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            g_warning("Could not map %s: %s", tmp_path, g_strerror(errno));
+            g_unlink(tmp_path);
+            return false;
+        }
+        // The file is zero-filled, so all records are empty
+        Header *header = static_cast<Header*>(addr);
+        header->magic = MAGIC;
+        header->version = VERSION;
+        header->capacity = CAPACITY;
+        header->record_size = sizeof(Record);
+        header->pid = getpid();
+        if (g_rename(tmp_path, path.c_str()) < 0) {
+            g_warning("Could not rename %s: %s", tmp_path, g_strerror(errno));
+            munmap(addr, sizeof(Header));
+            g_unlink(tmp_path);
+            return false;
+        }
+        next_seq = 1;
+        ring = header;
+        return true;
+    }
+
+    void Trace::close() {
+        if (!ring) {
+            return;
+        }
+        munmap(ring, sizeof(Header));
+        ring = NULL;
+    }
+
+    bool Trace::dump(const string &path, FILE *out) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            g_printerr("Could not open %s: %s\n", path.c_str(), g_strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Header)) {
+            g_printerr("%s is not a trace file\n", path.c_str());
+            ::close(fd);
+            return false;
+        }
+        void *addr = mmap(NULL, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            g_printerr("Could not map %s: %s\n", path.c_str(), g_strerror(errno));
+            return false;
+        }
+        const Header *header = static_cast<const Header*>(addr);
+        if (
+            header->magic != MAGIC
+            || header->version != VERSION
+            || header->capacity != CAPACITY
+            || header->record_size != sizeof(Record)
+        ) {
+            g_printerr("%s was written by an incompatible version of xidlechain\n", path.c_str());
+            munmap(addr, sizeof(Header));
+            return false;
+        }
+
+        int64_t now = now_ns();
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        uint64_t first = head > CAPACITY ? head - CAPACITY + 1 : 1;
+        fprintf(out, "# pid %lld, %llu records written, times in seconds before now\n",
+                (long long)header->pid, (unsigned long long)head);
+        for (uint64_t seq = first; seq <= head; seq++) {
+            const Record &r = header->records[(seq - 1) & (CAPACITY - 1)];
+            if (r.seq.load(std::memory_order_acquire) != seq) {
+                // Already overwritten by a newer record
+                continue;
+            }
+            int64_t time_ns = r.time_ns.load(std::memory_order_relaxed);
+            int64_t origin_ns = r.origin_ns.load(std::memory_order_relaxed);
+            unsigned int stage = r.stage.load(std::memory_order_relaxed);
+            unsigned int event_type = r.event_type.load(std::memory_order_relaxed);
+            int arg = r.arg.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (r.seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            fprintf(out, "%8llu %12.6f %-10s %-18s %6d",
+                    (unsigned long long)seq,
+                    (now - time_ns) / 1e9,
+                    stage < TRACE_STAGE_COUNT && stage > 0 ? STAGE_NAMES[stage] : "?",
+                    event_type < EVENT_TYPE_COUNT && event_type > 0 ? EVENT_TYPE_NAMES[event_type] : "-",
+                    arg);
+            if (origin_ns) {
+                fprintf(out, "  +%.1f us", (time_ns - origin_ns) / 1e3);
+            }
+            fputc('\n', out);
+        }
+        munmap(addr, sizeof(Header));
+        return true;
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+using std::int32_t;
+using std::int64_t;
+using std::string;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace Xidlechain {
+    // The points in the life of an event at which it is traced.
+    enum TraceStage {
+        // An Event was created by a detector (X, logind, PulseAudio, ...)
+        TRACE_DETECTED = 1,
+        // The EventManager received the event
+        TRACE_DISPATCHED,
+        // A command's activation action is about to run
+        TRACE_ACTIVATE,
+        // A command's deactivation action is about to run
+        TRACE_DEACTIVATE,
+        // A shell command was spawned (or exited, for synchronous ones)
+        TRACE_SPAWNED,
+        // The main loop was blocked; the event and command (the arg) are
+        // the last ones which were handled before the stall was noticed
+        TRACE_STALL,
+        TRACE_STAGE_COUNT
+    };
+
+    // A fixed-size ring of binary records in a file under
+    // $XDG_RUNTIME_DIR, which `xidlechain --dump-trace` decodes while the
+    // daemon keeps running (or after it crashed). Everything is written
+    // from the main thread, so the ring has a single writer and needs no
+    // locks: each slot carries a sequence number which is zeroed while
+    // the slot is being rewritten, and readers discard slots whose
+    // sequence number changed while they were copying them.
+    class Trace {
+    public:
+        static constexpr uint32_t MAGIC = 0x58494454;  // "XIDT"
+        static constexpr uint32_t VERSION = 1;
+        // Must be a power of two
+        static constexpr uint32_t CAPACITY = 4096;
+
+        struct Record {
+            // 0 while the slot is being written
+            std::atomic<uint64_t> seq;
+            // CLOCK_MONOTONIC, in nanoseconds
+            std::atomic<int64_t> time_ns;
+            // When the event was detected, for the stages which follow
+            // TRACE_DETECTED, or 0
+            std::atomic<int64_t> origin_ns;
+            std::atomic<uint16_t> stage;
+            std::atomic<uint16_t> event_type;
+            // Depends on the stage, e.g. a command ID or an exit status
+            std::atomic<int32_t> arg;
+        };
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t capacity;
+            uint32_t record_size;
+            int64_t pid;
+            // The sequence number of the last complete record
+            std::atomic<uint64_t> head;
+            Record records[CAPACITY];
+        };
+        static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                      "the trace ring is shared with other processes");
+
+    private:
+        static inline Header *ring = NULL;
+        static inline uint64_t next_seq = 1;
+    public:
+        // The file which open() and dump() use by default
+        static string default_path();
+        // Creates (or replaces) the trace file and starts recording.
+        // Until this is called, record() does nothing.
+        static bool open(const string &path);
+        static void close();
+        // Prints the records in |path| to |out|, oldest first. Returns
+        // false if the file can't be read.
+        static bool dump(const string &path, FILE *out);
+
+        static int64_t now_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+
+        static void record(TraceStage stage, int event_type, int arg, int64_t origin_ns = 0) {
+            if (!ring) {
+                return;
+            }
+            uint64_t seq = next_seq++;
+            Record &r = ring->records[(seq - 1) & (CAPACITY - 1)];
+            r.seq.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            r.time_ns.store(now_ns(), std::memory_order_relaxed);
+            r.origin_ns.store(origin_ns, std::memory_order_relaxed);
+            r.stage.store(stage, std::memory_order_relaxed);
+            r.event_type.store(event_type, std::memory_order_relaxed);
+            r.arg.store(arg, std::memory_order_relaxed);
+            r.seq.store(seq, std::memory_order_release);
+            ring->head.store(seq, std::memory_order_release);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,170 @@
+#include "x_connection.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using std::find;
+using std::free;
+
+namespace Xidlechain {
+    struct XConnection::Source {
+        GSource source;
+        XConnection *connection;
+        gpointer fd_tag;
+    };
+
+    GSourceFuncs XConnection::source_funcs = {
+        XConnection::source_prepare,
+        XConnection::source_check,
+        XConnection::source_dispatch,
+        NULL,
+        NULL,
+        NULL
+    };
+
+    XConnection::XConnection():
+        conn(NULL),
+        screen(NULL),
+        source(NULL),
+        pending_event(NULL),
+        connection_lost_func(NULL),
+        connection_lost_data(NULL)
+    {}
+
+    XConnection::~XConnection() {
+        if (source) {
+            g_source_destroy(&source->source);
+            g_source_unref(&source->source);
+        }
+        free(pending_event);
+        if (conn) {
+            xcb_disconnect(conn);
+        }
+    }
+
+    bool XConnection::open(const char *display_name, GMainContext *context) {
+        g_return_val_if_fail(conn == NULL, FALSE);
+        int screen_num;
+        conn = xcb_connect(display_name, &screen_num);
+        if (xcb_connection_has_error(conn)) {
+            g_critical("Could not connect to X server %s",
+                       display_name ? display_name : g_getenv("DISPLAY"));
+            return false;
+        }
+        xcb_screen_iterator_t it = xcb_setup_roots_iterator(xcb_get_setup(conn));
+        for (int i = 0; i < screen_num && it.rem > 0; i++) {
+            xcb_screen_next(&it);
+        }
+        if (it.rem == 0) {
+            g_critical("Screen %d not found", screen_num);
+            return false;
+        }
+        screen = it.data;
+
+        source = (Source*)g_source_new(&source_funcs, sizeof(Source));
+        source->connection = this;
+        source->fd_tag = g_source_add_unix_fd(
+            &source->source,
+            xcb_get_file_descriptor(conn),
+            (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR)
+        );
+        g_source_set_name(&source->source, "X connection");
+        g_source_attach(&source->source, context);
+        return true;
+    }
+
+    void XConnection::set_connection_lost_func(void (*func)(gpointer), gpointer data) {
+        connection_lost_func = func;
+        connection_lost_data = data;
+    }
+
+    void XConnection::add_event_handler(XEventHandler *handler) {
+        handlers.push_back(handler);
+    }
+
+    void XConnection::remove_event_handler(XEventHandler *handler) {
+        vector<XEventHandler*>::iterator it = find(handlers.begin(), handlers.end(), handler);
+        if (it != handlers.end()) {
+            handlers.erase(it);
+        }
+    }
+
+    const xcb_query_extension_reply_t *XConnection::get_extension(xcb_extension_t *extension) {
+        const xcb_query_extension_reply_t *reply = xcb_get_extension_data(conn, extension);
+        if (!reply || !reply->present) {
+            return NULL;
+        }
+        return reply;
+    }
+
+    void XConnection::flush() {
+        xcb_flush(conn);
+    }
+
+    bool XConnection::has_pending_event() {
+        if (!pending_event) {
+            // Replies to our requests may have pulled events off the socket
+            // already, in which case the fd won't become readable for them.
+            pending_event = xcb_poll_for_queued_event(conn);
+        }
+        return pending_event != NULL;
+    }
+
+    void XConnection::dispatch_event(xcb_generic_event_t *event) {
+        if (event->response_type == 0) {
+            xcb_generic_error_t *error = (xcb_generic_error_t*)event;
+            g_debug("Ignoring X error %d for request %d.%d",
+                    error->error_code, error->major_code, error->minor_code);
+        } else {
+            // A handler may remove itself while handling the event
+            vector<XEventHandler*> handlers_copy = handlers;
+            for (XEventHandler *handler : handlers_copy) {
+                handler->handle_x_event(event);
+            }
+        }
+        free(event);
+    }
+
+    gboolean XConnection::dispatch_events() {
+        if (pending_event) {
+            xcb_generic_event_t *event = pending_event;
+            pending_event = NULL;
+            dispatch_event(event);
+        }
+        xcb_generic_event_t *event;
+        while ((event = xcb_poll_for_event(conn)) != NULL) {
+            dispatch_event(event);
+        }
+        if (xcb_connection_has_error(conn)) {
+            g_warning("Lost connection to X server");
+            if (connection_lost_func) {
+                connection_lost_func(connection_lost_data);
+            }
+            return G_SOURCE_REMOVE;
+        }
+        // Handlers might have made requests
+        xcb_flush(conn);
+        return G_SOURCE_CONTINUE;
+    }
+
+    gboolean XConnection::source_prepare(GSource *source, gint *timeout) {
+        XConnection *_this = ((Source*)source)->connection;
+        *timeout = -1;
+        xcb_flush(_this->conn);
+        return _this->has_pending_event();
+    }
+
+    gboolean XConnection::source_check(GSource *source) {
+        Source *xsource = (Source*)source;
+        XConnection *_this = xsource->connection;
+        if (g_source_query_unix_fd(source, xsource->fd_tag)) {
+            return TRUE;
+        }
+        return _this->has_pending_event();
+    }
+
+    gboolean XConnection::source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+        XConnection *_this = ((Source*)source)->connection;
+        return _this->dispatch_events();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _X_CONNECTION_H_
+#define _X_CONNECTION_H_
+
+#include <vector>
+
+#include <glib.h>
+#include <xcb/xcb.h>
+
+using std::vector;
+
+namespace Xidlechain {
+    class XEventHandler {
+    public:
+        // Called for every event received on the connection. X errors
+        // are not passed on; requests which may legitimately fail (e.g.
+        // because a window was destroyed) should be checked by the caller.
+        virtual void handle_x_event(const xcb_generic_event_t *event) = 0;
+    protected:
+        ~XEventHandler() = default;
+    };
+
+    // A connection to an X server whose events are dispatched from a GLib
+    // main context, so that the daemon does not need to link against GDK.
+    class XConnection {
+        struct Source;
+
+        xcb_connection_t *conn;
+        xcb_screen_t *screen;
+        Source *source;
+        // Set if an event was taken off xcb's queue while preparing
+        // the source, but not dispatched yet.
+        xcb_generic_event_t *pending_event;
+        vector<XEventHandler*> handlers;
+        void (*connection_lost_func)(gpointer);
+        gpointer connection_lost_data;
+
+        bool has_pending_event();
+        gboolean dispatch_events();
+        void dispatch_event(xcb_generic_event_t *event);
+        static gboolean source_prepare(GSource *source, gint *timeout);
+        static gboolean source_check(GSource *source);
+        static gboolean source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data);
+        static GSourceFuncs source_funcs;
+    public:
+        XConnection();
+        ~XConnection();
+        XConnection(const XConnection&) = delete;
+        XConnection& operator=(const XConnection&) = delete;
+
+        // Connects to |display_name|, or $DISPLAY if it is null, and starts
+        // dispatching events from |context| (the default context if null).
+        bool open(const char *display_name, GMainContext *context = NULL);
+        // |func| is called once if the X server closes the connection.
+        void set_connection_lost_func(void (*func)(gpointer), gpointer data);
+        void add_event_handler(XEventHandler *handler);
+        void remove_event_handler(XEventHandler *handler);
+        // Returns null if the extension is not present.
+        const xcb_query_extension_reply_t *get_extension(xcb_extension_t *extension);
+        xcb_connection_t *get_connection() const { return conn; }
+        xcb_window_t get_root_window() const { return screen->root; }
+        void flush();
+    };
+}
+
+#endif
@@ -1,27 +1,127 @@
 #include <csignal>
 #include <cstdlib>
 #include <getopt.h>
+#include <memory>
 #include <sstream>
-#include <gdk/gdk.h>
-#include "activity_detector.h"
+#include <vector>
+#include <glib-unix.h>
 #include "audio_detector.h"
-#include "brightness_controller.h"
-#include "config_manager.h"
 #include "dbus_request_handler.h"
-#include "event_manager.h"
-#include "logind_manager.h"
-#include "process_spawner.h"
+#include "display_session.h"
+#include "event_stream.h"
+#include "metrics.h"
+#include "service_notifier.h"
+#include "stall_monitor.h"
+#include "status_page.h"
+#include "startup_timeline.h"
+#include "trace.h"
 
 using namespace std;
 
 class ShowUsage {};
 
+// Long options without a short equivalent
+enum {
+    OPT_DUMP_TRACE = 256,
+    OPT_METRICS_SOCKET,
+    OPT_QUERY,
+    OPT_EVENT_SOCKET,
+};
+
+static const struct option long_options[] = {
+    {"dump-trace", no_argument, NULL, OPT_DUMP_TRACE},
+    {"metrics-socket", optional_argument, NULL, OPT_METRICS_SOCKET},
+    {"query", no_argument, NULL, OPT_QUERY},
+    {"event-socket", optional_argument, NULL, OPT_EVENT_SOCKET},
+    {NULL, 0, NULL, 0},
+};
+
+struct DisplaySpec {
+    string display_name;
+    string config_file_path;
+};
+
+struct SessionList {
+    vector<unique_ptr<Xidlechain::DisplaySession>> sessions;
+    GMainLoop *loop;
+    // What main() returns once the loop quits
+    int exit_status = EXIT_FAILURE;
+};
+
+struct SessionRemoval {
+    SessionList *list;
+    Xidlechain::DisplaySession *session;
+};
+
+// The last session is left for main() to destroy once the loop has quit.
+// In single-display mode, the DbusRequestHandler points into it, and its
+// bus handlers could still run if it were destroyed any earlier.
+static gboolean remove_session(gpointer user_data) {
+    g_autofree SessionRemoval *removal = (SessionRemoval*)user_data;
+    vector<unique_ptr<Xidlechain::DisplaySession>> &sessions = removal->list->sessions;
+    if (sessions.size() == 1) {
+        g_main_loop_quit(removal->list->loop);
+        return G_SOURCE_REMOVE;
+    }
+    for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+        if (it->get() == removal->session) {
+            sessions.erase(it);
+            break;
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// SIGTERM (e.g. logging out, or systemctl --user stop) and SIGINT stop the
+// main loop, so that main() returns and the destructors run: the pending
+// config save is written, and the sockets and status page are removed.
+static gboolean on_quit_signal(gpointer user_data) {
+    SessionList *list = (SessionList*)user_data;
+    g_info("Received a signal to quit");
+    list->exit_status = EXIT_SUCCESS;
+    g_main_loop_quit(list->loop);
+    return G_SOURCE_CONTINUE;
+}
+
+// For the service manager's STATUS=
+static string describe_sessions(gpointer user_data) {
+    SessionList *list = (SessionList*)user_data;
+    if (list->sessions.size() == 1) {
+        return list->sessions[0]->get_status();
+    }
+    string status;
+    for (unique_ptr<Xidlechain::DisplaySession> &session : list->sessions) {
+        if (!status.empty()) {
+            status += " | ";
+        }
+        status += string(session->get_display_name()) + ": " + session->get_status();
+    }
+    return status;
+}
+
+// In multi-display mode, losing one display must not affect the others.
+// The session can't be destroyed while its X connection is dispatching.
+static void on_x_connection_lost(Xidlechain::DisplaySession *session, gpointer user_data) {
+    g_info("Stopping the session on display %s", session->get_display_name());
+    SessionRemoval *removal = g_new(SessionRemoval, 1);
+    removal->list = (SessionList*)user_data;
+    removal->session = session;
+    g_idle_add(remove_session, removal);
+}
+
 int main(int argc, char *argv[]) {
     int ch;
     string config_file_path;
+    vector<DisplaySpec> display_specs;
+    bool dump_trace = false;
+    bool query = false;
+    bool export_metrics = false;
+    string metrics_socket_path;
+    bool stream_events = false;
+    string event_socket_path;
 
     try {
-        while ((ch = getopt(argc, argv, "c:dh")) != -1) {
+        while ((ch = getopt_long(argc, argv, "c:dhx:", long_options, NULL)) != -1) {
             switch (ch) {
                 case 'c':
                     config_file_path = string(optarg);
@@ -29,67 +129,137 @@ int main(int argc, char *argv[]) {
                 case 'd':
                     setenv("G_MESSAGES_DEBUG", "all", 1);
                     break;
+                case 'x': {
+                    // DISPLAY or DISPLAY=CONFIG_FILE
+                    string spec(optarg);
+                    size_t eq_pos = spec.find('=');
+                    if (eq_pos == 0 || spec.empty()) {
+                        throw ShowUsage();
+                    }
+                    if (eq_pos == string::npos) {
+                        display_specs.push_back({spec, ""});
+                    } else {
+                        display_specs.push_back({spec.substr(0, eq_pos), spec.substr(eq_pos + 1)});
+                    }
+                    break;
+                }
+                case OPT_DUMP_TRACE:
+                    dump_trace = true;
+                    break;
+                case OPT_QUERY:
+                    query = true;
+                    break;
+                case OPT_METRICS_SOCKET:
+                    export_metrics = true;
+                    metrics_socket_path = optarg
+                        ? string(optarg) : Xidlechain::MetricsExporter::default_path();
+                    break;
+                case OPT_EVENT_SOCKET:
+                    stream_events = true;
+                    event_socket_path = optarg
+                        ? string(optarg) : Xidlechain::EventStream::default_path();
+                    break;
                 case 'h':
                 case '?':
                 default:
                     throw ShowUsage();
             }
         }
-        if (optind != argc) {
+        // Only --query takes arguments, the fields to print
+        if (optind != argc && !query) {
             throw ShowUsage();
         }
     } catch (ShowUsage&) {
         printf("Usage: %s [OPTIONS]\n"
+               "       %s [-x DISPLAY] --query [FIELD...]\n"
                "  -h\tthis help menu\n"
                "  -d\tdebug\n"
-               "  -c\tconfiguration file path\n",
-               argv[0]);
+               "  -c\tconfiguration file path\n"
+               "  -x\tserve DISPLAY[=CONFIG], may be repeated\n"
+               "  --dump-trace\tprint the event trace of the running daemon\n"
+               "  --metrics-socket[=PATH]\tserve metrics on a Unix socket\n"
+               "  --event-socket[=PATH]\tstream events on a Unix socket\n"
+               "  --query\tprint the idle status of the running daemon\n",
+               argv[0], argv[0]);
         return ch == 'h' ? 0 : 1;
     }
 
-    // GDK parses its own arguments - maybe it would be better to pass
-    // a dummy array here instead?
-    // https://gitlab.gnome.org/GNOME/gtk/-/blob/gtk-3-0/gdk/gdk.c#L181
-    gdk_init(&argc, &argv);
-
-    Xidlechain::ConfigManager config_manager;
-    if (!config_manager.parse_config_file(config_file_path)) {
-        return EXIT_FAILURE;
+    if (dump_trace) {
+        return Xidlechain::Trace::dump(Xidlechain::Trace::default_path(), stdout)
+            ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    Xidlechain::EventManager event_manager(&config_manager);
-    Xidlechain::XsyncActivityDetector activity_detector;
-    Xidlechain::PulseAudioDetector audio_detector;
-    Xidlechain::DbusLogindManager logind_manager;
-    Xidlechain::GProcessSpawner process_spawner;
-    Xidlechain::DbusBrightnessController brightness_controller;
-    Xidlechain::DbusRequestHandler request_handler;
-    if (!activity_detector.init(&event_manager)) {
-        return EXIT_FAILURE;
-    }
-    if (!audio_detector.init(&event_manager)) {
-        return EXIT_FAILURE;
+    if (query) {
+        const char *display_name = display_specs.empty() ? NULL : display_specs[0].display_name.c_str();
+        return Xidlechain::StatusPage::query(Xidlechain::StatusPage::default_path(display_name),
+                                             argv + optind, argc - optind, stdout)
+            ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    if (!logind_manager.init(&event_manager)) {
-        return EXIT_FAILURE;
+
+    Xidlechain::StartupTimeline::begin();
+    // Tracing is only a debugging aid, so carry on without it
+    Xidlechain::Trace::open(Xidlechain::Trace::default_path());
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    Xidlechain::StallMonitor stall_monitor;
+    stall_monitor.start();
+    Xidlechain::MetricsExporter metrics_exporter;
+    // Like the trace, the metrics are not worth failing over
+    if (export_metrics) {
+        metrics_exporter.start(metrics_socket_path);
     }
-    if (!brightness_controller.init(&logind_manager)) {
+    // Scripts rely on the event stream though, so give up without it
+    Xidlechain::EventStream event_stream;
+    if (stream_events && !event_stream.start(event_socket_path)) {
         return EXIT_FAILURE;
     }
-    if (!event_manager.init(&activity_detector,
-                            &logind_manager,
-                            &audio_detector,
-                            &process_spawner,
-                            &brightness_controller))
-    {
-        return EXIT_FAILURE;
+    Xidlechain::PulseAudioDetector pulse_audio_detector;
+    Xidlechain::SharedAudioDetector audio_detector(&pulse_audio_detector);
+    Xidlechain::DbusRequestHandler request_handler;
+    SessionList session_list;
+    session_list.loop = loop;
+
+    if (display_specs.empty()) {
+        session_list.sessions.emplace_back(new Xidlechain::DisplaySession(
+            NULL, config_file_path, &audio_detector));
+        if (!session_list.sessions[0]->init(&request_handler)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        // The D-Bus interface has a single well-known name, so it is
+        // only available when serving a single display.
+        for (const DisplaySpec &spec : display_specs) {
+            const string &session_config_file_path =
+                spec.config_file_path.empty() ? config_file_path : spec.config_file_path;
+            unique_ptr<Xidlechain::DisplaySession> session(new Xidlechain::DisplaySession(
+                spec.display_name.c_str(), session_config_file_path, &audio_detector));
+            if (!session->init(NULL)) {
+                g_warning("Could not start the session on display %s", spec.display_name.c_str());
+                continue;
+            }
+            session_list.sessions.push_back(move(session));
+        }
+        if (session_list.sessions.empty()) {
+            return EXIT_FAILURE;
+        }
     }
-    if (config_manager.enable_dbus) {
-        request_handler.init(&config_manager, &event_manager);
+    // Nothing works without the X server, so exit like an X client would
+    // once the last display is gone
+    for (unique_ptr<Xidlechain::DisplaySession> &session : session_list.sessions) {
+        session->set_connection_lost_func(on_x_connection_lost, &session_list);
     }
+    Xidlechain::StartupTimeline::mark("entering main loop");
+    // READY=1 is sent once the steps started above are done
+    Xidlechain::ServiceNotifier::start(describe_sessions, &session_list);
+    guint sigterm_source_id = g_unix_signal_add(SIGTERM, on_quit_signal, &session_list);
+    guint sigint_source_id = g_unix_signal_add(SIGINT, on_quit_signal, &session_list);
 
-    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
     g_main_loop_run(loop);
 
-    return 0;
+    g_source_remove(sigterm_source_id);
+    g_source_remove(sigint_source_id);
+    // The status callback uses the sessions, which are about to go
+    Xidlechain::ServiceNotifier::stop();
+    Xidlechain::ServiceNotifier::notify("STOPPING=1");
+    return session_list.exit_status;
 }